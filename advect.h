@@ -1,10 +1,18 @@
 #ifndef __ADVECT__
 #define __ADVECT__
 
+#include "mac_grid.h"
+#include "grid_fns.h"
+#include "thread_pool.h"
 #include <cmath>
 #include <typeinfo>
 using namespace std;
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define ADVECT_X86
+#endif
+
 
 // for every grid cell:
 // 	calculate negative central velocity
@@ -19,7 +27,7 @@ using namespace std;
 
 	Return type: float
 */
-float bound(float input, float maxSize){
+inline float bound(float input, float maxSize){
 	// Bounds input between 0 and maxSize, inclusive
 	float zero = 0;
 	input = min(input, maxSize);
@@ -27,15 +35,23 @@ float bound(float input, float maxSize){
 	return input;
 }
 
+/*
+	The two cells an interpolation reads from, already bounded to the grid.
+*/
+struct CellPair {
+	int first;
+	int second;
+};
+
 /*
 	factor: float&; possibly incorrect interpolation factor
 	cell_prev: int; cell index closest to prev
 	prev: float; location in velocity field at previous time step
 
 	Alters by reference: factor
-	Return type: vector<float> of size 2
+	Return type: CellPair
 */
-vector<int> cellLeftOrRight(float &factor, int cell_prev, float prev, int max) {
+inline CellPair cellLeftOrRight(float &factor, int cell_prev, float prev, int max) {
 	/*
 	Returns the correct cell indices to use in interpolation.
 	May change factor if prev is to the left/below cell_prev.
@@ -52,61 +68,234 @@ vector<int> cellLeftOrRight(float &factor, int cell_prev, float prev, int max) {
 		cell_left = cell_prev;
 		cell_right = cell_prev + 1;
 	}
-	return vector<int> {bound(cell_left, max), bound(cell_right, max)};
+	CellPair cells = {(int)bound(cell_left, max), (int)bound(cell_right, max)};
+	return cells;
+}
+
+/*
+	Where the backtrace from one cell lands and the bounded cells its interpolations read.
+	alpha: float; weight of right against left, in (0, 1]
+	beta: float; weight of above against below, in (0, 1]
+	cellX, cellY: int; the cell nearest to the departure point
+	left, right: int; the columns either side of the departure point
+	below, above: int; the rows either side of the departure point
+	top: int; the row above cellY
+*/
+struct Backtrace {
+	float alpha;
+	float beta;
+	int cellX;
+	int cellY;
+	int left;
+	int right;
+	int below;
+	int above;
+	int top;
+};
+
+/*
+	centerVelocity: Vec2; velocity at the center of cell (i, j)
+	xDim, yDim: int; grid size in cells
+	deltaT: float; time step to trace back over, negative to trace forward
+	i, j: int; the cell
+
+	The one backtrace of the solver: advect(), advectCell() of advect_simd.cpp, the
+	MacCormack and BFECC corrections and the sparse grid all read their cells from it, and
+	traceBack8() below, which the AVX2 kernels of both share, mirrors its arithmetic lane by lane.
+	The SSE4.1 kernel of advect_simd.cpp mirrors it 4 lanes at a time.
+	Return type: Backtrace
+*/
+inline Backtrace traceBack(Vec2 centerVelocity, int xDim, int yDim, float deltaT, int i, int j) {
+	float x_prev = bound(i - centerVelocity.x * deltaT, xDim-1);
+	float y_prev = bound(j - centerVelocity.y * deltaT, yDim-1);
+	int cell_x_prev = round(x_prev);
+	int cell_y_prev = round(y_prev);
+
+	Backtrace trace;
+	trace.alpha = x_prev - cell_x_prev;
+	trace.beta = y_prev - cell_y_prev;
+	CellPair leftAndRight = cellLeftOrRight(trace.alpha, cell_x_prev, x_prev, xDim-1);
+	CellPair belowAndAbove = cellLeftOrRight(trace.beta, cell_y_prev, y_prev, yDim-1);
+	trace.cellX = cell_x_prev;
+	trace.cellY = cell_y_prev;
+	trace.left = leftAndRight.first;
+	trace.right = leftAndRight.second;
+	trace.below = belowAndAbove.first;
+	trace.above = belowAndAbove.second;
+	trace.top = bound(cell_y_prev + 1, yDim-1);
+	return trace;
+}
+
+#ifdef ADVECT_X86
+
+/*
+	Rounds half away from zero like round() for non-negative inputs. x - trunc(x) is exact,
+	so unlike floor(x + .5) this does not round 0.49999997 up.
+*/
+__attribute__((target("avx2")))
+inline __m256 roundHalfUp8(__m256 x) {
+	__m256 whole = _mm256_round_ps(x, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC);
+	__m256 up = _mm256_cmp_ps(_mm256_sub_ps(x, whole), _mm256_set1_ps(0.5f), _CMP_GE_OQ);
+	return _mm256_add_ps(whole, _mm256_and_ps(up, _mm256_set1_ps(1.0f)));
+}
+
+/*
+	Backtrace of 8 cells of a row, one per lane, for the AVX2 kernels.
+*/
+struct Backtrace8 {
+	__m256 alpha;
+	__m256 beta;
+	__m256i cellX;
+	__m256i cellY;
+	__m256i left;
+	__m256i right;
+	__m256i below;
+	__m256i above;
+	__m256i top;
+};
+
+/*
+	horizVelocityGrid, vertVelocityGrid: FieldGrid; faces the center velocities are averaged from
+	xDim, yDim: int; grid size in cells
+	deltaT: float; time step to trace back over, negative to trace forward
+	i: int; the row
+	j: int; first of the 8 cells, at least 1, with j+8 <= yDim
+
+	traceBack() of cells (i, j) to (i, j+7), bit for bit: the center velocities are averaged as
+	horCenterVel() and verCenterVel() do, and multiplies and adds are kept separate (no FMA) so
+	rounding matches. j = 0 reads its bottom face from j = 1, which a contiguous load cannot
+	express, so it is left to traceBack(). Fields nobody reads are dropped once this is inlined.
+	Return type: Backtrace8
+*/
+__attribute__((target("avx2")))
+inline Backtrace8 traceBack8(const FieldGrid &horizVelocityGrid, const FieldGrid &vertVelocityGrid, int xDim, int yDim, float deltaT, int i, int j) {
+	const __m256 zero = _mm256_setzero_ps();
+	const __m256 one = _mm256_set1_ps(1.0f);
+	const __m256 two = _mm256_set1_ps(2.0f);
+	const __m256 dt = _mm256_set1_ps(deltaT);
+	const __m256i zeroI = _mm256_setzero_si256();
+	const __m256i oneI = _mm256_set1_epi32(1);
+	const __m256i xMaxI = _mm256_set1_epi32(xDim - 1);
+	const __m256i yMaxI = _mm256_set1_epi32(yDim - 1);
+	// Same half index faces correctHVGet/correctVVGet pick, see horCenterVel/verCenterVel.
+	const float* horizLeft = horizVelocityGrid.row(i == 0 ? 1 : i);
+	const float* horizRight = horizVelocityGrid.row(i + 1);
+	const float* vertRow = vertVelocityGrid.row(i);
+
+	__m256i cellJ = _mm256_add_epi32(_mm256_set1_epi32(j), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+	__m256 centerU = _mm256_div_ps(_mm256_add_ps(_mm256_loadu_ps(horizLeft + j), _mm256_loadu_ps(horizRight + j)), two);
+	__m256 centerV = _mm256_div_ps(_mm256_add_ps(_mm256_loadu_ps(vertRow + j), _mm256_loadu_ps(vertRow + j + 1)), two);
+
+	// Backtrace and bound, operand order matches min()/max() in bound()
+	__m256 xPrev = _mm256_sub_ps(_mm256_set1_ps(i), _mm256_mul_ps(centerU, dt));
+	__m256 yPrev = _mm256_sub_ps(_mm256_cvtepi32_ps(cellJ), _mm256_mul_ps(centerV, dt));
+	xPrev = _mm256_max_ps(zero, _mm256_min_ps(_mm256_set1_ps(xDim - 1), xPrev));
+	yPrev = _mm256_max_ps(zero, _mm256_min_ps(_mm256_set1_ps(yDim - 1), yPrev));
+	__m256 cellX = roundHalfUp8(xPrev);
+	__m256 cellY = roundHalfUp8(yPrev);
+
+	// cellLeftOrRight() along x, then along y
+	Backtrace8 trace;
+	trace.alpha = _mm256_sub_ps(xPrev, cellX);
+	__m256 belowX = _mm256_cmp_ps(trace.alpha, zero, _CMP_LE_OQ);
+	__m256 leftX = _mm256_sub_ps(cellX, _mm256_and_ps(belowX, one));
+	trace.alpha = _mm256_blendv_ps(trace.alpha, _mm256_sub_ps(xPrev, leftX), belowX);
+	__m256i left = _mm256_cvttps_epi32(leftX);
+	trace.right = _mm256_min_epi32(_mm256_add_epi32(left, oneI), xMaxI);
+	trace.left = _mm256_max_epi32(_mm256_min_epi32(left, xMaxI), zeroI);
+
+	trace.beta = _mm256_sub_ps(yPrev, cellY);
+	__m256 belowY = _mm256_cmp_ps(trace.beta, zero, _CMP_LE_OQ);
+	__m256 lowerY = _mm256_sub_ps(cellY, _mm256_and_ps(belowY, one));
+	trace.beta = _mm256_blendv_ps(trace.beta, _mm256_sub_ps(yPrev, lowerY), belowY);
+	__m256i below = _mm256_cvttps_epi32(lowerY);
+	trace.above = _mm256_min_epi32(_mm256_add_epi32(below, oneI), yMaxI);
+	trace.below = _mm256_max_epi32(_mm256_min_epi32(below, yMaxI), zeroI);
+
+	trace.cellX = _mm256_cvttps_epi32(cellX);
+	trace.cellY = _mm256_cvttps_epi32(cellY);
+	trace.top = _mm256_min_epi32(_mm256_add_epi32(trace.cellY, oneI), yMaxI);
+	return trace;
+}
+
+#endif
+
+/*
+	grid: FieldGrid; horizontal faces
+	trace: Backtrace; from traceBack()
+
+	Return type: float; grid along x between left and right, at row cellY
+*/
+inline float interpolateHoriz(const FieldGrid &grid, const Backtrace &trace) {
+	return (1-trace.alpha) * grid(trace.left, trace.cellY) + trace.alpha * grid(trace.right, trace.cellY);
+}
+
+/*
+	grid: FieldGrid; vertical faces
+	trace: Backtrace; from traceBack()
+
+	The vertical faces are weighted with alpha, as advect() always has, between cellY and top.
+	Return type: float
+*/
+inline float interpolateVert(const FieldGrid &grid, const Backtrace &trace) {
+	return (1-trace.alpha) * grid(trace.cellX, trace.cellY) + trace.alpha * grid(trace.cellX, trace.top);
 }
 
 /*
-	horizVelocityGrid: 2D vector of floats; holds vertical horizontal components at 1/2 indices
-	vertVelocityGrid: 2D vector of floats; holds vertical velocity components at 1/2 indices
-	updatedHorizGrid: 2D vector of floats; will hold the updated horizontal velocities
-	updatedVertGrid: 2D vector of floats; will hold the updated vertical velocities
+	grid: FieldGrid; a cell centred scalar
+	trace: Backtrace; from traceBack()
+
+	Return type: float; grid bilinearly interpolated between the four cells around the departure point
+*/
+inline float interpolateScalar(const FieldGrid &grid, const Backtrace &trace) {
+	float lower = (1-trace.alpha) * grid(trace.left, trace.below) + trace.alpha * grid(trace.right, trace.below);
+	float upper = (1-trace.alpha) * grid(trace.left, trace.above) + trace.alpha * grid(trace.right, trace.above);
+	return (1-trace.beta) * lower + trace.beta * upper;
+}
+
+/*
+	horizVelocityGrid: FieldGrid; holds vertical horizontal components at 1/2 indices
+	vertVelocityGrid: FieldGrid; holds vertical velocity components at 1/2 indices
+	updatedHorizGrid: FieldGrid; will hold the updated horizontal velocities
+	updatedVertGrid: FieldGrid; will hold the updated vertical velocities
 	xDim: int; number of cells in x direction
 	yDim: int; number of cells in y direction
 	deltaT: float; time step over which we advect the velocity
+	executor: Executor; runs the rows of the grid, split into contiguous chunks of i
 	i: integer; index for ith row
 	j: integer; index for jth column
 
 	Alters by reference: updatedHorizGrid and updatedVertGrid
 	Return type: void
 */
-void advect(vector< vector<float> > &horizVelocityGrid, vector< vector<float> > &vertVelocityGrid, vector< vector<float> >& updatedHorizGrid, vector< vector<float> >& updatedVertGrid, int xDim, int yDim, float deltaT) {
+inline void advect(const FieldGrid &horizVelocityGrid, const FieldGrid &vertVelocityGrid, FieldGrid &updatedHorizGrid, FieldGrid &updatedVertGrid, int xDim, int yDim, float deltaT, Executor &executor) {
 	/*
 	Updates the velocity field due to advection.
+	Only reads the current grids and each row i only writes row i of the updated grids,
+	so rows can run on any number of threads.
 	*/
 
 	// For all grid cells
-	for (int i = 0; i < xDim; ++i) {
-		for (int j = 0; j < yDim; ++j) {
-			// Get center velocity for (i,j)th cell
-			vector<float>* centerVelocity_n1 = centerVel(horizVelocityGrid, vertVelocityGrid, i, j);
-			// Trace velocity at (i,j) backwards over timeframe deltaT
-			float x_prev = bound(i - centerVelocity_n1->at(0) * deltaT, xDim-1);
-			float y_prev = bound(j - centerVelocity_n1->at(1) * deltaT, yDim-1);
-			// Get cell of floating point locations
-			int cell_x_prev = round(x_prev);
-			int cell_y_prev = round(y_prev);
-
-			// Interpolate floating point location with velocities at cell locations
-			float alpha = x_prev - cell_x_prev;
-			float beta = y_prev - cell_y_prev;
-			vector<int> xCellsLeftAndRight = cellLeftOrRight(alpha, cell_x_prev, x_prev, xDim-1);
-			vector<int> yCellsTopAndBottom = cellLeftOrRight(alpha, cell_y_prev, y_prev, yDim-1);
-			float horizVelTerm1 = (1-alpha) * horizVelocityGrid.at(xCellsLeftAndRight.at(0)).at(cell_y_prev);
-
-			float horizVelTerm2 = alpha * horizVelocityGrid.at(xCellsLeftAndRight.at(1)).at(cell_y_prev);
+	executor.parallelFor(0, xDim, [&](int rowBegin, int rowEnd) {
+		for (int i = rowBegin; i < rowEnd; ++i) {
+			for (int j = 0; j < yDim; ++j) {
+				// Trace the center velocity of the (i,j)th cell backwards over timeframe deltaT
+				Backtrace trace = traceBack(centerVel(horizVelocityGrid, vertVelocityGrid, i, j), xDim, yDim, deltaT, i, j);
 
-			// Update horizontal velocity of current cell with interpolated velocity at previous location
-			updatedHorizGrid.at(i).at(j) = horizVelTerm1 + horizVelTerm2;
-
-			float vertVelTerm1 = (1-alpha) * vertVelocityGrid.at(cell_x_prev).at(yCellsTopAndBottom.at(0));
-
-			float vertVelTerm2 = alpha * vertVelocityGrid.at(cell_x_prev).at(yCellsTopAndBottom.at(1));
-
-			// Update vertical velocity of current cell with interpolated velocity at previous location
-			updatedVertGrid.at(i).at(j) = vertVelTerm1 + vertVelTerm2;
-
-			delete centerVelocity_n1;
+				// Update the velocities of current cell with the interpolated velocities at previous location
+				updatedHorizGrid(i, j) = interpolateHoriz(horizVelocityGrid, trace);
+				updatedVertGrid(i, j) = interpolateVert(vertVelocityGrid, trace);
+			}
 		}
+	});
+
+	// Faces on the right and top walls are not advected. Carry them over so the updated
+	// grids do not depend on what the buffers held before they were swapped in.
+	for (int j = 0; j < yDim; ++j) {
+		updatedHorizGrid(xDim, j) = horizVelocityGrid(xDim, j);
+	}
+	for (int i = 0; i < xDim; ++i) {
+		updatedVertGrid(i, yDim) = vertVelocityGrid(i, yDim);
 	}
 }
 
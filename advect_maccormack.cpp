@@ -0,0 +1,307 @@
+#include "advect_maccormack.h"
+#include "advect.h"
+#include "grid_fns.h"
+#include "trace.h"
+#include <algorithm>
+#include <cmath>
+
+
+namespace {
+
+/*
+	value: float; corrected value
+	a, b: float; the two values the first order step interpolated between
+
+	Return type: float; value clamped between a and b
+*/
+inline float limit(float value, float a, float b) {
+	return min(max(value, min(a, b)), max(a, b));
+}
+
+/*
+	horizVelocityGrid, vertVelocityGrid: FieldGrid; u
+	forwardHorizGrid, forwardVertGrid: FieldGrid; u^
+	updatedHorizGrid, updatedVertGrid: FieldGrid; receive the MacCormack result, or u~ for BFECC
+	bfecc: bool
+
+	Cell (i,j) of the backward step and the correction.
+	Return type: void
+*/
+inline void correctCell(const FieldGrid &horizVelocityGrid, const FieldGrid &vertVelocityGrid, const FieldGrid &forwardHorizGrid, const FieldGrid &forwardVertGrid,
+	FieldGrid &updatedHorizGrid, FieldGrid &updatedVertGrid, int xDim, int yDim, float deltaT, bool bfecc, int i, int j) {
+	Backtrace backward = traceBack(centerVel(horizVelocityGrid, vertVelocityGrid, i, j), xDim, yDim, -deltaT, i, j);
+	float horizError = (horizVelocityGrid(i, j) - interpolateHoriz(forwardHorizGrid, backward)) / 2;
+	float vertError = (vertVelocityGrid(i, j) - interpolateVert(forwardVertGrid, backward)) / 2;
+	if (bfecc) {
+		updatedHorizGrid(i, j) = horizVelocityGrid(i, j) + horizError;
+		updatedVertGrid(i, j) = vertVelocityGrid(i, j) + vertError;
+		return;
+	}
+	Backtrace forward = traceBack(centerVel(horizVelocityGrid, vertVelocityGrid, i, j), xDim, yDim, deltaT, i, j);
+	updatedHorizGrid(i, j) = limit(forwardHorizGrid(i, j) + horizError,
+		horizVelocityGrid(forward.left, forward.cellY), horizVelocityGrid(forward.right, forward.cellY));
+	updatedVertGrid(i, j) = limit(forwardVertGrid(i, j) + vertError,
+		vertVelocityGrid(forward.cellX, forward.cellY), vertVelocityGrid(forward.cellX, forward.top));
+}
+
+/*
+	horizVelocityGrid, vertVelocityGrid: FieldGrid; u, whose backtraces are followed
+	correctedHorizGrid, correctedVertGrid: FieldGrid; u~
+	updatedHorizGrid, updatedVertGrid: FieldGrid; receive A(u~), limited
+
+	Cell (i,j) of BFECC's last step.
+	Return type: void
+*/
+inline void resampleCell(const FieldGrid &horizVelocityGrid, const FieldGrid &vertVelocityGrid, const FieldGrid &correctedHorizGrid, const FieldGrid &correctedVertGrid,
+	FieldGrid &updatedHorizGrid, FieldGrid &updatedVertGrid, int xDim, int yDim, float deltaT, int i, int j) {
+	Backtrace forward = traceBack(centerVel(horizVelocityGrid, vertVelocityGrid, i, j), xDim, yDim, deltaT, i, j);
+	updatedHorizGrid(i, j) = limit(interpolateHoriz(correctedHorizGrid, forward),
+		horizVelocityGrid(forward.left, forward.cellY), horizVelocityGrid(forward.right, forward.cellY));
+	updatedVertGrid(i, j) = limit(interpolateVert(correctedVertGrid, forward),
+		vertVelocityGrid(forward.cellX, forward.cellY), vertVelocityGrid(forward.cellX, forward.top));
+}
+
+#ifdef ADVECT_X86
+
+/*
+	grid: FieldGrid; horizontal faces
+	trace: Backtrace8
+	first, second: __m256 by reference; receive the faces left and right of cellY
+
+	Return type: void
+*/
+__attribute__((target("avx2")))
+inline void gatherHoriz8(const FieldGrid &grid, const Backtrace8 &trace, __m256 &first, __m256 &second) {
+	const __m256i stride = _mm256_set1_epi32(grid.rowStride());
+	first = _mm256_i32gather_ps(grid.row(0), _mm256_add_epi32(_mm256_mullo_epi32(trace.left, stride), trace.cellY), 4);
+	second = _mm256_i32gather_ps(grid.row(0), _mm256_add_epi32(_mm256_mullo_epi32(trace.right, stride), trace.cellY), 4);
+}
+
+/*
+	grid: FieldGrid; vertical faces
+	trace: Backtrace8
+	first, second: __m256 by reference; receive the faces at cellY and top of cellX
+
+	Return type: void
+*/
+__attribute__((target("avx2")))
+inline void gatherVert8(const FieldGrid &grid, const Backtrace8 &trace, __m256 &first, __m256 &second) {
+	__m256i column = _mm256_mullo_epi32(trace.cellX, _mm256_set1_epi32(grid.rowStride()));
+	first = _mm256_i32gather_ps(grid.row(0), _mm256_add_epi32(column, trace.cellY), 4);
+	second = _mm256_i32gather_ps(grid.row(0), _mm256_add_epi32(column, trace.top), 4);
+}
+
+__attribute__((target("avx2")))
+inline __m256 interpolate8(__m256 alpha, __m256 first, __m256 second) {
+	return _mm256_add_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(1.0f), alpha), first), _mm256_mul_ps(alpha, second));
+}
+
+/*
+	limit() lane by lane. Operands are ordered so ties and signed zeros resolve as min() and max() do.
+*/
+__attribute__((target("avx2")))
+inline __m256 limit8(__m256 value, __m256 a, __m256 b) {
+	return _mm256_min_ps(_mm256_max_ps(b, a), _mm256_max_ps(_mm256_min_ps(b, a), value));
+}
+
+/*
+	Rows [rowBegin, rowEnd) of correctCell(), 8 cells of a row per iteration, bit-identical to it.
+*/
+__attribute__((target("avx2")))
+void correctRowsAvx2(const FieldGrid &horizVelocityGrid, const FieldGrid &vertVelocityGrid, const FieldGrid &forwardHorizGrid, const FieldGrid &forwardVertGrid,
+	FieldGrid &updatedHorizGrid, FieldGrid &updatedVertGrid, int xDim, int yDim, float deltaT, bool bfecc, int rowBegin, int rowEnd) {
+	const __m256 half = _mm256_set1_ps(0.5f);
+	for (int i = rowBegin; i < rowEnd; ++i) {
+		// j = 0 reads its bottom face from j = 1, as in advectRowsAvx2()
+		correctCell(horizVelocityGrid, vertVelocityGrid, forwardHorizGrid, forwardVertGrid, updatedHorizGrid, updatedVertGrid, xDim, yDim, deltaT, bfecc, i, 0);
+		int j = 1;
+		for (; j + 8 <= yDim; j += 8) {
+			__m256 first, second;
+			Backtrace8 backward = traceBack8(horizVelocityGrid, vertVelocityGrid, xDim, yDim, -deltaT, i, j);
+			__m256 horiz = _mm256_loadu_ps(horizVelocityGrid.row(i) + j);
+			__m256 vert = _mm256_loadu_ps(vertVelocityGrid.row(i) + j);
+			gatherHoriz8(forwardHorizGrid, backward, first, second);
+			__m256 horizError = _mm256_mul_ps(_mm256_sub_ps(horiz, interpolate8(backward.alpha, first, second)), half);
+			gatherVert8(forwardVertGrid, backward, first, second);
+			__m256 vertError = _mm256_mul_ps(_mm256_sub_ps(vert, interpolate8(backward.alpha, first, second)), half);
+			if (bfecc) {
+				_mm256_storeu_ps(updatedHorizGrid.row(i) + j, _mm256_add_ps(horiz, horizError));
+				_mm256_storeu_ps(updatedVertGrid.row(i) + j, _mm256_add_ps(vert, vertError));
+				continue;
+			}
+			Backtrace8 forward = traceBack8(horizVelocityGrid, vertVelocityGrid, xDim, yDim, deltaT, i, j);
+			gatherHoriz8(horizVelocityGrid, forward, first, second);
+			_mm256_storeu_ps(updatedHorizGrid.row(i) + j, limit8(_mm256_add_ps(_mm256_loadu_ps(forwardHorizGrid.row(i) + j), horizError), first, second));
+			gatherVert8(vertVelocityGrid, forward, first, second);
+			_mm256_storeu_ps(updatedVertGrid.row(i) + j, limit8(_mm256_add_ps(_mm256_loadu_ps(forwardVertGrid.row(i) + j), vertError), first, second));
+		}
+		for (; j < yDim; ++j) {
+			correctCell(horizVelocityGrid, vertVelocityGrid, forwardHorizGrid, forwardVertGrid, updatedHorizGrid, updatedVertGrid, xDim, yDim, deltaT, bfecc, i, j);
+		}
+	}
+}
+
+/*
+	Rows [rowBegin, rowEnd) of resampleCell(), 8 cells of a row per iteration, bit-identical to it.
+*/
+__attribute__((target("avx2")))
+void resampleRowsAvx2(const FieldGrid &horizVelocityGrid, const FieldGrid &vertVelocityGrid, const FieldGrid &correctedHorizGrid, const FieldGrid &correctedVertGrid,
+	FieldGrid &updatedHorizGrid, FieldGrid &updatedVertGrid, int xDim, int yDim, float deltaT, int rowBegin, int rowEnd) {
+	for (int i = rowBegin; i < rowEnd; ++i) {
+		resampleCell(horizVelocityGrid, vertVelocityGrid, correctedHorizGrid, correctedVertGrid, updatedHorizGrid, updatedVertGrid, xDim, yDim, deltaT, i, 0);
+		int j = 1;
+		for (; j + 8 <= yDim; j += 8) {
+			__m256 first, second, lower, upper;
+			Backtrace8 forward = traceBack8(horizVelocityGrid, vertVelocityGrid, xDim, yDim, deltaT, i, j);
+			gatherHoriz8(correctedHorizGrid, forward, first, second);
+			gatherHoriz8(horizVelocityGrid, forward, lower, upper);
+			_mm256_storeu_ps(updatedHorizGrid.row(i) + j, limit8(interpolate8(forward.alpha, first, second), lower, upper));
+			gatherVert8(correctedVertGrid, forward, first, second);
+			gatherVert8(vertVelocityGrid, forward, lower, upper);
+			_mm256_storeu_ps(updatedVertGrid.row(i) + j, limit8(interpolate8(forward.alpha, first, second), lower, upper));
+		}
+		for (; j < yDim; ++j) {
+			resampleCell(horizVelocityGrid, vertVelocityGrid, correctedHorizGrid, correctedVertGrid, updatedHorizGrid, updatedVertGrid, xDim, yDim, deltaT, i, j);
+		}
+	}
+}
+
+#endif
+
+}
+
+
+/*
+	name: string; semilagrangian, maccormack or bfecc
+	scheme: AdvectScheme; receives the scheme named
+
+	Altered by reference: scheme
+	Return type: bool
+*/
+bool parseAdvectScheme(const string &name, AdvectScheme &scheme) {
+	if (name == "semilagrangian") {
+		scheme = ADVECT_SEMI_LAGRANGIAN;
+	}
+	else if (name == "maccormack") {
+		scheme = ADVECT_MACCORMACK;
+	}
+	else if (name == "bfecc") {
+		scheme = ADVECT_BFECC;
+	}
+	else {
+		return false;
+	}
+	return true;
+}
+
+/*
+	scheme: AdvectScheme
+
+	Return type: const char*
+*/
+const char* advectSchemeName(AdvectScheme scheme) {
+	switch (scheme) {
+		case ADVECT_MACCORMACK:
+			return "maccormack";
+		case ADVECT_BFECC:
+			return "bfecc";
+		default:
+			return "semilagrangian";
+	}
+}
+
+/*
+	xDim: int; number of cells in x direction
+	yDim: int; number of cells in y direction
+	scheme: AdvectScheme; scheme advect() runs
+*/
+MacCormackAdvector::MacCormackAdvector(int xDim, int yDim, AdvectScheme scheme)
+	: xDim(xDim), yDim(yDim), scheme(scheme),
+	  forwardHoriz(scheme != ADVECT_SEMI_LAGRANGIAN ? xDim+1 : 0, yDim, 0.0f),
+	  forwardVert(scheme != ADVECT_SEMI_LAGRANGIAN ? xDim : 0, yDim+1, 0.0f) {}
+
+/*
+	horizVelocityGrid, vertVelocityGrid: FieldGrid; the velocity to advect, left unchanged
+	updatedHorizGrid, updatedVertGrid: FieldGrid; receive the advected velocity
+	deltaT: float; time step over which we advect the velocity
+	kernel: AdvectKernel; instruction set of the forward steps
+	executor: Executor; runs the rows of the grid
+
+	Altered by reference: updatedHorizGrid and updatedVertGrid
+	Return type: void
+*/
+void MacCormackAdvector::advect(const FieldGrid &horizVelocityGrid, const FieldGrid &vertVelocityGrid, FieldGrid &updatedHorizGrid, FieldGrid &updatedVertGrid,
+	float deltaT, AdvectKernel kernel, Executor &executor) {
+	advect(horizVelocityGrid, vertVelocityGrid, updatedHorizGrid, updatedVertGrid, deltaT, NO_SCALARS, kernel, executor);
+}
+
+/*
+	horizVelocityGrid, vertVelocityGrid: FieldGrid; the velocity to advect, left unchanged
+	updatedHorizGrid, updatedVertGrid: FieldGrid; receive the advected velocity
+	deltaT: float; time step over which we advect the velocity
+	scalars: ScalarBatch; cell-centred fields carried along
+	kernel: AdvectKernel; instruction set of the forward steps
+	executor: Executor; runs the rows of the grid
+
+	Altered by reference: updatedHorizGrid, updatedVertGrid and scalars.updated
+	Return type: void
+*/
+void MacCormackAdvector::advect(const FieldGrid &horizVelocityGrid, const FieldGrid &vertVelocityGrid, FieldGrid &updatedHorizGrid, FieldGrid &updatedVertGrid,
+	float deltaT, const ScalarBatch &scalars, AdvectKernel kernel, Executor &executor) {
+	/*
+	The backward step follows the backtraces of u with -deltaT through u^, and only cell (i,j)
+	of u_ is needed to correct cell (i,j), so it is fused with the correction in one pass that
+	reads u^ and writes the updated grids. BFECC's last step needs every corrected face, so it
+	is a pass of its own into the forward grids, which are then swapped with the updated ones.
+	*/
+	if (scheme == ADVECT_SEMI_LAGRANGIAN) {
+		advectSimd(horizVelocityGrid, vertVelocityGrid, updatedHorizGrid, updatedVertGrid, xDim, yDim, deltaT, scalars, kernel, executor);
+		return;
+	}
+
+	// u^, with the wall faces carried over; the scalars are done with this step
+	advectSimd(horizVelocityGrid, vertVelocityGrid, forwardHoriz, forwardVert, xDim, yDim, deltaT, scalars, kernel, executor);
+
+	TRACE_SCOPE("advectCorrect");
+	bool bfecc = scheme == ADVECT_BFECC;
+	executor.parallelFor(0, xDim, [&](int rowBegin, int rowEnd) {
+#ifdef ADVECT_X86
+		if (kernel == ADVECT_AVX2) {
+			correctRowsAvx2(horizVelocityGrid, vertVelocityGrid, forwardHoriz, forwardVert, updatedHorizGrid, updatedVertGrid, xDim, yDim, deltaT, bfecc, rowBegin, rowEnd);
+			return;
+		}
+#endif
+		for (int i = rowBegin; i < rowEnd; ++i) {
+			for (int j = 0; j < yDim; ++j) {
+				correctCell(horizVelocityGrid, vertVelocityGrid, forwardHoriz, forwardVert, updatedHorizGrid, updatedVertGrid, xDim, yDim, deltaT, bfecc, i, j);
+			}
+		}
+	});
+
+	if (bfecc) {
+		// A(u~) along the backtraces of u, into the forward grids whose wall faces are already u's
+		executor.parallelFor(0, xDim, [&](int rowBegin, int rowEnd) {
+#ifdef ADVECT_X86
+			if (kernel == ADVECT_AVX2) {
+				resampleRowsAvx2(horizVelocityGrid, vertVelocityGrid, updatedHorizGrid, updatedVertGrid, forwardHoriz, forwardVert, xDim, yDim, deltaT, rowBegin, rowEnd);
+				return;
+			}
+#endif
+			for (int i = rowBegin; i < rowEnd; ++i) {
+				for (int j = 0; j < yDim; ++j) {
+					resampleCell(horizVelocityGrid, vertVelocityGrid, updatedHorizGrid, updatedVertGrid, forwardHoriz, forwardVert, xDim, yDim, deltaT, i, j);
+				}
+			}
+		});
+		updatedHorizGrid.swap(forwardHoriz);
+		updatedVertGrid.swap(forwardVert);
+		return;
+	}
+
+	for (int j = 0; j < yDim; ++j) {
+		updatedHorizGrid(xDim, j) = horizVelocityGrid(xDim, j);
+	}
+	for (int i = 0; i < xDim; ++i) {
+		updatedVertGrid(i, yDim) = vertVelocityGrid(i, yDim);
+	}
+}
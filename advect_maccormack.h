@@ -0,0 +1,99 @@
+#ifndef __ADVECTMACCORMACK__
+#define __ADVECTMACCORMACK__
+
+
+#include "mac_grid.h"
+#include "advect_simd.h"
+#include "thread_pool.h"
+#include <string>
+using namespace std;
+
+
+/*
+	How the velocity is advected.
+	ADVECT_SEMI_LAGRANGIAN: advectSimd(), one first order backtrace
+	ADVECT_MACCORMACK: a forward and a backward advection, corrected by half their round trip error
+	ADVECT_BFECC: the forward advection repeated from the corrected field
+*/
+enum AdvectScheme {
+	ADVECT_SEMI_LAGRANGIAN,
+	ADVECT_MACCORMACK,
+	ADVECT_BFECC
+};
+
+/*
+	name: string; semilagrangian, maccormack or bfecc
+	scheme: AdvectScheme; receives the scheme named
+
+	Altered by reference: scheme
+	Return type: bool; false if name is none of them
+*/
+bool parseAdvectScheme(const string &name, AdvectScheme &scheme);
+
+/*
+	scheme: AdvectScheme
+
+	Return type: const char*; its name as parseAdvectScheme() takes it
+*/
+const char* advectSchemeName(AdvectScheme scheme);
+
+
+/*
+	Second order advection built from the backtrace and interpolation of advect().
+
+	With A the semi-Lagrangian step of advectSimd() and u the velocity at the start of the substep:
+		MacCormack: u^ = A(u, deltaT), u_ = A(u^, -deltaT) along the backtraces of u,
+		            result u^ + (u - u_) / 2
+		BFECC:      u~ = u + (u - u_) / 2, result A(u~, deltaT) along the backtraces of u
+	Every face is then clamped to the two values advect() interpolated it from, so the
+	correction cannot create a new extremum or ring at a steep front. The wall faces are
+	carried over as advect() does.
+
+	The forward step runs on advectSimd(), the backward step and the correction on AVX2 when
+	kernel is ADVECT_AVX2 and are scalar otherwise, bit-identical either way. With AVX2 a
+	MacCormack substep costs about 3.5 first order ones and BFECC 4.5; bench_advect_order
+	measures what that buys.
+*/
+class MacCormackAdvector {
+public:
+	/*
+		xDim: int; number of cells in x direction
+		yDim: int; number of cells in y direction
+		scheme: AdvectScheme; scheme advect() runs, ADVECT_SEMI_LAGRANGIAN allocates no scratch
+	*/
+	MacCormackAdvector(int xDim, int yDim, AdvectScheme scheme);
+
+	/*
+		horizVelocityGrid, vertVelocityGrid: FieldGrid; the velocity to advect, left unchanged
+		updatedHorizGrid, updatedVertGrid: FieldGrid; receive the advected velocity
+		deltaT: float; time step over which we advect the velocity
+		kernel: AdvectKernel; instruction set of the forward steps
+		executor: Executor; runs the rows of the grid
+
+		Altered by reference: updatedHorizGrid and updatedVertGrid
+		Return type: void
+	*/
+	void advect(const FieldGrid &horizVelocityGrid, const FieldGrid &vertVelocityGrid, FieldGrid &updatedHorizGrid, FieldGrid &updatedVertGrid,
+		float deltaT, AdvectKernel kernel, Executor &executor);
+
+	/*
+		scalars: ScalarBatch; cell-centred fields carried along
+
+		advect() that also advects scalars into scalars.updated. They take the first order
+		forward step, sharing its backtrace, whatever the scheme.
+		Altered by reference: updatedHorizGrid, updatedVertGrid and scalars.updated
+		Return type: void
+	*/
+	void advect(const FieldGrid &horizVelocityGrid, const FieldGrid &vertVelocityGrid, FieldGrid &updatedHorizGrid, FieldGrid &updatedVertGrid,
+		float deltaT, const ScalarBatch &scalars, AdvectKernel kernel, Executor &executor);
+
+private:
+	int xDim;
+	int yDim;
+	AdvectScheme scheme;
+	// The forward step u^, and the final BFECC step before it is swapped into the updated grids
+	FieldGrid forwardHoriz;
+	FieldGrid forwardVert;
+};
+
+#endif
@@ -0,0 +1,370 @@
+#include "advect_simd.h"
+#include "advect.h"
+#include "grid_fns.h"
+#include "trace.h"
+#include <cmath>
+
+
+namespace {
+
+/*
+	One cell of advect() without its heap allocations, for the cells the vector loops do not cover.
+	Reads the cells of traceBack() in advect.h as advect() does; scalars are interpolated bilinearly.
+*/
+inline void advectCell(const FieldGrid &horizVelocityGrid, const FieldGrid &vertVelocityGrid, FieldGrid &updatedHorizGrid, FieldGrid &updatedVertGrid, int xDim, int yDim, float deltaT, const ScalarBatch &scalars, int i, int j) {
+	Backtrace trace = traceBack(centerVel(horizVelocityGrid, vertVelocityGrid, i, j), xDim, yDim, deltaT, i, j);
+	updatedHorizGrid(i, j) = interpolateHoriz(horizVelocityGrid, trace);
+	updatedVertGrid(i, j) = interpolateVert(vertVelocityGrid, trace);
+	for (int field = 0; field < scalars.count; ++field) {
+		scalars.updated[field](i, j) = interpolateScalar(scalars.fields[field], trace);
+	}
+}
+
+#ifdef ADVECT_X86
+
+// roundHalfUp8() of advect.h, 4 lanes wide
+__attribute__((target("sse4.1")))
+inline __m128 roundHalfUp4(__m128 x) {
+	__m128 whole = _mm_round_ps(x, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC);
+	__m128 up = _mm_cmpge_ps(_mm_sub_ps(x, whole), _mm_set1_ps(0.5f));
+	return _mm_add_ps(whole, _mm_and_ps(up, _mm_set1_ps(1.0f)));
+}
+
+__attribute__((target("sse4.1")))
+inline __m128 gather4(const float* base, __m128i index) {
+	alignas(16) int lanes[4];
+	_mm_store_si128((__m128i*)lanes, index);
+	return _mm_setr_ps(base[lanes[0]], base[lanes[1]], base[lanes[2]], base[lanes[3]]);
+}
+
+/*
+	Cells [rowBegin, rowEnd) x [colBegin, colEnd) of advect(), 8 cells of a row per iteration,
+	each backtraced by traceBack8() of advect.h. Multiplies and adds are kept separate (no FMA)
+	so rounding matches the scalar code.
+*/
+__attribute__((target("avx2")))
+void advectRowsAvx2(const FieldGrid &horizVelocityGrid, const FieldGrid &vertVelocityGrid, FieldGrid &updatedHorizGrid, FieldGrid &updatedVertGrid, int xDim, int yDim, float deltaT, int rowBegin, int rowEnd, int colBegin, int colEnd, const ScalarBatch &scalars) {
+	const __m256 one = _mm256_set1_ps(1.0f);
+	const __m256i horizStride = _mm256_set1_epi32(horizVelocityGrid.rowStride());
+	const __m256i vertStride = _mm256_set1_epi32(vertVelocityGrid.rowStride());
+	const float* horizBase = horizVelocityGrid.row(0);
+	const float* vertBase = vertVelocityGrid.row(0);
+	// Every scalar field has the same shape, so one index serves them all
+	const __m256i scalarStride = _mm256_set1_epi32(scalars.count > 0 ? scalars.fields[0].rowStride() : 0);
+
+	for (int i = rowBegin; i < rowEnd; ++i) {
+		float* horizOut = updatedHorizGrid.row(i);
+		float* vertOut = updatedVertGrid.row(i);
+
+		// j = 0 reads its bottom face from j = 1, which a contiguous load cannot express.
+		if (colBegin == 0) {
+			advectCell(horizVelocityGrid, vertVelocityGrid, updatedHorizGrid, updatedVertGrid, xDim, yDim, deltaT, scalars, i, 0);
+		}
+
+		int j = colBegin > 1 ? colBegin : 1;
+		for (; j + 8 <= colEnd; j += 8) {
+			Backtrace8 trace = traceBack8(horizVelocityGrid, vertVelocityGrid, xDim, yDim, deltaT, i, j);
+			__m256 horiz0 = _mm256_i32gather_ps(horizBase, _mm256_add_epi32(_mm256_mullo_epi32(trace.left, horizStride), trace.cellY), 4);
+			__m256 horiz1 = _mm256_i32gather_ps(horizBase, _mm256_add_epi32(_mm256_mullo_epi32(trace.right, horizStride), trace.cellY), 4);
+			__m256i vertColumn = _mm256_mullo_epi32(trace.cellX, vertStride);
+			__m256 vert0 = _mm256_i32gather_ps(vertBase, _mm256_add_epi32(vertColumn, trace.cellY), 4);
+			__m256 vert1 = _mm256_i32gather_ps(vertBase, _mm256_add_epi32(vertColumn, trace.top), 4);
+
+			__m256 alpha = trace.alpha;
+			__m256 oneMinusAlpha = _mm256_sub_ps(one, alpha);
+			_mm256_storeu_ps(horizOut + j, _mm256_add_ps(_mm256_mul_ps(oneMinusAlpha, horiz0), _mm256_mul_ps(alpha, horiz1)));
+			_mm256_storeu_ps(vertOut + j, _mm256_add_ps(_mm256_mul_ps(oneMinusAlpha, vert0), _mm256_mul_ps(alpha, vert1)));
+			if (scalars.count > 0) {
+				// interpolateScalar(), the cells and weights shared by every scalar field
+				__m256 beta = trace.beta;
+				__m256 oneMinusBeta = _mm256_sub_ps(one, beta);
+				__m256i scalarLeft = _mm256_mullo_epi32(trace.left, scalarStride);
+				__m256i scalarRight = _mm256_mullo_epi32(trace.right, scalarStride);
+				__m256i leftLower = _mm256_add_epi32(scalarLeft, trace.below);
+				__m256i rightLower = _mm256_add_epi32(scalarRight, trace.below);
+				__m256i leftUpper = _mm256_add_epi32(scalarLeft, trace.above);
+				__m256i rightUpper = _mm256_add_epi32(scalarRight, trace.above);
+				for (int field = 0; field < scalars.count; ++field) {
+					const float* scalarBase = scalars.fields[field].row(0);
+					__m256 lowerValue = _mm256_add_ps(_mm256_mul_ps(oneMinusAlpha, _mm256_i32gather_ps(scalarBase, leftLower, 4)), _mm256_mul_ps(alpha, _mm256_i32gather_ps(scalarBase, rightLower, 4)));
+					__m256 upperValue = _mm256_add_ps(_mm256_mul_ps(oneMinusAlpha, _mm256_i32gather_ps(scalarBase, leftUpper, 4)), _mm256_mul_ps(alpha, _mm256_i32gather_ps(scalarBase, rightUpper, 4)));
+					_mm256_storeu_ps(scalars.updated[field].row(i) + j, _mm256_add_ps(_mm256_mul_ps(oneMinusBeta, lowerValue), _mm256_mul_ps(beta, upperValue)));
+				}
+			}
+		}
+		for (; j < colEnd; ++j) {
+			advectCell(horizVelocityGrid, vertVelocityGrid, updatedHorizGrid, updatedVertGrid, xDim, yDim, deltaT, scalars, i, j);
+		}
+	}
+}
+
+/*
+	Cells [rowBegin, rowEnd) x [colBegin, colEnd) of advect(), 4 cells of a row per iteration. SSE has no
+	gather, so the interpolated values are loaded lane by lane.
+*/
+__attribute__((target("sse4.1")))
+void advectRowsSse41(const FieldGrid &horizVelocityGrid, const FieldGrid &vertVelocityGrid, FieldGrid &updatedHorizGrid, FieldGrid &updatedVertGrid, int xDim, int yDim, float deltaT, int rowBegin, int rowEnd, int colBegin, int colEnd, const ScalarBatch &scalars) {
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 two = _mm_set1_ps(2.0f);
+	const __m128 dt = _mm_set1_ps(deltaT);
+	const __m128 xMax = _mm_set1_ps(xDim - 1);
+	const __m128 yMax = _mm_set1_ps(yDim - 1);
+	const __m128i zeroI = _mm_setzero_si128();
+	const __m128i oneI = _mm_set1_epi32(1);
+	const __m128i xMaxI = _mm_set1_epi32(xDim - 1);
+	const __m128i yMaxI = _mm_set1_epi32(yDim - 1);
+	const __m128i lanes = _mm_setr_epi32(0, 1, 2, 3);
+	const __m128i horizStride = _mm_set1_epi32(horizVelocityGrid.rowStride());
+	const __m128i vertStride = _mm_set1_epi32(vertVelocityGrid.rowStride());
+	const float* horizBase = horizVelocityGrid.row(0);
+	const float* vertBase = vertVelocityGrid.row(0);
+	const __m128i scalarStride = _mm_set1_epi32(scalars.count > 0 ? scalars.fields[0].rowStride() : 0);
+
+	for (int i = rowBegin; i < rowEnd; ++i) {
+		const float* horizLeft = horizVelocityGrid.row(i == 0 ? 1 : i);
+		const float* horizRight = horizVelocityGrid.row(i + 1);
+		const float* vertRow = vertVelocityGrid.row(i);
+		float* horizOut = updatedHorizGrid.row(i);
+		float* vertOut = updatedVertGrid.row(i);
+		const __m128 x = _mm_set1_ps(i);
+
+		if (colBegin == 0) {
+			advectCell(horizVelocityGrid, vertVelocityGrid, updatedHorizGrid, updatedVertGrid, xDim, yDim, deltaT, scalars, i, 0);
+		}
+
+		int j = colBegin > 1 ? colBegin : 1;
+		for (; j + 4 <= colEnd; j += 4) {
+			__m128i cellJ = _mm_add_epi32(_mm_set1_epi32(j), lanes);
+			__m128 centerU = _mm_div_ps(_mm_add_ps(_mm_loadu_ps(horizLeft + j), _mm_loadu_ps(horizRight + j)), two);
+			__m128 centerV = _mm_div_ps(_mm_add_ps(_mm_loadu_ps(vertRow + j), _mm_loadu_ps(vertRow + j + 1)), two);
+
+			__m128 xPrev = _mm_sub_ps(x, _mm_mul_ps(centerU, dt));
+			__m128 yPrev = _mm_sub_ps(_mm_cvtepi32_ps(cellJ), _mm_mul_ps(centerV, dt));
+			xPrev = _mm_max_ps(zero, _mm_min_ps(xMax, xPrev));
+			yPrev = _mm_max_ps(zero, _mm_min_ps(yMax, yPrev));
+			__m128 cellX = roundHalfUp4(xPrev);
+			__m128 cellY = roundHalfUp4(yPrev);
+
+			__m128 alpha = _mm_sub_ps(xPrev, cellX);
+			__m128 below = _mm_cmple_ps(alpha, zero);
+			__m128 leftX = _mm_sub_ps(cellX, _mm_and_ps(below, one));
+			alpha = _mm_blendv_ps(alpha, _mm_sub_ps(xPrev, leftX), below);
+			__m128i left = _mm_cvttps_epi32(leftX);
+			__m128i right = _mm_min_epi32(_mm_add_epi32(left, oneI), xMaxI);
+			left = _mm_max_epi32(_mm_min_epi32(left, xMaxI), zeroI);
+			__m128i cellXI = _mm_cvttps_epi32(cellX);
+			__m128i cellYI = _mm_cvttps_epi32(cellY);
+			__m128i top = _mm_min_epi32(_mm_add_epi32(cellYI, oneI), yMaxI);
+
+			__m128 horiz0 = gather4(horizBase, _mm_add_epi32(_mm_mullo_epi32(left, horizStride), cellYI));
+			__m128 horiz1 = gather4(horizBase, _mm_add_epi32(_mm_mullo_epi32(right, horizStride), cellYI));
+			__m128i vertColumn = _mm_mullo_epi32(cellXI, vertStride);
+			__m128 vert0 = gather4(vertBase, _mm_add_epi32(vertColumn, cellYI));
+			__m128 vert1 = gather4(vertBase, _mm_add_epi32(vertColumn, top));
+
+			__m128 oneMinusAlpha = _mm_sub_ps(one, alpha);
+			_mm_storeu_ps(horizOut + j, _mm_add_ps(_mm_mul_ps(oneMinusAlpha, horiz0), _mm_mul_ps(alpha, horiz1)));
+			_mm_storeu_ps(vertOut + j, _mm_add_ps(_mm_mul_ps(oneMinusAlpha, vert0), _mm_mul_ps(alpha, vert1)));
+			if (scalars.count > 0) {
+				__m128 beta = _mm_sub_ps(yPrev, cellY);
+				__m128 belowY = _mm_cmple_ps(beta, zero);
+				__m128 lowerY = _mm_sub_ps(cellY, _mm_and_ps(belowY, one));
+				beta = _mm_blendv_ps(beta, _mm_sub_ps(yPrev, lowerY), belowY);
+				__m128i lower = _mm_cvttps_epi32(lowerY);
+				__m128i upper = _mm_min_epi32(_mm_add_epi32(lower, oneI), yMaxI);
+				lower = _mm_max_epi32(_mm_min_epi32(lower, yMaxI), zeroI);
+				__m128 oneMinusBeta = _mm_sub_ps(one, beta);
+
+				__m128i scalarLeft = _mm_mullo_epi32(left, scalarStride);
+				__m128i scalarRight = _mm_mullo_epi32(right, scalarStride);
+				__m128i leftLower = _mm_add_epi32(scalarLeft, lower);
+				__m128i rightLower = _mm_add_epi32(scalarRight, lower);
+				__m128i leftUpper = _mm_add_epi32(scalarLeft, upper);
+				__m128i rightUpper = _mm_add_epi32(scalarRight, upper);
+				for (int field = 0; field < scalars.count; ++field) {
+					const float* scalarBase = scalars.fields[field].row(0);
+					__m128 lowerValue = _mm_add_ps(_mm_mul_ps(oneMinusAlpha, gather4(scalarBase, leftLower)), _mm_mul_ps(alpha, gather4(scalarBase, rightLower)));
+					__m128 upperValue = _mm_add_ps(_mm_mul_ps(oneMinusAlpha, gather4(scalarBase, leftUpper)), _mm_mul_ps(alpha, gather4(scalarBase, rightUpper)));
+					_mm_storeu_ps(scalars.updated[field].row(i) + j, _mm_add_ps(_mm_mul_ps(oneMinusBeta, lowerValue), _mm_mul_ps(beta, upperValue)));
+				}
+			}
+		}
+		for (; j < colEnd; ++j) {
+			advectCell(horizVelocityGrid, vertVelocityGrid, updatedHorizGrid, updatedVertGrid, xDim, yDim, deltaT, scalars, i, j);
+		}
+	}
+}
+
+#endif
+
+}
+
+
+/*
+	Return type: AdvectKernel; the widest kernel the running CPU supports
+*/
+AdvectKernel bestAdvectKernel() {
+#ifdef ADVECT_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		return ADVECT_AVX2;
+	}
+	if (__builtin_cpu_supports("sse4.1")) {
+		return ADVECT_SSE41;
+	}
+#endif
+	return ADVECT_SCALAR;
+}
+
+/*
+	kernel: AdvectKernel; kernel to name
+
+	Return type: const char*
+*/
+const char* advectKernelName(AdvectKernel kernel) {
+	switch (kernel) {
+		case ADVECT_AVX2:
+			return "avx2";
+		case ADVECT_SSE41:
+			return "sse4.1";
+		default:
+			return "scalar";
+	}
+}
+
+/*
+	horizVelocityGrid: FieldGrid; holds horizontal velocity components at 1/2 indices
+	vertVelocityGrid: FieldGrid; holds vertical velocity components at 1/2 indices
+	updatedHorizGrid: FieldGrid; will hold the updated horizontal velocities
+	updatedVertGrid: FieldGrid; will hold the updated vertical velocities
+	xDim: int; number of cells in x direction
+	yDim: int; number of cells in y direction
+	deltaT: float; time step over which we advect the velocity
+	kernel: AdvectKernel; instruction set to use, must be supported by the CPU
+	executor: Executor; runs the rows of the grid, split into contiguous chunks of i
+
+	Alters by reference: updatedHorizGrid and updatedVertGrid
+	Return type: void
+*/
+void advectSimd(const FieldGrid &horizVelocityGrid, const FieldGrid &vertVelocityGrid, FieldGrid &updatedHorizGrid, FieldGrid &updatedVertGrid, int xDim, int yDim, float deltaT, AdvectKernel kernel, Executor &executor) {
+	advectSimdRows(horizVelocityGrid, vertVelocityGrid, updatedHorizGrid, updatedVertGrid, xDim, yDim, deltaT, 0, xDim, NO_SCALARS, kernel, executor);
+}
+
+/*
+	horizVelocityGrid: FieldGrid; holds horizontal velocity components at 1/2 indices
+	vertVelocityGrid: FieldGrid; holds vertical velocity components at 1/2 indices
+	updatedHorizGrid: FieldGrid; will hold the updated horizontal velocities
+	updatedVertGrid: FieldGrid; will hold the updated vertical velocities
+	xDim: int; number of cells in x direction
+	yDim: int; number of cells in y direction
+	deltaT: float; time step over which we advect the velocity
+	scalars: ScalarBatch; cell-centred fields carried along
+	kernel: AdvectKernel; instruction set to use, must be supported by the CPU
+	executor: Executor; runs the rows of the grid, split into contiguous chunks of i
+
+	Alters by reference: updatedHorizGrid, updatedVertGrid and scalars.updated
+	Return type: void
+*/
+void advectSimd(const FieldGrid &horizVelocityGrid, const FieldGrid &vertVelocityGrid, FieldGrid &updatedHorizGrid, FieldGrid &updatedVertGrid, int xDim, int yDim, float deltaT,
+	const ScalarBatch &scalars, AdvectKernel kernel, Executor &executor) {
+	advectSimdRows(horizVelocityGrid, vertVelocityGrid, updatedHorizGrid, updatedVertGrid, xDim, yDim, deltaT, 0, xDim, scalars, kernel, executor);
+}
+
+/*
+	horizVelocityGrid: FieldGrid; holds horizontal velocity components at 1/2 indices
+	vertVelocityGrid: FieldGrid; holds vertical velocity components at 1/2 indices
+	updatedHorizGrid: FieldGrid; will hold the updated horizontal velocities
+	updatedVertGrid: FieldGrid; will hold the updated vertical velocities
+	xDim: int; number of cells in x direction
+	yDim: int; number of cells in y direction
+	deltaT: float; time step over which we advect the velocity
+	sliceBegin: int; first row i to advect
+	sliceEnd: int; one past the last row i to advect, at most xDim
+	scalars: ScalarBatch; cell-centred fields carried along, NO_SCALARS for none
+	kernel: AdvectKernel; instruction set to use, must be supported by the CPU
+	executor: Executor; runs the rows, split into contiguous chunks of i
+
+	Alters by reference: updatedHorizGrid, updatedVertGrid and scalars.updated
+	Return type: void
+*/
+void advectSimdRows(const FieldGrid &horizVelocityGrid, const FieldGrid &vertVelocityGrid, FieldGrid &updatedHorizGrid, FieldGrid &updatedVertGrid, int xDim, int yDim, float deltaT,
+	int sliceBegin, int sliceEnd, const ScalarBatch &scalars, AdvectKernel kernel, Executor &executor) {
+	TRACE_SCOPE("advect");
+#ifdef ADVECT_X86
+	if (kernel == ADVECT_AVX2 || kernel == ADVECT_SSE41) {
+		executor.parallelFor(sliceBegin, sliceEnd, [&](int rowBegin, int rowEnd) {
+			if (kernel == ADVECT_AVX2) {
+				advectRowsAvx2(horizVelocityGrid, vertVelocityGrid, updatedHorizGrid, updatedVertGrid, xDim, yDim, deltaT, rowBegin, rowEnd, 0, yDim, scalars);
+			}
+			else {
+				advectRowsSse41(horizVelocityGrid, vertVelocityGrid, updatedHorizGrid, updatedVertGrid, xDim, yDim, deltaT, rowBegin, rowEnd, 0, yDim, scalars);
+			}
+		});
+
+		// Wall faces are carried over exactly as advect() does.
+		if (sliceEnd == xDim) {
+			for (int j = 0; j < yDim; ++j) {
+				updatedHorizGrid(xDim, j) = horizVelocityGrid(xDim, j);
+			}
+		}
+		for (int i = sliceBegin; i < sliceEnd; ++i) {
+			updatedVertGrid(i, yDim) = vertVelocityGrid(i, yDim);
+		}
+		return;
+	}
+#endif
+	if (sliceBegin == 0 && sliceEnd == xDim && scalars.count == 0) {
+		advect(horizVelocityGrid, vertVelocityGrid, updatedHorizGrid, updatedVertGrid, xDim, yDim, deltaT, executor);
+		return;
+	}
+	executor.parallelFor(sliceBegin, sliceEnd, [&](int rowBegin, int rowEnd) {
+		for (int i = rowBegin; i < rowEnd; ++i) {
+			for (int j = 0; j < yDim; ++j) {
+				advectCell(horizVelocityGrid, vertVelocityGrid, updatedHorizGrid, updatedVertGrid, xDim, yDim, deltaT, scalars, i, j);
+			}
+		}
+	});
+	if (sliceEnd == xDim) {
+		for (int j = 0; j < yDim; ++j) {
+			updatedHorizGrid(xDim, j) = horizVelocityGrid(xDim, j);
+		}
+	}
+	for (int i = sliceBegin; i < sliceEnd; ++i) {
+		updatedVertGrid(i, yDim) = vertVelocityGrid(i, yDim);
+	}
+}
+
+/*
+	horizVelocityGrid: FieldGrid; holds horizontal velocity components at 1/2 indices
+	vertVelocityGrid: FieldGrid; holds vertical velocity components at 1/2 indices
+	updatedHorizGrid: FieldGrid; will hold the updated horizontal velocities
+	updatedVertGrid: FieldGrid; will hold the updated vertical velocities
+	xDim: int; number of cells in x direction
+	yDim: int; number of cells in y direction
+	deltaT: float; time step over which we advect the velocity
+	rowBegin, rowEnd: int; rows i of the block
+	colBegin, colEnd: int; columns j of the block
+	kernel: AdvectKernel; instruction set to use, must be supported by the CPU
+
+	Alters by reference: updatedHorizGrid and updatedVertGrid
+	Return type: void
+*/
+void advectSimdBlock(const FieldGrid &horizVelocityGrid, const FieldGrid &vertVelocityGrid, FieldGrid &updatedHorizGrid, FieldGrid &updatedVertGrid, int xDim, int yDim, float deltaT,
+	int rowBegin, int rowEnd, int colBegin, int colEnd, AdvectKernel kernel) {
+#ifdef ADVECT_X86
+	if (kernel == ADVECT_AVX2) {
+		advectRowsAvx2(horizVelocityGrid, vertVelocityGrid, updatedHorizGrid, updatedVertGrid, xDim, yDim, deltaT, rowBegin, rowEnd, colBegin, colEnd, NO_SCALARS);
+		return;
+	}
+	if (kernel == ADVECT_SSE41) {
+		advectRowsSse41(horizVelocityGrid, vertVelocityGrid, updatedHorizGrid, updatedVertGrid, xDim, yDim, deltaT, rowBegin, rowEnd, colBegin, colEnd, NO_SCALARS);
+		return;
+	}
+#endif
+	for (int i = rowBegin; i < rowEnd; ++i) {
+		for (int j = colBegin; j < colEnd; ++j) {
+			advectCell(horizVelocityGrid, vertVelocityGrid, updatedHorizGrid, updatedVertGrid, xDim, yDim, deltaT, NO_SCALARS, i, j);
+		}
+	}
+}
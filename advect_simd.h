@@ -0,0 +1,115 @@
+#ifndef __ADVECTSIMD__
+#define __ADVECTSIMD__
+
+
+#include "mac_grid.h"
+#include "thread_pool.h"
+using namespace std;
+
+
+/*
+	Instruction sets advectSimd() can run on.
+	ADVECT_SCALAR runs advect() itself; the others process 4 (SSE4.1) or 8 (AVX2) cells
+	of a row per iteration and produce bit-identical results.
+*/
+enum AdvectKernel {
+	ADVECT_SCALAR,
+	ADVECT_SSE41,
+	ADVECT_AVX2
+};
+
+
+/*
+	Cell-centred scalars (dye, temperature, ...) carried along by the velocity, one FieldGrid per
+	field (SoA). Each reuses the backtrace of cell (i,j)'s velocity and is interpolated bilinearly
+	with interpolateScalar() of advect.h, its own vertical weight beside the horizontal one, so a
+	batch costs four more gathers per field and no backtrace.
+	fields: FieldGrid*; count grids, xDim x yDim indexed (x,y), all of the same shape
+	updated: FieldGrid*; count grids of that shape receiving the advected values
+	count: int; number of fields
+*/
+struct ScalarBatch {
+	const FieldGrid* fields;
+	FieldGrid* updated;
+	int count;
+};
+
+const ScalarBatch NO_SCALARS = {0, 0, 0};
+
+
+/*
+	Return type: AdvectKernel; the widest kernel the running CPU supports
+*/
+AdvectKernel bestAdvectKernel();
+
+
+/*
+	kernel: AdvectKernel; kernel to name
+
+	Return type: const char*
+*/
+const char* advectKernelName(AdvectKernel kernel);
+
+
+/*
+	horizVelocityGrid: FieldGrid; holds horizontal velocity components at 1/2 indices
+	vertVelocityGrid: FieldGrid; holds vertical velocity components at 1/2 indices
+	updatedHorizGrid: FieldGrid; will hold the updated horizontal velocities
+	updatedVertGrid: FieldGrid; will hold the updated vertical velocities
+	xDim: int; number of cells in x direction
+	yDim: int; number of cells in y direction
+	deltaT: float; time step over which we advect the velocity
+	kernel: AdvectKernel; instruction set to use, must be supported by the CPU
+	executor: Executor; runs the rows of the grid, split into contiguous chunks of i
+
+	Same result as advect(). Center velocities, backtraces, clamping and interpolation
+	are computed for a run of cells along j at once, with gathers for the interpolated values.
+
+	Alters by reference: updatedHorizGrid and updatedVertGrid
+	Return type: void
+*/
+void advectSimd(const FieldGrid &horizVelocityGrid, const FieldGrid &vertVelocityGrid, FieldGrid &updatedHorizGrid, FieldGrid &updatedVertGrid, int xDim, int yDim, float deltaT, AdvectKernel kernel, Executor &executor);
+
+/*
+	scalars: ScalarBatch; fields advected in the same pass
+
+	advectSimd() that also advects every field of scalars into scalars.updated.
+	Alters by reference: updatedHorizGrid, updatedVertGrid and scalars.updated
+	Return type: void
+*/
+void advectSimd(const FieldGrid &horizVelocityGrid, const FieldGrid &vertVelocityGrid, FieldGrid &updatedHorizGrid, FieldGrid &updatedVertGrid, int xDim, int yDim, float deltaT,
+	const ScalarBatch &scalars, AdvectKernel kernel, Executor &executor);
+
+
+/*
+	sliceBegin: int; first row i to advect
+	sliceEnd: int; one past the last row i to advect, at most xDim
+	scalars: ScalarBatch; fields advected in the same pass, rows [sliceBegin, sliceEnd) of scalars.updated; NO_SCALARS for none
+
+	advectSimd() for rows [sliceBegin, sliceEnd) of a grid xDim cells wide, as a slab of the
+	domain advects them; the other arguments are those of advectSimd(). The grids may be
+	windows: the velocity grids must hold every row the backtraces from these rows reach,
+	the updated grids rows [sliceBegin, sliceEnd). The right wall faces are carried over when sliceEnd is xDim.
+
+	Alters by reference: updatedHorizGrid and updatedVertGrid
+	Return type: void
+*/
+void advectSimdRows(const FieldGrid &horizVelocityGrid, const FieldGrid &vertVelocityGrid, FieldGrid &updatedHorizGrid, FieldGrid &updatedVertGrid, int xDim, int yDim, float deltaT,
+	int sliceBegin, int sliceEnd, const ScalarBatch &scalars, AdvectKernel kernel, Executor &executor);
+
+
+/*
+	rowBegin, rowEnd: int; rows i of the block
+	colBegin, colEnd: int; columns j of the block
+
+	advectSimd() for one block of cells of a grid xDim by yDim, on the calling thread; the other
+	arguments are those of advectSimd(). The grids may be windows: the velocity grids must hold
+	every face the block's backtraces read, the updated grids the block. Wall faces are not carried over.
+
+	Alters by reference: updatedHorizGrid and updatedVertGrid
+	Return type: void
+*/
+void advectSimdBlock(const FieldGrid &horizVelocityGrid, const FieldGrid &vertVelocityGrid, FieldGrid &updatedHorizGrid, FieldGrid &updatedVertGrid, int xDim, int yDim, float deltaT,
+	int rowBegin, int rowEnd, int colBegin, int colEnd, AdvectKernel kernel);
+
+#endif
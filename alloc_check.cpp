@@ -0,0 +1,450 @@
+#include "mac_grid.h"
+#include "grid_fns.h"
+#include "pressure_solver.h"
+#include "multigrid.h"
+#include "advect_simd.h"
+#include "advect_maccormack.h"
+#include "thread_pool.h"
+#include "step_kernels.h"
+#include "sparse_grid.h"
+#include "packed_grid.h"
+#include "config.h"
+#include <atomic>
+#include <cerrno>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+/*
+	Heap allocation check of the solver's substep:
+		./alloc_check [--warmup n] [--substeps n] [--thread-counts 1,2,...] [--config file] [--key value]...
+
+	Every allocation in the process is counted: malloc, calloc, realloc, aligned_alloc,
+	posix_memalign, memalign, valloc and pvalloc are replaced below by wrappers around glibc's
+	own allocator, so operator new, which calls malloc, and the aligned_alloc of FieldGrid are
+	both seen. Each pressure solver runs the substep of solver.cpp on every path below and
+	at every thread count (default 1 and 3), from a Gaussian vortex of xDim by yDim cells.
+	After --warmup substeps (default 2), the next --substeps (default 4) must not allocate.
+
+	Paths:
+		dense       the step kernels of selectStepKernels() over the whole grid
+		tiled       the fused kernels over blocks of tileSize, 16 unless set
+		sparse      a SparseGrid of sparseTile 8, gs and rbsor only; sparseThreshold is -1, so
+		            every tile stays allocated, since tiles the flow reaches are allocated by design
+		float16     a PackedMacGrid of float16 storage
+		bfloat16    a PackedMacGrid of bfloat16 storage
+		maccormack  the dense path with MacCormack advection
+		bfecc       the dense path with BFECC advection
+		scalars     the dense path carrying two passive scalars
+	The other solver options, deltaT and the solves' tolerances among them, apply to every run.
+	Only builds against glibc, whose __libc_malloc and friends the wrappers call.
+	Exits with 1 if any run allocates after its warm-up.
+*/
+
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t count, size_t size);
+void* __libc_realloc(void* memory, size_t size);
+void* __libc_memalign(size_t alignment, size_t size);
+void __libc_free(void* memory);
+}
+
+namespace {
+
+// Allocations are only counted while this is set, so setting up a run does not count
+atomic<bool> counting(false);
+atomic<long long> allocations(0);
+
+inline void countAllocation() {
+	if (counting.load(memory_order_relaxed)) {
+		allocations++;
+	}
+}
+
+}
+
+extern "C" {
+
+void* malloc(size_t size) noexcept {
+	countAllocation();
+	return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size) noexcept {
+	countAllocation();
+	return __libc_calloc(count, size);
+}
+
+void* realloc(void* memory, size_t size) noexcept {
+	countAllocation();
+	return __libc_realloc(memory, size);
+}
+
+void* aligned_alloc(size_t alignment, size_t size) noexcept {
+	countAllocation();
+	return __libc_memalign(alignment, size);
+}
+
+void* memalign(size_t alignment, size_t size) noexcept {
+	countAllocation();
+	return __libc_memalign(alignment, size);
+}
+
+int posix_memalign(void** memory, size_t alignment, size_t size) noexcept {
+	countAllocation();
+	*memory = __libc_memalign(alignment, size);
+	return *memory || size == 0 ? 0 : ENOMEM;
+}
+
+void* valloc(size_t size) noexcept {
+	countAllocation();
+	return __libc_memalign(sysconf(_SC_PAGESIZE), size);
+}
+
+void* pvalloc(size_t size) noexcept {
+	countAllocation();
+	size_t page = sysconf(_SC_PAGESIZE);
+	return __libc_memalign(page, (size + page - 1) / page * page);
+}
+
+void free(void* memory) noexcept {
+	__libc_free(memory);
+}
+
+}
+
+namespace {
+
+const char* SOLVERS[] = {"gs", "pcg", "mg", "rbsor"};
+
+/*
+	name: const char*; name in the report
+	tileSize: int; fused step kernels over blocks of this edge, 0 for the whole grid, -1 for config.tileSize or 16
+	sparseTile: int; SparseGrid tile edge, 0 for the dense grids
+	storage: const char*; storagePrecision
+	advection: const char*; advectScheme
+	numScalars: int; passive scalars carried
+*/
+struct Path {
+	const char* name;
+	int tileSize;
+	int sparseTile;
+	const char* storage;
+	const char* advection;
+	int numScalars;
+};
+
+const Path PATHS[] = {
+	{"dense", 0, 0, "float32", "semilagrangian", 0},
+	{"tiled", -1, 0, "float32", "semilagrangian", 0},
+	{"sparse", 0, 8, "float32", "semilagrangian", 0},
+	{"float16", 0, 0, "float16", "semilagrangian", 0},
+	{"bfloat16", 0, 0, "bfloat16", "semilagrangian", 0},
+	{"maccormack", 0, 0, "float32", "maccormack", 0},
+	{"bfecc", 0, 0, "float32", "bfecc", 0},
+	{"scalars", 0, 0, "float32", "semilagrangian", 2},
+};
+
+/*
+	Everything one run of solver.cpp keeps between substeps, allocated up front as solver.cpp does.
+*/
+struct Simulation {
+	SolverConfig config;
+	ThreadPool threadPool;
+	StepKernels stepKernels;
+	AdvectKernel advectKernel;
+	bool sparse;
+	bool packed;
+	MacGrid grid;
+	FieldGrid updatedHoriz;
+	FieldGrid updatedVert;
+	vector<FieldGrid> scalarGrids;
+	vector<FieldGrid> updatedScalarGrids;
+	vector<float> rhs;
+	SparseGrid sparseGrid;
+	PackedMacGrid packedGrid;
+	MacCormackAdvector advector;
+	PCGSolver pcgSolver;
+	MultigridSolver multigridSolver;
+	float maxFaceVelocity;
+
+	Simulation(const SolverConfig &config, StoragePrecision precision, AdvectScheme scheme)
+		: config(config), threadPool(config.numThreads), stepKernels(selectStepKernels(config.xDim, config.yDim)),
+		  advectKernel(bestAdvectKernel()), sparse(config.sparseTile > 0), packed(precision != STORAGE_FLOAT32),
+		  grid(config.xDim, config.yDim, 0), updatedHoriz(config.xDim+1, config.yDim, 0), updatedVert(config.xDim, config.yDim+1, 0),
+		  scalarGrids(scalarFileNames(config).size(), FieldGrid(config.xDim, config.yDim, 0)),
+		  updatedScalarGrids(scalarFileNames(config).size(), FieldGrid(config.xDim, config.yDim, 0)),
+		  rhs(config.xDim * config.yDim), sparseGrid(config.xDim, config.yDim, config.sparseTile),
+		  packedGrid(config.xDim, config.yDim, precision, 0), advector(config.xDim, config.yDim, scheme),
+		  pcgSolver(config.xDim, config.yDim), multigridSolver(config.xDim, config.yDim), maxFaceVelocity(0.0f) {}
+};
+
+/*
+	simulation: Simulation; receives a Gaussian vortex, zero pressure and a blob of each scalar
+
+	Altered by reference: simulation
+	Return type: void
+*/
+void fillVortex(Simulation &simulation) {
+	int xDim = simulation.config.xDim;
+	int yDim = simulation.config.yDim;
+	MacGrid &grid = simulation.grid;
+	float scale = min(xDim, yDim);
+	float radius = scale / 6.0f;
+	grid.pressure.fill(0.0f);
+	for (int x = 0; x <= xDim; ++x) {
+		for (int y = 0; y < yDim; ++y) {
+			float dx = x - xDim / 2.0f;
+			float dy = y + 0.5f - yDim / 2.0f;
+			grid.horizVelocity(x, y) = -dy / radius * exp(-(dx * dx + dy * dy) / (radius * radius)) * scale / 4;
+		}
+	}
+	for (int x = 0; x < xDim; ++x) {
+		for (int y = 0; y <= yDim; ++y) {
+			float dx = x + 0.5f - xDim / 2.0f;
+			float dy = y - yDim / 2.0f;
+			grid.vertVelocity(x, y) = dx / radius * exp(-(dx * dx + dy * dy) / (radius * radius)) * scale / 4;
+		}
+	}
+	for (FieldGrid &scalar : simulation.scalarGrids) {
+		for (int x = 0; x < xDim; ++x) {
+			for (int y = 0; y < yDim; ++y) {
+				float dx = x - xDim / 3.0f;
+				float dy = y - yDim / 3.0f;
+				scalar(x, y) = exp(-(dx * dx + dy * dy) / (radius * radius));
+			}
+		}
+	}
+	if (simulation.sparse) {
+		simulation.sparseGrid.load(grid.horizVelocity, grid.vertVelocity, grid.pressure, simulation.config.sparseThreshold);
+	}
+	if (simulation.packed) {
+		simulation.packedGrid.load(grid.horizVelocity, grid.vertVelocity, grid.pressure);
+	}
+	simulation.maxFaceVelocity = maxVelocity(grid.horizVelocity, grid.vertVelocity, xDim, yDim);
+}
+
+/*
+	simulation: Simulation; advanced by one substep, the stages solver.cpp runs for its config
+	deltaT: float; substep length
+
+	Altered by reference: simulation
+	Return type: void
+*/
+void substep(Simulation &simulation, float deltaT) {
+	const SolverConfig &config = simulation.config;
+	int xDim = config.xDim;
+	int yDim = config.yDim;
+	FieldGrid &horiz = simulation.grid.horizVelocity;
+	FieldGrid &vert = simulation.grid.vertVelocity;
+	FieldGrid &pressure = simulation.grid.pressure;
+	const StepKernels &stepKernels = simulation.stepKernels;
+	const int tileSize = config.tileSize;
+	const vector<float> &solveRhs = simulation.packed ? simulation.packedGrid.rhs() : simulation.rhs;
+
+	if (simulation.sparse) {
+		SparseGrid &sparseGrid = simulation.sparseGrid;
+		sparseGrid.addGravityBuildRHS(deltaT);
+		if (config.pressureSolver == "gs") {
+			sparseGrid.project(deltaT);
+		}
+		else {
+			sparseGrid.projectRedBlack(deltaT, config.sorOmega, config.redBlackSweeps, simulation.threadPool);
+		}
+		simulation.maxFaceVelocity = sparseGrid.applyPressure(deltaT);
+		sparseGrid.advect(deltaT, simulation.maxFaceVelocity, simulation.advectKernel, simulation.threadPool);
+		sparseGrid.updateActiveTiles(config.sparseThreshold, simulation.maxFaceVelocity * deltaT);
+		return;
+	}
+
+	if (simulation.packed) {
+		simulation.packedGrid.addGravityBuildRHS(deltaT);
+	}
+	else if (tileSize > 0) {
+		addGravityBuildRHSTiled(horiz, vert, xDim, yDim, deltaT, simulation.rhs, tileSize);
+	}
+	else {
+		stepKernels.addGravity(vert, xDim, yDim, deltaT);
+		stepKernels.buildRHS(horiz, vert, xDim, yDim, simulation.rhs);
+	}
+
+	if (config.pressureSolver == "gs") {
+		if (simulation.packed) {
+			simulation.packedGrid.project(deltaT);
+		}
+		else {
+			stepKernels.project(pressure, deltaT, xDim, yDim, simulation.rhs);
+		}
+	}
+	else {
+		if (simulation.packed) {
+			simulation.packedGrid.unpackPressure(pressure);
+		}
+		if (config.pressureSolver == "rbsor") {
+			projectRedBlack(pressure, deltaT, xDim, yDim, solveRhs, config.sorOmega, config.redBlackSweeps, simulation.threadPool);
+		}
+		else if (config.pressureSolver == "pcg") {
+			simulation.pcgSolver.solve(pressure, deltaT, solveRhs, config.pressureTolerance, config.maxPressureIterations);
+		}
+		else {
+			simulation.multigridSolver.solve(pressure, deltaT, solveRhs, config.pressureTolerance, config.maxPressureIterations);
+		}
+		if (simulation.packed) {
+			simulation.packedGrid.packPressure(pressure);
+		}
+	}
+
+	if (simulation.packed) {
+		simulation.maxFaceVelocity = simulation.packedGrid.applyPressure(deltaT);
+	}
+	else if (tileSize > 0) {
+		simulation.maxFaceVelocity = applyPressureTiled(pressure, horiz, vert, deltaT, xDim, yDim, tileSize, 0);
+	}
+	else {
+		simulation.maxFaceVelocity = stepKernels.applyPressure(pressure, horiz, vert, deltaT, xDim, yDim);
+	}
+
+	if (simulation.packed) {
+		simulation.packedGrid.advect(deltaT, simulation.maxFaceVelocity, simulation.advectKernel, simulation.threadPool);
+		return;
+	}
+	ScalarBatch scalars = {simulation.scalarGrids.data(), simulation.updatedScalarGrids.data(), (int)simulation.scalarGrids.size()};
+	simulation.advector.advect(horiz, vert, simulation.updatedHoriz, simulation.updatedVert, deltaT, scalars, simulation.advectKernel, simulation.threadPool);
+	horiz.swap(simulation.updatedHoriz);
+	vert.swap(simulation.updatedVert);
+	simulation.scalarGrids.swap(simulation.updatedScalarGrids);
+}
+
+/*
+	config: SolverConfig; the run, path options already set
+	warmup: int; substeps run before counting
+	substeps: int; substeps counted
+
+	Return type: long long; allocations during the counted substeps
+*/
+long long countSubsteps(const SolverConfig &config, int warmup, int substeps) {
+	StoragePrecision precision = STORAGE_FLOAT32;
+	parseStoragePrecision(config.storagePrecision, precision);
+	AdvectScheme scheme = ADVECT_SEMI_LAGRANGIAN;
+	parseAdvectScheme(config.advectScheme, scheme);
+	Simulation simulation(config, precision, scheme);
+	fillVortex(simulation);
+
+	for (int step = 0; step < warmup; ++step) {
+		substep(simulation, cflTimestep(config.deltaT, config.cfl, simulation.maxFaceVelocity, config.deltaT));
+	}
+	allocations = 0;
+	counting = true;
+	for (int step = 0; step < substeps; ++step) {
+		substep(simulation, cflTimestep(config.deltaT, config.cfl, simulation.maxFaceVelocity, config.deltaT));
+	}
+	counting = false;
+	return allocations;
+}
+
+}
+
+int main(int argc, char* argv[]){
+	/*
+	The options of this tool are taken out before the rest go to parseArguments().
+	*/
+	int warmup = 2;
+	int substeps = 4;
+	vector<int> threadCounts;
+	vector<char*> solverArguments(1, argv[0]);
+	for (int index = 1; index < argc; ++index) {
+		string option = argv[index];
+		bool hasValue = index + 1 < argc;
+		if (option == "--warmup" && hasValue) {
+			warmup = atoi(argv[++index]);
+		}
+		else if (option == "--substeps" && hasValue) {
+			substeps = atoi(argv[++index]);
+		}
+		else if (option == "--thread-counts" && hasValue) {
+			stringstream list(argv[++index]);
+			string count;
+			while (getline(list, count, ',')) {
+				threadCounts.push_back(atoi(count.c_str()));
+			}
+		}
+		else {
+			solverArguments.push_back(argv[index]);
+		}
+	}
+
+	SolverConfig defaults;
+	if (!parseArguments(defaults, (int)solverArguments.size(), solverArguments.data())) {
+		cerr << "usage: " << argv[0] << " [--warmup n] [--substeps n] [--thread-counts 1,2,...] and the solver options:" << endl;
+		printUsage(argv[0]);
+		return 1;
+	}
+	if (threadCounts.empty()) {
+		threadCounts = {1, 3};
+	}
+	for (int count : threadCounts) {
+		if (count < 1) {
+			cerr << "--thread-counts must be positive" << endl;
+			return 1;
+		}
+	}
+	if (warmup < 1 || substeps < 1) {
+		cerr << "--warmup and --substeps must be positive" << endl;
+		return 1;
+	}
+
+	// The hooks must see both kinds of allocation the solver makes, or a pass means nothing
+	counting = true;
+	{
+		FieldGrid probeGrid(4, 4, 0.0f);
+		PCGSolver probeSolver(4, 4);
+	}
+	counting = false;
+	if (allocations < 2) {
+		cerr << "the allocation hooks are not installed: " << allocations << " of 2 probe allocations counted" << endl;
+		return 1;
+	}
+
+	cout << defaults.xDim << "x" << defaults.yDim << ", " << warmup << " warm-up and " << substeps << " counted substeps" << endl;
+	int failures = 0;
+	for (const char* solver : SOLVERS) {
+		for (const Path &path : PATHS) {
+			if (path.sparseTile > 0 && string(solver) != "gs" && string(solver) != "rbsor") {
+				continue;
+			}
+			for (int count : threadCounts) {
+				SolverConfig config = defaults;
+				config.pressureSolver = solver;
+				config.numThreads = count;
+				config.tileSize = path.tileSize == -1 ? (defaults.tileSize > 0 ? defaults.tileSize : 16) : path.tileSize;
+				config.sparseTile = path.sparseTile;
+				config.sparseThreshold = -1;
+				config.storagePrecision = path.storage;
+				config.advectScheme = path.advection;
+				config.scalarFiles = "";
+				for (int field = 0; field < path.numScalars; ++field) {
+					config.scalarFiles += (field > 0 ? "," : "") + string("scalar") + to_string(field);
+				}
+				config.checkpointInterval = 0;
+				config.resume = false;
+				if (!validateConfig(config)) {
+					return 1;
+				}
+
+				long long counted = countSubsteps(config, warmup, substeps);
+				cout << solver << " " << path.name << ", " << count << " threads: " << counted << " allocations";
+				if (counted > 0) {
+					cout << "  FAIL";
+					failures++;
+				}
+				cout << endl;
+			}
+		}
+	}
+	cout << (failures == 0 ? "PASS" : "FAIL") << endl;
+	return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,145 @@
+#include "async_frame_writer.h"
+#include <chrono>
+
+
+const int AsyncFrameWriter::TASK_SLOT;
+
+/*
+	xDim: int; number of cells in x direction
+	yDim: int; number of cells in y direction
+	queueSize: int; number of snapshot buffers, at least 1
+	sink: function taking (horizVelocityGrid, vertVelocityGrid, scalarGrids)
+	numScalars: int; number of scalar fields snapshotted with every frame
+*/
+AsyncFrameWriter::AsyncFrameWriter(int xDim, int yDim, int queueSize, Sink sink, int numScalars)
+	: sink(sink), stopping(false), inFlight(0) {
+	if (queueSize < 1) {
+		queueSize = 1;
+	}
+	counters.framesWritten = 0;
+	counters.highWaterMark = 0;
+	counters.blockedSeconds = 0.0;
+
+	for (int slot = 0; slot < queueSize; ++slot) {
+		horizSnapshots.push_back(FieldGrid(xDim+1, yDim, 0));
+		vertSnapshots.push_back(FieldGrid(xDim, yDim+1, 0));
+		scalarSnapshots.push_back(vector<FieldGrid>(numScalars, FieldGrid(xDim, yDim, 0)));
+		freeSlots.push_back(slot);
+	}
+	writer = thread(&AsyncFrameWriter::writerLoop, this);
+}
+
+AsyncFrameWriter::~AsyncFrameWriter() {
+	finish();
+}
+
+/*
+	horizVelocityGrid: FieldGrid; holds horizontal velocity components at 1/2 indices
+	vertVelocityGrid: FieldGrid; holds vertical velocity components at 1/2 indices
+	scalarGrids: FieldGrid*; numScalars scalar fields
+
+	Return type: void
+*/
+void AsyncFrameWriter::submit(const FieldGrid &horizVelocityGrid, const FieldGrid &vertVelocityGrid, const FieldGrid* scalarGrids) {
+	int slot;
+	{
+		unique_lock<mutex> guard(lock);
+		if (freeSlots.empty()) {
+			auto start = chrono::steady_clock::now();
+			slotFreed.wait(guard, [&] { return !freeSlots.empty(); });
+			counters.blockedSeconds += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+		}
+		slot = freeSlots.front();
+		freeSlots.pop_front();
+	}
+
+	// The slot is owned by this thread until it is queued, so copy without the lock.
+	horizSnapshots[slot] = horizVelocityGrid;
+	vertSnapshots[slot] = vertVelocityGrid;
+	for (size_t field = 0; field < scalarSnapshots[slot].size(); ++field) {
+		scalarSnapshots[slot][field] = scalarGrids[field];
+	}
+
+	{
+		unique_lock<mutex> guard(lock);
+		readySlots.push_back(slot);
+		inFlight++;
+		if (inFlight > counters.highWaterMark) {
+			counters.highWaterMark = inFlight;
+		}
+	}
+	frameReady.notify_one();
+}
+
+/*
+	task: function; run on the writer thread once every frame submitted before it is written
+
+	Return type: void
+*/
+void AsyncFrameWriter::submitTask(function<void()> task) {
+	{
+		unique_lock<mutex> guard(lock);
+		tasks.push_back(task);
+		readySlots.push_back(TASK_SLOT);
+	}
+	frameReady.notify_one();
+}
+
+void AsyncFrameWriter::writerLoop() {
+	/*
+	Writes ready snapshots and runs tasks in order until finish() is called and the queue is empty.
+	*/
+	while (true) {
+		int slot;
+		function<void()> task;
+		{
+			unique_lock<mutex> guard(lock);
+			frameReady.wait(guard, [&] { return stopping || !readySlots.empty(); });
+			if (readySlots.empty()) {
+				return;
+			}
+			slot = readySlots.front();
+			readySlots.pop_front();
+			if (slot == TASK_SLOT) {
+				task.swap(tasks.front());
+				tasks.pop_front();
+			}
+		}
+
+		if (slot == TASK_SLOT) {
+			task();
+			continue;
+		}
+
+		vector<FieldGrid> &scalars = scalarSnapshots[slot];
+		sink(horizSnapshots[slot], vertSnapshots[slot], scalars.empty() ? 0 : scalars.data());
+
+		{
+			unique_lock<mutex> guard(lock);
+			freeSlots.push_back(slot);
+			inFlight--;
+			counters.framesWritten++;
+		}
+		slotFreed.notify_one();
+	}
+}
+
+void AsyncFrameWriter::finish() {
+	{
+		unique_lock<mutex> guard(lock);
+		if (stopping) {
+			return;
+		}
+		stopping = true;
+	}
+	frameReady.notify_one();
+	writer.join();
+}
+
+/*
+	Return type: FrameWriterStats
+*/
+FrameWriterStats AsyncFrameWriter::stats() {
+	unique_lock<mutex> guard(lock);
+	return counters;
+}
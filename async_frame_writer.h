@@ -0,0 +1,105 @@
+#ifndef __ASYNCFRAMEWRITER__
+#define __ASYNCFRAMEWRITER__
+
+
+#include "mac_grid.h"
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+using namespace std;
+
+
+/*
+	framesWritten: int; frames the sink has finished
+	highWaterMark: int; most frames ever waiting or being written at once
+	blockedSeconds: double; total time submit() waited for a free snapshot buffer
+*/
+struct FrameWriterStats {
+	int framesWritten;
+	int highWaterMark;
+	double blockedSeconds;
+};
+
+
+/*
+	Moves frame output off the simulation thread.
+	submit() copies the face velocity grids, and any passive scalars, into one of queueSize preallocated snapshot
+	buffers and returns; a dedicated writer thread hands each snapshot to the sink in
+	submission order. When every buffer is in use submit() blocks until the writer frees one,
+	so a slow disk slows the solver down instead of growing memory.
+	Tasks queued with submitTask() run on the same thread in the same order as the frames.
+*/
+class AsyncFrameWriter {
+public:
+	typedef function<void(const FieldGrid&, const FieldGrid&, const FieldGrid*)> Sink;
+	static const int TASK_SLOT = -1;
+
+	/*
+		xDim: int; number of cells in x direction
+		yDim: int; number of cells in y direction
+		queueSize: int; number of snapshot buffers, at least 1
+		sink: function taking (horizVelocityGrid, vertVelocityGrid, scalarGrids); serializes one frame,
+			only ever called from the writer thread; scalarGrids is 0 when numScalars is 0
+		numScalars: int; number of xDim x yDim scalar fields snapshotted with every frame
+	*/
+	AsyncFrameWriter(int xDim, int yDim, int queueSize, Sink sink, int numScalars = 0);
+
+	/*
+		Calls finish().
+	*/
+	~AsyncFrameWriter();
+
+	/*
+		horizVelocityGrid: FieldGrid; holds horizontal velocity components at 1/2 indices
+		vertVelocityGrid: FieldGrid; holds vertical velocity components at 1/2 indices
+		scalarGrids: FieldGrid*; numScalars scalar fields, may be 0 when there are none
+
+		Snapshots the grids for the writer thread, blocking while the queue is full.
+		Return type: void
+	*/
+	void submit(const FieldGrid &horizVelocityGrid, const FieldGrid &vertVelocityGrid, const FieldGrid* scalarGrids = 0);
+
+	/*
+		task: function; run on the writer thread once every frame submitted before it is written
+
+		Does not block and does not take a snapshot buffer; the task must own or guard its data.
+		Return type: void
+	*/
+	void submitTask(function<void()> task);
+
+	/*
+		Waits for every submitted frame to be written and stops the writer thread.
+		Return type: void
+	*/
+	void finish();
+
+	/*
+		Return type: FrameWriterStats
+	*/
+	FrameWriterStats stats();
+
+private:
+	void writerLoop();
+
+	Sink sink;
+	vector<FieldGrid> horizSnapshots;
+	vector<FieldGrid> vertSnapshots;
+	// numScalars grids per slot
+	vector<vector<FieldGrid>> scalarSnapshots;
+	deque<int> freeSlots;
+	// Slot numbers in submission order; TASK_SLOT means the next entry of tasks.
+	deque<int> readySlots;
+	deque<function<void()>> tasks;
+	mutex lock;
+	condition_variable slotFreed;
+	condition_variable frameReady;
+	thread writer;
+	bool stopping;
+	int inFlight;
+	FrameWriterStats counters;
+};
+
+#endif
@@ -0,0 +1,103 @@
+#include "mac_grid.h"
+#include "grid_fns.h"
+#include "advect.h"
+#include "advect_simd.h"
+#include "thread_pool.h"
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+/*
+	Micro-benchmark of one advection step on a single thread: advect() against every
+	advectSimd() kernel the CPU supports, at 256^2, 1024^2 and 4096^2.
+	Prints cells/second, speedup over advect(), and whether the result is bit-identical.
+*/
+
+/*
+	grid: FieldGrid; grid to fill with velocities in [-scale, scale]
+	seed: unsigned; seed for the pseudo random sequence
+	scale: float; largest velocity magnitude
+
+	Return type: void
+*/
+void fillRandom(FieldGrid &grid, unsigned seed, float scale) {
+	for (int i = 0; i < grid.rows(); ++i) {
+		for (int j = 0; j < grid.cols(); ++j) {
+			seed = seed * 1664525u + 1013904223u;
+			grid(i, j) = scale * ((seed >> 8) / 8388608.0f - 1.0f);
+		}
+	}
+}
+
+/*
+	a: FieldGrid; first grid
+	b: FieldGrid; second grid of the same shape
+
+	Return type: bool; true if every interior value has the same bits
+*/
+bool identical(const FieldGrid &a, const FieldGrid &b) {
+	for (int i = 0; i < a.rows(); ++i) {
+		if (memcmp(a.row(i), b.row(i), a.cols() * sizeof(float)) != 0) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/*
+	grid: MacGrid; velocities to advect
+	updatedHoriz: FieldGrid; receives the advected horizontal velocities
+	updatedVert: FieldGrid; receives the advected vertical velocities
+	deltaT: float; time step to advect over
+	kernel: AdvectKernel; kernel to time, or -1 for advect()
+	minSeconds: double; keep repeating until at least this much time has passed
+
+	Return type: double; cells advected per second
+*/
+double cellsPerSecond(const MacGrid &grid, FieldGrid &updatedHoriz, FieldGrid &updatedVert, float deltaT, int kernel, double minSeconds) {
+	SerialExecutor serial;
+	int repeats = 0;
+	double elapsed = 0.0;
+	auto start = chrono::steady_clock::now();
+	while (elapsed < minSeconds || repeats < 2) {
+		if (kernel < 0) {
+			advect(grid.horizVelocity, grid.vertVelocity, updatedHoriz, updatedVert, grid.xDim, grid.yDim, deltaT, serial);
+		}
+		else {
+			advectSimd(grid.horizVelocity, grid.vertVelocity, updatedHoriz, updatedVert, grid.xDim, grid.yDim, deltaT, (AdvectKernel)kernel, serial);
+		}
+		repeats++;
+		elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	}
+	return (double)grid.xDim * grid.yDim * repeats / elapsed;
+}
+
+int main(int argc, char* argv[]) {
+	const int sizes[] = {256, 1024, 4096};
+	const float deltaT = 1 / 30.0;
+	double minSeconds = 0.5;
+	if (argc > 1) {
+		minSeconds = atof(argv[1]);
+	}
+
+	AdvectKernel best = bestAdvectKernel();
+	cout << "size,kernel,cells_per_second,speedup,identical" << endl;
+	for (int size : sizes) {
+		MacGrid grid(size, size, 0);
+		fillRandom(grid.horizVelocity, 1, 30.0f);
+		fillRandom(grid.vertVelocity, 2, 30.0f);
+
+		FieldGrid referenceHoriz(size+1, size, 0), referenceVert(size, size+1, 0);
+		double reference = cellsPerSecond(grid, referenceHoriz, referenceVert, deltaT, -1, minSeconds);
+		cout << size << ",advect," << reference << ",1," << "yes" << endl;
+
+		for (int kernel = ADVECT_SCALAR; kernel <= best; ++kernel) {
+			FieldGrid updatedHoriz(size+1, size, 0), updatedVert(size, size+1, 0);
+			double rate = cellsPerSecond(grid, updatedHoriz, updatedVert, deltaT, kernel, minSeconds);
+			bool same = identical(updatedHoriz, referenceHoriz) && identical(updatedVert, referenceVert);
+			cout << size << "," << advectKernelName((AdvectKernel)kernel) << "," << rate << ","
+				<< rate / reference << "," << (same ? "yes" : "no") << endl;
+		}
+	}
+}
@@ -0,0 +1,168 @@
+#include "mac_grid.h"
+#include "advect_simd.h"
+#include "advect_maccormack.h"
+#include "thread_pool.h"
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+/*
+	Wall-clock to equivalent error of the advection schemes of advect_maccormack.h:
+		./bench_advect_order [largest size]
+	Advects a 1D Burgers pulse, u = U + a exp(-((x - x0) / w)^2) along x and v = 0, on square
+	grids of 32^2 up to the largest size (512 by default) on a single thread. Pressure plays no
+	part, so the exact solution u(x, T) = u(x - u T, 0) is known until the pulse steepens into a
+	shock; the run stops at half that time. Each scheme runs at every size with substeps of
+	CFL_CELLS cells, and prints the wall-clock time of the advection and the RMS and largest
+	error of u relative to a. The summary then gives, for the semi-Lagrangian error at each
+	size, the smallest grid on which each corrected scheme is at least as accurate and how
+	much less time it took there.
+*/
+
+namespace {
+
+const double BACKGROUND = 1.0;
+const double AMPLITUDE = 0.1;
+const double CENTER = 0.25;
+const double WIDTH = 0.1;
+const double END_TIME = 0.5;
+const double CFL_CELLS = 0.5;
+
+/*
+	x: double; position in [0, 1]
+
+	Return type: double; initial velocity there, in domain lengths per unit time
+*/
+double initialVelocity(double x) {
+	double s = (x - CENTER) / WIDTH;
+	return BACKGROUND + AMPLITUDE * exp(-s * s);
+}
+
+/*
+	x: double; position in [0, 1]
+	time: double; before the shock forms
+
+	Return type: double; u(x, time), the value carried from the foot xi of the characteristic xi + u(xi, 0) time = x
+*/
+double exactVelocity(double x, double time) {
+	double xi = x - BACKGROUND * time;
+	for (int iteration = 0; iteration < 50; ++iteration) {
+		double s = (xi - CENTER) / WIDTH;
+		double bump = AMPLITUDE * exp(-s * s);
+		double residual = xi + (BACKGROUND + bump) * time - x;
+		double slope = 1.0 + bump * (-2.0 * s / WIDTH) * time;
+		xi -= residual / slope;
+	}
+	return initialVelocity(xi);
+}
+
+/*
+	size, scheme, steps: the run
+	seconds: double; time in the advection
+	rmsError, maxError: double; error of u relative to AMPLITUDE at END_TIME
+*/
+struct OrderRun {
+	int size;
+	AdvectScheme scheme;
+	int steps;
+	double seconds;
+	double rmsError;
+	double maxError;
+};
+
+/*
+	size: int; cells along each axis
+	scheme: AdvectScheme
+
+	Return type: OrderRun
+*/
+OrderRun runPulse(int size, AdvectScheme scheme) {
+	/*
+	Face i of a row sits at x = i / size, velocities are in cells per unit time.
+	*/
+	SerialExecutor serial;
+	AdvectKernel kernel = bestAdvectKernel();
+	MacGrid grid(size, size, 0);
+	FieldGrid updatedHoriz(size+1, size, 0), updatedVert(size, size+1, 0);
+	MacCormackAdvector advector(size, size, scheme);
+	for (int i = 0; i <= size; ++i) {
+		for (int j = 0; j < size; ++j) {
+			grid.horizVelocity(i, j) = size * initialVelocity((double)i / size);
+		}
+	}
+
+	OrderRun run;
+	run.size = size;
+	run.scheme = scheme;
+	run.steps = (int)ceil(END_TIME * (BACKGROUND + AMPLITUDE) * size / CFL_CELLS);
+	float deltaT = END_TIME / run.steps;
+	auto start = chrono::steady_clock::now();
+	for (int step = 0; step < run.steps; ++step) {
+		advector.advect(grid.horizVelocity, grid.vertVelocity, updatedHoriz, updatedVert, deltaT, kernel, serial);
+		grid.horizVelocity.swap(updatedHoriz);
+		grid.vertVelocity.swap(updatedVert);
+	}
+	run.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+	// Every row holds the same pulse
+	double sumSquares = 0.0;
+	run.maxError = 0.0;
+	for (int i = 0; i < size; ++i) {
+		double error = fabs(grid.horizVelocity(i, size / 2) / size - exactVelocity((double)i / size, END_TIME)) / AMPLITUDE;
+		sumSquares += error * error;
+		run.maxError = fmax(run.maxError, error);
+	}
+	run.rmsError = sqrt(sumSquares / size);
+	return run;
+}
+
+}
+
+int main(int argc, char* argv[]) {
+	int largest = 512;
+	if (argc > 1) {
+		largest = atoi(argv[1]);
+	}
+	const AdvectScheme schemes[] = {ADVECT_SEMI_LAGRANGIAN, ADVECT_MACCORMACK, ADVECT_BFECC};
+
+	vector<OrderRun> runs;
+	cout << "size,scheme,steps,seconds,rms_error,max_error" << endl;
+	for (int size = 32; size <= largest; size *= 2) {
+		for (AdvectScheme scheme : schemes) {
+			OrderRun run = runPulse(size, scheme);
+			runs.push_back(run);
+			cout << size << "," << advectSchemeName(scheme) << "," << run.steps << "," << run.seconds << ","
+				<< run.rmsError << "," << run.maxError << endl;
+		}
+	}
+
+	cout << endl << "equivalent error:" << endl;
+	for (const OrderRun &target : runs) {
+		if (target.scheme != ADVECT_SEMI_LAGRANGIAN) {
+			continue;
+		}
+		cout << "semilagrangian at " << target.size << " (rms " << target.rmsError << ", " << target.seconds << " s):";
+		for (AdvectScheme scheme : schemes) {
+			if (scheme == ADVECT_SEMI_LAGRANGIAN) {
+				continue;
+			}
+			const OrderRun* match = 0;
+			for (const OrderRun &run : runs) {
+				if (run.scheme == scheme && run.rmsError <= target.rmsError && (!match || run.size < match->size)) {
+					match = &run;
+				}
+			}
+			if (match) {
+				cout << " " << advectSchemeName(scheme) << " at " << match->size << " in " << match->seconds << " s ("
+					<< target.seconds / match->seconds << "x)";
+			}
+			else {
+				cout << " " << advectSchemeName(scheme) << " not reached";
+			}
+		}
+		cout << endl;
+	}
+	return 0;
+}
@@ -0,0 +1,462 @@
+#include "mac_grid.h"
+#include "grid_fns.h"
+#include "step_kernels.h"
+#include "sparse_grid.h"
+#include "packed_grid.h"
+#include "advect_simd.h"
+#include "thread_pool.h"
+#include "frame_io.h"
+#include "utils.h"
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <new>
+#include <sstream>
+#include <sys/stat.h>
+
+/*
+	Benchmark of every stage of a solver step on its own, and of the whole step, over a
+	sweep of grid sizes and thread counts.
+
+	usage: bench_stages [--sizes 32,64,...] [--threads 1,2,...] [--samples n] [--min-time seconds] [--tile-size n] [--sparse-tile n] [--json]
+
+	Each stage is run once to warm up, then timed over `samples` batches of calls; a batch
+	repeats the stage until it has taken at least min-time seconds. Per stage it reports
+	the mean, standard deviation and minimum of the batch ns/cell, GB/s from the mean and
+	the bytes each cell of the stage must move, and heap allocations per call.
+	Stages that do not take an Executor are only run at the first thread count.
+	The stages the tiled kernels fuse are also timed as the separate passes they replace,
+	gravity_build_rhs and apply_pressure_divergence, next to their _tiled versions, which use
+	blocks of --tile-size cells a side (cacheTileSize() by default). Bytes per cell count
+	every pass, so the fused rows move less for the same work.
+	step_sparse_<percent> runs the gs step on a SparseGrid of --sparse-tile cells a side (16 by
+	default) whose flow fills the given percentage of the columns; ns/cell is per cell of the
+	whole grid, so it falls with the active fraction. The active tiles are chosen once per batch
+	and updateActiveTiles() is not timed.
+	step_float16 and step_bfloat16 run the gs step on a PackedMacGrid; bytes per cell count
+	the 16-bit fields, so on grids larger than the cache they should approach half of step.
+	advect_scalars is advect carrying ADVECT_SCALARS passive scalars in the same pass; the
+	difference to advect is what the scalars cost on top of the shared backtrace.
+	save_text writes tens of bytes per cell, so it is skipped above TEXT_SAVE_MAX_SIZE.
+	Output is CSV on stdout, or a JSON document with --json.
+*/
+
+const int TEXT_SAVE_MAX_SIZE = 1024;
+const char* TEXT_OUTPUT = "bench_stages_output.txt";
+const char* BINARY_OUTPUT = "bench_stages_output.bin";
+// Passive scalars carried by the advect_scalars row
+const int ADVECT_SCALARS = 4;
+// Percentages of the columns that move in the step_sparse rows
+const int SPARSE_PERCENTS[] = {100, 25, 6};
+
+// Every operator new in the process is counted, so allocations in a stage show up in the report.
+// The aligned_alloc of FieldGrid bypasses it; alloc_check counts every allocation of a substep.
+static atomic<long long> heapAllocations(0);
+
+// malloc and free stay behind calls the compiler cannot see through, so it does not pair an
+// inlined new with a free and warn of a mismatched deallocation.
+__attribute__((noinline)) static void* countedAllocate(size_t size) {
+	heapAllocations++;
+	return malloc(size ? size : 1);
+}
+
+__attribute__((noinline)) static void countedRelease(void* memory) {
+	free(memory);
+}
+
+void* operator new(size_t size) {
+	void* memory = countedAllocate(size);
+	if (!memory) {
+		throw bad_alloc();
+	}
+	return memory;
+}
+
+void operator delete(void* memory) noexcept {
+	countedRelease(memory);
+}
+
+void operator delete(void* memory, size_t) noexcept {
+	countedRelease(memory);
+}
+
+
+/*
+	calls: long long; calls per timed batch
+	meanNs: double; mean over the batches of ns per call per cell
+	stddevNs: double; sample standard deviation of the same
+	minNs: double; fastest batch
+	allocationsPerCall: double; heap allocations per call while timing
+*/
+struct StageTiming {
+	long long calls;
+	double meanNs;
+	double stddevNs;
+	double minNs;
+	double allocationsPerCall;
+};
+
+
+/*
+	size: int; cells per side
+	stage: string; stage name
+	threads: int; threads the stage ran on
+	bytesPerCell: double; memory traffic the stage needs per cell
+	timing: StageTiming
+*/
+struct Row {
+	int size;
+	string stage;
+	int threads;
+	double bytesPerCell;
+	StageTiming timing;
+};
+
+
+/*
+	grid: FieldGrid; grid to fill with values in [-scale, scale]
+	seed: unsigned; seed for the pseudo random sequence
+	scale: float; largest magnitude
+
+	Return type: void
+*/
+void fillRandom(FieldGrid &grid, unsigned seed, float scale) {
+	for (int i = 0; i < grid.rows(); ++i) {
+		for (int j = 0; j < grid.cols(); ++j) {
+			seed = seed * 1664525u + 1013904223u;
+			grid(i, j) = scale * ((seed >> 8) / 8388608.0f - 1.0f);
+		}
+	}
+}
+
+/*
+	list: string; comma separated integers
+
+	Return type: vector<int>
+*/
+vector<int> parseList(const string &list) {
+	vector<int> values;
+	stringstream stream(list);
+	string item;
+	while (getline(stream, item, ',')) {
+		if (!item.empty()) {
+			values.push_back(atoi(item.c_str()));
+		}
+	}
+	return values;
+}
+
+/*
+	cells: double; cells the stage touches per call
+	samples: int; timed batches, at least 2
+	minSeconds: double; shortest batch
+	stage: callable; one call of the stage
+	reset: callable; run before every batch, outside the timed region
+
+	Return type: StageTiming
+*/
+template<class Stage, class Reset>
+StageTiming timeStage(double cells, int samples, double minSeconds, const Stage &stage, const Reset &reset) {
+	reset();
+	auto start = chrono::steady_clock::now();
+	stage();
+	double once = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+	StageTiming timing;
+	timing.calls = once > 0 ? (long long)ceil(minSeconds / once) : 1;
+	if (timing.calls < 1) {
+		timing.calls = 1;
+	}
+
+	double sum = 0.0, sumSquares = 0.0;
+	long long allocations = 0;
+	timing.minNs = 0.0;
+	for (int sample = 0; sample < samples; ++sample) {
+		reset();
+		long long allocationsBefore = heapAllocations;
+		start = chrono::steady_clock::now();
+		for (long long call = 0; call < timing.calls; ++call) {
+			stage();
+		}
+		double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+		allocations += heapAllocations - allocationsBefore;
+
+		double nsPerCell = seconds * 1e9 / (timing.calls * cells);
+		sum += nsPerCell;
+		sumSquares += nsPerCell * nsPerCell;
+		if (sample == 0 || nsPerCell < timing.minNs) {
+			timing.minNs = nsPerCell;
+		}
+	}
+	timing.meanNs = sum / samples;
+	timing.stddevNs = sqrt(fmax(0.0, (sumSquares - sum * sum / samples) / (samples - 1)));
+	timing.allocationsPerCall = (double)allocations / (timing.calls * samples);
+	return timing;
+}
+
+template<class Stage>
+StageTiming timeStage(double cells, int samples, double minSeconds, const Stage &stage) {
+	return timeStage(cells, samples, minSeconds, stage, [] {});
+}
+
+/*
+	fileName: string
+
+	Return type: double; size of the file in bytes, 0 if it does not exist
+*/
+double fileSize(const char* fileName) {
+	struct stat status;
+	return stat(fileName, &status) == 0 ? (double)status.st_size : 0.0;
+}
+
+void printCsv(const vector<Row> &rows) {
+	cout << "size,stage,threads,calls,ns_per_cell,stddev_ns_per_cell,min_ns_per_cell,gb_per_s,allocations_per_call" << endl;
+	for (const Row &row : rows) {
+		cout << row.size << "," << row.stage << "," << row.threads << "," << row.timing.calls << ","
+			<< row.timing.meanNs << "," << row.timing.stddevNs << "," << row.timing.minNs << ","
+			<< row.bytesPerCell / row.timing.meanNs << "," << row.timing.allocationsPerCall << endl;
+	}
+}
+
+void printJson(const vector<Row> &rows, int samples, double minSeconds, int tileSize) {
+	cout << "{" << endl;
+	cout << "\t\"advect_kernel\": \"" << advectKernelName(bestAdvectKernel()) << "\"," << endl;
+	cout << "\t\"samples\": " << samples << "," << endl;
+	cout << "\t\"min_time\": " << minSeconds << "," << endl;
+	cout << "\t\"tile_size\": " << tileSize << "," << endl;
+	cout << "\t\"results\": [" << endl;
+	for (size_t index = 0; index < rows.size(); ++index) {
+		const Row &row = rows[index];
+		cout << "\t\t{\"size\": " << row.size << ", \"stage\": \"" << row.stage << "\", \"threads\": " << row.threads
+			<< ", \"calls\": " << row.timing.calls << ", \"ns_per_cell\": " << row.timing.meanNs
+			<< ", \"stddev_ns_per_cell\": " << row.timing.stddevNs << ", \"min_ns_per_cell\": " << row.timing.minNs
+			<< ", \"gb_per_s\": " << row.bytesPerCell / row.timing.meanNs
+			<< ", \"allocations_per_call\": " << row.timing.allocationsPerCall << "}"
+			<< (index + 1 < rows.size() ? "," : "") << endl;
+	}
+	cout << "\t]" << endl;
+	cout << "}" << endl;
+}
+
+int main(int argc, char* argv[]) {
+	vector<int> sizes = {32, 64, 128, 256, 512, 1024, 2048, 4096};
+	vector<int> threadCounts;
+	int hardwareThreads = thread::hardware_concurrency();
+	for (int threads = 1; threads < hardwareThreads; threads *= 2) {
+		threadCounts.push_back(threads);
+	}
+	threadCounts.push_back(hardwareThreads > 0 ? hardwareThreads : 1);
+	int samples = 5;
+	double minSeconds = 0.05;
+	bool json = false;
+	int tileSize = cacheTileSize();
+	int sparseTile = 16;
+
+	for (int arg = 1; arg < argc; ++arg) {
+		string option = argv[arg];
+		bool hasValue = arg + 1 < argc;
+		if (option == "--json") {
+			json = true;
+		}
+		else if (option == "--sizes" && hasValue) {
+			sizes = parseList(argv[++arg]);
+		}
+		else if (option == "--threads" && hasValue) {
+			threadCounts = parseList(argv[++arg]);
+		}
+		else if (option == "--samples" && hasValue) {
+			samples = atoi(argv[++arg]);
+		}
+		else if (option == "--min-time" && hasValue) {
+			minSeconds = atof(argv[++arg]);
+		}
+		else if (option == "--tile-size" && hasValue) {
+			tileSize = atoi(argv[++arg]);
+		}
+		else if (option == "--sparse-tile" && hasValue) {
+			sparseTile = atoi(argv[++arg]);
+		}
+		else {
+			cerr << "usage: " << argv[0] << " [--sizes 32,64,...] [--threads 1,2,...] [--samples n] [--min-time seconds] [--tile-size n] [--sparse-tile n] [--json]" << endl;
+			return 1;
+		}
+	}
+	if (samples < 2) {
+		samples = 2;
+	}
+	if (tileSize < 1) {
+		tileSize = cacheTileSize();
+	}
+	if (sparseTile < 4 || (sparseTile & (sparseTile - 1)) != 0) {
+		sparseTile = 16;
+	}
+
+	const float deltaT = 1 / 30.0;
+	const double sorOmega = 1.8;
+	AdvectKernel kernel = bestAdvectKernel();
+	vector<Row> rows;
+
+	for (int size : sizes) {
+		double cells = (double)size * size;
+		MacGrid grid(size, size, 0);
+		fillRandom(grid.horizVelocity, 1, 1.0f);
+		fillRandom(grid.vertVelocity, 2, 1.0f);
+		FieldGrid updatedHoriz(size+1, size, 0);
+		FieldGrid updatedVert(size, size+1, 0);
+		vector<float> rhs(size * size);
+		buildRHS(grid.horizVelocity, grid.vertVelocity, size, size, rhs);
+		float divergence = 0.0f;
+
+		for (size_t threadIndex = 0; threadIndex < threadCounts.size(); ++threadIndex) {
+			int threads = threadCounts[threadIndex];
+			ThreadPool pool(threads);
+
+			// Bytes per cell count each array a stage reads or writes once, as floats.
+			if (threadIndex == 0) {
+				rows.push_back({size, "gravity", 1, 8.0, timeStage(cells, samples, minSeconds, [&] {
+					addGravity(grid.vertVelocity, size, size, deltaT);
+				})});
+				rows.push_back({size, "build_rhs", 1, 12.0, timeStage(cells, samples, minSeconds, [&] {
+					buildRHS(grid.horizVelocity, grid.vertVelocity, size, size, rhs);
+				})});
+				rows.push_back({size, "project", 1, 12.0, timeStage(cells, samples, minSeconds, [&] {
+					project(grid.pressure, deltaT, size, size, rhs);
+				})});
+				rows.push_back({size, "apply_pressure", 1, 20.0, timeStage(cells, samples, minSeconds, [&] {
+					applyPressure(grid.pressure, grid.horizVelocity, grid.vertVelocity, deltaT, size, size);
+				})});
+
+				rows.push_back({size, "gravity_build_rhs", 1, 8.0 + 12.0, timeStage(cells, samples, minSeconds, [&] {
+					addGravity(grid.vertVelocity, size, size, deltaT);
+					buildRHS(grid.horizVelocity, grid.vertVelocity, size, size, rhs);
+				})});
+				rows.push_back({size, "gravity_build_rhs_tiled", 1, 16.0, timeStage(cells, samples, minSeconds, [&] {
+					addGravityBuildRHSTiled(grid.horizVelocity, grid.vertVelocity, size, size, deltaT, rhs, tileSize);
+				})});
+				rows.push_back({size, "apply_pressure_divergence", 1, 20.0 + 16.0, timeStage(cells, samples, minSeconds, [&] {
+					applyPressure(grid.pressure, grid.horizVelocity, grid.vertVelocity, deltaT, size, size);
+					divergence = maxDivergence(grid.horizVelocity, grid.vertVelocity, size, size);
+				})});
+				rows.push_back({size, "apply_pressure_tiled", 1, 20.0, timeStage(cells, samples, minSeconds, [&] {
+					applyPressureTiled(grid.pressure, grid.horizVelocity, grid.vertVelocity, deltaT, size, size, tileSize, &divergence);
+				})});
+
+				FrameWriter frameWriter;
+				frameWriter.open(BINARY_OUTPUT, size, size);
+				rows.push_back({size, "save_binary", 1, 16.0, timeStage(cells, samples, minSeconds, [&] {
+					frameWriter.writeFrame(grid.horizVelocity, grid.vertVelocity);
+				}, [&] {
+					frameWriter.open(BINARY_OUTPUT, size, size);
+				})});
+				frameWriter.close();
+
+				if (size <= TEXT_SAVE_MAX_SIZE) {
+					clearOutputFile(TEXT_OUTPUT, 1, size, size);
+					double header = fileSize(TEXT_OUTPUT);
+					saveVelocityField(grid.horizVelocity, grid.vertVelocity, size, size, TEXT_OUTPUT);
+					double textBytesPerCell = 8.0 + (fileSize(TEXT_OUTPUT) - header) / cells;
+					rows.push_back({size, "save_text", 1, textBytesPerCell, timeStage(cells, samples, minSeconds, [&] {
+						saveVelocityField(grid.horizVelocity, grid.vertVelocity, size, size, TEXT_OUTPUT);
+					}, [&] {
+						clearOutputFile(TEXT_OUTPUT, 1, size, size);
+					})});
+				}
+			}
+
+			rows.push_back({size, "rbsor_sweep", threads, 24.0, timeStage(cells, samples, minSeconds, [&] {
+				projectRedBlack(grid.pressure, deltaT, size, size, rhs, sorOmega, 1, pool);
+			})});
+			rows.push_back({size, "advect", threads, 16.0, timeStage(cells, samples, minSeconds, [&] {
+				advectSimd(grid.horizVelocity, grid.vertVelocity, updatedHoriz, updatedVert, size, size, deltaT, kernel, pool);
+			})});
+			vector<FieldGrid> scalars, updatedScalars(ADVECT_SCALARS, FieldGrid(size, size, 0));
+			for (int field = 0; field < ADVECT_SCALARS; ++field) {
+				scalars.push_back(FieldGrid(size, size, 0));
+				fillRandom(scalars[field], 7 + field, 1.0f);
+			}
+			ScalarBatch scalarBatch = {scalars.data(), updatedScalars.data(), ADVECT_SCALARS};
+			rows.push_back({size, "advect_scalars", threads, 16.0 + 8.0 * ADVECT_SCALARS, timeStage(cells, samples, minSeconds, [&] {
+				advectSimd(grid.horizVelocity, grid.vertVelocity, updatedHoriz, updatedVert, size, size, deltaT, scalarBatch, kernel, pool);
+			})});
+
+			// The gs step of the solver: one substep with the Gauss-Seidel sweep of project().
+			rows.push_back({size, "step", threads, 8.0 + 12.0 + 12.0 + 20.0 + 16.0, timeStage(cells, samples, minSeconds, [&] {
+				addGravity(grid.vertVelocity, size, size, deltaT);
+				buildRHS(grid.horizVelocity, grid.vertVelocity, size, size, rhs);
+				project(grid.pressure, deltaT, size, size, rhs);
+				applyPressure(grid.pressure, grid.horizVelocity, grid.vertVelocity, deltaT, size, size);
+				advectSimd(grid.horizVelocity, grid.vertVelocity, updatedHoriz, updatedVert, size, size, deltaT, kernel, pool);
+				grid.horizVelocity.swap(updatedHoriz);
+				grid.vertVelocity.swap(updatedVert);
+			})});
+			rows.push_back({size, "step_tiled", threads, 16.0 + 12.0 + 20.0 + 16.0, timeStage(cells, samples, minSeconds, [&] {
+				addGravityBuildRHSTiled(grid.horizVelocity, grid.vertVelocity, size, size, deltaT, rhs, tileSize);
+				project(grid.pressure, deltaT, size, size, rhs);
+				applyPressureTiled(grid.pressure, grid.horizVelocity, grid.vertVelocity, deltaT, size, size, tileSize, 0);
+				advectSimd(grid.horizVelocity, grid.vertVelocity, updatedHoriz, updatedVert, size, size, deltaT, kernel, pool);
+				grid.horizVelocity.swap(updatedHoriz);
+				grid.vertVelocity.swap(updatedVert);
+			})});
+
+			// The same step on 16-bit storage, restarted every batch from fresh random faces:
+			// the shared grid has run thousands of steps and may no longer be finite in float16
+			MacGrid start(size, size, 0);
+			fillRandom(start.horizVelocity, 5, 1.0f);
+			fillRandom(start.vertVelocity, 6, 1.0f);
+			for (StoragePrecision precision : {STORAGE_FLOAT16, STORAGE_BFLOAT16}) {
+				PackedMacGrid packed(size, size, precision, 0.0f);
+				rows.push_back({size, string("step_") + storagePrecisionName(precision), threads, (8.0 + 12.0 + 12.0 + 20.0 + 16.0) / 2,
+					timeStage(cells, samples, minSeconds, [&] {
+						packed.addGravityBuildRHS(deltaT);
+						packed.project(deltaT);
+						float maxFaceVelocity = packed.applyPressure(deltaT);
+						packed.advect(deltaT, maxFaceVelocity, kernel, pool);
+					}, [&] {
+						packed.load(start.horizVelocity, start.vertVelocity, start.pressure);
+					})});
+			}
+
+			for (int percent : SPARSE_PERCENTS) {
+				// Random faces in the first columns, still water elsewhere
+				int movingColumns = (size * percent + 99) / 100;
+				MacGrid band(size, size, 0);
+				fillRandom(band.horizVelocity, 3, 1.0f);
+				fillRandom(band.vertVelocity, 4, 1.0f);
+				for (int x = movingColumns; x <= size; ++x) {
+					for (int y = 0; y < size; ++y) {
+						band.horizVelocity(x, y) = 0.0f;
+						if (x < size) {
+							band.vertVelocity(x, y) = 0.0f;
+						}
+					}
+					if (x < size) {
+						band.vertVelocity(x, size) = 0.0f;
+					}
+				}
+				SparseGrid sparse(size, size, sparseTile);
+				rows.push_back({size, "step_sparse_" + to_string(percent), threads, (8.0 + 12.0 + 12.0 + 20.0 + 16.0) * percent / 100,
+					timeStage(cells, samples, minSeconds, [&] {
+						sparse.addGravityBuildRHS(deltaT);
+						sparse.project(deltaT);
+						float maxFaceVelocity = sparse.applyPressure(deltaT);
+						sparse.advect(deltaT, maxFaceVelocity, kernel, pool);
+					}, [&] {
+						sparse.load(band.horizVelocity, band.vertVelocity, band.pressure, 0.0f);
+					})});
+			}
+		}
+	}
+	remove(TEXT_OUTPUT);
+	remove(BINARY_OUTPUT);
+
+	if (json) {
+		printJson(rows, samples, minSeconds, tileSize);
+	}
+	else {
+		printCsv(rows);
+	}
+}
@@ -0,0 +1,343 @@
+#include "checkpoint.h"
+#include "frame_io.h"
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+namespace {
+
+const char CHECKPOINT_MAGIC[4] = {'F', 'L', 'C', 'K'};
+const uint32_t CHECKPOINT_VERSION = 2;
+
+/*
+	Fields are little-endian, in the order put below; strings are a u32 length then the bytes,
+	grids their interior rows of float32.
+*/
+void putU32(vector<unsigned char> &out, uint32_t value) {
+	for (int byte = 0; byte < 4; ++byte) {
+		out.push_back((value >> (8 * byte)) & 0xff);
+	}
+}
+
+void putU64(vector<unsigned char> &out, uint64_t value) {
+	for (int byte = 0; byte < 8; ++byte) {
+		out.push_back((value >> (8 * byte)) & 0xff);
+	}
+}
+
+void putFloat(vector<unsigned char> &out, float value) {
+	uint32_t bits;
+	memcpy(&bits, &value, 4);
+	putU32(out, bits);
+}
+
+void putDouble(vector<unsigned char> &out, double value) {
+	uint64_t bits;
+	memcpy(&bits, &value, 8);
+	putU64(out, bits);
+}
+
+void putString(vector<unsigned char> &out, const string &value) {
+	putU32(out, value.size());
+	out.insert(out.end(), value.begin(), value.end());
+}
+
+void putGrid(vector<unsigned char> &out, const FieldGrid &grid) {
+	for (int i = 0; i < grid.rows(); ++i) {
+		const float* row = grid.row(i);
+		for (int j = 0; j < grid.cols(); ++j) {
+			putFloat(out, row[j]);
+		}
+	}
+}
+
+// Reads fields back in order; any read past the end clears ok and returns zeros.
+struct Cursor {
+	const unsigned char* at;
+	const unsigned char* end;
+	bool ok;
+
+	bool take(size_t size) {
+		ok = ok && (size_t)(end - at) >= size;
+		return ok;
+	}
+
+	uint32_t u32() {
+		uint32_t value = 0;
+		if (take(4)) {
+			for (int byte = 0; byte < 4; ++byte) {
+				value |= (uint32_t)at[byte] << (8 * byte);
+			}
+			at += 4;
+		}
+		return value;
+	}
+
+	uint64_t u64() {
+		uint64_t value = 0;
+		if (take(8)) {
+			for (int byte = 0; byte < 8; ++byte) {
+				value |= (uint64_t)at[byte] << (8 * byte);
+			}
+			at += 8;
+		}
+		return value;
+	}
+
+	float f32() {
+		uint32_t bits = u32();
+		float value;
+		memcpy(&value, &bits, 4);
+		return value;
+	}
+
+	double f64() {
+		uint64_t bits = u64();
+		double value;
+		memcpy(&value, &bits, 8);
+		return value;
+	}
+
+	string text() {
+		uint32_t size = u32();
+		if (!take(size)) {
+			return "";
+		}
+		string value((const char*)at, size);
+		at += size;
+		return value;
+	}
+
+	void grid(FieldGrid &grid) {
+		if (!take((size_t)grid.rows() * grid.cols() * 4)) {
+			return;
+		}
+		for (int i = 0; i < grid.rows(); ++i) {
+			float* row = grid.row(i);
+			for (int j = 0; j < grid.cols(); ++j) {
+				row[j] = f32();
+			}
+		}
+	}
+};
+
+}
+
+
+/*
+	config: SolverConfig; the run being checkpointed
+*/
+Checkpointer::Checkpointer(const SolverConfig &config)
+	: config(config), inFlight(false), numWritten(0) {
+	pending.horizVelocity = FieldGrid(config.xDim + 1, config.yDim, 0.0f);
+	pending.vertVelocity = FieldGrid(config.xDim, config.yDim + 1, 0.0f);
+	pending.pressure = FieldGrid(config.yDim, config.xDim, 0.0f);
+}
+
+/*
+	horizVelocityGrid: FieldGrid; holds horizontal velocity components at 1/2 indices
+	vertVelocityGrid: FieldGrid; holds vertical velocity components at 1/2 indices
+	pressureGrid: FieldGrid; holds pressure values at integer indices
+	nextFrame: int; frame about to be simulated from these grids
+	maxFaceVelocity: float; largest face velocity applyPressure reported last
+
+	Return type: CheckpointState&
+*/
+CheckpointState& Checkpointer::capture(const FieldGrid &horizVelocityGrid, const FieldGrid &vertVelocityGrid, const FieldGrid &pressureGrid,
+	int nextFrame, float maxFaceVelocity) {
+	unique_lock<mutex> guard(lock);
+	written.wait(guard, [this] { return !inFlight; });
+	inFlight = true;
+	guard.unlock();
+
+	// Same shapes, so the copies reuse the preallocated buffers.
+	pending.horizVelocity = horizVelocityGrid;
+	pending.vertVelocity = vertVelocityGrid;
+	pending.pressure = pressureGrid;
+	pending.nextFrame = nextFrame;
+	pending.maxFaceVelocity = maxFaceVelocity;
+	pending.outputSize = 0;
+	pending.frameOffsets.clear();
+	pending.frameSizes.clear();
+	pending.encoderFrames = 0;
+	pending.encoderState.clear();
+	return pending;
+}
+
+/*
+	fileName: string; checkpoint to replace
+
+	A zero outputSize means the frame output could not be synced, so nothing is written.
+	Return type: bool
+*/
+bool Checkpointer::write(string fileName) {
+	bytes.assign(CHECKPOINT_MAGIC, CHECKPOINT_MAGIC + 4);
+	putU32(bytes, CHECKPOINT_VERSION);
+	putU32(bytes, config.xDim);
+	putU32(bytes, config.yDim);
+	putU32(bytes, config.numFrames);
+	putDouble(bytes, config.deltaT);
+	putDouble(bytes, config.cfl);
+	putDouble(bytes, config.timePerFrame);
+	putString(bytes, config.pressureSolver);
+	putDouble(bytes, config.pressureTolerance);
+	putU32(bytes, config.maxPressureIterations);
+	putDouble(bytes, config.sorOmega);
+	putU32(bytes, config.redBlackSweeps);
+	putString(bytes, config.advectScheme);
+	putString(bytes, config.outputFormat);
+	putString(bytes, config.outputFile);
+	putDouble(bytes, config.outputErrorBound);
+	putU32(bytes, config.keyframeInterval);
+
+	putU32(bytes, pending.nextFrame);
+	putFloat(bytes, pending.maxFaceVelocity);
+	putU64(bytes, pending.outputSize);
+	putU32(bytes, pending.frameOffsets.size());
+	for (size_t frame = 0; frame < pending.frameOffsets.size(); ++frame) {
+		putU64(bytes, pending.frameOffsets[frame]);
+		putU64(bytes, pending.frameSizes[frame]);
+	}
+	putU32(bytes, pending.encoderFrames);
+	putU32(bytes, pending.encoderState.size());
+	for (size_t value = 0; value < pending.encoderState.size(); ++value) {
+		putU64(bytes, pending.encoderState[value]);
+	}
+	putGrid(bytes, pending.horizVelocity);
+	putGrid(bytes, pending.vertVelocity);
+	putGrid(bytes, pending.pressure);
+
+	/*
+	Replace the old checkpoint only once the new one is on disk, then sync the directory so the rename is too.
+	*/
+	string tempName = fileName + ".tmp";
+	ofstream file(tempName, ios::out | ios::binary | ios::trunc);
+	file.write((const char*)bytes.data(), bytes.size());
+	file.close();
+	uint64_t size;
+	bool valid = pending.outputSize > 0 && file && syncFile(tempName, size) && rename(tempName.c_str(), fileName.c_str()) == 0;
+	if (valid) {
+		size_t slash = fileName.rfind('/');
+		syncFile(slash == string::npos ? "." : fileName.substr(0, slash + 1), size);
+	}
+	else {
+		cerr << "could not write checkpoint " << fileName << endl;
+	}
+
+	lock_guard<mutex> guard(lock);
+	inFlight = false;
+	numWritten += valid;
+	written.notify_all();
+	return valid;
+}
+
+/*
+	Return type: int
+*/
+int Checkpointer::checkpointsWritten() {
+	lock_guard<mutex> guard(lock);
+	return numWritten;
+}
+
+
+/*
+	fileName: string; checkpoint written by Checkpointer
+	config: SolverConfig by reference; receives the options of the checkpointed run
+	state: CheckpointState by reference; receives the grids and output state
+
+	Altered by reference: config, state
+	Return type: bool
+*/
+bool readCheckpoint(string fileName, SolverConfig &config, CheckpointState &state) {
+	int descriptor = ::open(fileName.c_str(), O_RDONLY);
+	if (descriptor < 0) {
+		cerr << "could not open checkpoint " << fileName << endl;
+		return false;
+	}
+	struct stat status;
+	if (fstat(descriptor, &status) != 0 || status.st_size < 8) {
+		::close(descriptor);
+		cerr << fileName << " is not a checkpoint" << endl;
+		return false;
+	}
+	size_t mappingSize = status.st_size;
+	void* mapped = mmap(0, mappingSize, PROT_READ, MAP_SHARED, descriptor, 0);
+	::close(descriptor);
+	if (mapped == MAP_FAILED) {
+		cerr << "could not map checkpoint " << fileName << endl;
+		return false;
+	}
+
+	Cursor in = {(const unsigned char*)mapped, (const unsigned char*)mapped + mappingSize, true};
+	bool magic = memcmp(in.at, CHECKPOINT_MAGIC, 4) == 0;
+	in.at += 4;
+	if (!magic || in.u32() != CHECKPOINT_VERSION) {
+		munmap(mapped, mappingSize);
+		cerr << fileName << " is not a version " << CHECKPOINT_VERSION << " checkpoint" << endl;
+		return false;
+	}
+
+	SolverConfig saved = config;
+	saved.xDim = in.u32();
+	saved.yDim = in.u32();
+	saved.numFrames = in.u32();
+	saved.deltaT = in.f64();
+	saved.cfl = in.f64();
+	saved.timePerFrame = in.f64();
+	saved.pressureSolver = in.text();
+	saved.pressureTolerance = in.f64();
+	saved.maxPressureIterations = in.u32();
+	saved.sorOmega = in.f64();
+	saved.redBlackSweeps = in.u32();
+	saved.advectScheme = in.text();
+	saved.outputFormat = in.text();
+	saved.outputFile = in.text();
+	saved.outputErrorBound = in.f64();
+	saved.keyframeInterval = in.u32();
+
+	state.nextFrame = in.u32();
+	state.maxFaceVelocity = in.f32();
+	state.outputSize = in.u64();
+	uint32_t frameCount = in.u32();
+	if (in.take(16 * (size_t)frameCount)) {
+		state.frameOffsets.resize(frameCount);
+		state.frameSizes.resize(frameCount);
+		for (uint32_t frame = 0; frame < frameCount; ++frame) {
+			state.frameOffsets[frame] = in.u64();
+			state.frameSizes[frame] = in.u64();
+		}
+	}
+	state.encoderFrames = in.u32();
+	uint32_t encoderValues = in.u32();
+	if (in.take(8 * (size_t)encoderValues)) {
+		state.encoderState.resize(encoderValues);
+		for (uint32_t value = 0; value < encoderValues; ++value) {
+			state.encoderState[value] = in.u64();
+		}
+	}
+
+	// Sizes are checked before allocating the grids, so a corrupt header cannot ask for gigabytes.
+	bool sized = in.ok && saved.xDim >= 1 && saved.yDim >= 1
+		&& (uint64_t)(in.end - in.at) == 4 * (3 * (uint64_t)saved.xDim * saved.yDim + saved.xDim + saved.yDim);
+	if (sized) {
+		state.horizVelocity = FieldGrid(saved.xDim + 1, saved.yDim, 0.0f);
+		state.vertVelocity = FieldGrid(saved.xDim, saved.yDim + 1, 0.0f);
+		state.pressure = FieldGrid(saved.yDim, saved.xDim, 0.0f);
+		in.grid(state.horizVelocity);
+		in.grid(state.vertVelocity);
+		in.grid(state.pressure);
+	}
+	munmap(mapped, mappingSize);
+	if (!sized || !in.ok || state.nextFrame > saved.numFrames) {
+		cerr << fileName << " is truncated or corrupt" << endl;
+		return false;
+	}
+	config = saved;
+	return true;
+}
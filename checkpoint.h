@@ -0,0 +1,111 @@
+#ifndef __CHECKPOINT__
+#define __CHECKPOINT__
+
+
+#include "mac_grid.h"
+#include "config.h"
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+using namespace std;
+
+
+/*
+	Everything a run needs to carry on from the start of a frame exactly as if it had never stopped.
+
+	nextFrame: int; first frame the resumed run simulates; frames before it are already in the output
+	maxFaceVelocity: float; largest face velocity applyPressure reported last, the next substep's cfl input
+	outputSize: uint64_t; bytes of the output file holding frames 0 to nextFrame-1, synced to disk;
+		0 if they could not be, and the checkpoint is not written
+	frameOffsets: vector of uint64_t; binary and compressed formats, start of each of those frames
+	frameSizes: vector of uint64_t; binary and compressed formats, size of each of those frames
+	encoderFrames: int; compressed format, FrameEncoder::framesEncoded()
+	encoderState: vector of int64_t; compressed format, FrameEncoder::lastQuantized()
+	horizVelocity, vertVelocity, pressure: FieldGrid; the MacGrid at the start of nextFrame
+*/
+struct CheckpointState {
+	int nextFrame;
+	float maxFaceVelocity;
+	uint64_t outputSize;
+	vector<uint64_t> frameOffsets;
+	vector<uint64_t> frameSizes;
+	int encoderFrames;
+	vector<int64_t> encoderState;
+	FieldGrid horizVelocity;
+	FieldGrid vertVelocity;
+	FieldGrid pressure;
+};
+
+
+/*
+	Writes checkpoints without holding up the simulation.
+
+	capture() snapshots the grids on the solver thread, which is all the solver waits for.
+	write() then runs wherever the caller likes, normally as an AsyncFrameWriter task so it
+	follows the frames already queued and overlaps the next substeps.
+	Only one checkpoint is in flight: capture() blocks until the previous write() is done.
+
+	The file is written next to its final name, synced and renamed over it, so a crash at any
+	point leaves either the old checkpoint or the new one, never a partial file.
+	The frame output it refers to is synced before the rename.
+*/
+class Checkpointer {
+public:
+	/*
+		config: SolverConfig; the run being checkpointed, stored so a resume needs no other options
+	*/
+	explicit Checkpointer(const SolverConfig &config);
+
+	/*
+		horizVelocityGrid: FieldGrid; holds horizontal velocity components at 1/2 indices
+		vertVelocityGrid: FieldGrid; holds vertical velocity components at 1/2 indices
+		pressureGrid: FieldGrid; holds pressure values at integer indices
+		nextFrame: int; frame about to be simulated from these grids
+		maxFaceVelocity: float; largest face velocity applyPressure reported last
+
+		Copies the grids into the pending checkpoint.
+		Return type: CheckpointState&; the pending checkpoint, whose output fields the caller fills before write()
+	*/
+	CheckpointState& capture(const FieldGrid &horizVelocityGrid, const FieldGrid &vertVelocityGrid, const FieldGrid &pressureGrid,
+		int nextFrame, float maxFaceVelocity);
+
+	/*
+		fileName: string; checkpoint to replace
+
+		Writes the pending checkpoint and lets the next capture() proceed.
+		Return type: bool; false, with the reason on cerr, if the file could not be written
+	*/
+	bool write(string fileName);
+
+	/*
+		Return type: int; checkpoints written so far
+	*/
+	int checkpointsWritten();
+
+private:
+	SolverConfig config;
+	CheckpointState pending;
+	vector<unsigned char> bytes;
+	mutex lock;
+	condition_variable written;
+	bool inFlight;
+	int numWritten;
+};
+
+
+/*
+	fileName: string; checkpoint written by Checkpointer
+	config: SolverConfig by reference; receives the options of the checkpointed run
+	state: CheckpointState by reference; receives the grids and output state
+
+	Only the options that change results are replaced; threads, queueSize and the checkpoint
+	options keep the values they already have.
+
+	Altered by reference: config, state
+	Return type: bool; false, with the reason on cerr, if the file is missing, truncated or not a checkpoint
+*/
+bool readCheckpoint(string fileName, SolverConfig &config, CheckpointState &state);
+
+#endif
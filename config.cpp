@@ -0,0 +1,420 @@
+#include "config.h"
+#include <cerrno>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <thread>
+
+
+namespace {
+
+bool parseInt(const string &key, const string &value, int &out) {
+	char* end = 0;
+	errno = 0;
+	long parsed = strtol(value.c_str(), &end, 10);
+	if (value.empty() || *end != '\0' || errno != 0 || parsed < -2147483647L || parsed > 2147483647L) {
+		cerr << key << ": expected an integer, got \"" << value << "\"" << endl;
+		return false;
+	}
+	out = (int)parsed;
+	return true;
+}
+
+bool parseDouble(const string &key, const string &value, double &out) {
+	char* end = 0;
+	errno = 0;
+	double parsed = strtod(value.c_str(), &end);
+	if (value.empty() || *end != '\0' || errno != 0) {
+		cerr << key << ": expected a number, got \"" << value << "\"" << endl;
+		return false;
+	}
+	out = parsed;
+	return true;
+}
+
+string trim(const string &text) {
+	size_t first = text.find_first_not_of(" \t\r\n");
+	if (first == string::npos) {
+		return "";
+	}
+	size_t last = text.find_last_not_of(" \t\r\n");
+	return text.substr(first, last - first + 1);
+}
+
+}
+
+
+SolverConfig::SolverConfig()
+	: xDim(32), yDim(32), numFrames(500), deltaT(1 / 30.0), cfl(0.0), timePerFrame(1 / 15.0),
+	  pressureSolver("pcg"), pressureTolerance(1e-5), maxPressureIterations(200), sorOmega(1.8), redBlackSweeps(10),
+	  numThreads(thread::hardware_concurrency()), tileSize(0), sparseTile(0), sparseThreshold(1e-3), storagePrecision("float32"),
+	  advectScheme("semilagrangian"),
+	  outputFormat("binary"), outputFile(""), outputErrorBound(1e-4), keyframeInterval(30), outputQueueSize(4),
+	  initialHorizFile("initialHorizVelocities.txt"), initialVertFile("initialVertVelocities.txt"),
+	  initialPressureFile("initialPressure.txt"),
+	  checkpointInterval(0), checkpointFile("checkpoint.bin"), resume(false) {
+	if (numThreads < 1) {
+		numThreads = 1;
+	}
+}
+
+/*
+	config: SolverConfig; receives the option
+	key: string; one of the keys listed at SolverConfig
+	value: string; text of the value
+
+	Return type: bool
+*/
+bool setOption(SolverConfig &config, const string &key, const string &value) {
+	if (key == "xDim") {
+		return parseInt(key, value, config.xDim);
+	}
+	if (key == "yDim") {
+		return parseInt(key, value, config.yDim);
+	}
+	if (key == "frames") {
+		return parseInt(key, value, config.numFrames);
+	}
+	if (key == "deltaT") {
+		return parseDouble(key, value, config.deltaT);
+	}
+	if (key == "cfl") {
+		return parseDouble(key, value, config.cfl);
+	}
+	if (key == "timePerFrame") {
+		return parseDouble(key, value, config.timePerFrame);
+	}
+	if (key == "solver") {
+		config.pressureSolver = value;
+		return true;
+	}
+	if (key == "tolerance") {
+		return parseDouble(key, value, config.pressureTolerance);
+	}
+	if (key == "maxIterations") {
+		return parseInt(key, value, config.maxPressureIterations);
+	}
+	if (key == "omega") {
+		return parseDouble(key, value, config.sorOmega);
+	}
+	if (key == "sweeps") {
+		return parseInt(key, value, config.redBlackSweeps);
+	}
+	if (key == "threads") {
+		return parseInt(key, value, config.numThreads);
+	}
+	if (key == "tileSize") {
+		if (value == "auto") {
+			config.tileSize = -1;
+			return true;
+		}
+		return parseInt(key, value, config.tileSize);
+	}
+	if (key == "sparseTile") {
+		return parseInt(key, value, config.sparseTile);
+	}
+	if (key == "sparseThreshold") {
+		return parseDouble(key, value, config.sparseThreshold);
+	}
+	if (key == "storage") {
+		config.storagePrecision = value;
+		return true;
+	}
+	if (key == "advection") {
+		config.advectScheme = value;
+		return true;
+	}
+	if (key == "scalars") {
+		config.scalarFiles = value;
+		return true;
+	}
+	if (key == "format") {
+		config.outputFormat = value;
+		return true;
+	}
+	if (key == "output") {
+		config.outputFile = value;
+		return true;
+	}
+	if (key == "errorBound") {
+		return parseDouble(key, value, config.outputErrorBound);
+	}
+	if (key == "keyframeInterval") {
+		return parseInt(key, value, config.keyframeInterval);
+	}
+	if (key == "queueSize") {
+		return parseInt(key, value, config.outputQueueSize);
+	}
+	if (key == "initialHoriz") {
+		config.initialHorizFile = value;
+		return true;
+	}
+	if (key == "initialVert") {
+		config.initialVertFile = value;
+		return true;
+	}
+	if (key == "initialPressure") {
+		config.initialPressureFile = value;
+		return true;
+	}
+	if (key == "checkpointInterval") {
+		return parseInt(key, value, config.checkpointInterval);
+	}
+	if (key == "checkpoint") {
+		config.checkpointFile = value;
+		return true;
+	}
+	if (key == "resume") {
+		int resume;
+		if (!parseInt(key, value, resume)) {
+			return false;
+		}
+		config.resume = resume != 0;
+		return true;
+	}
+	cerr << "unknown option " << key << endl;
+	return false;
+}
+
+/*
+	config: SolverConfig; receives the options
+	fileName: string; config file
+
+	Altered by reference: config
+	Return type: bool
+*/
+bool loadConfig(SolverConfig &config, string fileName) {
+	ifstream inputFile(fileName);
+	if (!inputFile) {
+		cerr << "could not open config file " << fileName << endl;
+		return false;
+	}
+	string line;
+	int lineNumber = 0;
+	while (getline(inputFile, line)) {
+		lineNumber++;
+		line = trim(line.substr(0, line.find('#')));
+		if (line.empty()) {
+			continue;
+		}
+		size_t equals = line.find('=');
+		if (equals == string::npos) {
+			cerr << fileName << ":" << lineNumber << ": expected key = value" << endl;
+			return false;
+		}
+		if (!setOption(config, trim(line.substr(0, equals)), trim(line.substr(equals + 1)))) {
+			cerr << fileName << ":" << lineNumber << ": invalid line" << endl;
+			return false;
+		}
+	}
+	return true;
+}
+
+/*
+	config: SolverConfig; receives the options
+	argc: int; argument count from main
+	argv: char**; arguments from main
+
+	Altered by reference: config
+	Return type: bool
+*/
+bool parseArguments(SolverConfig &config, int argc, char* argv[]) {
+	int positional = 0;
+	for (int arg = 1; arg < argc; ++arg) {
+		string argument = argv[arg];
+		if (argument == "--help" || argument == "-h") {
+			return false;
+		}
+		if (argument.compare(0, 2, "--") == 0) {
+			string key = argument.substr(2);
+			string value;
+			size_t equals = key.find('=');
+			if (equals != string::npos) {
+				value = key.substr(equals + 1);
+				key = key.substr(0, equals);
+			}
+			else if (key == "resume") {
+				value = "1";
+			}
+			else if (arg + 1 < argc) {
+				value = argv[++arg];
+			}
+			else {
+				cerr << "missing value for --" << key << endl;
+				return false;
+			}
+
+			bool valid = key == "config" ? loadConfig(config, value) : setOption(config, key, value);
+			if (!valid) {
+				return false;
+			}
+			continue;
+		}
+
+		// The original positional form: [gs|pcg|mg|rbsor] [numThreads] [binary|compressed|text]
+		const char* positionalKeys[] = {"solver", "threads", "format"};
+		if (positional >= 3) {
+			cerr << "unexpected argument " << argument << endl;
+			return false;
+		}
+		if (!setOption(config, positionalKeys[positional++], argument)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/*
+	config: SolverConfig
+
+	Return type: vector of string; the files of scalarFiles in order, surrounding spaces removed
+*/
+vector<string> scalarFileNames(const SolverConfig &config) {
+	vector<string> fileNames;
+	if (trim(config.scalarFiles).empty()) {
+		return fileNames;
+	}
+	size_t start = 0;
+	while (true) {
+		size_t comma = config.scalarFiles.find(',', start);
+		fileNames.push_back(trim(config.scalarFiles.substr(start, comma == string::npos ? string::npos : comma - start)));
+		if (comma == string::npos) {
+			return fileNames;
+		}
+		start = comma + 1;
+	}
+}
+
+/*
+	config: SolverConfig; options to check
+
+	Return type: bool
+*/
+bool validateConfig(const SolverConfig &config) {
+	bool valid = true;
+	if (config.xDim < 1 || config.yDim < 1) {
+		cerr << "xDim and yDim must be at least 1" << endl;
+		valid = false;
+	}
+	if (config.numFrames < 0) {
+		cerr << "frames must not be negative" << endl;
+		valid = false;
+	}
+	if (!(config.deltaT > 0) || !(config.timePerFrame > 0)) {
+		cerr << "deltaT and timePerFrame must be positive" << endl;
+		valid = false;
+	}
+	if (!(config.cfl >= 0)) {
+		cerr << "cfl must not be negative" << endl;
+		valid = false;
+	}
+	if (config.pressureSolver != "gs" && config.pressureSolver != "pcg" && config.pressureSolver != "mg" && config.pressureSolver != "rbsor") {
+		cerr << "solver must be gs, pcg, mg or rbsor, not " << config.pressureSolver << endl;
+		valid = false;
+	}
+	if (!(config.pressureTolerance > 0) || config.maxPressureIterations < 1) {
+		cerr << "tolerance must be positive and maxIterations at least 1" << endl;
+		valid = false;
+	}
+	if (!(config.sorOmega > 0 && config.sorOmega < 2) || config.redBlackSweeps < 1) {
+		cerr << "omega must be between 0 and 2 and sweeps at least 1" << endl;
+		valid = false;
+	}
+	if (config.numThreads < 1) {
+		cerr << "threads must be at least 1" << endl;
+		valid = false;
+	}
+	if (config.tileSize < -1) {
+		cerr << "tileSize must be auto, 0 or positive" << endl;
+		valid = false;
+	}
+	if (config.sparseTile != 0 && (config.sparseTile < 4 || config.sparseTile > 256 || (config.sparseTile & (config.sparseTile - 1)) != 0)) {
+		cerr << "sparseTile must be 0 or a power of two from 4 to 256" << endl;
+		valid = false;
+	}
+	if (config.sparseTile != 0 && config.pressureSolver != "gs" && config.pressureSolver != "rbsor") {
+		cerr << "sparseTile needs the gs or rbsor solver" << endl;
+		valid = false;
+	}
+	if (config.sparseTile != 0 && (config.tileSize != 0 || config.checkpointInterval > 0 || config.resume)) {
+		cerr << "sparseTile cannot be combined with tileSize, checkpoints or resume" << endl;
+		valid = false;
+	}
+	if (config.storagePrecision != "float32" && config.storagePrecision != "float16" && config.storagePrecision != "bfloat16") {
+		cerr << "storage must be float32, float16 or bfloat16, not " << config.storagePrecision << endl;
+		valid = false;
+	}
+	else if (config.storagePrecision != "float32" && (config.tileSize != 0 || config.sparseTile != 0 || config.checkpointInterval > 0 || config.resume)) {
+		cerr << "16-bit storage cannot be combined with tileSize, sparseTile, checkpoints or resume" << endl;
+		valid = false;
+	}
+	if (config.advectScheme != "semilagrangian" && config.advectScheme != "maccormack" && config.advectScheme != "bfecc") {
+		cerr << "advection must be semilagrangian, maccormack or bfecc, not " << config.advectScheme << endl;
+		valid = false;
+	}
+	else if (config.advectScheme != "semilagrangian" && (config.sparseTile != 0 || config.storagePrecision != "float32")) {
+		cerr << "maccormack and bfecc advection cannot be combined with sparseTile or 16-bit storage" << endl;
+		valid = false;
+	}
+	vector<string> scalarFiles = scalarFileNames(config);
+	for (const string &scalarFile : scalarFiles) {
+		if (scalarFile.empty()) {
+			cerr << "scalars must be a comma separated list of files, not \"" << config.scalarFiles << "\"" << endl;
+			valid = false;
+			break;
+		}
+	}
+	if (!scalarFiles.empty() && (config.sparseTile != 0 || config.storagePrecision != "float32" || config.checkpointInterval > 0 || config.resume)) {
+		cerr << "scalars cannot be combined with sparseTile, 16-bit storage, checkpoints or resume" << endl;
+		valid = false;
+	}
+	if (config.outputFormat != "binary" && config.outputFormat != "compressed" && config.outputFormat != "text") {
+		cerr << "format must be binary, compressed or text, not " << config.outputFormat << endl;
+		valid = false;
+	}
+	if (!(config.outputErrorBound > 0) || config.keyframeInterval < 1 || config.outputQueueSize < 1) {
+		cerr << "errorBound must be positive, keyframeInterval and queueSize at least 1" << endl;
+		valid = false;
+	}
+	if (config.checkpointInterval < 0) {
+		cerr << "checkpointInterval must not be negative" << endl;
+		valid = false;
+	}
+	return valid;
+}
+
+/*
+	program: const char*; name the solver was started as
+
+	Return type: void
+*/
+void printUsage(const char* program) {
+	cerr << "usage: " << program << " [gs|pcg|mg|rbsor] [numThreads] [binary|compressed|text] [--config file] [--key value]..." << endl
+		<< "keys:" << endl
+		<< "  xDim, yDim              grid size in cells" << endl
+		<< "  frames                  frames to simulate" << endl
+		<< "  deltaT                  substep length, or the longest substep with cfl" << endl
+		<< "  cfl                     largest cells moved per substep, 0 for fixed deltaT" << endl
+		<< "  timePerFrame            simulated time between frames" << endl
+		<< "  solver                  gs, pcg, mg or rbsor" << endl
+		<< "  tolerance               pcg/mg relative residual to stop at" << endl
+		<< "  maxIterations           pcg iterations or mg V-cycles per solve" << endl
+		<< "  omega, sweeps           rbsor relaxation and sweeps per substep" << endl
+		<< "  threads                 worker threads, including the main thread" << endl
+		<< "  tileSize                fused step kernel block edge, auto, or 0 for whole-grid passes" << endl
+		<< "  sparseTile              sparse tile edge, a power of two from 4 to 256, or 0 for a dense grid" << endl
+		<< "  sparseThreshold         face velocity below which a sparse tile may be freed" << endl
+		<< "  storage                 float32, float16 or bfloat16 field storage" << endl
+		<< "  advection               semilagrangian, maccormack or bfecc" << endl
+		<< "  scalars                 comma separated initial files of passive scalars carried by the flow" << endl
+		<< "  format                  binary, compressed or text" << endl
+		<< "  output                  frame file to write" << endl
+		<< "  errorBound              compressed format error bound" << endl
+		<< "  keyframeInterval        compressed format keyframe spacing" << endl
+		<< "  queueSize               frames buffered for the writer thread" << endl
+		<< "  initialHoriz, initialVert, initialPressure" << endl
+		<< "                          initial condition files, text or binary" << endl
+		<< "  checkpointInterval      frames between checkpoints, 0 for none" << endl
+		<< "  checkpoint              checkpoint file to write or resume from" << endl
+		<< "  resume                  1 (or --resume alone) to continue the run saved in checkpoint" << endl;
+}
@@ -0,0 +1,158 @@
+#ifndef __CONFIG__
+#define __CONFIG__
+
+
+#include <string>
+#include <vector>
+using namespace std;
+
+
+/*
+	Everything about a run that used to be hard-coded in solver.cpp.
+	Each field is set by the option of the same key, in a config file or on the command line.
+
+	key               field                  default
+	xDim, yDim        xDim, yDim             32, 32
+	frames            numFrames              500
+	deltaT            deltaT                 1/30; substep length, the longest substep when cfl is set
+	cfl               cfl                    0; if > 0, substeps are shortened so no face velocity
+	                                            carries anything further than cfl cells in one
+	timePerFrame      timePerFrame           1/15; simulated time between saved frames
+	solver            pressureSolver         pcg; gs, pcg, mg or rbsor
+	tolerance         pressureTolerance      1e-5; pcg and mg stop at max|residual| <= tolerance*max|rhs|
+	maxIterations     maxPressureIterations  200; pcg iterations or mg V-cycles
+	omega             sorOmega               1.8; rbsor relaxation
+	sweeps            redBlackSweeps         10; rbsor sweeps per substep
+	threads           numThreads             hardware concurrency
+	tileSize          tileSize               0; 0 runs each step kernel over the whole grid, otherwise gravity
+	                                            with the rhs and the pressure update run fused over
+	                                            blocks of this edge; auto (-1) sizes them to the L2 cache
+	sparseTile        sparseTile             0; 0 stores the whole grid, otherwise a power of two from 4 to
+	                                            256: the grid is kept in tiles of this edge, allocated only
+	                                            where the flow moves (gs and rbsor only, see sparse_grid.h)
+	sparseThreshold   sparseThreshold        1e-3; a sparse tile is freed once no tile near it has a face
+	                                            faster than this; negative keeps every tile
+	storage           storagePrecision       float32; float16 or bfloat16 keep the velocities and the
+	                                            pressure in 16 bits between stages (see packed_grid.h)
+	advection         advectScheme           semilagrangian; maccormack or bfecc for the second order
+	                                            schemes of advect_maccormack.h
+	scalars           scalarFiles            none; comma separated initial condition files of passive
+	                                            scalars (dye, temperature), xDim by yDim each, carried by
+	                                            the flow and written after u and v in every frame
+	format            outputFormat           binary; binary, compressed or text
+	output            outputFile             outputVelocities.bin, or .txt for text
+	errorBound        outputErrorBound       1e-4; compressed format error bound
+	keyframeInterval  keyframeInterval       30; compressed format keyframe spacing
+	queueSize         outputQueueSize        4; frames buffered for the writer thread
+	initialHoriz      initialHorizFile       initialHorizVelocities.txt
+	initialVert       initialVertFile        initialVertVelocities.txt
+	initialPressure   initialPressureFile    initialPressure.txt
+	checkpointInterval checkpointInterval    0; frames between checkpoints, 0 for none
+	checkpoint        checkpointFile         checkpoint.bin
+	resume            resume                 0; 1 to continue from checkpointFile, with the
+	                                            options it was written with; --resume alone means 1
+*/
+struct SolverConfig {
+	SolverConfig();
+
+	int xDim;
+	int yDim;
+	int numFrames;
+	double deltaT;
+	double cfl;
+	double timePerFrame;
+
+	string pressureSolver;
+	double pressureTolerance;
+	int maxPressureIterations;
+	double sorOmega;
+	int redBlackSweeps;
+	int numThreads;
+	int tileSize;
+	int sparseTile;
+	double sparseThreshold;
+	string storagePrecision;
+	string advectScheme;
+	string scalarFiles;
+
+	string outputFormat;
+	string outputFile;
+	double outputErrorBound;
+	int keyframeInterval;
+	int outputQueueSize;
+
+	string initialHorizFile;
+	string initialVertFile;
+	string initialPressureFile;
+
+	int checkpointInterval;
+	string checkpointFile;
+	bool resume;
+};
+
+
+/*
+	config: SolverConfig; receives the option
+	key: string; one of the keys listed at SolverConfig
+	value: string; text of the value
+
+	Return type: bool; false, with the reason on cerr, if the key is unknown or the value does not parse
+*/
+bool setOption(SolverConfig &config, const string &key, const string &value);
+
+
+/*
+	config: SolverConfig; receives the options
+	fileName: string; config file
+
+	One "key = value" per line. Blank lines and text after '#' are ignored.
+
+	Altered by reference: config
+	Return type: bool; false, with the file and line on cerr, if the file cannot be read or a line is invalid
+*/
+bool loadConfig(SolverConfig &config, string fileName);
+
+
+/*
+	config: SolverConfig; receives the options
+	argc: int; argument count from main
+	argv: char**; arguments from main
+
+	Arguments apply in order, later ones overriding earlier ones:
+		--config file      loads a config file
+		--key value        sets one option, also written --key=value
+		--resume           same as --resume 1
+		gs|pcg|mg|rbsor, a thread count and binary|compressed|text may still be given
+		as the first positional arguments, in that order.
+
+	Altered by reference: config
+	Return type: bool; false if an argument is invalid, or --help was given
+*/
+bool parseArguments(SolverConfig &config, int argc, char* argv[]);
+
+
+/*
+	config: SolverConfig
+
+	Return type: vector of string; the files of scalarFiles in order, empty for none
+*/
+vector<string> scalarFileNames(const SolverConfig &config);
+
+
+/*
+	config: SolverConfig; options to check
+
+	Return type: bool; false, with every problem on cerr, if the options cannot be run
+*/
+bool validateConfig(const SolverConfig &config);
+
+
+/*
+	program: const char*; name the solver was started as
+
+	Prints the command line syntax and every key to cerr.
+	Return type: void
+*/
+void printUsage(const char* program);
+
+#endif
@@ -0,0 +1,127 @@
+#include "frame_io.h"
+#include "frame_codec.h"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+/*
+	Round trip of the compressed output through FrameDecoder:
+		./solver --format binary --output raw.bin [--key value]...
+		./solver --format compressed --output compressed.bin [--key value]...
+		./decode_check raw.bin compressed.bin
+	The same options go to both runs, so their frames come from the same simulation. Every frame
+	of compressed.bin is decoded in order with one decoder, then in a shuffled order with
+	another, which has to jump back to a keyframe or carry on from the frame it decoded last.
+	Each decoded value has to lie within the error bound stored in the frame of the raw value,
+	plus the float32 rounding of the decoded value, and both orders have to decode to the same
+	bits. Reports the largest error of any frame. Exits with 1 if any check fails.
+*/
+
+namespace {
+
+/*
+	values: float*; decoded frame
+	expected: float*; the raw frame
+	count: size_t; values in a frame
+	errorBound: float; bound the frame was encoded with
+	largestError: double; raised to the largest error in the frame
+
+	Altered by reference: largestError
+	Return type: size_t; values further from the raw value than the bound allows
+*/
+size_t outOfBound(const float* values, const float* expected, size_t count, float errorBound, double &largestError) {
+	/*
+	Quantizing is within errorBound in double; storing the result as a float adds up to
+	half an ulp of the value, which FLT_EPSILON * |value| covers with room to spare.
+	*/
+	size_t outside = 0;
+	for (size_t index = 0; index < count; ++index) {
+		double error = fabs((double)values[index] - expected[index]);
+		largestError = max(largestError, error);
+		if (!(error <= errorBound + FLT_EPSILON * fabs(expected[index]))) {
+			outside++;
+		}
+	}
+	return outside;
+}
+
+}
+
+int main(int argc, char* argv[]){
+	if (argc != 3) {
+		cerr << "usage: " << argv[0] << " raw.bin compressed.bin" << endl;
+		return 1;
+	}
+	string rawFile = argv[1];
+	string compressedFile = argv[2];
+	FrameReader raw;
+	FrameReader compressed;
+	if (!raw.open(rawFile) || raw.codec() != FRAME_CODEC_RAW) {
+		cerr << rawFile << " is not a binary frame file" << endl;
+		return 1;
+	}
+	if (!compressed.open(compressedFile) || compressed.codec() != FRAME_CODEC_QUANT_RICE) {
+		cerr << compressedFile << " is not a compressed frame file" << endl;
+		return 1;
+	}
+	if (raw.xDim() != compressed.xDim() || raw.yDim() != compressed.yDim() || raw.components() != compressed.components()
+		|| raw.frameCount() != compressed.frameCount()) {
+		cerr << rawFile << " and " << compressedFile << " hold different grids or frame counts" << endl;
+		return 1;
+	}
+
+	int numFrames = compressed.frameCount();
+	size_t frameValues = (size_t)compressed.xDim() * compressed.yDim() * compressed.components();
+	vector<float> sequential(numFrames * frameValues);
+	vector<float> decoded(frameValues);
+	int failures = 0;
+	double largestError = 0.0;
+	float errorBound = 0.0f;
+
+	FrameDecoder inOrder;
+	for (int frame = 0; frame < numFrames; ++frame) {
+		float* values = &sequential[frame * frameValues];
+		if (!inOrder.decode(compressed, frame, values)) {
+			cout << "FAIL: frame " << frame << " does not decode in order" << endl;
+			failures++;
+			continue;
+		}
+		errorBound = inOrder.decodedErrorBound();
+		size_t outside = outOfBound(values, raw.frame(frame), frameValues, errorBound, largestError);
+		if (outside > 0) {
+			cout << "FAIL: frame " << frame << " has " << outside << " values beyond the error bound " << errorBound << endl;
+			failures++;
+		}
+	}
+
+	// A fixed seed, so a failing order can be run again.
+	vector<int> order(numFrames);
+	for (int frame = 0; frame < numFrames; ++frame) {
+		order[frame] = frame;
+	}
+	shuffle(order.begin(), order.end(), mt19937(12345));
+	FrameDecoder randomAccess;
+	int differing = 0;
+	for (int frame : order) {
+		if (!randomAccess.decode(compressed, frame, decoded.data())) {
+			cout << "FAIL: frame " << frame << " does not decode out of order" << endl;
+			failures++;
+			continue;
+		}
+		differing += memcmp(decoded.data(), &sequential[frame * frameValues], frameValues * sizeof(float)) != 0;
+	}
+	if (differing > 0) {
+		cout << "FAIL: " << differing << " frames decode differently out of order" << endl;
+		failures++;
+	}
+
+	cout << numFrames << " frames of " << compressed.xDim() << "x" << compressed.yDim() << "x" << compressed.components()
+		<< ", error bound " << errorBound << ", largest error " << largestError << endl;
+	cout << (failures == 0 ? "PASS" : "FAIL") << endl;
+	return failures == 0 ? 0 : 1;
+}
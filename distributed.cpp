@@ -0,0 +1,557 @@
+#include "distributed.h"
+#include "step_kernels.h"
+#include "trace.h"
+#include <algorithm>
+#include <cmath>
+
+
+namespace {
+
+const int ROWS_TAG = 1;
+const int PRESSURE_TAG = 2;
+const int PIPELINE_TAG = 3;
+const int SCATTER_TAG = 4;
+const int GATHER_TAG = 5;
+
+// Rows of the Gauss-Seidel sweep a rank finishes before passing its last column on.
+const int PIPELINE_ROWS = 64;
+
+/*
+	grid: FieldGrid; grid to copy from
+	rowBegin, rowEnd: int; rows to copy, every column of each
+	out: float*; receives the rows back to back
+
+	Return type: float*; one past the last value written
+*/
+float* packRows(const FieldGrid &grid, int rowBegin, int rowEnd, float* out) {
+	for (int i = rowBegin; i < rowEnd; ++i) {
+		const float* row = grid.row(i);
+		out = copy(row, row + grid.cols(), out);
+	}
+	return out;
+}
+
+/*
+	grid: FieldGrid; grid to copy into
+	rowBegin, rowEnd: int; rows to fill, every column of each
+	in: const float*; rows back to back, as packRows() wrote them
+
+	Return type: const float*; one past the last value read
+*/
+const float* unpackRows(FieldGrid &grid, int rowBegin, int rowEnd, const float* in) {
+	for (int i = rowBegin; i < rowEnd; ++i) {
+		copy(in, in + grid.cols(), grid.row(i));
+		in += grid.cols();
+	}
+	return in;
+}
+
+/*
+	grid: FieldGrid; grid of (y,x) pressures
+	colBegin, colEnd: int; columns to copy, every row of each
+	out: float*; receives, row by row, the columns' values
+
+	Return type: float*; one past the last value written
+*/
+float* packColumns(const FieldGrid &grid, int colBegin, int colEnd, float* out) {
+	for (int y = grid.firstRow(); y < grid.firstRow() + grid.rows(); ++y) {
+		for (int x = colBegin; x < colEnd; ++x) {
+			*out++ = grid(y, x);
+		}
+	}
+	return out;
+}
+
+/*
+	grid: FieldGrid; grid of (y,x) pressures
+	colBegin, colEnd: int; columns to fill, every row of each
+	in: const float*; values as packColumns() wrote them
+
+	Return type: const float*; one past the last value read
+*/
+const float* unpackColumns(FieldGrid &grid, int colBegin, int colEnd, const float* in) {
+	for (int y = grid.firstRow(); y < grid.firstRow() + grid.rows(); ++y) {
+		for (int x = colBegin; x < colEnd; ++x) {
+			grid(y, x) = *in++;
+		}
+	}
+	return in;
+}
+
+}
+
+
+/*
+	xDim: int; number of cells in x direction
+	yDim: int; number of cells in y direction
+	communicator: MPI_Comm; ranks to spread the grid over, no more than xDim of them
+*/
+SlabSolver::SlabSolver(int xDim, int yDim, MPI_Comm communicator)
+	: comm(communicator), xDim(xDim), yDim(yDim), halo(0) {
+	MPI_Comm_rank(comm, &rankIndex);
+	MPI_Comm_size(comm, &numRanks);
+	cellBegin = ownedBegin(rankIndex);
+	cellEnd = ownedEnd(rankIndex);
+
+	int pressureBegin = max(cellBegin - 1, 0);
+	int pressureEnd = min(cellEnd + 1, xDim);
+	pressure = FieldGrid(yDim, pressureEnd - pressureBegin, 0.0f, 0, pressureBegin);
+	rhs.assign((cellEnd - cellBegin) * yDim, 0.0f);
+	// Any substep needs at least 3: advect() reads one row past the cell it lands in.
+	reserveHalo(3);
+}
+
+/*
+	slabRank: int; rank to ask about
+
+	Return type: int; first cell column that rank owns
+*/
+int SlabSolver::ownedBegin(int slabRank) const {
+	return (int)((long)slabRank * xDim / numRanks);
+}
+
+/*
+	slabRank: int; rank to ask about
+
+	Return type: int; one past the last cell column that rank owns
+*/
+int SlabSolver::ownedEnd(int slabRank) const {
+	return ownedBegin(slabRank + 1);
+}
+
+/*
+	rows: int; velocity rows the windows must hold either side of the slab
+
+	Regrows the velocity windows, keeping the rows this rank owns. Halo rows are refilled by the next exchange.
+	Return type: void
+*/
+void SlabSolver::reserveHalo(int rows) {
+	if (rows <= halo) {
+		return;
+	}
+	halo = rows;
+	int horizBegin = max(cellBegin - halo, 0);
+	int horizEnd = min(cellEnd + 1 + halo, xDim + 1);
+	int vertBegin = max(cellBegin - halo, 0);
+	int vertEnd = min(cellEnd + halo, xDim);
+	int ownedHorizEnd = cellEnd == xDim ? xDim + 1 : cellEnd;
+
+	FieldGrid horiz(horizEnd - horizBegin, yDim, 0.0f, horizBegin, 0);
+	FieldGrid vert(vertEnd - vertBegin, yDim + 1, 0.0f, vertBegin, 0);
+	if (horizVelocity.rows() > 0) {
+		for (int i = cellBegin; i < ownedHorizEnd; ++i) {
+			copy(horizVelocity.row(i), horizVelocity.row(i) + yDim, horiz.row(i));
+		}
+		for (int i = cellBegin; i < cellEnd; ++i) {
+			copy(vertVelocity.row(i), vertVelocity.row(i) + yDim + 1, vert.row(i));
+		}
+	}
+	horizVelocity.swap(horiz);
+	vertVelocity.swap(vert);
+	updatedHoriz = horizVelocity;
+	updatedVert = vertVelocity;
+}
+
+/*
+	grid: FieldGrid; horizVelocity or vertVelocity
+	lastRow: int; one past the last row of the whole grid, xDim+1 or xDim
+	horizontal: bool; true for horizVelocity, whose last rank also owns the right wall row
+	rows: int; rows to refresh either side of the slab, no more than halo
+
+	Copies every row within rows of each rank's slab from the rank that owns it.
+	Return type: void
+*/
+void SlabSolver::exchangeRows(FieldGrid &grid, int lastRow, bool horizontal, int rows) {
+	TRACE_SCOPE("exchangeRows");
+	/*
+	Rank s owns rows [ownedBegin(s), ownedEnd(s)), the last rank through lastRow, and wants
+	the rows within rows of them. Every rank works out every overlap the same way, so sends
+	and receives pair up without any negotiation.
+	*/
+	auto owned = [&](int slabRank, int &begin, int &end) {
+		begin = ownedBegin(slabRank);
+		end = slabRank == numRanks - 1 ? lastRow : ownedEnd(slabRank);
+	};
+	auto wanted = [&](int slabRank, int &begin, int &end) {
+		owned(slabRank, begin, end);
+		begin = max(begin - rows, 0);
+		end = min(end + rows + (horizontal ? 1 : 0), lastRow);
+	};
+
+	int myBegin, myEnd, wantBegin, wantEnd;
+	owned(rankIndex, myBegin, myEnd);
+	wanted(rankIndex, wantBegin, wantEnd);
+	size_t sendSize = 0, receiveSize = 0;
+	for (int other = 0; other < numRanks; ++other) {
+		if (other == rankIndex) {
+			continue;
+		}
+		int begin, end, otherWantBegin, otherWantEnd;
+		owned(other, begin, end);
+		receiveSize += max(min(end, wantEnd) - max(begin, wantBegin), 0);
+		wanted(other, otherWantBegin, otherWantEnd);
+		sendSize += max(min(myEnd, otherWantEnd) - max(myBegin, otherWantBegin), 0);
+	}
+	sendBuffer.resize(sendSize * grid.cols());
+	receiveBuffer.resize(receiveSize * grid.cols());
+
+	vector<MPI_Request> requests;
+	float* sendAt = sendBuffer.data();
+	float* receiveAt = receiveBuffer.data();
+	for (int other = 0; other < numRanks; ++other) {
+		if (other == rankIndex) {
+			continue;
+		}
+		int begin, end, otherWantBegin, otherWantEnd;
+		owned(other, begin, end);
+		int count = max(min(end, wantEnd) - max(begin, wantBegin), 0) * grid.cols();
+		if (count > 0) {
+			requests.push_back(MPI_REQUEST_NULL);
+			MPI_Irecv(receiveAt, count, MPI_FLOAT, other, ROWS_TAG, comm, &requests.back());
+			receiveAt += count;
+		}
+		wanted(other, otherWantBegin, otherWantEnd);
+		int sendBegin = max(myBegin, otherWantBegin);
+		int sendEnd = min(myEnd, otherWantEnd);
+		if (sendEnd > sendBegin) {
+			float* packed = sendAt;
+			sendAt = packRows(grid, sendBegin, sendEnd, sendAt);
+			requests.push_back(MPI_REQUEST_NULL);
+			MPI_Isend(packed, sendAt - packed, MPI_FLOAT, other, ROWS_TAG, comm, &requests.back());
+		}
+	}
+	MPI_Waitall(requests.size(), requests.data(), MPI_STATUSES_IGNORE);
+
+	const float* in = receiveBuffer.data();
+	for (int other = 0; other < numRanks; ++other) {
+		if (other == rankIndex) {
+			continue;
+		}
+		int begin, end;
+		owned(other, begin, end);
+		if (min(end, wantEnd) > max(begin, wantBegin)) {
+			in = unpackRows(grid, max(begin, wantBegin), min(end, wantEnd), in);
+		}
+	}
+}
+
+/*
+	Copies the pressure columns either side of the slab from their owners.
+	Return type: void
+*/
+void SlabSolver::exchangePressure() {
+	TRACE_SCOPE("exchangePressure");
+	sendBuffer.resize(2 * yDim);
+	receiveBuffer.resize(2 * yDim);
+	vector<MPI_Request> requests;
+	if (rankIndex > 0) {
+		requests.push_back(MPI_REQUEST_NULL);
+		MPI_Irecv(receiveBuffer.data(), yDim, MPI_FLOAT, rankIndex - 1, PRESSURE_TAG, comm, &requests.back());
+		packColumns(pressure, cellBegin, cellBegin + 1, sendBuffer.data());
+		requests.push_back(MPI_REQUEST_NULL);
+		MPI_Isend(sendBuffer.data(), yDim, MPI_FLOAT, rankIndex - 1, PRESSURE_TAG, comm, &requests.back());
+	}
+	if (rankIndex < numRanks - 1) {
+		requests.push_back(MPI_REQUEST_NULL);
+		MPI_Irecv(receiveBuffer.data() + yDim, yDim, MPI_FLOAT, rankIndex + 1, PRESSURE_TAG, comm, &requests.back());
+		packColumns(pressure, cellEnd - 1, cellEnd, sendBuffer.data() + yDim);
+		requests.push_back(MPI_REQUEST_NULL);
+		MPI_Isend(sendBuffer.data() + yDim, yDim, MPI_FLOAT, rankIndex + 1, PRESSURE_TAG, comm, &requests.back());
+	}
+	MPI_Waitall(requests.size(), requests.data(), MPI_STATUSES_IGNORE);
+	if (rankIndex > 0) {
+		unpackColumns(pressure, cellBegin - 1, cellBegin, receiveBuffer.data());
+	}
+	if (rankIndex < numRanks - 1) {
+		unpackColumns(pressure, cellEnd, cellEnd + 1, receiveBuffer.data() + yDim);
+	}
+}
+
+/*
+	horizVelocityGrid, vertVelocityGrid, pressureGrid: FieldGrid*; the whole initial grids
+		on rank 0, ignored elsewhere
+
+	Return type: void
+*/
+void SlabSolver::scatter(const FieldGrid* horizVelocityGrid, const FieldGrid* vertVelocityGrid, const FieldGrid* pressureGrid) {
+	for (int other = 0; other < numRanks; ++other) {
+		int begin = ownedBegin(other);
+		int end = ownedEnd(other);
+		int horizEnd = end == xDim ? xDim + 1 : end;
+		size_t size = (size_t)(horizEnd - begin) * yDim + (size_t)(end - begin) * (yDim + 1) + (size_t)(end - begin) * yDim;
+		if (rankIndex == 0) {
+			sendBuffer.resize(size);
+			float* out = packRows(*horizVelocityGrid, begin, horizEnd, sendBuffer.data());
+			out = packRows(*vertVelocityGrid, begin, end, out);
+			packColumns(*pressureGrid, begin, end, out);
+			if (other != 0) {
+				MPI_Send(sendBuffer.data(), size, MPI_FLOAT, other, SCATTER_TAG, comm);
+				continue;
+			}
+			receiveBuffer.swap(sendBuffer);
+		}
+		else if (other == rankIndex) {
+			receiveBuffer.resize(size);
+			MPI_Recv(receiveBuffer.data(), size, MPI_FLOAT, 0, SCATTER_TAG, comm, MPI_STATUS_IGNORE);
+		}
+		else {
+			continue;
+		}
+		const float* in = unpackRows(horizVelocity, begin, horizEnd, receiveBuffer.data());
+		in = unpackRows(vertVelocity, begin, end, in);
+		unpackColumns(pressure, begin, end, in);
+	}
+}
+
+/*
+	horizVelocityGrid, vertVelocityGrid: FieldGrid*; receive the whole velocity grids on rank 0,
+		ignored elsewhere
+
+	Return type: void
+*/
+void SlabSolver::gather(FieldGrid* horizVelocityGrid, FieldGrid* vertVelocityGrid) {
+	TRACE_SCOPE("gather");
+	for (int other = 0; other < numRanks; ++other) {
+		int begin = ownedBegin(other);
+		int end = ownedEnd(other);
+		int horizEnd = end == xDim ? xDim + 1 : end;
+		size_t size = (size_t)(horizEnd - begin) * yDim + (size_t)(end - begin) * (yDim + 1);
+		if (other == rankIndex) {
+			sendBuffer.resize(size);
+			packRows(vertVelocity, begin, end, packRows(horizVelocity, begin, horizEnd, sendBuffer.data()));
+			if (rankIndex != 0) {
+				MPI_Send(sendBuffer.data(), size, MPI_FLOAT, 0, GATHER_TAG, comm);
+				continue;
+			}
+			receiveBuffer.swap(sendBuffer);
+		}
+		else if (rankIndex == 0) {
+			receiveBuffer.resize(size);
+			MPI_Recv(receiveBuffer.data(), size, MPI_FLOAT, other, GATHER_TAG, comm, MPI_STATUS_IGNORE);
+		}
+		else {
+			continue;
+		}
+		unpackRows(*vertVelocityGrid, begin, end, unpackRows(*horizVelocityGrid, begin, horizEnd, receiveBuffer.data()));
+	}
+}
+
+/*
+	deltaT: float; length of the substep
+
+	Return type: void
+*/
+void SlabSolver::addGravityBuildRHS(float deltaT) {
+	{
+		TRACE_SCOPE("addGravity");
+		for (int x = cellBegin; x < cellEnd; ++x) {
+			float* vert = vertVelocity.row(x);
+			for (int y = 0; y < yDim; ++y) {
+				vert[y] -= deltaT * 9.81;
+			}
+		}
+	}
+
+	// The right face of the slab's last cell belongs to the next rank.
+	exchangeRows(horizVelocity, xDim + 1, true, 0);
+	TRACE_SCOPE("buildRHS");
+	int width = cellEnd - cellBegin;
+	for (int y = 0; y < yDim; y++) {
+		for (int x = cellBegin; x < cellEnd; x++) {
+			rhs[(x - cellBegin) + y*width] = wallCellRHS(x, y, xDim, yDim, horizVelocity(x, y), horizVelocity(x + 1, y),
+				vertVelocity(x, y), vertVelocity(x, y + 1));
+		}
+	}
+}
+
+/*
+	deltaT: double; time step the system is scaled by
+
+	Return type: void
+*/
+void SlabSolver::project(double deltaT) {
+	/*
+	project() visits y then x, so a cell reads the new pressure of the cell to its left and the
+	old one of the cell to its right. The right neighbour's first column is taken before it
+	starts; the left neighbour's last column arrives PIPELINE_ROWS rows at a time as it finishes them.
+	*/
+	TRACE_SCOPE("project");
+	bool hasLeft = rankIndex > 0;
+	bool hasRight = rankIndex < numRanks - 1;
+	int width = cellEnd - cellBegin;
+	sendBuffer.resize(max(yDim, PIPELINE_ROWS));
+	receiveBuffer.resize(yDim);
+
+	MPI_Request request = MPI_REQUEST_NULL;
+	if (hasRight) {
+		MPI_Irecv(receiveBuffer.data(), yDim, MPI_FLOAT, rankIndex + 1, PRESSURE_TAG, comm, &request);
+	}
+	if (hasLeft) {
+		packColumns(pressure, cellBegin, cellBegin + 1, sendBuffer.data());
+		MPI_Send(sendBuffer.data(), yDim, MPI_FLOAT, rankIndex - 1, PRESSURE_TAG, comm);
+	}
+	MPI_Wait(&request, MPI_STATUS_IGNORE);
+	if (hasRight) {
+		unpackColumns(pressure, cellEnd, cellEnd + 1, receiveBuffer.data());
+	}
+
+	for (int rowBegin = 0; rowBegin < yDim; rowBegin += PIPELINE_ROWS) {
+		int rowEnd = min(rowBegin + PIPELINE_ROWS, yDim);
+		if (hasLeft) {
+			MPI_Recv(receiveBuffer.data(), rowEnd - rowBegin, MPI_FLOAT, rankIndex - 1, PIPELINE_TAG, comm, MPI_STATUS_IGNORE);
+			for (int y = rowBegin; y < rowEnd; ++y) {
+				pressure(y, cellBegin - 1) = receiveBuffer[y - rowBegin];
+			}
+		}
+		for (int y = rowBegin; y < rowEnd; y++) {
+			for (int x = cellBegin; x < cellEnd; x++) {
+				double diagonal = 0.0, offDiagonal = 0.0;
+
+				if (x > 0) {
+					diagonal    += deltaT;
+					offDiagonal -= deltaT * pressure(y, x - 1);
+				}
+				if (y > 0) {
+					diagonal    += deltaT;
+					offDiagonal -= deltaT * pressure(y - 1, x);
+				}
+				if (x < xDim - 1) {
+					diagonal    += deltaT;
+					offDiagonal -= deltaT * pressure(y, x + 1);
+				}
+				if (y < yDim - 1) {
+					diagonal    += deltaT;
+					offDiagonal -= deltaT * pressure(y + 1, x);
+				}
+
+				pressure(y, x) = (rhs[(x - cellBegin) + y*width] - offDiagonal) / diagonal;
+			}
+		}
+		if (hasRight) {
+			for (int y = rowBegin; y < rowEnd; ++y) {
+				sendBuffer[y - rowBegin] = pressure(y, cellEnd - 1);
+			}
+			MPI_Send(sendBuffer.data(), rowEnd - rowBegin, MPI_FLOAT, rankIndex + 1, PIPELINE_TAG, comm);
+		}
+	}
+}
+
+/*
+	deltaT: double; time step the system is scaled by
+	omega: double; relaxation factor
+	sweeps: int; number of red-black sweeps to run
+	executor: Executor; runs the rows of each colour within this slab
+
+	Return type: void
+*/
+void SlabSolver::projectRedBlack(double deltaT, double omega, int sweeps, Executor &executor) {
+	TRACE_SCOPE("projectRedBlack");
+	int width = cellEnd - cellBegin;
+	for (int sweep = 0; sweep < sweeps; ++sweep) {
+		for (int color = 0; color < 2; ++color) {
+			// A colour reads the other colour's cells either side of the slab as the last pass left them.
+			exchangePressure();
+			executor.parallelFor(0, yDim, [&](int rowBegin, int rowEnd) {
+				for (int y = rowBegin; y < rowEnd; y++) {
+					int first = cellBegin + (cellBegin + y + color) % 2;
+					for (int x = first; x < cellEnd; x += 2) {
+						double diagonal = 0.0, offDiagonal = 0.0;
+
+						if (x > 0) {
+							diagonal    += deltaT;
+							offDiagonal -= deltaT * pressure(y, x-1);
+						}
+						if (y > 0) {
+							diagonal    += deltaT;
+							offDiagonal -= deltaT * pressure(y-1, x);
+						}
+						if (x < xDim - 1) {
+							diagonal    += deltaT;
+							offDiagonal -= deltaT * pressure(y, x+1);
+						}
+						if (y < yDim - 1) {
+							diagonal    += deltaT;
+							offDiagonal -= deltaT * pressure(y+1, x);
+						}
+
+						double newPressure = (rhs[(x - cellBegin) + y*width] - offDiagonal) / diagonal;
+						pressure(y, x) = (1 - omega) * pressure(y, x) + omega * newPressure;
+					}
+				}
+			});
+		}
+	}
+}
+
+/*
+	deltaT: double; time step the system is scaled by
+
+	Return type: float
+*/
+float SlabSolver::applyPressure(double deltaT) {
+	/*
+	The slab's left face also takes the update of the cell left of it, first, as in applyPressure(),
+	so that cell is visited too; what it does to the rows left of the slab is overwritten by the next exchange.
+	*/
+	exchangePressure();
+	TRACE_SCOPE("applyPressure");
+	float largest = 0.0f;
+	for (int y = 0; y < yDim; y++) {
+		for (int x = max(cellBegin - 1, 0); x < cellEnd; x++) {
+			float cellPressure = pressure(y, x);
+			horizVelocity(x, y) -= deltaT * cellPressure;
+			horizVelocity(x + 1, y) += deltaT * cellPressure;
+			vertVelocity(x, y) -= deltaT * cellPressure;
+			vertVelocity(x, y + 1) += deltaT * cellPressure;
+
+			if (x >= cellBegin) {
+				float horizFace = x > 0 ? horizVelocity(x, y) : 0.0f;
+				float vertFace = y > 0 ? vertVelocity(x, y) : 0.0f;
+				largest = fmax(largest, fmax(fabs(horizFace), fabs(vertFace)));
+			}
+		}
+	}
+
+	// Bound the liquid to edges of screen
+	for (int y = 0; y < yDim; y++) {
+		if (cellBegin == 0) {
+			horizVelocity(0, y) = 0.0;
+		}
+		if (cellEnd == xDim) {
+			horizVelocity(xDim, y) = 0.0;
+		}
+	}
+	for (int x = cellBegin; x < cellEnd; x++) {
+		vertVelocity(x, 0) = 0.0;
+		vertVelocity(x, yDim) = 0.0;
+	}
+
+	float globalLargest;
+	MPI_Allreduce(&largest, &globalLargest, 1, MPI_FLOAT, MPI_MAX, comm);
+	return globalLargest;
+}
+
+/*
+	deltaT: float; time step over which we advect the velocity
+	maxFaceVelocity: float; applyPressure() of this substep, bounds how far a backtrace reaches
+	kernel: AdvectKernel; instruction set to use
+	executor: Executor; runs the rows of this slab
+
+	Return type: void
+*/
+void SlabSolver::advect(float deltaT, float maxFaceVelocity, AdvectKernel kernel, Executor &executor) {
+	/*
+	A backtrace from row i lands within maxFaceVelocity*deltaT rows of it and interpolates
+	between the rows either side of where it lands. Every rank has the same maxFaceVelocity,
+	so they all agree on the halo. A NaN or huge velocity needs the whole grid.
+	*/
+	double reach = (double)maxFaceVelocity * deltaT;
+	int rows = reach < xDim ? (int)ceil(reach) + 3 : xDim + 1;
+	reserveHalo(rows);
+	exchangeRows(horizVelocity, xDim + 1, true, rows);
+	exchangeRows(vertVelocity, xDim, false, rows);
+
+	advectSimdRows(horizVelocity, vertVelocity, updatedHoriz, updatedVert, xDim, yDim, deltaT, cellBegin, cellEnd, NO_SCALARS, kernel, executor);
+	horizVelocity.swap(updatedHoriz);
+	vertVelocity.swap(updatedVert);
+}
@@ -0,0 +1,139 @@
+#ifndef __DISTRIBUTED__
+#define __DISTRIBUTED__
+
+
+#include "mac_grid.h"
+#include "advect_simd.h"
+#include "thread_pool.h"
+#include <mpi.h>
+#include <vector>
+using namespace std;
+
+
+/*
+	One substep of the solver spread over the ranks of an MPI communicator.
+
+	The domain is cut into slabs of whole columns of cells: rank r owns cells x in
+	[cellBegin, cellEnd) for every y, with the horizontal faces on their left (and the right
+	wall on the last rank), their vertical faces and their pressures. Each rank keeps its slab
+	in FieldGrid windows, addressed by whole grid indices, with room for halo copies of its
+	neighbours' rows. Halos are refreshed from their owners before every stage that reads them:
+	the face to the right of the slab before buildRHS(), the pressure columns either side before
+	each pressure sweep and before applyPressure(), and as many velocity rows as the fastest
+	face can carry in a substep before advect().
+
+	Every cell is updated with the same arithmetic, in the same order per cell, as the single
+	process solver, and reductions are maxima, so results are identical for any rank count.
+	The Gauss-Seidel sweep of project() depends on the cell to its left, so it is pipelined:
+	each rank sweeps a block of rows as soon as the rank to its left has finished them.
+	pcg and mg sum over the whole grid in one fixed order and are not supported.
+*/
+class SlabSolver {
+public:
+	/*
+		xDim: int; number of cells in x direction
+		yDim: int; number of cells in y direction
+		communicator: MPI_Comm; ranks to spread the grid over, no more than xDim of them
+	*/
+	SlabSolver(int xDim, int yDim, MPI_Comm communicator);
+
+	/*
+		horizVelocityGrid, vertVelocityGrid, pressureGrid: FieldGrid*; the whole initial grids
+			on rank 0, ignored elsewhere
+
+		Hands every rank its slab of the initial grids. Collective.
+		Return type: void
+	*/
+	void scatter(const FieldGrid* horizVelocityGrid, const FieldGrid* vertVelocityGrid, const FieldGrid* pressureGrid);
+
+	/*
+		horizVelocityGrid, vertVelocityGrid: FieldGrid*; receive the whole velocity grids on rank 0,
+			ignored elsewhere
+
+		Collects every slab's face velocities. Collective.
+		Return type: void
+	*/
+	void gather(FieldGrid* horizVelocityGrid, FieldGrid* vertVelocityGrid);
+
+	/*
+		deltaT: float; length of the substep
+
+		addGravity() then buildRHS() on this slab.
+		Return type: void
+	*/
+	void addGravityBuildRHS(float deltaT);
+
+	/*
+		deltaT: double; time step the system is scaled by
+
+		One Gauss-Seidel sweep, as project(), over the whole grid.
+		Return type: void
+	*/
+	void project(double deltaT);
+
+	/*
+		deltaT: double; time step the system is scaled by
+		omega: double; relaxation factor
+		sweeps: int; number of red-black sweeps to run
+		executor: Executor; runs the rows of each colour within this slab
+
+		As projectRedBlack() over the whole grid.
+		Return type: void
+	*/
+	void projectRedBlack(double deltaT, double omega, int sweeps, Executor &executor);
+
+	/*
+		deltaT: double; time step the system is scaled by
+
+		As applyPressure() over the whole grid.
+		Return type: float; largest |velocity| on any face of the whole grid afterwards
+	*/
+	float applyPressure(double deltaT);
+
+	/*
+		deltaT: float; time step over which we advect the velocity
+		maxFaceVelocity: float; applyPressure() of this substep, bounds how far a backtrace reaches
+		kernel: AdvectKernel; instruction set to use
+		executor: Executor; runs the rows of this slab
+
+		As advectSimd() followed by swapping the updated grids in.
+		Return type: void
+	*/
+	void advect(float deltaT, float maxFaceVelocity, AdvectKernel kernel, Executor &executor);
+
+	inline int rank() const { return rankIndex; }
+	inline int ranks() const { return numRanks; }
+
+	/*
+		Return type: int; velocity rows held either side of the slab, grows as faces speed up
+	*/
+	inline int haloRows() const { return halo; }
+
+private:
+	int ownedBegin(int slabRank) const;
+	int ownedEnd(int slabRank) const;
+	void reserveHalo(int rows);
+	void exchangeRows(FieldGrid &grid, int lastRow, bool horizontal, int rows);
+	void exchangePressure();
+
+	MPI_Comm comm;
+	int rankIndex;
+	int numRanks;
+	int xDim;
+	int yDim;
+	int cellBegin;
+	int cellEnd;
+	int halo;
+
+	FieldGrid horizVelocity;
+	FieldGrid vertVelocity;
+	FieldGrid updatedHoriz;
+	FieldGrid updatedVert;
+	FieldGrid pressure;
+	// Negated divergence of the slab's cells, indexed (x - cellBegin) + y*(cellEnd - cellBegin)
+	vector<float> rhs;
+	vector<float> sendBuffer;
+	vector<float> receiveBuffer;
+};
+
+#endif
@@ -0,0 +1,157 @@
+#include "ensemble.h"
+#include "mac_grid.h"
+#include "grid_fns.h"
+#include "utils.h"
+#include "fluid_solver.h"
+#include "frame_io.h"
+#include "frame_codec.h"
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <set>
+#include <sstream>
+
+
+/*
+	fileName: string; manifest listing the cases
+	defaults: SolverConfig; options every case starts from
+	cases: vector of SolverConfig; receives one config per case, in manifest order
+
+	Altered by reference: cases
+	Return type: bool
+*/
+bool loadManifest(string fileName, const SolverConfig &defaults, vector<SolverConfig> &cases) {
+	ifstream inputFile(fileName);
+	if (!inputFile) {
+		cerr << "could not open manifest " << fileName << endl;
+		return false;
+	}
+	bool valid = true;
+	set<string> outputFiles;
+	string line;
+	int lineNumber = 0;
+	while (getline(inputFile, line)) {
+		lineNumber++;
+		/*
+		The line is handed to parseArguments() as a command line, so a case reads exactly like
+		the arguments of a solver run, --config files included.
+		*/
+		stringstream words(line.substr(0, line.find('#')));
+		vector<string> arguments(1, fileName);
+		string word;
+		while (words >> word) {
+			arguments.push_back(word);
+		}
+		if (arguments.size() == 1) {
+			continue;
+		}
+		vector<char*> argv;
+		for (size_t arg = 0; arg < arguments.size(); ++arg) {
+			argv.push_back(&arguments[arg][0]);
+		}
+
+		SolverConfig config = defaults;
+		if (!parseArguments(config, (int)argv.size(), argv.data()) || !validateConfig(config)) {
+			cerr << fileName << ":" << lineNumber << ": invalid case" << endl;
+			valid = false;
+			continue;
+		}
+		if (config.checkpointInterval > 0 || config.resume || config.sparseTile != 0 || config.storagePrecision != "float32" || !scalarFileNames(config).empty()) {
+			cerr << fileName << ":" << lineNumber << ": ensemble cases cannot use checkpoints, resume, sparseTile, 16-bit storage or scalars" << endl;
+			valid = false;
+			continue;
+		}
+		if (config.outputFile.empty()) {
+			config.outputFile = "case" + to_string(cases.size()) + (config.outputFormat == "text" ? ".txt" : ".bin");
+		}
+		if (!outputFiles.insert(config.outputFile).second) {
+			cerr << fileName << ":" << lineNumber << ": " << config.outputFile << " is already written by another case" << endl;
+			valid = false;
+			continue;
+		}
+		config.numThreads = 1;
+		cases.push_back(config);
+	}
+	return valid;
+}
+
+/*
+	config: SolverConfig; one case from loadManifest()
+	result: CaseResult; receives the case's counts and time
+
+	Altered by reference: result
+	Return type: bool
+*/
+bool runCase(const SolverConfig &config, CaseResult &result) {
+	/*
+	The case is a FluidSolver on one thread, stepped a frame at a time; each frame is taken
+	from its center velocities and serialized where it is made rather than on a writer
+	thread, since in an ensemble every core already has a case of its own.
+	*/
+	auto start = chrono::steady_clock::now();
+	result.substeps = 0;
+	result.cellSteps = 0.0;
+	result.pressureIterations = 0;
+	result.seconds = 0.0;
+
+	int numFrames = config.numFrames;
+	int xDim = config.xDim;
+	int yDim = config.yDim;
+	int initValue = 1;
+	string outputFormat = config.outputFormat;
+	string fileName = config.outputFile;
+
+	FrameWriter frameWriter;
+	uint32_t outputCodec = outputFormat == "compressed" ? FRAME_CODEC_QUANT_RICE : FRAME_CODEC_RAW;
+	if (outputFormat == "text" ? !clearOutputFile(fileName, numFrames, xDim, yDim)
+		: !frameWriter.open(fileName, xDim, yDim, outputCodec)) {
+		cerr << "could not open " << fileName << endl;
+		return false;
+	}
+
+	// The initial files are read into a staging grid the solver copies.
+	FluidSolver solver;
+	{
+		MacGrid grid(xDim, yDim, initValue);
+		if (!fillGrid(grid.horizVelocity, config.initialHorizFile)
+			|| !fillGrid(grid.vertVelocity, config.initialVertFile)
+			|| !fillGrid(grid.pressure, config.initialPressureFile)
+			|| !solver.init(config, grid)) {
+			return false;
+		}
+	}
+
+	FrameEncoder frameEncoder(xDim * yDim * 2, config.outputErrorBound, config.keyframeInterval);
+	vector<unsigned char> encodedFrame;
+	bool outputFailed = false;
+	auto writeFrame = [&] {
+		const float* centerVelocities = solver.centerVelocities().data;
+		bool written;
+		if (outputFormat == "text") {
+			written = saveCenterVelocities(centerVelocities, xDim, yDim, 2, fileName);
+		}
+		else if (outputFormat == "compressed") {
+			frameEncoder.encode(centerVelocities, encodedFrame);
+			written = frameWriter.writeFrameBytes(encodedFrame.data(), encodedFrame.size());
+		}
+		else {
+			written = frameWriter.writeFrame(centerVelocities);
+		}
+		outputFailed = outputFailed || !written;
+	};
+
+	for (int i = 0; i < numFrames; ++i) {
+		writeFrame();
+		result.substeps += solver.step(config.timePerFrame);
+		result.pressureIterations += solver.stepPressureIterations();
+	}
+	writeFrame();
+	if (!frameWriter.close() || outputFailed) {
+		cerr << "could not write " << fileName << endl;
+		return false;
+	}
+
+	result.cellSteps = (double)xDim * yDim * result.substeps;
+	result.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	return true;
+}
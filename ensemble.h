@@ -0,0 +1,57 @@
+#ifndef __ENSEMBLE__
+#define __ENSEMBLE__
+
+
+#include "config.h"
+#include <string>
+#include <vector>
+using namespace std;
+
+
+/*
+	substeps: int; substeps the case ran
+	cellSteps: double; cells of the grid times substeps
+	pressureIterations: long long; pcg iterations or mg V-cycles over every substep, 0 for gs and rbsor
+	seconds: double; wall time from reading the initial grids to closing the output
+*/
+struct CaseResult {
+	int substeps;
+	double cellSteps;
+	long long pressureIterations;
+	double seconds;
+};
+
+
+/*
+	fileName: string; manifest listing the cases
+	defaults: SolverConfig; options every case starts from
+	cases: vector of SolverConfig; receives one config per case, in manifest order
+
+	Each line holds the arguments of one case, as they would be given to solver, e.g.
+		--initialHoriz h17.txt --initialVert v17.txt --deltaT 0.02 --output case17.bin
+	Blank lines and text after '#' are ignored; arguments are separated by whitespace and
+	cannot be quoted. A case without an output file writes to case<n>.bin, or .txt for text,
+	n counting cases from 0. Every case must pass validateConfig(), write a file of its own
+	and not use checkpoints, resume, sparseTile, 16-bit storage or scalars. threads is
+	ignored: each case runs on one thread.
+
+	Altered by reference: cases
+	Return type: bool; false, with the line of every problem on cerr, if any case is invalid
+*/
+bool loadManifest(string fileName, const SolverConfig &defaults, vector<SolverConfig> &cases);
+
+
+/*
+	config: SolverConfig; one case from loadManifest()
+	result: CaseResult; receives the case's counts and time
+
+	Runs the whole simulation on the calling thread and writes its frames as they are made,
+	with the same results, bit for bit, as solver with the same options. Safe to call
+	concurrently for cases writing different files. pcg and mg report no per-substep lines.
+
+	Altered by reference: result
+	Return type: bool; false, with the reason on cerr, if the initial grids cannot be read or the output cannot be written
+*/
+bool runCase(const SolverConfig &config, CaseResult &result);
+
+#endif
@@ -0,0 +1,229 @@
+#include "fluid_solver.h"
+#include "grid_fns.h"
+#include "advect_simd.h"
+#include "trace.h"
+#include <iostream>
+
+
+namespace {
+
+/*
+	grid: FieldGrid; receives the values
+	values: float*; rows*cols values, row by row without padding, or 0 for all 0
+
+	Return type: void
+*/
+void copyIn(FieldGrid &grid, const float* values) {
+	if (!values) {
+		grid.fill(0.0f);
+		return;
+	}
+	for (int row = 0; row < grid.rows(); ++row) {
+		for (int col = 0; col < grid.cols(); ++col) {
+			grid(row, col) = values[(size_t)row * grid.cols() + col];
+		}
+	}
+}
+
+FieldView viewOf(const FieldGrid &grid) {
+	FieldView view = {grid.row(0), grid.rows(), grid.cols(), grid.rowStride()};
+	return view;
+}
+
+}
+
+
+FluidSolver::FluidSolver()
+	: tileSize(0), stepKernels(), advectKernel(ADVECT_SCALAR), centersCurrent(false), faceVelocity(0.0f), stats({0, 0.0}), stepIterations(0) {}
+
+/*
+	config: SolverConfig; grid size, substep, pressure solve, advection and threads
+	horizVelocity: float*; (xDim+1)*yDim face velocities, or 0
+	vertVelocity: float*; xDim*(yDim+1) face velocities, or 0
+	pressure: float*; yDim*xDim cell pressures, or 0
+
+	Return type: bool; false if config is invalid or not supported
+*/
+bool FluidSolver::init(const SolverConfig &config, const float* horizVelocity, const float* vertVelocity, const float* pressure) {
+	if (!allocate(config)) {
+		return false;
+	}
+	copyIn(horizVelocityGrid, horizVelocity);
+	copyIn(vertVelocityGrid, vertVelocity);
+	copyIn(pressureGrid, pressure);
+	faceVelocity = maxVelocity(horizVelocityGrid, vertVelocityGrid, config.xDim, config.yDim);
+	return true;
+}
+
+/*
+	config: SolverConfig; grid size, substep, pressure solve, advection and threads
+	grid: MacGrid; initial faces and pressures
+
+	Return type: bool; false if config is invalid or not supported or grid is another size
+*/
+bool FluidSolver::init(const SolverConfig &config, const MacGrid &grid) {
+	if (grid.xDim != config.xDim || grid.yDim != config.yDim) {
+		cerr << "FluidSolver was given a " << grid.xDim << "x" << grid.yDim << " grid for a "
+			<< config.xDim << "x" << config.yDim << " config" << endl;
+		return false;
+	}
+	if (!allocate(config)) {
+		return false;
+	}
+	horizVelocityGrid = grid.horizVelocity;
+	vertVelocityGrid = grid.vertVelocity;
+	pressureGrid = grid.pressure;
+	faceVelocity = maxVelocity(horizVelocityGrid, vertVelocityGrid, config.xDim, config.yDim);
+	return true;
+}
+
+/*
+	config: SolverConfig; grid size, substep, pressure solve, advection and threads
+
+	Validates config and sizes every grid, buffer and solver for it, the fields all 0.
+	Return type: bool; false if config is invalid or not supported
+*/
+bool FluidSolver::allocate(const SolverConfig &config) {
+	if (!validateConfig(config)) {
+		return false;
+	}
+	if (config.sparseTile != 0 || config.storagePrecision != "float32" || !scalarFileNames(config).empty()) {
+		cerr << "FluidSolver does not support sparseTile, 16-bit storage or scalars" << endl;
+		return false;
+	}
+	this->config = config;
+	int xDim = config.xDim;
+	int yDim = config.yDim;
+	tileSize = config.tileSize == -1 ? cacheTileSize() : config.tileSize;
+	stepKernels = selectStepKernels(xDim, yDim);
+	advectKernel = bestAdvectKernel();
+	AdvectScheme advectScheme = ADVECT_SEMI_LAGRANGIAN;
+	parseAdvectScheme(config.advectScheme, advectScheme);
+
+	horizVelocityGrid = FieldGrid(xDim+1, yDim, 0);
+	vertVelocityGrid = FieldGrid(xDim, yDim+1, 0);
+	pressureGrid = FieldGrid(yDim, xDim, 0);
+	updatedHorizGrid = FieldGrid(xDim+1, yDim, 0);
+	updatedVertGrid = FieldGrid(xDim, yDim+1, 0);
+	rhs.assign(xDim * yDim, 0.0f);
+	centers.assign(xDim * yDim * 2, 0.0f);
+	centersCurrent = false;
+	faceVelocity = 0.0f;
+	stats = {0, 0.0};
+	stepIterations = 0;
+
+	threadPool.reset(new ThreadPool(config.numThreads));
+	advector.reset(new MacCormackAdvector(xDim, yDim, advectScheme));
+	pcgSolver.reset(config.pressureSolver == "pcg" ? new PCGSolver(xDim, yDim) : 0);
+	multigridSolver.reset(config.pressureSolver == "mg" ? new MultigridSolver(xDim, yDim) : 0);
+	return true;
+}
+
+/*
+	deltaT: float; simulated time to advance
+
+	Return type: int; number of substeps taken
+*/
+int FluidSolver::step(float deltaT) {
+	/*
+	The frame loop of solver.cpp: each substep as long as cflTimestep() allows, the last one
+	whatever is left, so the same config and deltaT reproduce its frames bit for bit.
+	*/
+	TRACE_SCOPE("step");
+	int substeps = 0;
+	stepIterations = 0;
+	float timeLeft = deltaT;
+	while (timeLeft > 0) {
+		float substepT = cflTimestep(config.deltaT, config.cfl, faceVelocity, timeLeft);
+		substep(substepT);
+		timeLeft -= substepT;
+		substeps++;
+	}
+	centersCurrent = false;
+	return substeps;
+}
+
+/*
+	deltaT: float; substep length
+
+	Return type: void
+*/
+void FluidSolver::substep(float deltaT) {
+	int xDim = config.xDim;
+	int yDim = config.yDim;
+	if (tileSize > 0) {
+		addGravityBuildRHSTiled(horizVelocityGrid, vertVelocityGrid, xDim, yDim, deltaT, rhs, tileSize);
+	}
+	else {
+		stepKernels.addGravity(vertVelocityGrid, xDim, yDim, deltaT);
+		stepKernels.buildRHS(horizVelocityGrid, vertVelocityGrid, xDim, yDim, rhs);
+	}
+
+	if (config.pressureSolver == "gs") {
+		stepKernels.project(pressureGrid, deltaT, xDim, yDim, rhs);
+	}
+	else if (config.pressureSolver == "rbsor") {
+		projectRedBlack(pressureGrid, deltaT, xDim, yDim, rhs, config.sorOmega, config.redBlackSweeps, *threadPool);
+	}
+	else if (config.pressureSolver == "pcg") {
+		stats = pcgSolver->solve(pressureGrid, deltaT, rhs, config.pressureTolerance, config.maxPressureIterations);
+		stepIterations += stats.iterations;
+	}
+	else {
+		stats = multigridSolver->solve(pressureGrid, deltaT, rhs, config.pressureTolerance, config.maxPressureIterations);
+		stepIterations += stats.iterations;
+	}
+
+	if (tileSize > 0) {
+		faceVelocity = applyPressureTiled(pressureGrid, horizVelocityGrid, vertVelocityGrid, deltaT, xDim, yDim, tileSize, 0);
+	}
+	else {
+		faceVelocity = stepKernels.applyPressure(pressureGrid, horizVelocityGrid, vertVelocityGrid, deltaT, xDim, yDim);
+	}
+
+	advector->advect(horizVelocityGrid, vertVelocityGrid, updatedHorizGrid, updatedVertGrid, deltaT, advectKernel, *threadPool);
+	horizVelocityGrid.swap(updatedHorizGrid);
+	vertVelocityGrid.swap(updatedVertGrid);
+}
+
+/*
+	Return type: FieldView
+*/
+FieldView FluidSolver::horizVelocity() const {
+	return viewOf(horizVelocityGrid);
+}
+
+/*
+	Return type: FieldView
+*/
+FieldView FluidSolver::vertVelocity() const {
+	return viewOf(vertVelocityGrid);
+}
+
+/*
+	Return type: FieldView
+*/
+FieldView FluidSolver::pressure() const {
+	return viewOf(pressureGrid);
+}
+
+/*
+	Return type: FieldView; xDim rows of 2*yDim values
+*/
+FieldView FluidSolver::centerVelocities() {
+	int xDim = config.xDim;
+	int yDim = config.yDim;
+	if (!centersCurrent) {
+		threadPool->parallelFor(0, xDim, [&](int rowBegin, int rowEnd) {
+			for (int i = rowBegin; i < rowEnd; ++i) {
+				for (int j = 0; j < yDim; ++j) {
+					centers[2*(i*yDim + j)] = horCenterVel(horizVelocityGrid, i, j);
+					centers[2*(i*yDim + j) + 1] = verCenterVel(vertVelocityGrid, i, j);
+				}
+			}
+		});
+		centersCurrent = true;
+	}
+	FieldView view = {centers.data(), xDim, 2 * yDim, 2 * yDim};
+	return view;
+}
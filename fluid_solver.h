@@ -0,0 +1,146 @@
+#ifndef __FLUIDSOLVER__
+#define __FLUIDSOLVER__
+
+
+#include "mac_grid.h"
+#include "config.h"
+#include "pressure_solver.h"
+#include "multigrid.h"
+#include "advect_maccormack.h"
+#include "thread_pool.h"
+#include "step_kernels.h"
+#include <cstddef>
+#include <memory>
+#include <vector>
+using namespace std;
+
+
+/*
+	Read-only view of a field in solver memory; nothing is copied.
+	data: float*; value (0, 0)
+	rows: int; number of rows
+	cols: int; number of values in a row
+	rowStride: int; floats from the start of one row to the next, at least cols
+*/
+struct FieldView {
+	const float* data;
+	int rows;
+	int cols;
+	int rowStride;
+
+	inline float operator()(int row, int col) const { return data[(size_t)row * rowStride + col]; }
+	inline const float* row(int row) const { return data + (size_t)row * rowStride; }
+};
+
+
+/*
+	The dense solver of solver.cpp as an object a host application drives in-process:
+	init() from arrays in memory, step() the simulation, then read the fields straight from
+	the solver's grids through FieldViews, with no frame written or copied. Built as
+	libfluid.a and libfluid.so by scons library.
+
+	The views point into grids that step() swaps, so they are only valid until the next
+	step() or init(). A solver is used from one thread at a time; step() runs its stages on
+	the solver's own pool of config.numThreads threads.
+*/
+class FluidSolver {
+public:
+	FluidSolver();
+
+	/*
+		config: SolverConfig; grid size, substep, pressure solve, advection and threads. The
+			output, checkpoint and initial file options are ignored; sparseTile, 16-bit storage
+			and scalars are not supported.
+		horizVelocity: float*; (xDim+1)*yDim face velocities, (x, y) at x*yDim + y, or 0 for all 0
+		vertVelocity: float*; xDim*(yDim+1) face velocities, (x, y) at x*(yDim+1) + y, or 0 for all 0
+		pressure: float*; yDim*xDim cell pressures, (y, x) at y*xDim + x, or 0 for all 0
+
+		Copies the arrays into the solver's grids and allocates everything step() needs.
+		Return type: bool; false, with the reason on cerr, if config is invalid or not supported
+	*/
+	bool init(const SolverConfig &config, const float* horizVelocity, const float* vertVelocity, const float* pressure);
+
+	/*
+		config: SolverConfig; as for init() from arrays
+		grid: MacGrid; initial faces and pressures, config.xDim by config.yDim cells
+
+		Copies the grid's fields into the solver, e.g. once fillGrid() has read the initial files into it.
+		Return type: bool; false, with the reason on cerr, if config is invalid or not supported or grid is another size
+	*/
+	bool init(const SolverConfig &config, const MacGrid &grid);
+
+	/*
+		deltaT: float; simulated time to advance, > 0
+
+		Advances as solver.cpp advances one frame of this length: cfl substeps of gravity,
+		pressure solve, pressure update and advection, the last one ending exactly at deltaT.
+		Return type: int; number of substeps taken
+	*/
+	int step(float deltaT);
+
+	/*
+		Return type: FieldView; (xDim+1) rows of yDim horizontal face velocities, indexed (x, y)
+	*/
+	FieldView horizVelocity() const;
+
+	/*
+		Return type: FieldView; xDim rows of yDim+1 vertical face velocities, indexed (x, y)
+	*/
+	FieldView vertVelocity() const;
+
+	/*
+		Return type: FieldView; yDim rows of xDim cell pressures, indexed (y, x)
+	*/
+	FieldView pressure() const;
+
+	/*
+		Return type: FieldView; xDim rows of 2*yDim values, (u, v) of cell (x, y) at columns
+			2y and 2y+1, the frame layout of frame_io.h. Averaged from the faces on the first
+			call after init() or step(), then served from the solver's buffer. Only after init().
+	*/
+	FieldView centerVelocities();
+
+	int xDim() const { return config.xDim; }
+	int yDim() const { return config.yDim; }
+
+	/*
+		Return type: float; largest face velocity after the last pressure update, in cells per unit time
+	*/
+	float maxFaceVelocity() const { return faceVelocity; }
+
+	/*
+		Return type: SolveStats; last pcg or mg solve, zero for gs and rbsor
+	*/
+	SolveStats lastSolve() const { return stats; }
+
+	/*
+		Return type: int; pcg iterations or mg V-cycles summed over the substeps of the last step(), 0 for gs and rbsor
+	*/
+	int stepPressureIterations() const { return stepIterations; }
+
+private:
+	bool allocate(const SolverConfig &config);
+	void substep(float deltaT);
+
+	SolverConfig config;
+	int tileSize;
+	StepKernels stepKernels;
+	AdvectKernel advectKernel;
+	FieldGrid horizVelocityGrid;
+	FieldGrid vertVelocityGrid;
+	FieldGrid pressureGrid;
+	FieldGrid updatedHorizGrid;
+	FieldGrid updatedVertGrid;
+	vector<float> rhs;
+	vector<float> centers;
+	bool centersCurrent;
+	float faceVelocity;
+	SolveStats stats;
+	int stepIterations;
+	unique_ptr<ThreadPool> threadPool;
+	unique_ptr<MacCormackAdvector> advector;
+	unique_ptr<PCGSolver> pcgSolver;
+	unique_ptr<MultigridSolver> multigridSolver;
+};
+
+#endif
@@ -0,0 +1,342 @@
+#include "frame_codec.h"
+#include <chrono>
+#include <cmath>
+#include <cstring>
+
+
+namespace {
+
+// Unary runs this long are followed by the value in 64 raw bits instead of its low k bits.
+const int RICE_ESCAPE = 24;
+// Rice parameter marking a block whose values are all zero.
+const int ZERO_BLOCK = 31;
+const int FRAME_CODEC_HEADER_SIZE = 13;
+// Quantized values are clamped to +-2^52 so deltas of two of them fit in 64 bits.
+const int64_t QUANT_LIMIT = (int64_t)1 << 52;
+
+class BitWriter {
+public:
+	BitWriter(vector<unsigned char> &out) : out(out), accumulator(0), numBits(0) {}
+
+	// count <= 56
+	void put(uint64_t value, int count) {
+		accumulator |= value << numBits;
+		numBits += count;
+		while (numBits >= 8) {
+			out.push_back(accumulator & 0xff);
+			accumulator >>= 8;
+			numBits -= 8;
+		}
+	}
+
+	void flush() {
+		if (numBits > 0) {
+			out.push_back(accumulator & 0xff);
+		}
+		accumulator = 0;
+		numBits = 0;
+	}
+
+private:
+	vector<unsigned char> &out;
+	uint64_t accumulator;
+	int numBits;
+};
+
+class BitReader {
+public:
+	BitReader(const unsigned char* data, uint64_t size) : data(data), size(size), position(0), accumulator(0), numBits(0), overrun(false) {}
+
+	// count <= 32
+	uint64_t get(int count) {
+		refill();
+		if (numBits < count) {
+			overrun = true;
+			return 0;
+		}
+		uint64_t value = accumulator & ((1ull << count) - 1);
+		accumulator >>= count;
+		numBits -= count;
+		return value;
+	}
+
+	// Number of one bits before the next zero, capped at limit; consumes the terminating zero.
+	int unary(int limit) {
+		refill();
+		uint64_t inverted = ~accumulator;
+		int run = inverted ? __builtin_ctzll(inverted) : 64;
+		if (run >= limit && numBits >= limit) {
+			accumulator >>= limit;
+			numBits -= limit;
+			return limit;
+		}
+		if (run >= numBits) {
+			overrun = true;
+			return 0;
+		}
+		accumulator >>= run + 1;
+		numBits -= run + 1;
+		return run;
+	}
+
+	bool failed() const { return overrun; }
+
+private:
+	void refill() {
+		while (numBits <= 56 && position < size) {
+			accumulator |= (uint64_t)data[position++] << numBits;
+			numBits += 8;
+		}
+	}
+
+	const unsigned char* data;
+	uint64_t size;
+	uint64_t position;
+	uint64_t accumulator;
+	int numBits;
+	bool overrun;
+};
+
+inline uint64_t zigzag(int64_t value) {
+	return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+inline int64_t unzigzag(uint64_t value) {
+	return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+void putU32(unsigned char* out, uint32_t value) {
+	for (int byte = 0; byte < 4; ++byte) {
+		out[byte] = (value >> (8 * byte)) & 0xff;
+	}
+}
+
+uint32_t getU32(const unsigned char* in) {
+	uint32_t value = 0;
+	for (int byte = 0; byte < 4; ++byte) {
+		value |= (uint32_t)in[byte] << (8 * byte);
+	}
+	return value;
+}
+
+/*
+	values: uint64_t*; count zigzagged values
+	writer: BitWriter; receives the block
+
+	Picks k as floor(log2(mean)), close to the optimal Rice parameter for geometric data.
+*/
+void riceEncodeBlock(const uint64_t* values, int count, BitWriter &writer) {
+	// Deltas of two clamped values are below 2^54 after zigzag, so 64 of them cannot overflow the sum.
+	uint64_t sum = 0;
+	for (int value = 0; value < count; ++value) {
+		sum += values[value];
+	}
+	if (sum == 0) {
+		writer.put(ZERO_BLOCK, 5);
+		return;
+	}
+
+	uint64_t mean = sum / count;
+	int k = 0;
+	while (k < ZERO_BLOCK - 1 && (mean >> (k + 1)) > 0) {
+		k++;
+	}
+	writer.put(k, 5);
+
+	for (int value = 0; value < count; ++value) {
+		uint64_t quotient = values[value] >> k;
+		if (quotient < (uint64_t)RICE_ESCAPE) {
+			writer.put((1ull << quotient) - 1, quotient + 1);
+			writer.put(values[value] & ((1ull << k) - 1), k);
+		}
+		else {
+			writer.put((1ull << RICE_ESCAPE) - 1, RICE_ESCAPE);
+			writer.put(values[value] & 0xffffffffull, 32);
+			writer.put(values[value] >> 32, 32);
+		}
+	}
+}
+
+bool riceDecodeBlock(uint64_t* values, int count, BitReader &reader) {
+	int k = reader.get(5);
+	if (k == ZERO_BLOCK) {
+		for (int value = 0; value < count; ++value) {
+			values[value] = 0;
+		}
+		return !reader.failed();
+	}
+
+	for (int value = 0; value < count; ++value) {
+		int quotient = reader.unary(RICE_ESCAPE);
+		if (quotient < RICE_ESCAPE) {
+			values[value] = ((uint64_t)quotient << k) | reader.get(k);
+		}
+		else {
+			uint64_t low = reader.get(32);
+			values[value] = low | (reader.get(32) << 32);
+		}
+	}
+	return !reader.failed();
+}
+
+}
+
+
+/*
+	numValues: size_t; floats per frame
+	errorBound: float; largest absolute error allowed per value, > 0
+	keyframeInterval: int; a keyframe every this many frames, at least 1
+*/
+FrameEncoder::FrameEncoder(size_t numValues, float errorBound, int keyframeInterval)
+	: numValues(numValues), errorBound(errorBound), keyframeInterval(keyframeInterval < 1 ? 1 : keyframeInterval),
+	  frameNumber(0), previous(numValues, 0), current(numValues, 0), residuals(numValues, 0) {
+	counters.rawBytes = 0;
+	counters.encodedBytes = 0;
+	counters.encodeSeconds = 0.0;
+}
+
+/*
+	values: float*; numValues floats of the next frame
+	out: vector of bytes; replaced with the encoded frame
+
+	Return type: void
+*/
+void FrameEncoder::encode(const float* values, vector<unsigned char> &out) {
+	auto start = chrono::steady_clock::now();
+	bool keyframe = frameNumber % keyframeInterval == 0;
+	double inverseStep = 1.0 / (2.0 * errorBound);
+
+	for (size_t index = 0; index < numValues; ++index) {
+		int64_t q = 0;
+		if (isfinite(values[index])) {
+			double scaled = values[index] * inverseStep;
+			q = (int64_t)fmax(-(double)QUANT_LIMIT, fmin((double)QUANT_LIMIT, round(scaled)));
+		}
+		current[index] = q;
+		residuals[index] = zigzag(keyframe ? q : q - previous[index]);
+	}
+	previous.swap(current);
+
+	out.resize(FRAME_CODEC_HEADER_SIZE);
+	out[0] = keyframe ? 0 : 1;
+	uint32_t boundBits;
+	memcpy(&boundBits, &errorBound, 4);
+	putU32(&out[1], boundBits);
+	putU32(&out[5], keyframeInterval);
+	putU32(&out[9], numValues);
+
+	BitWriter writer(out);
+	for (size_t block = 0; block < numValues; block += FRAME_CODEC_BLOCK) {
+		int count = (int)min((size_t)FRAME_CODEC_BLOCK, numValues - block);
+		riceEncodeBlock(&residuals[block], count, writer);
+	}
+	writer.flush();
+
+	frameNumber++;
+	counters.rawBytes += numValues * sizeof(float);
+	counters.encodedBytes += out.size();
+	counters.encodeSeconds += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+/*
+	frames: int; framesEncoded() of the encoder being continued
+	quantized: vector of int64_t; its lastQuantized(), numValues long
+
+	Return type: bool; false if quantized has the wrong length
+*/
+bool FrameEncoder::restore(int frames, const vector<int64_t> &quantized) {
+	if (quantized.size() != numValues || frames < 0) {
+		return false;
+	}
+	frameNumber = frames;
+	previous = quantized;
+	return true;
+}
+
+
+FrameDecoder::FrameDecoder() : errorBound(0.0f), decodedFrame(-1) {}
+
+bool FrameDecoder::decodeFrame(const unsigned char* bytes, uint64_t size, int n) {
+	/*
+	Decodes one frame into quantized, adding to it for delta frames.
+	*/
+	if (size < (uint64_t)FRAME_CODEC_HEADER_SIZE) {
+		return false;
+	}
+	bool keyframe = bytes[0] == 0;
+	uint32_t boundBits = getU32(bytes + 1);
+	memcpy(&errorBound, &boundBits, 4);
+	size_t numValues = getU32(bytes + 9);
+	if (numValues != quantized.size() || (!keyframe && decodedFrame != n - 1)) {
+		return false;
+	}
+
+	BitReader reader(bytes + FRAME_CODEC_HEADER_SIZE, size - FRAME_CODEC_HEADER_SIZE);
+	for (size_t block = 0; block < numValues; block += FRAME_CODEC_BLOCK) {
+		int count = (int)min((size_t)FRAME_CODEC_BLOCK, numValues - block);
+		if (!riceDecodeBlock(&residuals[block], count, reader)) {
+			return false;
+		}
+	}
+	for (size_t index = 0; index < numValues; ++index) {
+		int64_t value = unzigzag(residuals[index]);
+		quantized[index] = keyframe ? value : quantized[index] + value;
+	}
+	decodedFrame = n;
+	return true;
+}
+
+/*
+	reader: FrameReader; open frame file
+	n: int; frame to decode, 0 <= n < reader.frameCount()
+	values: float*; receives xDim*yDim*components floats
+
+	Return type: bool; false if a frame on the way is corrupt
+*/
+bool FrameDecoder::decode(const FrameReader &reader, int n, float* values) {
+	/*
+	Decodes from the keyframe at or before n, or continues from the last decoded frame
+	when it lies between that keyframe and n.
+	*/
+	size_t numValues = (size_t)reader.xDim() * reader.yDim() * reader.components();
+	if (reader.codec() == FRAME_CODEC_RAW) {
+		memcpy(values, reader.frame(n), numValues * sizeof(float));
+		return true;
+	}
+	if (reader.codec() != FRAME_CODEC_QUANT_RICE) {
+		return false;
+	}
+	if (quantized.size() != numValues) {
+		quantized.assign(numValues, 0);
+		residuals.assign(numValues, 0);
+		decodedFrame = -1;
+	}
+
+	uint64_t size;
+	const unsigned char* bytes = reader.frameBytes(n, size);
+	if (size < (uint64_t)FRAME_CODEC_HEADER_SIZE) {
+		return false;
+	}
+	int keyframeInterval = getU32(bytes + 5);
+	if (keyframeInterval < 1) {
+		return false;
+	}
+	int start = n - n % keyframeInterval;
+	if (decodedFrame >= start && decodedFrame <= n) {
+		start = decodedFrame + 1;
+	}
+
+	for (int frame = start; frame <= n; ++frame) {
+		bytes = reader.frameBytes(frame, size);
+		if (!decodeFrame(bytes, size, frame)) {
+			decodedFrame = -1;
+			return false;
+		}
+	}
+
+	double step = 2.0 * errorBound;
+	for (size_t index = 0; index < numValues; ++index) {
+		values[index] = quantized[index] * step;
+	}
+	return true;
+}
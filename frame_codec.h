@@ -0,0 +1,130 @@
+#ifndef __FRAMECODEC__
+#define __FRAMECODEC__
+
+
+#include "frame_io.h"
+#include <cstdint>
+#include <vector>
+using namespace std;
+
+
+/*
+	Lossy frame codec for frame files, stored with codec FRAME_CODEC_QUANT_RICE.
+
+	Each value is quantized to q = round(value / (2*errorBound)), so decoding is within
+	errorBound of the input (plus float32 rounding of the result). Keyframes store q, every
+	other frame stores q minus the previous frame's q, which is exact so errors do not drift.
+	The zigzagged integers are Rice coded in blocks of FRAME_CODEC_BLOCK values with a
+	per-block parameter; an all-zero block costs 5 bits.
+
+	Encoded frame:
+		uint8 frame type; 0 keyframe, 1 delta
+		float32 errorBound
+		uint32 keyframeInterval
+		uint32 numValues
+		bitstream, least significant bit first
+	Frame n is a keyframe when n % keyframeInterval == 0, so decoding frame n touches at most
+	keyframeInterval frames.
+*/
+const uint32_t FRAME_CODEC_QUANT_RICE = 1;
+const int FRAME_CODEC_BLOCK = 64;
+
+
+/*
+	rawBytes: uint64_t; float32 bytes handed to the encoder
+	encodedBytes: uint64_t; bytes it produced
+	encodeSeconds: double; time spent encoding
+*/
+struct CodecStats {
+	uint64_t rawBytes;
+	uint64_t encodedBytes;
+	double encodeSeconds;
+};
+
+
+class FrameEncoder {
+public:
+	/*
+		numValues: size_t; floats per frame
+		errorBound: float; largest absolute error allowed per value, > 0
+		keyframeInterval: int; a keyframe every this many frames, at least 1
+	*/
+	FrameEncoder(size_t numValues, float errorBound, int keyframeInterval);
+
+	/*
+		values: float*; numValues floats of the next frame
+		out: vector of bytes; replaced with the encoded frame
+
+		Non-finite values are stored as 0; values beyond 2^52 quantization steps are clamped.
+		Return type: void
+	*/
+	void encode(const float* values, vector<unsigned char> &out);
+
+	/*
+		Return type: CodecStats
+	*/
+	CodecStats stats() const { return counters; }
+
+	/*
+		Return type: int; frames encoded so far
+	*/
+	int framesEncoded() const { return frameNumber; }
+
+	/*
+		Return type: vector of int64_t; quantized values of the last frame, what the next delta frame is taken against
+	*/
+	const vector<int64_t>& lastQuantized() const { return previous; }
+
+	/*
+		frames: int; framesEncoded() of the encoder being continued
+		quantized: vector of int64_t; its lastQuantized(), numValues long
+
+		Makes the next frame continue that encoder's keyframe schedule and deltas exactly.
+		Return type: bool; false if quantized has the wrong length
+	*/
+	bool restore(int frames, const vector<int64_t> &quantized);
+
+private:
+	size_t numValues;
+	float errorBound;
+	int keyframeInterval;
+	int frameNumber;
+	vector<int64_t> previous;
+	vector<int64_t> current;
+	vector<uint64_t> residuals;
+	CodecStats counters;
+};
+
+
+/*
+	Decodes frames of a FRAME_CODEC_QUANT_RICE file. Remembers the last decoded frame, so
+	reading frames in order decodes each one once.
+*/
+class FrameDecoder {
+public:
+	FrameDecoder();
+
+	/*
+		reader: FrameReader; open frame file
+		n: int; frame to decode, 0 <= n < reader.frameCount()
+		values: float*; receives xDim*yDim*components floats
+
+		Return type: bool; false if a frame on the way is corrupt
+	*/
+	bool decode(const FrameReader &reader, int n, float* values);
+
+	/*
+		Return type: float; error bound the last decoded frame was encoded with, 0 before any
+	*/
+	float decodedErrorBound() const { return errorBound; }
+
+private:
+	bool decodeFrame(const unsigned char* bytes, uint64_t size, int n);
+
+	vector<int64_t> quantized;
+	vector<uint64_t> residuals;
+	float errorBound;
+	int decodedFrame;
+};
+
+#endif
@@ -0,0 +1,378 @@
+#include "frame_io.h"
+#include "grid_fns.h"
+#include <climits>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+namespace {
+
+const char FRAME_MAGIC[4] = {'F', 'L', 'V', 'F'};
+
+bool hostIsLittleEndian() {
+	uint16_t probe = 1;
+	return *(unsigned char*)&probe == 1;
+}
+
+void putU32(unsigned char* out, uint32_t value) {
+	for (int byte = 0; byte < 4; ++byte) {
+		out[byte] = (value >> (8 * byte)) & 0xff;
+	}
+}
+
+void putU64(unsigned char* out, uint64_t value) {
+	for (int byte = 0; byte < 8; ++byte) {
+		out[byte] = (value >> (8 * byte)) & 0xff;
+	}
+}
+
+uint32_t getU32(const unsigned char* in) {
+	uint32_t value = 0;
+	for (int byte = 0; byte < 4; ++byte) {
+		value |= (uint32_t)in[byte] << (8 * byte);
+	}
+	return value;
+}
+
+uint64_t getU64(const unsigned char* in) {
+	uint64_t value = 0;
+	for (int byte = 0; byte < 8; ++byte) {
+		value |= (uint64_t)in[byte] << (8 * byte);
+	}
+	return value;
+}
+
+void encodeHeader(unsigned char* header, int xDim, int yDim, int components, uint32_t codec, uint32_t frameCount, uint64_t indexOffset) {
+	memcpy(header, FRAME_MAGIC, 4);
+	putU32(header + 4, FRAME_VERSION);
+	putU32(header + 8, xDim);
+	putU32(header + 12, yDim);
+	putU32(header + 16, components);
+	putU32(header + 20, FRAME_DTYPE_FLOAT32);
+	putU32(header + 24, frameCount);
+	putU32(header + 28, codec);
+	putU64(header + 32, indexOffset);
+}
+
+}
+
+
+/*
+	fileName: string; file to push to the disk
+	size: uint64_t by reference; receives the size of the file once synced
+
+	Altered by reference: size
+	Return type: bool; false if the file could not be opened or synced
+*/
+bool syncFile(string fileName, uint64_t &size) {
+	/*
+	fsync through a descriptor of our own; it syncs the file, whichever descriptor wrote the data.
+	*/
+	int descriptor = ::open(fileName.c_str(), O_RDONLY);
+	if (descriptor < 0) {
+		return false;
+	}
+	struct stat status;
+	bool synced = fsync(descriptor) == 0 && fstat(descriptor, &status) == 0;
+	size = synced ? status.st_size : 0;
+	::close(descriptor);
+	return synced;
+}
+
+
+/*
+	horizVelocityGrid: FieldGrid; holds horizontal velocity components at 1/2 indices
+	vertVelocityGrid: FieldGrid; holds vertical velocity components at 1/2 indices
+	xDim: int; number of cells in x direction
+	yDim: int; number of cells in y direction
+	frame: float*; receives xDim*yDim*(2+numScalars) values in frame file order
+	scalarGrids: FieldGrid*; numScalars cell-centred xDim x yDim fields
+	numScalars: int; number of scalar fields
+
+	Return type: void
+*/
+void centerVelocityFrame(const FieldGrid &horizVelocityGrid, const FieldGrid &vertVelocityGrid, int xDim, int yDim, float* frame,
+	const FieldGrid* scalarGrids, int numScalars) {
+	int components = 2 + numScalars;
+	for (int i = 0; i < xDim; ++i) {
+		for (int j = 0; j < yDim; ++j) {
+			float* cell = frame + (size_t)components * (i*yDim + j);
+			cell[0] = horCenterVel(horizVelocityGrid, i, j);
+			cell[1] = verCenterVel(vertVelocityGrid, i, j);
+			for (int field = 0; field < numScalars; ++field) {
+				cell[2 + field] = scalarGrids[field](i, j);
+			}
+		}
+	}
+}
+
+
+FrameWriter::FrameWriter() : xDim(0), yDim(0), components(2), codec(FRAME_CODEC_RAW) {}
+
+FrameWriter::~FrameWriter() {
+	close();
+}
+
+/*
+	fileName: string; file to create, truncated if it exists
+	xDim: int; number of cells in x direction
+	yDim: int; number of cells in y direction
+	codec: uint32_t; codec recorded in the header
+	components: int; values per cell
+
+	Return type: bool; false if the file could not be opened
+*/
+bool FrameWriter::open(string fileName, int xDim, int yDim, uint32_t codec, int components) {
+	/*
+	Writes a header with no frames and no index; close() fills both in.
+	*/
+	close();
+	path = fileName;
+	this->xDim = xDim;
+	this->yDim = yDim;
+	this->components = components;
+	this->codec = codec;
+	offsets.clear();
+	sizes.clear();
+	frameBuffer.assign((size_t)xDim * yDim * components, 0.0f);
+
+	file.open(fileName, ios::out | ios::binary | ios::trunc);
+	if (!file) {
+		return false;
+	}
+	unsigned char header[FRAME_HEADER_SIZE];
+	encodeHeader(header, xDim, yDim, components, codec, 0, 0);
+	file.write((const char*)header, FRAME_HEADER_SIZE);
+	return (bool)file;
+}
+
+/*
+	frame: float*; xDim*yDim*components values, as filled by centerVelocityFrame()
+
+	Return type: bool; false if the file could not be written
+*/
+bool FrameWriter::writeFrame(const float* frame) {
+	size_t numValues = (size_t)xDim * yDim * components;
+	uint64_t size = numValues * sizeof(float);
+	offsets.push_back(file.tellp());
+	sizes.push_back(size);
+
+	if (hostIsLittleEndian()) {
+		file.write((const char*)frame, size);
+		return (bool)file;
+	}
+	vector<unsigned char> swapped(size);
+	for (size_t value = 0; value < numValues; ++value) {
+		uint32_t bits;
+		memcpy(&bits, frame + value, 4);
+		putU32(&swapped[4 * value], bits);
+	}
+	file.write((const char*)swapped.data(), size);
+	return (bool)file;
+}
+
+/*
+	horizVelocityGrid: FieldGrid; holds horizontal velocity components at 1/2 indices
+	vertVelocityGrid: FieldGrid; holds vertical velocity components at 1/2 indices
+	scalarGrids: FieldGrid*; components-2 scalar fields
+
+	Return type: bool; false if the file could not be written
+*/
+bool FrameWriter::writeFrame(const FieldGrid &horizVelocityGrid, const FieldGrid &vertVelocityGrid, const FieldGrid* scalarGrids) {
+	centerVelocityFrame(horizVelocityGrid, vertVelocityGrid, xDim, yDim, frameBuffer.data(), scalarGrids, components - 2);
+	return writeFrame(frameBuffer.data());
+}
+
+/*
+	bytes: unsigned char*; an already encoded frame
+	size: uint64_t; number of bytes in the frame
+
+	Return type: bool; false if the file could not be written
+*/
+bool FrameWriter::writeFrameBytes(const unsigned char* bytes, uint64_t size) {
+	offsets.push_back(file.tellp());
+	sizes.push_back(size);
+	file.write((const char*)bytes, size);
+	return (bool)file;
+}
+
+/*
+	fileName: string; frame file a previous run was writing, possibly without an index
+	xDim: int; number of cells in x direction
+	yDim: int; number of cells in y direction
+	codec: uint32_t; codec recorded in the header
+	offsets: vector of uint64_t; start of every frame to keep
+	sizes: vector of uint64_t; size of every frame to keep
+	endOffset: uint64_t; file size flush() returned when offsets and sizes were taken
+	components: int; values per cell
+
+	Return type: bool; false if the file is missing or shorter than endOffset
+*/
+bool FrameWriter::resume(string fileName, int xDim, int yDim, uint32_t codec, const vector<uint64_t> &offsets, const vector<uint64_t> &sizes, uint64_t endOffset,
+	int components) {
+	/*
+	The header keeps its zero frame count and index offset until close() patches them.
+	*/
+	close();
+	struct stat status;
+	if (stat(fileName.c_str(), &status) != 0 || (uint64_t)status.st_size < endOffset || endOffset < (uint64_t)FRAME_HEADER_SIZE
+		|| truncate(fileName.c_str(), endOffset) != 0) {
+		return false;
+	}
+	path = fileName;
+	this->xDim = xDim;
+	this->yDim = yDim;
+	this->components = components;
+	this->codec = codec;
+	this->offsets = offsets;
+	this->sizes = sizes;
+	frameBuffer.assign((size_t)xDim * yDim * components, 0.0f);
+
+	file.open(fileName, ios::in | ios::out | ios::binary);
+	file.seekp(endOffset);
+	return (bool)file;
+}
+
+/*
+	Return type: uint64_t; bytes in the file, 0 if it could not be synced
+*/
+uint64_t FrameWriter::flush() {
+	file.flush();
+	uint64_t size = 0;
+	if (!file || !syncFile(path, size)) {
+		return 0;
+	}
+	return size;
+}
+
+/*
+	Return type: bool; false if any write since open() or resume() failed, or the file could not be finished
+*/
+bool FrameWriter::close() {
+	/*
+	Appends the index and rewrites the header with the final frame count and index offset.
+	A failed write leaves the stream failed, so one check after closing covers every frame;
+	close() itself fails the stream if the buffered bytes cannot be written out.
+	*/
+	if (!file.is_open()) {
+		return true;
+	}
+	uint64_t indexOffset = file.tellp();
+	vector<unsigned char> index(16 * offsets.size());
+	for (size_t frame = 0; frame < offsets.size(); ++frame) {
+		putU64(&index[16 * frame], offsets[frame]);
+		putU64(&index[16 * frame + 8], sizes[frame]);
+	}
+	file.write((const char*)index.data(), index.size());
+
+	unsigned char header[FRAME_HEADER_SIZE];
+	encodeHeader(header, xDim, yDim, components, codec, offsets.size(), indexOffset);
+	file.seekp(0);
+	file.write((const char*)header, FRAME_HEADER_SIZE);
+	file.close();
+	bool written = (bool)file;
+	file.clear();
+	return written;
+}
+
+
+FrameReader::FrameReader() : mapping(0), mappingSize(0), index(0), dimX(0), dimY(0), numComponents(2), numFrames(0), frameCodec(FRAME_CODEC_RAW) {}
+
+FrameReader::~FrameReader() {
+	close();
+}
+
+/*
+	fileName: string; frame file written by FrameWriter
+
+	Return type: bool; false if the file is missing, truncated or not a frame file
+*/
+bool FrameReader::open(string fileName) {
+	close();
+	int descriptor = ::open(fileName.c_str(), O_RDONLY);
+	if (descriptor < 0) {
+		return false;
+	}
+	struct stat status;
+	if (fstat(descriptor, &status) != 0 || status.st_size < FRAME_HEADER_SIZE) {
+		::close(descriptor);
+		return false;
+	}
+	mappingSize = status.st_size;
+	void* mapped = mmap(0, mappingSize, PROT_READ, MAP_SHARED, descriptor, 0);
+	::close(descriptor);
+	if (mapped == MAP_FAILED) {
+		mappingSize = 0;
+		return false;
+	}
+	mapping = (const unsigned char*)mapped;
+
+	/*
+	Every offset and size comes from the file, so each sum is checked as a difference that
+	cannot overflow. A raw frame must hold exactly dimX*dimY*components floats; that product
+	is only formed once it is known to be no larger than the file.
+	*/
+	uint64_t indexOffset = getU64(mapping + 32);
+	uint64_t frames = getU32(mapping + 24);
+	if (memcmp(mapping, FRAME_MAGIC, 4) != 0 || getU32(mapping + 4) != FRAME_VERSION
+		|| getU32(mapping + 16) < 2 || getU32(mapping + 20) != FRAME_DTYPE_FLOAT32
+		|| getU32(mapping + 8) > INT_MAX || getU32(mapping + 12) > INT_MAX || getU32(mapping + 16) > INT_MAX || frames > INT_MAX
+		|| indexOffset < (uint64_t)FRAME_HEADER_SIZE || indexOffset > mappingSize || 16 * frames > mappingSize - indexOffset) {
+		close();
+		return false;
+	}
+	dimX = getU32(mapping + 8);
+	dimY = getU32(mapping + 12);
+	numComponents = getU32(mapping + 16);
+	numFrames = frames;
+	frameCodec = getU32(mapping + 28);
+	index = mapping + indexOffset;
+
+	uint64_t cells = (uint64_t)dimX * dimY;
+	bool rawFits = cells == 0 || (uint64_t)numComponents <= indexOffset / sizeof(float) / cells;
+	uint64_t rawSize = rawFits ? cells * numComponents * sizeof(float) : 0;
+	for (int frame = 0; frame < numFrames; ++frame) {
+		uint64_t offset = getU64(index + 16 * frame);
+		uint64_t size = getU64(index + 16 * frame + 8);
+		if (offset < (uint64_t)FRAME_HEADER_SIZE || offset > indexOffset || size > indexOffset - offset
+			|| (frameCodec == FRAME_CODEC_RAW && (!rawFits || size != rawSize))) {
+			close();
+			return false;
+		}
+	}
+	return true;
+}
+
+void FrameReader::close() {
+	if (mapping) {
+		munmap((void*)mapping, mappingSize);
+	}
+	mapping = 0;
+	mappingSize = 0;
+	index = 0;
+	numFrames = 0;
+}
+
+/*
+	n: int; frame to look up
+	size: uint64_t by reference; receives the stored size of the frame in bytes
+
+	Return type: const unsigned char*; start of the stored frame
+*/
+const unsigned char* FrameReader::frameBytes(int n, uint64_t &size) const {
+	size = getU64(index + 16 * n + 8);
+	return mapping + getU64(index + 16 * n);
+}
+
+/*
+	n: int; frame to look up, 0 <= n < frameCount()
+
+	Return type: const float*
+*/
+const float* FrameReader::frame(int n) const {
+	uint64_t size;
+	return (const float*)frameBytes(n, size);
+}
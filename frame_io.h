@@ -0,0 +1,210 @@
+#ifndef __FRAMEIO__
+#define __FRAMEIO__
+
+
+#include "mac_grid.h"
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+using namespace std;
+
+
+/*
+	Binary frame file, all fields little-endian:
+		header (FRAME_HEADER_SIZE bytes)
+			char[4] magic "FLVF"
+			uint32 version
+			uint32 xDim, yDim
+			uint32 components; values per cell, 2 for (u, v) and one more per passive scalar
+			uint32 dtype; FRAME_DTYPE_FLOAT32
+			uint32 frameCount
+			uint32 codec; FRAME_CODEC_RAW, or FRAME_CODEC_QUANT_RICE from frame_codec.h
+			uint64 indexOffset; byte offset of the frame index
+		frames
+			raw: xDim*yDim*components float32, cell (i,j) at (i*yDim + j)*components as
+			u, v and then the scalars, the same order saveVelocityField() writes
+			other codecs: one encoded frame of those values, see frame_codec.h
+		index
+			frameCount x {uint64 offset, uint64 size}
+
+	Frames are appended as they are produced and the index is written by close(), which
+	then patches frameCount and indexOffset into the header.
+*/
+const uint32_t FRAME_VERSION = 1;
+const uint32_t FRAME_DTYPE_FLOAT32 = 0;
+const uint32_t FRAME_CODEC_RAW = 0;
+const int FRAME_HEADER_SIZE = 40;
+
+
+/*
+	fileName: string; file to push to the disk
+	size: uint64_t by reference; receives the size of the file once synced
+
+	Altered by reference: size
+	Return type: bool; false if the file could not be opened or synced
+*/
+bool syncFile(string fileName, uint64_t &size);
+
+
+/*
+	horizVelocityGrid: FieldGrid; holds horizontal velocity components at 1/2 indices
+	vertVelocityGrid: FieldGrid; holds vertical velocity components at 1/2 indices
+	xDim: int; number of cells in x direction
+	yDim: int; number of cells in y direction
+	frame: float*; receives xDim*yDim*(2+numScalars) values in frame file order
+	scalarGrids: FieldGrid*; numScalars cell-centred xDim x yDim fields stored after the velocity of each cell
+	numScalars: int; number of scalar fields, 0 for a velocity-only frame
+
+	Return type: void
+*/
+void centerVelocityFrame(const FieldGrid &horizVelocityGrid, const FieldGrid &vertVelocityGrid, int xDim, int yDim, float* frame,
+	const FieldGrid* scalarGrids = 0, int numScalars = 0);
+
+
+class FrameWriter {
+public:
+	FrameWriter();
+	~FrameWriter();
+
+	/*
+		fileName: string; file to create, truncated if it exists
+		xDim: int; number of cells in x direction
+		yDim: int; number of cells in y direction
+		codec: uint32_t; codec recorded in the header, frames of other codecs go through writeFrameBytes()
+		components: int; values per cell, 2 plus the number of passive scalars
+
+		Return type: bool; false if the file could not be opened
+	*/
+	bool open(string fileName, int xDim, int yDim, uint32_t codec = FRAME_CODEC_RAW, int components = 2);
+
+	/*
+		frame: float*; xDim*yDim*components values, as filled by centerVelocityFrame()
+
+		Return type: bool; false if the file could not be written
+	*/
+	bool writeFrame(const float* frame);
+
+	/*
+		horizVelocityGrid: FieldGrid; holds horizontal velocity components at 1/2 indices
+		vertVelocityGrid: FieldGrid; holds vertical velocity components at 1/2 indices
+		scalarGrids: FieldGrid*; components-2 scalar fields, may be 0 when there are none
+
+		Computes the center velocities into a reused buffer and appends them as one frame.
+		Return type: bool; false if the file could not be written
+	*/
+	bool writeFrame(const FieldGrid &horizVelocityGrid, const FieldGrid &vertVelocityGrid, const FieldGrid* scalarGrids = 0);
+
+	/*
+		bytes: unsigned char*; an already encoded frame
+		size: uint64_t; number of bytes in the frame
+
+		Return type: bool; false if the file could not be written
+	*/
+	bool writeFrameBytes(const unsigned char* bytes, uint64_t size);
+
+	/*
+		fileName: string; frame file a previous run was writing, possibly without an index
+		xDim: int; number of cells in x direction
+		yDim: int; number of cells in y direction
+		codec: uint32_t; codec recorded in the header
+		offsets: vector of uint64_t; start of every frame to keep, as frameOffsets() returned
+		sizes: vector of uint64_t; size of every frame to keep, as frameSizes() returned
+		endOffset: uint64_t; file size flush() returned when offsets and sizes were taken
+		components: int; values per cell the file was opened with
+
+		Drops everything after endOffset and continues appending frames there.
+		Return type: bool; false if the file is missing or shorter than endOffset
+	*/
+	bool resume(string fileName, int xDim, int yDim, uint32_t codec, const vector<uint64_t> &offsets, const vector<uint64_t> &sizes, uint64_t endOffset,
+		int components = 2);
+
+	/*
+		Pushes every frame written so far to the disk.
+		Return type: uint64_t; bytes in the file, 0 if it could not be synced
+	*/
+	uint64_t flush();
+
+	/*
+		Return type: vector of uint64_t; file offset of every frame written so far
+	*/
+	const vector<uint64_t>& frameOffsets() const { return offsets; }
+
+	/*
+		Return type: vector of uint64_t; size in bytes of every frame written so far
+	*/
+	const vector<uint64_t>& frameSizes() const { return sizes; }
+
+	/*
+		Writes the frame index, patches the header and closes the file. Called by the destructor.
+		Return type: bool; false if any write since open() or resume() failed, or the file could
+			not be finished; true if no file was open
+	*/
+	bool close();
+
+private:
+	fstream file;
+	string path;
+	int xDim;
+	int yDim;
+	int components;
+	uint32_t codec;
+	vector<uint64_t> offsets;
+	vector<uint64_t> sizes;
+	vector<float> frameBuffer;
+};
+
+
+/*
+	Memory maps a frame file. frame(n) is a pointer into the mapping, found through the
+	index in O(1) without reading any other frame.
+*/
+class FrameReader {
+public:
+	FrameReader();
+	~FrameReader();
+
+	/*
+		fileName: string; frame file written by FrameWriter
+
+		Return type: bool; false if the file is missing, truncated or not a frame file, or its
+			index points outside the frames or holds a raw frame of the wrong size
+	*/
+	bool open(string fileName);
+	void close();
+
+	int xDim() const { return dimX; }
+	int yDim() const { return dimY; }
+	int frameCount() const { return numFrames; }
+	// Values per cell, u and v first
+	int components() const { return numComponents; }
+	uint32_t codec() const { return frameCodec; }
+
+	/*
+		n: int; frame to look up, 0 <= n < frameCount()
+
+		Return type: const float*; xDim*yDim*components values, only valid for FRAME_CODEC_RAW files
+		on little-endian hosts
+	*/
+	const float* frame(int n) const;
+
+	/*
+		n: int; frame to look up
+		size: uint64_t by reference; receives the stored size of the frame in bytes
+
+		Return type: const unsigned char*; start of the stored frame
+	*/
+	const unsigned char* frameBytes(int n, uint64_t &size) const;
+
+private:
+	const unsigned char* mapping;
+	size_t mappingSize;
+	const unsigned char* index;
+	int dimX;
+	int dimY;
+	int numComponents;
+	int numFrames;
+	uint32_t frameCodec;
+};
+
+#endif
@@ -1,291 +1,358 @@
 #include "grid_fns.h"
+#include "step_kernels.h"
+#include "trace.h"
 #include <iostream>
 #include <fstream>
 #include <math.h>
+#include <cctype>
+#include <charconv>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+const char INITIAL_CONDITION_MAGIC[4] = {'F', 'L', 'I', 'C'};
+const size_t INITIAL_CONDITION_HEADER_SIZE = 16;
+
+bool hostIsLittleEndian() {
+	uint16_t probe = 1;
+	return *(unsigned char*)&probe == 1;
+}
+
+uint32_t getU32(const char* in) {
+	uint32_t value = 0;
+	for (int byte = 0; byte < 4; ++byte) {
+		value |= (uint32_t)(unsigned char)in[byte] << (8 * byte);
+	}
+	return value;
+}
+
+void putU32(char* out, uint32_t value) {
+	for (int byte = 0; byte < 4; ++byte) {
+		out[byte] = (value >> (8 * byte)) & 0xff;
+	}
+}
 
 /*
-	inputFileName: string; name of input file to be read from
-	Data format: Each row holds space seperated values for that row in toFill.
-		row 0 data
-		row 1 data
-		...
-		row n data
-		---------------------------
-		Ex:
-		---------------------------
-		1.2 1 3.4 3 23 2 ... 3 1
-		3 9 9.3 8 23 0 ... 0 9
-		...
-		4 9.6 3 25 28 2.5 ... 3 6
-
-	Return type: vector<float>*
+	toFill: FieldGrid; grid to fill
+	data: char*; binary initial condition file
+	size: size_t; bytes in data
+
+	Return type: bool; false, with the reason on cerr, if the file does not match toFill
 */
-vector<float>* getInputData(string inputFileName) {
-	/*
-	Returns vector holding inputFileName's input data
-	*/
-	ifstream inputFile;
-	string strValue;
-	float fltValue;
-	vector<float>* values = new vector<float>;
-
-	inputFile.open(inputFileName, ios::in);
-	while(inputFile >> strValue) {
-		if (strValue != "\n") {
-			fltValue = stof(strValue);
-			values->push_back(fltValue);
+bool fillGridBinary(FieldGrid &toFill, const char* data, size_t size, const string &inputFileName) {
+	int numRows = toFill.rows();
+	int numCols = toFill.cols();
+	uint32_t version = getU32(data + 4);
+	uint32_t rows = getU32(data + 8);
+	uint32_t cols = getU32(data + 12);
+
+	if (version != INITIAL_CONDITION_VERSION) {
+		cerr << inputFileName << ": unsupported initial condition version " << version << endl;
+		return false;
+	}
+	if (rows != (uint32_t)numRows || cols != (uint32_t)numCols) {
+		cerr << inputFileName << ": holds a " << rows << "x" << cols << " grid, expected "
+			<< numRows << "x" << numCols << endl;
+		return false;
+	}
+	if (size != INITIAL_CONDITION_HEADER_SIZE + (size_t)rows * cols * sizeof(float)) {
+		cerr << inputFileName << ": expected " << (size_t)rows * cols << " values after the header, file is "
+			<< size << " bytes" << endl;
+		return false;
+	}
+
+	const char* values = data + INITIAL_CONDITION_HEADER_SIZE;
+	for (int i = 0; i < numRows; ++i) {
+		if (hostIsLittleEndian()) {
+			memcpy(toFill.row(i), values + (size_t)i * numCols * sizeof(float), numCols * sizeof(float));
+			continue;
+		}
+		for (int j = 0; j < numCols; ++j) {
+			uint32_t bits = getU32(values + ((size_t)i * numCols + j) * sizeof(float));
+			memcpy(&toFill(i, j), &bits, sizeof(float));
 		}
 	}
-	return values;
+	return true;
 }
 
 /*
-	toFill: 2D vector of floats; holds default values, needs to be initialized
-	inputFileName: string; file name of the input file
+	toFill: FieldGrid; grid to fill
+	data: char*; text initial condition file
+	size: size_t; bytes in data
 
-	Altered by reference: toFill
-	Return type: void
+	Return type: bool; false, with the reason on cerr, if a value is malformed or the count does not match toFill
 */
-void fillGrid(vector< vector<float> > &toFill, string inputFileName) {
+bool fillGridText(FieldGrid &toFill, const char* data, size_t size, const string &inputFileName) {
 	/*
-	Gets values from input file, fills toFill with them
+	Parses values with from_chars directly into toFill, row by row.
 	*/
-	int numRows = toFill.size();
-	int numCols = toFill.at(0).size();
-
-	const vector<float>* inputData = getInputData(inputFileName);
+	int numCols = toFill.cols();
+	size_t expected = (size_t)toFill.rows() * numCols;
+	size_t count = 0;
+	const char* position = data;
+	const char* end = data + size;
+
+	while (true) {
+		while (position < end && isspace((unsigned char)*position)) {
+			position++;
+		}
+		if (position == end) {
+			break;
+		}
+		if (count == expected) {
+			cerr << inputFileName << ": more than the " << expected << " values a "
+				<< toFill.rows() << "x" << numCols << " grid holds" << endl;
+			return false;
+		}
 
-	for(size_t i = 0; i < numRows; ++i) {
-		for (size_t j = 0; j < numCols; ++j) {
-			toFill.at(i).at(j) = inputData->at(i*numCols+j);
+		// stof accepted a leading '+', from_chars does not
+		if (*position == '+') {
+			position++;
 		}
+		float value;
+		from_chars_result result = from_chars(position, end, value);
+		if (result.ec != errc() || (result.ptr < end && !isspace((unsigned char)*result.ptr))) {
+			cerr << inputFileName << ": malformed value " << count << " at byte " << position - data << endl;
+			return false;
+		}
+		toFill(count / numCols, count % numCols) = value;
+		count++;
+		position = result.ptr;
 	}
 
-	delete inputData;
+	if (count != expected) {
+		cerr << inputFileName << ": found " << count << " values, a " << toFill.rows() << "x" << numCols
+			<< " grid needs " << expected << endl;
+		return false;
+	}
+	return true;
 }
 
-/*
-	pressureGrid: 2D vector of floats; holds pressure values
-	i: integer; index for ith row
-	j: integer; index for jth column
-
-	Return type: float
-*/
-float correctPGet(const vector< vector<float> > &pressureGrid, int i, int j){
-	/*
-	Gets the (i,j)th value from the pressure grid.
-	Used for consistency with horizontal and vertical Velocity getters.
-	*/
-	return pressureGrid.at(i).at(j);
 }
 
 /*
-	horizVelocityGrid: 2D vector of floats; holds horizontal velocity components at 1/2 indices
-	i: integer; index for ith row
-	j: integer; index for jth column
+	toFill: FieldGrid; holds default values, needs to be initialized
+	inputFileName: string; file name of the input file, text or binary
 
-	Return type: float
+	Altered by reference: toFill
+	Return type: bool; false if the file is missing, malformed or does not match toFill
 */
-float correctHVGet(const vector< vector<float> > &horizVelocityGrid, int i, int j){
+bool fillGrid(FieldGrid &toFill, string inputFileName) {
 	/*
-	Gets the correct half indice (i,j)th value from the horizVelocityGrid grid.
-	Expects i to be a half index Ex: 4-.5
-	Truncates index then adds 1; handles both i-.5 and i+.5
+	Maps the input file and fills toFill from it, picking the format from the magic bytes.
 	*/
-	return horizVelocityGrid.at(i+1).at(j);
-}
+	int descriptor = open(inputFileName.c_str(), O_RDONLY);
+	struct stat status;
+	if (descriptor < 0 || fstat(descriptor, &status) != 0) {
+		cerr << inputFileName << ": could not open" << endl;
+		if (descriptor >= 0) {
+			close(descriptor);
+		}
+		return false;
+	}
 
+	size_t size = status.st_size;
+	const char* data = "";
+	if (size > 0) {
+		void* mapped = mmap(0, size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+		if (mapped == MAP_FAILED) {
+			cerr << inputFileName << ": could not map" << endl;
+			close(descriptor);
+			return false;
+		}
+		data = (const char*)mapped;
+	}
+	close(descriptor);
 
-/*
-	verticalVelocityGrid: 2D vector of floats; holds vertical velocity components at 1/2 indices
-	i: integer; index for ith row
-	j: integer; index for jth column
+	bool filled;
+	if (size >= INITIAL_CONDITION_HEADER_SIZE && memcmp(data, INITIAL_CONDITION_MAGIC, 4) == 0) {
+		filled = fillGridBinary(toFill, data, size, inputFileName);
+	}
+	else {
+		filled = fillGridText(toFill, data, size, inputFileName);
+	}
 
-	Return type: float
-*/
-float correctVVGet(const vector< vector<float> > &verticalVelocityGrid, int i, int j){
-	/*
-	Gets the correct half indice (i,j)th value from the verticalVelocityGrid grid.
-	Expects j to be a half index Ex: 4-.5
-	Truncates index then adds 1; handles both j-.5 and j+.5
-	*/
-	return verticalVelocityGrid.at(i).at(j+1);
+	if (size > 0) {
+		munmap((void*)data, size);
+	}
+	return filled;
 }
 
 /*
-	horizVelocityGrid: 2D vector of floats; holds horizontal velocity components at 1/2 indices
-	i: integer; index for ith row
-	j: integer; index for jth column
+	grid: FieldGrid; grid to save
+	outputFileName: string; file to write in the binary initial condition format
 
-	Return type: float
+	Return type: bool; false if the file could not be written
 */
-float horCenterVel(const vector< vector<float> > &horizVelocityGrid, int i, int j) {
-	/*
-	Returns horizontal velocity at center of grid cell.
-	Averages horizontal velocities at left and right sides of the cell.
-	*/
-	float numeratorTerm1 = correctHVGet(horizVelocityGrid, i-.5, j);
-	float numeratorTerm2 = correctHVGet(horizVelocityGrid, i+.5, j);
-	return (numeratorTerm1 + numeratorTerm2) / 2;
+bool saveGrid(const FieldGrid &grid, string outputFileName) {
+	ofstream outputFile(outputFileName, ios::out | ios::binary | ios::trunc);
+	char header[INITIAL_CONDITION_HEADER_SIZE];
+	memcpy(header, INITIAL_CONDITION_MAGIC, 4);
+	putU32(header + 4, INITIAL_CONDITION_VERSION);
+	putU32(header + 8, grid.rows());
+	putU32(header + 12, grid.cols());
+	outputFile.write(header, INITIAL_CONDITION_HEADER_SIZE);
+
+	vector<char> row(grid.cols() * sizeof(float));
+	for (int i = 0; i < grid.rows(); ++i) {
+		for (int j = 0; j < grid.cols(); ++j) {
+			uint32_t bits;
+			memcpy(&bits, &grid(i, j), sizeof(float));
+			putU32(&row[j * sizeof(float)], bits);
+		}
+		outputFile.write(row.data(), row.size());
+	}
+	return (bool)outputFile;
 }
 
+// Based off of repo here: https://github.com/tunabrain/incremental-fluids.git
+void project(FieldGrid &pressureGrid, double deltaT, int width, int height, vector<float> &rhs) {
+	projectKernel<0, 0>(pressureGrid, deltaT, width, height, rhs);
+}
 
 /*
-	vertVelocityGrid: 2D vector of floats; holds vertical velocity components at 1/2 indices
-	i: integer; index for ith row
-	j: integer; index for jth column
-
-	Return type: float
+	pressureGrid: FieldGrid; holds pressure values
+	deltaT: double; time step the system is scaled by
+	width: int; number of cells in x direction
+	height: int; number of cells in y direction
+	rhs: vector of floats; negative divergence from buildRHS(), indexed x + y*width
+	omega: double; relaxation factor, 1 is plain Gauss-Seidel, between 1 and 2 over-relaxes
+	sweeps: int; number of red-black sweeps to run
+	executor: Executor; runs the rows of each colour
+
+	Altered by reference: pressureGrid
+	Return type: void
 */
-float verCenterVel(const vector< vector<float> > &vertVelocityGrid, int i, int j) {
+void projectRedBlack(FieldGrid &pressureGrid, double deltaT, int width, int height, const vector<float> &rhs, double omega, int sweeps, Executor &executor) {
 	/*
-	Returns vertical velocity at center of grid cell.
-	Averages vertical velocities at top and bottom sides of the cell.
+	Red-black ordered SOR on the system project() relaxes.
 	*/
-	float numeratorTerm1 = correctVVGet(vertVelocityGrid, i, j-.5);
-	float numeratorTerm2 = correctVVGet(vertVelocityGrid, i, j+.5);
-	return (numeratorTerm1 + numeratorTerm2) / 2;
+	TRACE_SCOPE("projectRedBlack");
+	for (int sweep = 0; sweep < sweeps; ++sweep) {
+		for (int color = 0; color < 2; ++color) {
+			executor.parallelFor(0, height, [&](int rowBegin, int rowEnd) {
+				for (int y = rowBegin; y < rowEnd; y++) {
+					for (int x = (y + color) % 2; x < width; x += 2) {
+						int index = x + y*width;
+						double diagonal = 0.0, offDiagonal = 0.0;
+
+						if (x > 0) {
+							diagonal    += deltaT;
+							offDiagonal -= deltaT * pressureGrid(y, x-1);
+						}
+						if (y > 0) {
+							diagonal    += deltaT;
+							offDiagonal -= deltaT * pressureGrid(y-1, x);
+						}
+						if (x < width - 1) {
+							diagonal    += deltaT;
+							offDiagonal -= deltaT * pressureGrid(y, x+1);
+						}
+						if (y < height - 1) {
+							diagonal    += deltaT;
+							offDiagonal -= deltaT * pressureGrid(y+1, x);
+						}
+
+						double newPressure = (rhs[index] - offDiagonal) / diagonal;
+						pressureGrid(y, x) = (1 - omega) * pressureGrid(y, x) + omega * newPressure;
+					}
+				}
+			});
+		}
+	}
 }
 
+// Based off of repo here: https://github.com/tunabrain/incremental-fluids.git
+float applyPressure(const FieldGrid &pressureGrid, FieldGrid &horizVelocityGrid, FieldGrid &vertVelocityGrid, double deltaT, int xDim, int yDim) {
+	return applyPressureKernel<0, 0>(pressureGrid, horizVelocityGrid, vertVelocityGrid, deltaT, xDim, yDim);
+}
 
 /*
-	horizVelocityGrid: 2D vector of floats; holds vertical horizontal components at 1/2 indices
-	vertVelocityGrid: 2D vector of floats; holds vertical velocity components at 1/2 indices
-	i: integer; index for ith row
-	j: integer; index for jth column
+	horizVelocityGrid: FieldGrid; holds horizontal velocity components at 1/2 indices
+	vertVelocityGrid: FieldGrid; holds vertical velocity components at 1/2 indices
+	xDim: int; number of cells in x direction
+	yDim: int; number of cells in y direction
+	rhs: vector of floats; receives the negative divergence, indexed x + y*xDim
 
-	Return type: vector<float>* of size 2
+	Based off of repo here: https://github.com/tunabrain/incremental-fluids.git
+
+	Altered by reference: rhs
+	Return type: void
 */
-vector<float>* centerVel(const vector< vector<float> > &horizVelocityGrid, const vector< vector<float> > &vertVelocityGrid, int i, int j) {
-	/*
-	Returns x and y components of velocity at center of the cell
-	*/
-	vector<float>* velocityComponents  = new vector<float>;
-	velocityComponents->push_back(horCenterVel(horizVelocityGrid, i, j));
-	velocityComponents->push_back(verCenterVel(vertVelocityGrid, i, j));
-	return velocityComponents;
+void buildRHS(const FieldGrid &horizVelocityGrid, const FieldGrid &vertVelocityGrid, int xDim, int yDim, vector<float> &rhs) {
+	buildRHSKernel<0, 0>(horizVelocityGrid, vertVelocityGrid, xDim, yDim, rhs);
+}
+
+void addGravity(FieldGrid &vertVelocityGrid, int xDim, int yDim, float deltaT) {
+	addGravityKernel<0, 0>(vertVelocityGrid, xDim, yDim, deltaT);
 }
 
 
 /*
-	horizVelocityGrid: 2D vector of floats; holds vertical horizontal components at 1/2 indices
-	vertVelocityGrid: 2D vector of floats; holds vertical velocity components at 1/2 indices
-	i: integer; index for ith row
-	j: integer; index for jth column
+	horizVelocityGrid: FieldGrid; holds horizontal velocity components at 1/2 indices
+	vertVelocityGrid: FieldGrid; holds vertical velocity components at 1/2 indices
+	xDim: int; number of cells in x direction
+	yDim: int; number of cells in y direction
 
-	Return type: vector<float>* of size 2
+	Return type: float; largest |divergence| of any cell, the quantity buildRHS() negates
 */
-vector<float>* rightSideVel(const vector< vector<float> > &horizVelocityGrid, const vector< vector<float> > &vertVelocityGrid, int i, int j) {
-	/*
-	Returns x and y components of velocity at right side of the cell.
-	Averages the vertical velocities at the top and bottoms of the cells to the left and right.
-	*/
-	float horizComponent = correctHVGet(horizVelocityGrid, i+.5, j);\
-
-	float vertComponentNumerator1 = correctVVGet(vertVelocityGrid, i, j-.5) + correctVVGet(vertVelocityGrid, i, j+.5);
-	float vertComponentNumerator2 = correctVVGet(vertVelocityGrid, i+1, j-.5) + correctVVGet(vertVelocityGrid, i+1, j+.5);
-	float vertComponent = (vertComponentNumerator1 + vertComponentNumerator2) / 4;
-	return new vector<float> {horizComponent, vertComponent};
+float maxDivergence(const FieldGrid &horizVelocityGrid, const FieldGrid &vertVelocityGrid, int xDim, int yDim) {
+	float largest = 0.0;
+	for (int y = 0; y < yDim; y++) {
+		for (int x = 0; x < xDim; x++) {
+			float divergence = horizVelocityGrid(x + 1, y) - horizVelocityGrid(x, y) + vertVelocityGrid(x, y + 1) - vertVelocityGrid(x, y);
+			largest = fmax(largest, fabs(divergence));
+		}
+	}
+	return largest;
 }
 
 /*
-	horizVelocityGrid: 2D vector of floats; holds vertical horizontal components at 1/2 indices
-	vertVelocityGrid: 2D vector of floats; holds vertical velocity components at 1/2 indices
-	i: integer; index for ith row
-	j: integer; index for jth column
+	horizVelocityGrid: FieldGrid; holds horizontal velocity components at 1/2 indices
+	vertVelocityGrid: FieldGrid; holds vertical velocity components at 1/2 indices
+	xDim: int; number of cells in x direction
+	yDim: int; number of cells in y direction
 
-	Return type: vector<float>* of size 2
+	Return type: float; largest |velocity| on any face, in cells per unit time
 */
-vector<float>* topSideVel(const vector< vector<float> > &horizVelocityGrid, const vector< vector<float> > &vertVelocityGrid, int i, int j) {
-	/*
-	Returns x and y components of velocity at top side of the cell.
-	Averages the horizontal velocities at the left and right of the cells to the top and bottom.
-	*/
-	float horizComponentNumerator1 = correctHVGet(horizVelocityGrid, i-.5, j) + correctHVGet(horizVelocityGrid, i+.5, j);
-	float horizComponentNumerator2 = correctHVGet(horizVelocityGrid, i-.5, j+1) + correctHVGet(horizVelocityGrid, i+.5, j+1);
-	float horizComponent = (horizComponentNumerator1 + horizComponentNumerator2) / 4;
-
-	float vertComponent = correctVVGet(vertVelocityGrid, i, j+.5);
-	return new vector<float> {horizComponent, vertComponent};
-}
-
-
-// Based off of repo here: https://github.com/tunabrain/incremental-fluids.git
-void project(vector< vector<float> > &pressureGrid, double deltaT, int width, int height, vector<float> &rhs) {
-	int index = 0;
-	double diagonal = 0.0, offDiagonal = 0.0, newPressure = 0.0;
-
-    for (int y = 0, index = 0; y < height; y++) {
-        for (int x = 0; x < width; x++) {
-            index = x + y*width;
-
-            diagonal = 0.0;
-			offDiagonal = 0.0;
-
-            if (x > 0) {
-                diagonal    += deltaT;
-                offDiagonal -= deltaT * pressureGrid.at(y).at(x-1);
-            }
-            if (y > 0) {
-                diagonal    += deltaT;
-                offDiagonal -= deltaT * pressureGrid.at(y-1).at(x);
-            }
-            if (x < width - 1) {
-                diagonal    += deltaT;
-                offDiagonal -= deltaT * pressureGrid.at(y).at(x+1);
-            }
-            if (y < height - 1) {
-                diagonal    += deltaT;
-                offDiagonal -= deltaT * pressureGrid.at(y+1).at(x);
-            }
-
-            newPressure = (rhs.at(index) - offDiagonal) / diagonal;
-            pressureGrid.at(y).at(x) = newPressure;
-        }
-    }
-}
-
-// Based off of repo here: https://github.com/tunabrain/incremental-fluids.git
-void applyPressure(const vector< vector<float> > &pressureGrid, vector< vector<float> > &horizVelocityGrid, vector< vector<float> > &vertVelocityGrid, double deltaT, int xDim, int yDim) {
-    for (int y = 0; y < yDim; y++) {
-        for (int x = 0; x < xDim; x++) {
-            horizVelocityGrid.at(x).at(y) -= deltaT * pressureGrid.at(y).at(x);
-            horizVelocityGrid.at(x + 1).at(y) += deltaT * pressureGrid.at(y).at(x);
-            vertVelocityGrid.at(x).at(y) -= deltaT * pressureGrid.at(y).at(x);
-            vertVelocityGrid.at(x).at(y+ 1) += deltaT * pressureGrid.at(y).at(x);
-        }
-    }
-
-	// Bound the liquid to edges of screen
-    for (int y = 0; y < yDim; y++) {
-        horizVelocityGrid.at(0).at(y) = 0.0;
-		horizVelocityGrid.at(xDim).at(y) = 0.0;
+float maxVelocity(const FieldGrid &horizVelocityGrid, const FieldGrid &vertVelocityGrid, int xDim, int yDim) {
+	float largest = 0.0;
+	for (int i = 0; i <= xDim; ++i) {
+		for (int j = 0; j < yDim; ++j) {
+			largest = fmax(largest, fabs(horizVelocityGrid(i, j)));
+		}
 	}
-    for (int x = 0; x < xDim; x++) {
-        vertVelocityGrid.at(x).at(0) = 0.0;
-		vertVelocityGrid.at(x).at(yDim) = 0.0;
+	for (int i = 0; i < xDim; ++i) {
+		for (int j = 0; j <= yDim; ++j) {
+			largest = fmax(largest, fabs(vertVelocityGrid(i, j)));
+		}
 	}
+	return largest;
 }
 
-// Based off of repo here: https://github.com/tunabrain/incremental-fluids.git
-vector<float>* buildRHS(const vector< vector<float> > &horizVelocityGrid, const vector< vector<float> > &vertVelocityGrid, int xDim, int yDim) {
-	vector<float>* rhs = new vector<float>;
-	float term1 = 0.0, term2 = 0.0;
-
-    for (int y = 0; y < yDim; y++) {
-        for (int x = 0; x < xDim; x++) {
-			term1 = horizVelocityGrid.at(x + 1).at(y) - horizVelocityGrid.at(x).at(y);
-			term2 = vertVelocityGrid.at(x).at(y + 1) - vertVelocityGrid.at(x).at(y);
-            rhs->push_back(-1*(term1 + term2));
-        }
-    }
-	return rhs;
-}
+/*
+	maxDeltaT: float; longest substep allowed
+	cfl: double; largest number of cells a face velocity may carry anything in one substep, 0 for no limit
+	maxFaceVelocity: float; maxVelocity() at the start of the substep, in cells per unit time
+	remaining: float; time left until the next frame boundary, > 0
 
-void addGravity(vector< vector<float> > &vertVelocityGrid, int xDim, int yDim, float deltaT) {
-	for(int x = 0; x < xDim; ++x) {
-		for(int y = 0; y < yDim; ++y) {
-			vertVelocityGrid.at(x).at(y) -= deltaT * 9.81;
-		}
+	Return type: float; length of the next substep
+*/
+float cflTimestep(float maxDeltaT, double cfl, float maxFaceVelocity, float remaining) {
+	float deltaT = maxDeltaT;
+	if (cfl > 0) {
+		float limit = cfl / (maxFaceVelocity + sqrt(5 * 9.81));
+		deltaT = fmin(deltaT, limit);
+	}
+	if (deltaT >= remaining) {
+		return remaining;
+	}
+	if (2 * deltaT > remaining) {
+		return remaining / 2;
 	}
+	return deltaT;
 }
@@ -2,14 +2,18 @@
 #define __GRIDFUNCTIONS__
 
 
+#include "mac_grid.h"
+#include "thread_pool.h"
+#include <cstdint>
 #include <vector>
 #include <string>
 using namespace std;
 
 
 /*
-	inputFileName: string; name of input file to be read from
-	Data format: Each row holds space seperated values for that row in toFill.
+	Initial condition files hold one value per grid cell, row i of the grid after row i-1.
+
+	Text format: whitespace separated values, each row of toFill on its own line.
 		row 0 data
 		row 1 data
 		...
@@ -22,114 +26,280 @@ using namespace std;
 		...
 		4 9.6 3 25 28 2.5 ... 3 6
 
-	Return type: vector<float>*
+	Binary format, all fields little-endian:
+		char[4] magic "FLIC"
+		uint32 version; INITIAL_CONDITION_VERSION
+		uint32 rows, cols
+		rows*cols float32, in the same order as the text format
 */
-vector<float>* getInputData(string inputFileName);
+const uint32_t INITIAL_CONDITION_VERSION = 1;
 
 /*
-	toFill: 2D vector of floats; holds default values, needs to be initialized
-	inputFileName: string; file name of the input file
+	toFill: FieldGrid; holds default values, needs to be initialized
+	inputFileName: string; file name of the input file, text or binary
+
+	Maps the file and parses it straight into toFill. The number of values (text) or the
+	rows and cols (binary) must match toFill; otherwise the problem is printed to cerr.
 
 	Altered by reference: toFill
-	Return type: void
+	Return type: bool; false if the file is missing, malformed or does not match toFill
 */
-void fillGrid(vector< vector<float> > &toFill, string inputFileName);
+bool fillGrid(FieldGrid &toFill, string inputFileName);
+
+/*
+	grid: FieldGrid; grid to save
+	outputFileName: string; file to write in the binary initial condition format
+
+	Return type: bool; false if the file could not be written
+*/
+bool saveGrid(const FieldGrid &grid, string outputFileName);
 
 
 /*
-	pressureGrid: 2D vector of floats; holds pressure values
+	pressureGrid: FieldGrid; holds pressure values
 	i: integer; index for ith row
 	j: integer; index for jth column
 
 	Return type: float
 */
-float correctPGet(const vector< vector<float> > &pressureGrid, int i, int j);
+inline float correctPGet(const FieldGrid &pressureGrid, int i, int j) {
+	// Unchecked; used for consistency with horizontal and vertical Velocity getters.
+	return pressureGrid(i, j);
+}
 
 
 /*
-	horizVelocityGrid: 2D vector of floats; holds horizontal velocity components at 1/2 indices
+	horizVelocityGrid: FieldGrid; holds horizontal velocity components at 1/2 indices
 	i: integer; index for ith row
 	j: integer; index for jth column
 
 	Return type: float
 */
-float correctHVGet(const vector< vector<float> > &horizVelocityGrid, int i, int j);
+inline float correctHVGet(const FieldGrid &horizVelocityGrid, int i, int j) {
+	// Unchecked; expects i to be a half index Ex: 4-.5, truncated by the call then shifted by 1.
+	return horizVelocityGrid(i+1, j);
+}
 
 
 /*
-	verticalVelocityGrid: 2D vector of floats; holds vertical velocity components at 1/2 indices
+	verticalVelocityGrid: FieldGrid; holds vertical velocity components at 1/2 indices
 	i: integer; index for ith row
 	j: integer; index for jth column
 
 	Return type: float
 */
-float correctVVGet(const vector< vector<float> > &verticalVelocityGrid, int i, int j);
+inline float correctVVGet(const FieldGrid &verticalVelocityGrid, int i, int j) {
+	// Unchecked; expects j to be a half index Ex: 4-.5, truncated by the call then shifted by 1.
+	return verticalVelocityGrid(i, j+1);
+}
+
+
+/*
+	Velocity sampled at one point of the grid, returned by value so the stencil
+	accessors below never touch the heap.
+*/
+struct Vec2 {
+	float x;
+	float y;
+};
 
 
 /*
-	horizVelocityGrid: 2D vector of floats; holds horizontal velocity components at 1/2 indices
+	horizVelocityGrid: FieldGrid; holds horizontal velocity components at 1/2 indices
 	i: integer; index for ith row
 	j: integer; index for jth column
 
 	Return type: float
 */
-float horCenterVel(const vector< vector<float> > &horizVelocityGrid, int i, int j);
+inline float horCenterVel(const FieldGrid &horizVelocityGrid, int i, int j) {
+	/*
+	Returns horizontal velocity at center of grid cell.
+	Averages horizontal velocities at left and right sides of the cell.
+	*/
+	float numeratorTerm1 = correctHVGet(horizVelocityGrid, i-.5, j);
+	float numeratorTerm2 = correctHVGet(horizVelocityGrid, i+.5, j);
+	return (numeratorTerm1 + numeratorTerm2) / 2;
+}
 
 
 /*
-	vertVelocityGrid: 2D vector of floats; holds vertical velocity components at 1/2 indices
+	vertVelocityGrid: FieldGrid; holds vertical velocity components at 1/2 indices
 	i: integer; index for ith row
 	j: integer; index for jth column
 
 	Return type: float
 */
-float verCenterVel(const vector< vector<float> > &vertVelocityGrid, int i, int j);
+inline float verCenterVel(const FieldGrid &vertVelocityGrid, int i, int j) {
+	/*
+	Returns vertical velocity at center of grid cell.
+	Averages vertical velocities at top and bottom sides of the cell.
+	*/
+	float numeratorTerm1 = correctVVGet(vertVelocityGrid, i, j-.5);
+	float numeratorTerm2 = correctVVGet(vertVelocityGrid, i, j+.5);
+	return (numeratorTerm1 + numeratorTerm2) / 2;
+}
 
 
 /*
-	horizVelocityGrid: 2D vector of floats; holds vertical horizontal components at 1/2 indices
-	vertVelocityGrid: 2D vector of floats; holds vertical velocity components at 1/2 indices
+	horizVelocityGrid: FieldGrid; holds vertical horizontal components at 1/2 indices
+	vertVelocityGrid: FieldGrid; holds vertical velocity components at 1/2 indices
 	i: integer; index for ith row
 	j: integer; index for jth column
 
-	Return type: vector<float>* of size 2
+	Return type: Vec2
 */
-vector<float>* centerVel(const vector< vector<float> > &horizVelocityGrid, const vector< vector<float> > &vertVelocityGrid, int i, int j);
+inline Vec2 centerVel(const FieldGrid &horizVelocityGrid, const FieldGrid &vertVelocityGrid, int i, int j) {
+	/*
+	Returns x and y components of velocity at center of the cell
+	*/
+	Vec2 velocity = {horCenterVel(horizVelocityGrid, i, j), verCenterVel(vertVelocityGrid, i, j)};
+	return velocity;
+}
 
 
 /*
-	horizVelocityGrid: 2D vector of floats; holds vertical horizontal components at 1/2 indices
-	vertVelocityGrid: 2D vector of floats; holds vertical velocity components at 1/2 indices
+	horizVelocityGrid: FieldGrid; holds vertical horizontal components at 1/2 indices
+	vertVelocityGrid: FieldGrid; holds vertical velocity components at 1/2 indices
 	i: integer; index for ith row
 	j: integer; index for jth column
 
-	Return type: vector<float>* of size 2
+	Return type: Vec2
 */
-vector<float>* rightSideVel(const vector< vector<float> > &horizVelocityGrid, const vector< vector<float> > &vertVelocityGrid, int i, int j);
+inline Vec2 rightSideVel(const FieldGrid &horizVelocityGrid, const FieldGrid &vertVelocityGrid, int i, int j) {
+	/*
+	Returns x and y components of velocity at right side of the cell.
+	Averages the vertical velocities at the top and bottoms of the cells to the left and right.
+	*/
+	float horizComponent = correctHVGet(horizVelocityGrid, i+.5, j);
+
+	float vertComponentNumerator1 = correctVVGet(vertVelocityGrid, i, j-.5) + correctVVGet(vertVelocityGrid, i, j+.5);
+	float vertComponentNumerator2 = correctVVGet(vertVelocityGrid, i+1, j-.5) + correctVVGet(vertVelocityGrid, i+1, j+.5);
+	float vertComponent = (vertComponentNumerator1 + vertComponentNumerator2) / 4;
+	Vec2 velocity = {horizComponent, vertComponent};
+	return velocity;
+}
 
 
 /*
-	horizVelocityGrid: 2D vector of floats; holds vertical horizontal components at 1/2 indices
-	vertVelocityGrid: 2D vector of floats; holds vertical velocity components at 1/2 indices
+	horizVelocityGrid: FieldGrid; holds vertical horizontal components at 1/2 indices
+	vertVelocityGrid: FieldGrid; holds vertical velocity components at 1/2 indices
 	i: integer; index for ith row
 	j: integer; index for jth column
 
-	Return type: vector<float>* of size 2
+	Return type: Vec2
 */
-vector<float>* topSideVel(const vector< vector<float> > &horizVelocityGrid, const vector< vector<float> > &vertVelocityGrid, int i, int j);
+inline Vec2 topSideVel(const FieldGrid &horizVelocityGrid, const FieldGrid &vertVelocityGrid, int i, int j) {
+	/*
+	Returns x and y components of velocity at top side of the cell.
+	Averages the horizontal velocities at the left and right of the cells to the top and bottom.
+	*/
+	float horizComponentNumerator1 = correctHVGet(horizVelocityGrid, i-.5, j) + correctHVGet(horizVelocityGrid, i+.5, j);
+	float horizComponentNumerator2 = correctHVGet(horizVelocityGrid, i-.5, j+1) + correctHVGet(horizVelocityGrid, i+.5, j+1);
+	float horizComponent = (horizComponentNumerator1 + horizComponentNumerator2) / 4;
+
+	float vertComponent = correctVVGet(vertVelocityGrid, i, j+.5);
+	Vec2 velocity = {horizComponent, vertComponent};
+	return velocity;
+}
 
-void addGravity(vector< vector<float> > &vertVelocityGrid, int xDim, int yDim, float deltaT);
+void addGravity(FieldGrid &vertVelocityGrid, int xDim, int yDim, float deltaT);
 
 
 // Based off of repo here: https://github.com/tunabrain/incremental-fluids.git
-void project(vector< vector<float> > &pressureGrid, double deltaT, int width, int height, vector<float> &rhs);
+void project(FieldGrid &pressureGrid, double deltaT, int width, int height, vector<float> &rhs);
 
 
-// Based off of repo here: https://github.com/tunabrain/incremental-fluids.git
-void applyPressure(const vector< vector<float> > &pressureGrid, vector< vector<float> > &horizVelocityGrid, vector< vector<float> > &vertVelocityGrid, double deltaT, int xDim, int yDim);
+/*
+	pressureGrid: FieldGrid; holds pressure values
+	deltaT: double; time step the system is scaled by
+	width: int; number of cells in x direction
+	height: int; number of cells in y direction
+	rhs: vector of floats; negative divergence from buildRHS(), indexed x + y*width
+	omega: double; relaxation factor, 1 is plain Gauss-Seidel, between 1 and 2 over-relaxes
+	sweeps: int; number of red-black sweeps to run
+	executor: Executor; runs the rows of each colour
+
+	Same update as project(), but cells are visited in two colours, (x+y) even then odd.
+	A cell only reads cells of the other colour, so every row of a colour can run in parallel.
+
+	Altered by reference: pressureGrid
+	Return type: void
+*/
+void projectRedBlack(FieldGrid &pressureGrid, double deltaT, int width, int height, const vector<float> &rhs, double omega, int sweeps, Executor &executor);
 
 
-// Based off of repo here: https://github.com/tunabrain/incremental-fluids.git
-vector<float>* buildRHS(const vector< vector<float> > &horizVelocityGrid, const vector< vector<float> > &vertVelocityGrid, int xDim, int yDim);
+/*
+	pressureGrid: FieldGrid; holds pressure values
+	horizVelocityGrid: FieldGrid; holds horizontal velocity components at 1/2 indices
+	vertVelocityGrid: FieldGrid; holds vertical velocity components at 1/2 indices
+	deltaT: double; time step the system is scaled by
+	xDim: int; number of cells in x direction
+	yDim: int; number of cells in y direction
+
+	Subtracts the pressure gradient and zeroes the wall faces. The largest face velocity is
+	reduced in the same pass, so cflTimestep() gets it without another sweep over the grid.
+	Based off of repo here: https://github.com/tunabrain/incremental-fluids.git
+
+	Altered by reference: horizVelocityGrid and vertVelocityGrid
+	Return type: float; maxVelocity() of the updated grids
+*/
+float applyPressure(const FieldGrid &pressureGrid, FieldGrid &horizVelocityGrid, FieldGrid &vertVelocityGrid, double deltaT, int xDim, int yDim);
+
+
+/*
+	horizVelocityGrid: FieldGrid; holds horizontal velocity components at 1/2 indices
+	vertVelocityGrid: FieldGrid; holds vertical velocity components at 1/2 indices
+	xDim: int; number of cells in x direction
+	yDim: int; number of cells in y direction
+	rhs: vector of floats; receives the negative divergence, indexed x + y*xDim
+
+	The wall faces are read as 0, as applyPressure() leaves them, so the solve makes the edge
+	cells divergence-free too; see wallCellRHS() in step_kernels.h.
+	rhs is only resized when its size is wrong, so a buffer kept across substeps is reused.
+	Based off of repo here: https://github.com/tunabrain/incremental-fluids.git
+
+	Altered by reference: rhs
+	Return type: void
+*/
+void buildRHS(const FieldGrid &horizVelocityGrid, const FieldGrid &vertVelocityGrid, int xDim, int yDim, vector<float> &rhs);
+
+
+/*
+	horizVelocityGrid: FieldGrid; holds horizontal velocity components at 1/2 indices
+	vertVelocityGrid: FieldGrid; holds vertical velocity components at 1/2 indices
+	xDim: int; number of cells in x direction
+	yDim: int; number of cells in y direction
+
+	Return type: float; largest |divergence| of any cell, the quantity buildRHS() negates
+*/
+float maxDivergence(const FieldGrid &horizVelocityGrid, const FieldGrid &vertVelocityGrid, int xDim, int yDim);
+
+
+/*
+	horizVelocityGrid: FieldGrid; holds horizontal velocity components at 1/2 indices
+	vertVelocityGrid: FieldGrid; holds vertical velocity components at 1/2 indices
+	xDim: int; number of cells in x direction
+	yDim: int; number of cells in y direction
+
+	Cells are one unit wide, so deltaT times this is the CFL number of a step.
+	Return type: float; largest |velocity| on any face, in cells per unit time
+*/
+float maxVelocity(const FieldGrid &horizVelocityGrid, const FieldGrid &vertVelocityGrid, int xDim, int yDim);
+
+
+/*
+	maxDeltaT: float; longest substep allowed
+	cfl: double; largest number of cells a face velocity may carry anything in one substep, 0 for no limit
+	maxFaceVelocity: float; maxVelocity() at the start of the substep, in cells per unit time
+	remaining: float; time left until the next frame boundary, > 0
+
+	Gravity speeds the flow up during the substep, so the limit uses maxFaceVelocity + sqrt(5*9.81)
+	(Bridson, Fluid Simulation for Computer Graphics). The last substep of a frame is exactly
+	remaining, and a remainder shorter than two substeps is split into two equal ones instead
+	of leaving a sliver.
+
+	Return type: float; length of the next substep
+*/
+float cflTimestep(float maxDeltaT, double cfl, float maxFaceVelocity, float remaining);
 
 #endif
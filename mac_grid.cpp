@@ -0,0 +1,140 @@
+#include "mac_grid.h"
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <utility>
+
+
+FieldGrid::FieldGrid() : numRows(0), numCols(0), rowOffset(0), colOffset(0), stride(0), numElements(0), buffer(0), origin(0) {}
+
+/*
+	rows: int; number of interior rows
+	cols: int; number of interior columns
+	initValue: float; value every interior cell starts with, ghost cells start at 0
+*/
+FieldGrid::FieldGrid(int rows, int cols, float initValue) : buffer(0), origin(0) {
+	allocate(rows, cols, 0, 0);
+	fill(initValue);
+}
+
+/*
+	rows: int; number of rows held
+	cols: int; number of columns held
+	initValue: float; value every held cell starts with, ghost cells start at 0
+	firstRow: int; index of the first held row in the whole grid
+	firstCol: int; index of the first held column in the whole grid
+*/
+FieldGrid::FieldGrid(int rows, int cols, float initValue, int firstRow, int firstCol) : buffer(0), origin(0) {
+	allocate(rows, cols, firstRow, firstCol);
+	fill(initValue);
+}
+
+FieldGrid::FieldGrid(const FieldGrid &other) : buffer(0), origin(0) {
+	allocate(other.numRows, other.numCols, other.rowOffset, other.colOffset);
+	memcpy(buffer, other.buffer, numElements * sizeof(float));
+}
+
+FieldGrid& FieldGrid::operator=(const FieldGrid &other) {
+	/*
+	Copies other's values. Reuses the existing buffer when the shapes match.
+	*/
+	if (this == &other) {
+		return *this;
+	}
+	if (numRows != other.numRows || numCols != other.numCols || rowOffset != other.rowOffset || colOffset != other.colOffset) {
+		release();
+		allocate(other.numRows, other.numCols, other.rowOffset, other.colOffset);
+	}
+	memcpy(buffer, other.buffer, numElements * sizeof(float));
+	return *this;
+}
+
+FieldGrid::~FieldGrid() {
+	release();
+}
+
+/*
+	other: FieldGrid by reference; grid to exchange buffers with
+
+	Swaps storage in O(1), no element is copied.
+	Return type: void
+*/
+void FieldGrid::swap(FieldGrid &other) {
+	std::swap(numRows, other.numRows);
+	std::swap(numCols, other.numCols);
+	std::swap(rowOffset, other.rowOffset);
+	std::swap(colOffset, other.colOffset);
+	std::swap(stride, other.stride);
+	std::swap(numElements, other.numElements);
+	std::swap(buffer, other.buffer);
+	std::swap(origin, other.origin);
+}
+
+/*
+	value: float; value to write into every interior cell
+
+	Return type: void
+*/
+void FieldGrid::fill(float value) {
+	for (int i = rowOffset; i < rowOffset + numRows; ++i) {
+		float* r = row(i);
+		for (int j = colOffset; j < colOffset + numCols; ++j) {
+			r[j] = value;
+		}
+	}
+}
+
+/*
+	firstRow: int; index in the whole grid the first held row now stands for
+	firstCol: int; index in the whole grid the first held column now stands for
+
+	Return type: void
+*/
+void FieldGrid::moveWindow(int firstRow, int firstCol) {
+	origin += (ptrdiff_t)(rowOffset - firstRow)*stride + (colOffset - firstCol);
+	rowOffset = firstRow;
+	colOffset = firstCol;
+}
+
+/*
+	rows: int; number of interior rows
+	cols: int; number of interior columns
+	firstRow: int; index of the first interior row
+	firstCol: int; index of the first interior column
+
+	Return type: void
+*/
+void FieldGrid::allocate(int rows, int cols, int firstRow, int firstCol) {
+	/*
+	Allocates one cache line aligned buffer holding the interior, the ghost ring and row padding.
+	Each row leads with ROW_ALIGN floats (the last GHOST of them are ghosts) so the first
+	interior cell of every row is aligned. Every cell, including ghosts and padding, starts zeroed.
+	For a window, origin is where element (0,0) of the whole grid would be, so it may lie outside the buffer.
+	*/
+	numRows = rows;
+	numCols = cols;
+	rowOffset = firstRow;
+	colOffset = firstCol;
+	stride = strideFor(cols);
+	numElements = (size_t)(rows + 2*GHOST) * stride;
+
+	buffer = static_cast<float*>(aligned_alloc(ROW_ALIGN * sizeof(float), numElements * sizeof(float)));
+	if (!buffer) {
+		throw bad_alloc();
+	}
+	memset(buffer, 0, numElements * sizeof(float));
+	origin = buffer + GHOST*stride + ROW_ALIGN - (ptrdiff_t)firstRow*stride - firstCol;
+}
+
+void FieldGrid::release() {
+	free(buffer);
+	buffer = 0;
+	origin = 0;
+}
+
+
+MacGrid::MacGrid(int xDim, int yDim, float initValue)
+	: xDim(xDim), yDim(yDim),
+	  horizVelocity(xDim+1, yDim, initValue),
+	  vertVelocity(xDim, yDim+1, initValue),
+	  pressure(yDim, xDim, initValue) {}
@@ -0,0 +1,124 @@
+#ifndef __MACGRID__
+#define __MACGRID__
+
+
+#include <cstddef>
+using namespace std;
+
+
+/*
+	One component of the staggered MAC grid stored in a single contiguous buffer.
+
+	Element (i,j) lives at origin[i*stride + j], where origin points past a ring of
+	GHOST ghost cells. Rows are padded to a multiple of ROW_ALIGN floats and the
+	buffer is cache line aligned, so the first interior cell of every row is aligned.
+	Accessors are unchecked; ghost cells may be read at i or j in [-GHOST, -1] and
+	[rows, rows+GHOST-1] / [cols, cols+GHOST-1].
+
+	A window holds only rows [firstRow, firstRow+rows) and columns [firstCol, firstCol+cols)
+	of a larger grid, addressed by their indices in that grid, so the same kernels run on a
+	slab of the domain (see distributed.h). Its ghost ring surrounds the window.
+*/
+class FieldGrid {
+public:
+	static const int GHOST = 1;
+	static const int ROW_ALIGN = 16;
+
+	FieldGrid();
+
+	/*
+		rows: int; number of interior rows
+		cols: int; number of interior columns
+		initValue: float; value every interior cell starts with, ghost cells start at 0
+	*/
+	FieldGrid(int rows, int cols, float initValue);
+
+	/*
+		rows: int; number of rows held
+		cols: int; number of columns held
+		initValue: float; value every held cell starts with, ghost cells start at 0
+		firstRow: int; index of the first held row in the whole grid
+		firstCol: int; index of the first held column in the whole grid
+	*/
+	FieldGrid(int rows, int cols, float initValue, int firstRow, int firstCol);
+	FieldGrid(const FieldGrid &other);
+	FieldGrid& operator=(const FieldGrid &other);
+	~FieldGrid();
+
+	/*
+		other: FieldGrid by reference; grid to exchange buffers with
+
+		Swaps storage in O(1), no element is copied.
+		Return type: void
+	*/
+	void swap(FieldGrid &other);
+
+	/*
+		value: float; value to write into every interior cell
+
+		Return type: void
+	*/
+	void fill(float value);
+
+	/*
+		firstRow: int; index in the whole grid the first held row now stands for
+		firstCol: int; index in the whole grid the first held column now stands for
+
+		Moves a window over the whole grid in O(1); the values it holds stay, now at the new indices.
+		Return type: void
+	*/
+	void moveWindow(int firstRow, int firstCol);
+
+	inline float& operator()(int i, int j) { return origin[i*stride + j]; }
+	inline const float& operator()(int i, int j) const { return origin[i*stride + j]; }
+
+	inline float* row(int i) { return origin + i*stride; }
+	inline const float* row(int i) const { return origin + i*stride; }
+
+	inline int rows() const { return numRows; }
+	inline int cols() const { return numCols; }
+	inline int firstRow() const { return rowOffset; }
+	inline int firstCol() const { return colOffset; }
+	inline int rowStride() const { return stride; }
+
+	/*
+		cols: int; number of interior columns
+
+		Return type: int; rowStride() of any grid with cols columns, usable as a compile-time constant
+	*/
+	static constexpr int strideFor(int cols) {
+		return ROW_ALIGN + ((cols + GHOST + ROW_ALIGN - 1) / ROW_ALIGN) * ROW_ALIGN;
+	}
+
+private:
+	void allocate(int rows, int cols, int firstRow, int firstCol);
+	void release();
+
+	int numRows;
+	int numCols;
+	int rowOffset;
+	int colOffset;
+	int stride;
+	size_t numElements;
+	float* buffer;
+	float* origin;
+};
+
+
+/*
+	Staggered MAC grid for an xDim by yDim domain.
+	horizVelocity: (xDim+1) x yDim; horizontal components on the left/right cell faces, indexed (x,y)
+	vertVelocity: xDim x (yDim+1); vertical components on the bottom/top cell faces, indexed (x,y)
+	pressure: yDim x xDim; cell centred pressure, indexed (y,x) as the pressure solve expects
+*/
+struct MacGrid {
+	MacGrid(int xDim, int yDim, float initValue);
+
+	int xDim;
+	int yDim;
+	FieldGrid horizVelocity;
+	FieldGrid vertVelocity;
+	FieldGrid pressure;
+};
+
+#endif
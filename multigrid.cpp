@@ -0,0 +1,254 @@
+#include "multigrid.h"
+#include "trace.h"
+#include <cmath>
+
+
+namespace {
+
+// Smoothing sweeps before and after the coarse grid correction.
+const int PRE_SWEEPS = 2;
+const int POST_SWEEPS = 2;
+// Stop coarsening once a level has at most this many cells, then relax it to convergence.
+const int COARSEST_CELLS = 16;
+const int COARSEST_SWEEPS = 64;
+
+}
+
+
+/*
+	width: int; number of cells in x direction
+	height: int; number of cells in y direction
+*/
+MultigridSolver::MultigridSolver(int width, int height) {
+	/*
+	Builds the grid hierarchy, halving (rounding up) each dimension per level.
+	*/
+	while (true) {
+		Level level;
+		level.width = width;
+		level.height = height;
+		level.solution.assign(width * height, 0.0);
+		level.rhs.assign(width * height, 0.0);
+		level.residual.assign(width * height, 0.0);
+		levels.push_back(level);
+
+		if (width * height <= COARSEST_CELLS) {
+			break;
+		}
+		width = (width + 1) / 2;
+		height = (height + 1) / 2;
+	}
+}
+
+void MultigridSolver::smooth(Level &level, int sweeps) {
+	/*
+	Red-black Gauss-Seidel on L * solution = rhs. Cells of one colour only read cells of the other.
+	*/
+	int width = level.width, height = level.height;
+	vector<double> &u = level.solution;
+	const vector<double> &f = level.rhs;
+
+	for (int sweep = 0; sweep < sweeps; ++sweep) {
+		for (int color = 0; color < 2; ++color) {
+			for (int y = 0; y < height; y++) {
+				for (int x = (y + color) % 2; x < width; x += 2) {
+					int index = x + y*width;
+					double diagonal = 0.0, neighbours = 0.0;
+
+					if (x > 0) {
+						diagonal   += 1.0;
+						neighbours += u[index - 1];
+					}
+					if (y > 0) {
+						diagonal   += 1.0;
+						neighbours += u[index - width];
+					}
+					if (x < width - 1) {
+						diagonal   += 1.0;
+						neighbours += u[index + 1];
+					}
+					if (y < height - 1) {
+						diagonal   += 1.0;
+						neighbours += u[index + width];
+					}
+
+					if (diagonal > 0.0) {
+						u[index] = (f[index] + neighbours) / diagonal;
+					}
+				}
+			}
+		}
+	}
+}
+
+double MultigridSolver::computeResidual(Level &level) {
+	/*
+	residual = rhs - L * solution. Returns max|residual|.
+	*/
+	int width = level.width, height = level.height;
+	const vector<double> &u = level.solution;
+	double largest = 0.0;
+
+	for (int y = 0; y < height; y++) {
+		for (int x = 0; x < width; x++) {
+			int index = x + y*width;
+			double diagonal = 0.0, neighbours = 0.0;
+
+			if (x > 0) {
+				diagonal   += 1.0;
+				neighbours += u[index - 1];
+			}
+			if (y > 0) {
+				diagonal   += 1.0;
+				neighbours += u[index - width];
+			}
+			if (x < width - 1) {
+				diagonal   += 1.0;
+				neighbours += u[index + 1];
+			}
+			if (y < height - 1) {
+				diagonal   += 1.0;
+				neighbours += u[index + width];
+			}
+
+			level.residual[index] = level.rhs[index] - (diagonal * u[index] - neighbours);
+			largest = fmax(largest, fabs(level.residual[index]));
+		}
+	}
+	return largest;
+}
+
+void MultigridSolver::restrictResidual(const Level &fine, Level &coarse) {
+	/*
+	Coarse rhs is the sum of the fine residuals in its block: the average of the block,
+	scaled by 4 because the coarse cells are twice as wide. Summing keeps a zero mean
+	residual zero mean, including the partial blocks along odd sized edges.
+	*/
+	for (size_t index = 0; index < coarse.rhs.size(); ++index) {
+		coarse.rhs[index] = 0.0;
+	}
+	for (int y = 0; y < fine.height; y++) {
+		for (int x = 0; x < fine.width; x++) {
+			coarse.rhs[x/2 + (y/2)*coarse.width] += fine.residual[x + y*fine.width];
+		}
+	}
+}
+
+void MultigridSolver::prolongCorrection(const Level &coarse, Level &fine) {
+	/*
+	Adds the bilinearly interpolated coarse solution to the fine solution. Each fine cell
+	sits in a quarter of its parent and blends in the two parents' neighbours on that side,
+	falling back to the parent itself at the walls.
+	*/
+	const vector<double> &c = coarse.solution;
+	for (int y = 0; y < fine.height; y++) {
+		int cy = y / 2;
+		int ny = cy + ((y % 2) ? 1 : -1);
+		if (ny < 0 || ny >= coarse.height) {
+			ny = cy;
+		}
+		for (int x = 0; x < fine.width; x++) {
+			int cx = x / 2;
+			int nx = cx + ((x % 2) ? 1 : -1);
+			if (nx < 0 || nx >= coarse.width) {
+				nx = cx;
+			}
+
+			double correction = 9.0 * c[cx + cy*coarse.width]
+				+ 3.0 * c[nx + cy*coarse.width]
+				+ 3.0 * c[cx + ny*coarse.width]
+				+ 1.0 * c[nx + ny*coarse.width];
+			fine.solution[x + y*fine.width] += correction / 16.0;
+		}
+	}
+}
+
+void MultigridSolver::vCycle(int level) {
+	/*
+	One V-cycle starting at the given level, recursing to the coarsest.
+	*/
+	Level &current = levels[level];
+
+	if (level == (int)levels.size() - 1) {
+		smooth(current, COARSEST_SWEEPS);
+
+		// The coarsest correction is only defined up to a constant.
+		double mean = 0.0;
+		for (size_t index = 0; index < current.solution.size(); ++index) {
+			mean += current.solution[index];
+		}
+		mean /= current.solution.size();
+		for (size_t index = 0; index < current.solution.size(); ++index) {
+			current.solution[index] -= mean;
+		}
+		return;
+	}
+
+	Level &coarse = levels[level + 1];
+	smooth(current, PRE_SWEEPS);
+	computeResidual(current);
+	restrictResidual(current, coarse);
+	for (size_t index = 0; index < coarse.solution.size(); ++index) {
+		coarse.solution[index] = 0.0;
+	}
+	vCycle(level + 1);
+	prolongCorrection(coarse, current);
+	smooth(current, POST_SWEEPS);
+}
+
+/*
+	pressureGrid: FieldGrid; holds pressure values, used as the initial guess
+	deltaT: double; time step the system is scaled by
+	rhs: vector of floats; negative divergence from buildRHS(), indexed x + y*width
+	tolerance: double; stop once max|residual| <= tolerance * max|rhs|
+	maxCycles: int; stop after this many V-cycles even if not converged
+
+	Altered by reference: pressureGrid
+	Return type: SolveStats; iterations counts V-cycles
+*/
+SolveStats MultigridSolver::solve(FieldGrid &pressureGrid, double deltaT, const vector<float> &rhs, double tolerance, int maxCycles) {
+	/*
+	Solves L * pressure = rhs / deltaT, warm started from pressureGrid.
+	As in PCGSolver the mean of rhs is removed so the closed box system has a solution.
+	*/
+	TRACE_SCOPE("multigridSolve");
+	SolveStats stats = {0, 0.0};
+	Level &finest = levels[0];
+	int width = finest.width, height = finest.height;
+	int numCells = width * height;
+
+	double mean = 0.0;
+	for (int index = 0; index < numCells; ++index) {
+		mean += rhs[index];
+	}
+	mean /= numCells;
+
+	double target = 0.0;
+	for (int index = 0; index < numCells; ++index) {
+		finest.rhs[index] = (rhs[index] - mean) / deltaT;
+		target = fmax(target, fabs(finest.rhs[index]));
+	}
+	target *= tolerance;
+
+	for (int y = 0; y < height; y++) {
+		for (int x = 0; x < width; x++) {
+			finest.solution[x + y*width] = pressureGrid(y, x);
+		}
+	}
+
+	double residualNorm = computeResidual(finest);
+	while (residualNorm > target && stats.iterations < maxCycles) {
+		vCycle(0);
+		residualNorm = computeResidual(finest);
+		stats.iterations++;
+	}
+
+	for (int y = 0; y < height; y++) {
+		for (int x = 0; x < width; x++) {
+			pressureGrid(y, x) = finest.solution[x + y*width];
+		}
+	}
+
+	stats.residual = residualNorm * deltaT;
+	return stats;
+}
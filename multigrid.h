@@ -0,0 +1,58 @@
+#ifndef __MULTIGRID__
+#define __MULTIGRID__
+
+
+#include "mac_grid.h"
+#include "pressure_solver.h"
+#include <vector>
+using namespace std;
+
+
+/*
+	Geometric multigrid V-cycle solver for the pressure Poisson system built by buildRHS().
+	Solves the same deltaT * L * pressure = rhs system as project() and PCGSolver.
+
+	Levels are cell centred: each coarse cell covers a 2x2 block of fine cells, so a level of
+	width w has (w+1)/2 coarse cells and xDim/yDim need not be powers of two. Residuals are
+	restricted by summing the block, corrections are prolonged bilinearly and every level is
+	smoothed with red-black Gauss-Seidel. All levels are allocated up front.
+*/
+class MultigridSolver {
+public:
+	/*
+		width: int; number of cells in x direction
+		height: int; number of cells in y direction
+	*/
+	MultigridSolver(int width, int height);
+
+	/*
+		pressureGrid: FieldGrid; holds pressure values, used as the initial guess
+		deltaT: double; time step the system is scaled by
+		rhs: vector of floats; negative divergence from buildRHS(), indexed x + y*width
+		tolerance: double; stop once max|residual| <= tolerance * max|rhs|
+		maxCycles: int; stop after this many V-cycles even if not converged
+
+		Altered by reference: pressureGrid
+		Return type: SolveStats; iterations counts V-cycles
+	*/
+	SolveStats solve(FieldGrid &pressureGrid, double deltaT, const vector<float> &rhs, double tolerance, int maxCycles);
+
+private:
+	struct Level {
+		int width;
+		int height;
+		vector<double> solution;
+		vector<double> rhs;
+		vector<double> residual;
+	};
+
+	void vCycle(int level);
+	void smooth(Level &level, int sweeps);
+	double computeResidual(Level &level);
+	void restrictResidual(const Level &fine, Level &coarse);
+	void prolongCorrection(const Level &coarse, Level &fine);
+
+	vector<Level> levels;
+};
+
+#endif
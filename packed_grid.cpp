@@ -0,0 +1,624 @@
+#include "packed_grid.h"
+#include "step_kernels.h"
+#include "trace.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define PACKED_X86
+#endif
+
+
+namespace {
+
+/*
+	Round to nearest even, as vcvtps2ph with _MM_FROUND_TO_NEAREST_INT.
+*/
+uint16_t floatToHalf(float value) {
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	uint32_t sign = (bits >> 16) & 0x8000;
+	uint32_t magnitude = bits & 0x7fffffff;
+
+	if (magnitude >= 0x7f800000) {
+		// Infinity stays infinity, a NaN stays a quiet NaN with the top of its payload
+		return sign | 0x7c00 | (magnitude > 0x7f800000 ? 0x200 | ((magnitude >> 13) & 0x3ff) : 0);
+	}
+	if (magnitude >= 0x477ff000) {
+		return sign | 0x7c00;
+	}
+	if (magnitude >= 0x38800000) {
+		uint32_t rounded = magnitude + 0xfff + ((magnitude >> 13) & 1);
+		return sign | ((rounded - 0x38000000) >> 13);
+	}
+	if (magnitude <= 0x33000000) {
+		return sign;
+	}
+	// Subnormal half: the value in units of 2^-24
+	int shift = 126 - (int)(magnitude >> 23);
+	uint32_t mantissa = (magnitude & 0x7fffff) | 0x800000;
+	uint32_t half = mantissa >> shift;
+	uint32_t remainder = mantissa & ((1u << shift) - 1);
+	uint32_t halfway = 1u << (shift - 1);
+	if (remainder > halfway || (remainder == halfway && (half & 1))) {
+		half++;
+	}
+	return sign | half;
+}
+
+float halfToFloat(uint16_t half) {
+	uint32_t sign = (uint32_t)(half & 0x8000) << 16;
+	uint32_t exponent = (half >> 10) & 0x1f;
+	uint32_t mantissa = half & 0x3ff;
+	uint32_t bits;
+	if (exponent == 0x1f) {
+		bits = sign | 0x7f800000 | (mantissa << 13);
+	}
+	else if (exponent != 0) {
+		bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+	}
+	else {
+		float value = mantissa * (1.0f / 16777216.0f);
+		return sign ? -value : value;
+	}
+	float value;
+	memcpy(&value, &bits, sizeof(value));
+	return value;
+}
+
+uint16_t floatToBfloat(float value) {
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	if ((bits & 0x7fffffff) > 0x7f800000) {
+		return (bits >> 16) | 0x40;
+	}
+	return (bits + 0x7fff + ((bits >> 16) & 1)) >> 16;
+}
+
+float bfloatToFloat(uint16_t bfloat) {
+	uint32_t bits = (uint32_t)bfloat << 16;
+	float value;
+	memcpy(&value, &bits, sizeof(value));
+	return value;
+}
+
+#ifdef PACKED_X86
+
+bool hasF16C() {
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx") && __builtin_cpu_supports("f16c");
+}
+
+bool hasAvx2() {
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2");
+}
+
+// 8 values per iteration; returns how many were converted, the caller does the rest
+__attribute__((target("avx,f16c")))
+int packHalfF16C(const float* values, uint16_t* packed, int count) {
+	int i = 0;
+	for (; i + 8 <= count; i += 8) {
+		_mm_storeu_si128((__m128i*)(packed + i), _mm256_cvtps_ph(_mm256_loadu_ps(values + i), _MM_FROUND_TO_NEAREST_INT));
+	}
+	return i;
+}
+
+__attribute__((target("avx,f16c")))
+int unpackHalfF16C(const uint16_t* packed, float* values, int count) {
+	int i = 0;
+	for (; i + 8 <= count; i += 8) {
+		_mm256_storeu_ps(values + i, _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)(packed + i))));
+	}
+	return i;
+}
+
+__attribute__((target("avx2")))
+int packBfloatAvx2(const float* values, uint16_t* packed, int count) {
+	const __m256i roundBias = _mm256_set1_epi32(0x7fff);
+	const __m256i one = _mm256_set1_epi32(1);
+	const __m256i quiet = _mm256_set1_epi32(0x40);
+	int i = 0;
+	for (; i + 8 <= count; i += 8) {
+		__m256 value = _mm256_loadu_ps(values + i);
+		__m256i bits = _mm256_castps_si256(value);
+		__m256i high = _mm256_srli_epi32(bits, 16);
+		__m256i rounded = _mm256_srli_epi32(_mm256_add_epi32(bits, _mm256_add_epi32(roundBias, _mm256_and_si256(high, one))), 16);
+		__m256i nan = _mm256_castps_si256(_mm256_cmp_ps(value, value, _CMP_UNORD_Q));
+		__m256i result = _mm256_blendv_epi8(rounded, _mm256_or_si256(high, quiet), nan);
+		// Every lane is below 0x10000, so the saturating pack is exact; gather the two halves' low quadwords
+		result = _mm256_permute4x64_epi64(_mm256_packus_epi32(result, result), 0x08);
+		_mm_storeu_si128((__m128i*)(packed + i), _mm256_castsi256_si128(result));
+	}
+	return i;
+}
+
+__attribute__((target("avx2")))
+int unpackBfloatAvx2(const uint16_t* packed, float* values, int count) {
+	int i = 0;
+	for (; i + 8 <= count; i += 8) {
+		__m256i bits = _mm256_slli_epi32(_mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(packed + i))), 16);
+		_mm256_storeu_ps(values + i, _mm256_castsi256_ps(bits));
+	}
+	return i;
+}
+
+#endif
+
+}
+
+
+/*
+	name: string; float32, float16 or bfloat16
+	precision: StoragePrecision; receives the precision named
+
+	Altered by reference: precision
+	Return type: bool
+*/
+bool parseStoragePrecision(const string &name, StoragePrecision &precision) {
+	if (name == "float32") {
+		precision = STORAGE_FLOAT32;
+	}
+	else if (name == "float16") {
+		precision = STORAGE_FLOAT16;
+	}
+	else if (name == "bfloat16") {
+		precision = STORAGE_BFLOAT16;
+	}
+	else {
+		return false;
+	}
+	return true;
+}
+
+/*
+	precision: StoragePrecision
+
+	Return type: const char*
+*/
+const char* storagePrecisionName(StoragePrecision precision) {
+	switch (precision) {
+		case STORAGE_FLOAT16:
+			return "float16";
+		case STORAGE_BFLOAT16:
+			return "bfloat16";
+		default:
+			return "float32";
+	}
+}
+
+/*
+	values: float*; count floats to convert
+	packed: uint16_t*; receives count 16-bit values
+	count: int
+	precision: StoragePrecision; STORAGE_FLOAT16 or STORAGE_BFLOAT16
+
+	Altered by reference: packed
+	Return type: void
+*/
+void packFloats(const float* values, uint16_t* packed, int count, StoragePrecision precision) {
+	int i = 0;
+	if (precision == STORAGE_FLOAT16) {
+#ifdef PACKED_X86
+		if (hasF16C()) {
+			i = packHalfF16C(values, packed, count);
+		}
+#endif
+		for (; i < count; ++i) {
+			packed[i] = floatToHalf(values[i]);
+		}
+		return;
+	}
+#ifdef PACKED_X86
+	if (hasAvx2()) {
+		i = packBfloatAvx2(values, packed, count);
+	}
+#endif
+	for (; i < count; ++i) {
+		packed[i] = floatToBfloat(values[i]);
+	}
+}
+
+/*
+	packed: uint16_t*; count 16-bit values to convert
+	values: float*; receives count floats
+	count: int
+	precision: StoragePrecision; STORAGE_FLOAT16 or STORAGE_BFLOAT16
+
+	Altered by reference: values
+	Return type: void
+*/
+void unpackFloats(const uint16_t* packed, float* values, int count, StoragePrecision precision) {
+	int i = 0;
+	if (precision == STORAGE_FLOAT16) {
+#ifdef PACKED_X86
+		if (hasF16C()) {
+			i = unpackHalfF16C(packed, values, count);
+		}
+#endif
+		for (; i < count; ++i) {
+			values[i] = halfToFloat(packed[i]);
+		}
+		return;
+	}
+#ifdef PACKED_X86
+	if (hasAvx2()) {
+		i = unpackBfloatAvx2(packed, values, count);
+	}
+#endif
+	for (; i < count; ++i) {
+		values[i] = bfloatToFloat(packed[i]);
+	}
+}
+
+
+PackedGrid::PackedGrid() : numRows(0), numCols(0), precision(STORAGE_FLOAT16) {}
+
+/*
+	rows: int; number of rows
+	cols: int; number of columns
+	precision: StoragePrecision; STORAGE_FLOAT16 or STORAGE_BFLOAT16
+	initValue: float; value every element starts with, rounded
+*/
+PackedGrid::PackedGrid(int rows, int cols, StoragePrecision precision, float initValue)
+	: numRows(rows), numCols(cols), precision(precision) {
+	uint16_t packedInit;
+	packFloats(&initValue, &packedInit, 1, precision);
+	values.assign((size_t)rows * cols, packedInit);
+}
+
+/*
+	i: int; row to convert
+	out: float*; receives count floats
+	first: int; first column
+	count: int; number of columns
+
+	Return type: void
+*/
+void PackedGrid::unpackRow(int i, float* out, int first, int count) const {
+	unpackFloats(values.data() + (size_t)i * numCols + first, out, count, precision);
+}
+
+/*
+	i: int; row to overwrite
+	in: float*; count floats to round into it
+	first: int; first column
+	count: int; number of columns
+
+	Return type: void
+*/
+void PackedGrid::packRow(int i, const float* in, int first, int count) {
+	packFloats(in, values.data() + (size_t)i * numCols + first, count, precision);
+}
+
+/*
+	grid: FieldGrid; grid of the same shape
+
+	Return type: void
+*/
+void PackedGrid::pack(const FieldGrid &grid) {
+	for (int i = 0; i < numRows; ++i) {
+		packRow(i, grid.row(i), 0, numCols);
+	}
+}
+
+void PackedGrid::unpack(FieldGrid &grid) const {
+	for (int i = 0; i < numRows; ++i) {
+		unpackRow(i, grid.row(i), 0, numCols);
+	}
+}
+
+/*
+	other: PackedGrid by reference; grid to exchange storage with
+
+	Return type: void
+*/
+void PackedGrid::swap(PackedGrid &other) {
+	std::swap(numRows, other.numRows);
+	std::swap(numCols, other.numCols);
+	std::swap(precision, other.precision);
+	values.swap(other.values);
+}
+
+
+/*
+	xDim: int; number of cells in x direction
+	yDim: int; number of cells in y direction
+	precision: StoragePrecision; STORAGE_FLOAT16 or STORAGE_BFLOAT16, or STORAGE_FLOAT32 for an unused grid
+	initValue: float; value the advect back buffers start with
+*/
+PackedMacGrid::PackedMacGrid(int xDim, int yDim, StoragePrecision precision, float initValue)
+	: xDim(xDim), yDim(yDim), precision(precision) {
+	if (precision == STORAGE_FLOAT32) {
+		return;
+	}
+	horizVelocity = PackedGrid(xDim+1, yDim, precision, 0.0f);
+	vertVelocity = PackedGrid(xDim, yDim+1, precision, 0.0f);
+	pressure = PackedGrid(yDim, xDim, precision, 0.0f);
+	updatedHoriz = PackedGrid(xDim+1, yDim, precision, initValue);
+	updatedVert = PackedGrid(xDim, yDim+1, precision, initValue);
+	rhsValues.resize(xDim * yDim);
+	horizRow.resize(yDim);
+	nextHorizRow.resize(yDim);
+	vertRow.resize(yDim+1);
+	pressureRows.resize(3 * max(xDim, BLOCK_ROWS + 1));
+	pressureColumns.resize((BLOCK_ROWS + 1) * yDim);
+}
+
+/*
+	horizVelocityGrid, vertVelocityGrid, pressureGrid: FieldGrid; the dense grids to start from
+
+	Return type: void
+*/
+void PackedMacGrid::load(const FieldGrid &horizVelocityGrid, const FieldGrid &vertVelocityGrid, const FieldGrid &pressureGrid) {
+	horizVelocity.pack(horizVelocityGrid);
+	vertVelocity.pack(vertVelocityGrid);
+	pressure.pack(pressureGrid);
+}
+
+/*
+	horizVelocityGrid, vertVelocityGrid: FieldGrid; receive every face
+
+	Altered by reference: horizVelocityGrid, vertVelocityGrid
+	Return type: void
+*/
+void PackedMacGrid::store(FieldGrid &horizVelocityGrid, FieldGrid &vertVelocityGrid) const {
+	horizVelocity.unpack(horizVelocityGrid);
+	vertVelocity.unpack(vertVelocityGrid);
+}
+
+/*
+	deltaT: float; length of the substep
+
+	Return type: void
+*/
+void PackedMacGrid::addGravityBuildRHS(float deltaT) {
+	/*
+	One pass over the rows of x: gravity is added to the row of vertical faces, which is
+	packed back, and the rhs of the row's cells is taken from the same unpacked rows.
+	*/
+	TRACE_SCOPE("packedGravityBuildRHS");
+	horizVelocity.unpackRow(0, horizRow.data(), 0, yDim);
+	for (int x = 0; x < xDim; ++x) {
+		horizVelocity.unpackRow(x + 1, nextHorizRow.data(), 0, yDim);
+		vertVelocity.unpackRow(x, vertRow.data(), 0, yDim + 1);
+		for (int y = 0; y < yDim; ++y) {
+			vertRow[y] -= deltaT * 9.81;
+		}
+		vertVelocity.packRow(x, vertRow.data(), 0, yDim);
+		for (int y = 0; y < yDim; ++y) {
+			rhsValues[x + y*xDim] = wallCellRHS(x, y, xDim, yDim, horizRow[y], nextHorizRow[y], vertRow[y], vertRow[y + 1]);
+		}
+		horizRow.swap(nextHorizRow);
+	}
+}
+
+/*
+	deltaT: double; time step the system is scaled by
+
+	Return type: void
+*/
+void PackedMacGrid::project(double deltaT) {
+	/*
+	The sweep of projectKernel() over three unpacked rows of pressure: the row below, already
+	swept, the row being swept and the row above. Each row is packed once it is swept.
+	*/
+	TRACE_SCOPE("packedProject");
+	float* below = pressureRows.data();
+	float* current = below + xDim;
+	float* above = current + xDim;
+	pressure.unpackRow(0, current, 0, xDim);
+	for (int y = 0; y < yDim; y++) {
+		if (y < yDim - 1) {
+			pressure.unpackRow(y + 1, above, 0, xDim);
+		}
+		for (int x = 0; x < xDim; x++) {
+			double diagonal = 0.0, offDiagonal = 0.0;
+
+			if (x > 0) {
+				diagonal    += deltaT;
+				offDiagonal -= deltaT * current[x - 1];
+			}
+			if (y > 0) {
+				diagonal    += deltaT;
+				offDiagonal -= deltaT * below[x];
+			}
+			if (x < xDim - 1) {
+				diagonal    += deltaT;
+				offDiagonal -= deltaT * current[x + 1];
+			}
+			if (y < yDim - 1) {
+				diagonal    += deltaT;
+				offDiagonal -= deltaT * above[x];
+			}
+
+			current[x] = (rhsValues[x + y*xDim] - offDiagonal) / diagonal;
+		}
+		pressure.packRow(y, current, 0, xDim);
+
+		float* swept = below;
+		below = current;
+		current = above;
+		above = swept;
+	}
+}
+
+/*
+	pressureGrid: FieldGrid; yDim x xDim
+
+	Return type: void
+*/
+void PackedMacGrid::unpackPressure(FieldGrid &pressureGrid) const {
+	pressure.unpack(pressureGrid);
+}
+
+void PackedMacGrid::packPressure(const FieldGrid &pressureGrid) {
+	pressure.pack(pressureGrid);
+}
+
+/*
+	firstX: int; first velocity row of the block
+	lastX: int; one past its last row
+
+	Unpacks pressure columns firstX-1 to lastX-1 into pressureColumns, column firstX-1+k at k*yDim.
+	Return type: void
+*/
+void PackedMacGrid::loadPressureColumns(int firstX, int lastX) {
+	int firstColumn = firstX > 0 ? firstX - 1 : 0;
+	int count = lastX - firstColumn;
+	float* segment = pressureRows.data();
+	for (int y = 0; y < yDim; ++y) {
+		pressure.unpackRow(y, segment, firstColumn, count);
+		for (int k = 0; k < count; ++k) {
+			pressureColumns[(firstColumn - (firstX - 1) + k) * yDim + y] = segment[k];
+		}
+	}
+}
+
+/*
+	deltaT: double; time step the system is scaled by
+
+	Return type: float; largest |velocity| on any face afterwards
+*/
+float PackedMacGrid::applyPressure(double deltaT) {
+	/*
+	applyPressureKernel() walks cells y outer, so a face gets the push of the cell before it
+	and then the pull of its own cell; row by row of x each face gets the same two updates in
+	the same order. Wall faces end up 0 and are left out of the largest velocity.
+	*/
+	TRACE_SCOPE("packedApplyPressure");
+	float largest = 0.0f;
+	for (int firstX = 0; firstX < xDim; firstX += BLOCK_ROWS) {
+		int lastX = min(firstX + BLOCK_ROWS, xDim);
+		loadPressureColumns(firstX, lastX);
+		for (int x = firstX; x < lastX; ++x) {
+			const float* left = pressureColumns.data() + (x - firstX) * yDim;
+			const float* own = left + yDim;
+
+			if (x == 0) {
+				fill(horizRow.begin(), horizRow.end(), 0.0f);
+			}
+			else {
+				horizVelocity.unpackRow(x, horizRow.data(), 0, yDim);
+				for (int y = 0; y < yDim; ++y) {
+					horizRow[y] += deltaT * left[y];
+					horizRow[y] -= deltaT * own[y];
+					largest = fmax(largest, fabs(horizRow[y]));
+				}
+			}
+			horizVelocity.packRow(x, horizRow.data(), 0, yDim);
+
+			vertVelocity.unpackRow(x, vertRow.data(), 0, yDim + 1);
+			vertRow[0] = 0.0f;
+			for (int y = 1; y < yDim; ++y) {
+				vertRow[y] += deltaT * own[y - 1];
+				vertRow[y] -= deltaT * own[y];
+				largest = fmax(largest, fabs(vertRow[y]));
+			}
+			vertRow[yDim] = 0.0f;
+			vertVelocity.packRow(x, vertRow.data(), 0, yDim + 1);
+		}
+	}
+	fill(horizRow.begin(), horizRow.end(), 0.0f);
+	horizVelocity.packRow(xDim, horizRow.data(), 0, yDim);
+	return largest;
+}
+
+/*
+	deltaT: float; time step over which we advect the velocity
+	maxFaceVelocity: float; applyPressure() of this substep, bounds how far a backtrace reaches
+	kernel: AdvectKernel; instruction set to use
+	executor: Executor; runs the blocks of rows
+
+	Return type: void
+*/
+void PackedMacGrid::advect(float deltaT, float maxFaceVelocity, AdvectKernel kernel, Executor &executor) {
+	/*
+	A backtrace moves at most maxFaceVelocity*deltaT cells and interpolates one face further,
+	so a block's windows hold its rows and an apron of that plus 2 either side; faster flows
+	than the grid is wide get the whole grid. Columns are always whole. Wall faces are carried
+	over as advectSimd() does. The blocks are split into one contiguous chunk per thread of
+	the executor, each with its own set of windows.
+	*/
+	TRACE_SCOPE("packedAdvect");
+	double reach = (double)maxFaceVelocity * deltaT;
+	int apron = reach < xDim ? (int)ceil(reach) + 2 : xDim + 1;
+	int windowRows = min(BLOCK_ROWS + 2*apron + 1, xDim + 1);
+	int numBlocks = (xDim + BLOCK_ROWS - 1) / BLOCK_ROWS;
+	int numChunks = min(executor.numThreads(), numBlocks);
+	if ((int)windows.size() < WINDOWS_PER_CHUNK * numChunks || windows[0].rows() < windowRows) {
+		int chunks = max(numChunks, (int)windows.size() / WINDOWS_PER_CHUNK);
+		windows.clear();
+		windows.reserve(WINDOWS_PER_CHUNK * chunks);
+		for (int chunk = 0; chunk < chunks; ++chunk) {
+			windows.push_back(FieldGrid(windowRows, yDim, 0.0f));
+			windows.push_back(FieldGrid(windowRows, yDim + 1, 0.0f));
+			windows.push_back(FieldGrid(BLOCK_ROWS, yDim, 0.0f));
+			windows.push_back(FieldGrid(BLOCK_ROWS, yDim + 1, 0.0f));
+		}
+	}
+	executor.parallelFor(0, numChunks, [&](int chunkBegin, int chunkEnd) {
+		for (int chunk = chunkBegin; chunk < chunkEnd; ++chunk) {
+			FieldGrid &horiz = windows[WINDOWS_PER_CHUNK * chunk];
+			FieldGrid &vert = windows[WINDOWS_PER_CHUNK * chunk + 1];
+			FieldGrid &updatedHorizWindow = windows[WINDOWS_PER_CHUNK * chunk + 2];
+			FieldGrid &updatedVertWindow = windows[WINDOWS_PER_CHUNK * chunk + 3];
+			for (int block = numBlocks * chunk / numChunks; block < numBlocks * (chunk + 1) / numChunks; ++block) {
+				int firstX = block * BLOCK_ROWS;
+				int lastX = min(firstX + BLOCK_ROWS, xDim);
+				int lowest = max(firstX - apron, 0);
+				int highest = min(lastX + apron + 1, xDim + 1);
+				horiz.moveWindow(lowest, 0);
+				vert.moveWindow(lowest, 0);
+				for (int x = lowest; x < highest; ++x) {
+					horizVelocity.unpackRow(x, horiz.row(x), 0, yDim);
+					if (x < xDim) {
+						vertVelocity.unpackRow(x, vert.row(x), 0, yDim + 1);
+					}
+				}
+
+				updatedHorizWindow.moveWindow(firstX, 0);
+				updatedVertWindow.moveWindow(firstX, 0);
+				advectSimdBlock(horiz, vert, updatedHorizWindow, updatedVertWindow, xDim, yDim, deltaT, firstX, lastX, 0, yDim, kernel);
+				for (int x = firstX; x < lastX; ++x) {
+					updatedVertWindow(x, yDim) = vert(x, yDim);
+					updatedHoriz.packRow(x, updatedHorizWindow.row(x), 0, yDim);
+					updatedVert.packRow(x, updatedVertWindow.row(x), 0, yDim + 1);
+				}
+				if (lastX == xDim) {
+					updatedHoriz.packRow(xDim, horiz.row(xDim), 0, yDim);
+				}
+			}
+		}
+	});
+	horizVelocity.swap(updatedHoriz);
+	vertVelocity.swap(updatedVert);
+}
+
+/*
+	Return type: float; largest |divergence| of any cell
+*/
+float PackedMacGrid::maxDivergence() const {
+	vector<float> left(yDim), right(yDim), vert(yDim + 1);
+	float largest = 0.0;
+	horizVelocity.unpackRow(0, left.data(), 0, yDim);
+	for (int x = 0; x < xDim; x++) {
+		horizVelocity.unpackRow(x + 1, right.data(), 0, yDim);
+		vertVelocity.unpackRow(x, vert.data(), 0, yDim + 1);
+		for (int y = 0; y < yDim; y++) {
+			float divergence = right[y] - left[y] + vert[y + 1] - vert[y];
+			largest = fmax(largest, fabs(divergence));
+		}
+		left.swap(right);
+	}
+	return largest;
+}
+
+/*
+	Return type: size_t; bytes of packed fields, the back buffers included
+*/
+size_t PackedMacGrid::bytes() const {
+	return horizVelocity.bytes() + vertVelocity.bytes() + pressure.bytes() + updatedHoriz.bytes() + updatedVert.bytes();
+}
@@ -0,0 +1,259 @@
+#ifndef __PACKEDGRID__
+#define __PACKEDGRID__
+
+
+#include "mac_grid.h"
+#include "advect_simd.h"
+#include "thread_pool.h"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+using namespace std;
+
+
+/*
+	How the fields are held between the stages of a step.
+	STORAGE_FLOAT32: the dense FieldGrids, nothing is packed
+	STORAGE_FLOAT16: IEEE half, 11 significant bits, largest finite value 65504
+	STORAGE_BFLOAT16: the top 16 bits of a float, 8 significant bits, the range of a float
+*/
+enum StoragePrecision {
+	STORAGE_FLOAT32,
+	STORAGE_FLOAT16,
+	STORAGE_BFLOAT16
+};
+
+/*
+	name: string; float32, float16 or bfloat16
+	precision: StoragePrecision; receives the precision named
+
+	Altered by reference: precision
+	Return type: bool; false if name is none of them
+*/
+bool parseStoragePrecision(const string &name, StoragePrecision &precision);
+
+/*
+	precision: StoragePrecision
+
+	Return type: const char*; its name as parseStoragePrecision() takes it
+*/
+const char* storagePrecisionName(StoragePrecision precision);
+
+/*
+	values: float*; count floats to convert
+	packed: uint16_t*; receives count 16-bit values
+	count: int
+	precision: StoragePrecision; STORAGE_FLOAT16 or STORAGE_BFLOAT16
+
+	Rounds to nearest, ties to even; float16 overflows to infinity. Uses F16C, or AVX2 for
+	bfloat16, when the CPU has it, with the same results as the scalar conversion.
+	Altered by reference: packed
+	Return type: void
+*/
+void packFloats(const float* values, uint16_t* packed, int count, StoragePrecision precision);
+
+/*
+	packed: uint16_t*; count 16-bit values to convert
+	values: float*; receives count floats, exactly the values packed
+	count: int
+	precision: StoragePrecision; STORAGE_FLOAT16 or STORAGE_BFLOAT16
+
+	Altered by reference: values
+	Return type: void
+*/
+void unpackFloats(const uint16_t* packed, float* values, int count, StoragePrecision precision);
+
+
+/*
+	A FieldGrid's interior held as 16-bit values, element (i,j) at i*cols + j.
+	Kernels unpack the rows they work on into float scratch and pack back the rows they change,
+	so memory traffic is half that of the FieldGrid while the arithmetic stays in float.
+*/
+class PackedGrid {
+public:
+	PackedGrid();
+
+	/*
+		rows: int; number of rows
+		cols: int; number of columns
+		precision: StoragePrecision; STORAGE_FLOAT16 or STORAGE_BFLOAT16
+		initValue: float; value every element starts with, rounded
+	*/
+	PackedGrid(int rows, int cols, StoragePrecision precision, float initValue);
+
+	/*
+		i: int; row to convert
+		out: float*; receives count floats
+		first: int; first column
+		count: int; number of columns
+
+		Return type: void
+	*/
+	void unpackRow(int i, float* out, int first, int count) const;
+
+	/*
+		i: int; row to overwrite
+		in: float*; count floats to round into it
+		first: int; first column
+		count: int; number of columns
+
+		Return type: void
+	*/
+	void packRow(int i, const float* in, int first, int count);
+
+	/*
+		grid: FieldGrid; grid of the same shape
+
+		Return type: void
+	*/
+	void pack(const FieldGrid &grid);
+	void unpack(FieldGrid &grid) const;
+
+	/*
+		other: PackedGrid by reference; grid to exchange storage with, O(1)
+
+		Return type: void
+	*/
+	void swap(PackedGrid &other);
+
+	inline int rows() const { return numRows; }
+	inline int cols() const { return numCols; }
+	inline size_t bytes() const { return values.size() * sizeof(uint16_t); }
+
+private:
+	int numRows;
+	int numCols;
+	StoragePrecision precision;
+	vector<uint16_t> values;
+};
+
+
+/*
+	The MAC grid held in PackedGrids, with the stages of a substep run on the packed fields.
+
+	Each stage streams the rows it needs: a row is unpacked into float scratch a few rows
+	long, updated with the arithmetic of the float kernels, rounded and packed back. Only
+	16-bit values go to and from memory, the accumulations of the pressure solve are in
+	double as in project(), and rhs stays a float vector. The velocity grids are walked in
+	blocks of BLOCK_ROWS rows of x, with the pressure those rows touch transposed into the
+	scratch, so the (y,x) pressure layout is read once per block rather than once per face.
+	advect() unpacks a block and the rows its backtraces can reach into FieldGrid windows and
+	runs advectSimdBlock() there.
+
+	Every face and pressure is rounded each time a stage writes it, so results drift from the
+	float32 solver by the rounding of the storage format; precision_report measures how far.
+*/
+class PackedMacGrid {
+public:
+	static const int BLOCK_ROWS = 16;
+
+	/*
+		xDim: int; number of cells in x direction
+		yDim: int; number of cells in y direction
+		precision: StoragePrecision; STORAGE_FLOAT16 or STORAGE_BFLOAT16, or STORAGE_FLOAT32 for an unused grid that allocates nothing
+		initValue: float; value the advect back buffers start with, as the solver's
+	*/
+	PackedMacGrid(int xDim, int yDim, StoragePrecision precision, float initValue);
+
+	/*
+		horizVelocityGrid, vertVelocityGrid, pressureGrid: FieldGrid; the dense grids to start from
+
+		Return type: void
+	*/
+	void load(const FieldGrid &horizVelocityGrid, const FieldGrid &vertVelocityGrid, const FieldGrid &pressureGrid);
+
+	/*
+		horizVelocityGrid, vertVelocityGrid: FieldGrid; receive every face
+
+		Altered by reference: horizVelocityGrid, vertVelocityGrid
+		Return type: void
+	*/
+	void store(FieldGrid &horizVelocityGrid, FieldGrid &vertVelocityGrid) const;
+
+	/*
+		deltaT: float; length of the substep
+
+		addGravity() then buildRHS(), the rhs left in rhs().
+		Return type: void
+	*/
+	void addGravityBuildRHS(float deltaT);
+
+	/*
+		deltaT: double; time step the system is scaled by
+
+		One Gauss-Seidel sweep, as project().
+		Return type: void
+	*/
+	void project(double deltaT);
+
+	/*
+		pressureGrid: FieldGrid; yDim x xDim
+
+		For the other pressure solves: unpackPressure(), solve on the float grid with rhs(), packPressure().
+		Return type: void
+	*/
+	void unpackPressure(FieldGrid &pressureGrid) const;
+	void packPressure(const FieldGrid &pressureGrid);
+
+	/*
+		Return type: vector of floats; negated divergence from addGravityBuildRHS(), indexed x + y*xDim
+	*/
+	inline const vector<float>& rhs() const { return rhsValues; }
+
+	/*
+		deltaT: double; time step the system is scaled by
+
+		As applyPressure().
+		Return type: float; largest |velocity| on any face afterwards
+	*/
+	float applyPressure(double deltaT);
+
+	/*
+		deltaT: float; time step over which we advect the velocity
+		maxFaceVelocity: float; applyPressure() of this substep, bounds how far a backtrace reaches
+		kernel: AdvectKernel; instruction set to use
+		executor: Executor; runs the blocks of rows
+
+		As advectSimd() followed by swapping the updated grids in.
+		Return type: void
+	*/
+	void advect(float deltaT, float maxFaceVelocity, AdvectKernel kernel, Executor &executor);
+
+	/*
+		Return type: float; largest |divergence| of any cell, as maxDivergence()
+	*/
+	float maxDivergence() const;
+
+	/*
+		Return type: size_t; bytes of packed fields, the back buffers included
+	*/
+	size_t bytes() const;
+
+private:
+	void loadPressureColumns(int firstX, int lastX);
+
+	int xDim;
+	int yDim;
+	StoragePrecision precision;
+	PackedGrid horizVelocity;
+	PackedGrid vertVelocity;
+	PackedGrid pressure;
+	PackedGrid updatedHoriz;
+	PackedGrid updatedVert;
+	vector<float> rhsValues;
+
+	// Float scratch of the serial stages: rows of the velocity grids and of the pressure,
+	// and pressure columns [firstX-1, lastX) of a block, column k at pressureColumns[k*yDim]
+	vector<float> horizRow;
+	vector<float> nextHorizRow;
+	vector<float> vertRow;
+	vector<float> pressureRows;
+	vector<float> pressureColumns;
+	// advect() windows of a chunk of blocks: horizontal and vertical faces with their apron,
+	// then the block's updated rows; kept between substeps, regrown for a wider apron
+	static const int WINDOWS_PER_CHUNK = 4;
+	vector<FieldGrid> windows;
+};
+
+#endif
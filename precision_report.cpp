@@ -0,0 +1,247 @@
+#include "mac_grid.h"
+#include "grid_fns.h"
+#include "pressure_solver.h"
+#include "multigrid.h"
+#include "advect_simd.h"
+#include "thread_pool.h"
+#include "step_kernels.h"
+#include "packed_grid.h"
+#include "config.h"
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+/*
+	Accuracy of the 16-bit storage modes of packed_grid.h against the float32 solver:
+		./precision_report [--config file] [--key value]...
+	Runs the configured simulation with float32, float16 and bfloat16 storage side by side from
+	the same initial grids. After every frame each 16-bit run's face velocities are compared with
+	the float32 run's. Per storage mode it reports the worst max divergence after applyPressure
+	of any substep, the largest and RMS face velocity error of any frame, the largest error
+	relative to the float32 run's fastest face, the time per cell-step and the bytes per cell the
+	fields take, so the cheapest storage that meets a tolerance can be picked. Per-frame values
+	go to precisionReport.csv. The storage, output and checkpoint options are ignored; no frames are written.
+*/
+
+const char* REPORT_FILE = "precisionReport.csv";
+
+/*
+	precision: StoragePrecision; how the run keeps its fields
+	grid: MacGrid; the fields of a float32 run, the staging grids of a 16-bit run
+	packed: PackedMacGrid; the fields of a 16-bit run
+	maxFaceVelocity: float; applyPressure() of the last substep
+	seconds: double; time in the stages of the step
+	substeps: long long
+	worstDivergence, worstError, worstRmsError, worstRelativeError: double; largest of any substep or frame
+*/
+struct Run {
+	StoragePrecision precision;
+	MacGrid grid;
+	PackedMacGrid packed;
+	FieldGrid updatedHoriz;
+	FieldGrid updatedVert;
+	vector<float> rhs;
+	float maxFaceVelocity;
+	double seconds;
+	long long substeps;
+	double worstDivergence;
+	double worstError;
+	double worstRmsError;
+	double worstRelativeError;
+
+	Run(int xDim, int yDim, StoragePrecision precision, float initValue)
+		: precision(precision), grid(xDim, yDim, initValue), packed(xDim, yDim, precision, initValue),
+		  updatedHoriz(precision == STORAGE_FLOAT32 ? xDim+1 : 0, yDim, initValue),
+		  updatedVert(precision == STORAGE_FLOAT32 ? xDim : 0, yDim+1, initValue),
+		  rhs(precision == STORAGE_FLOAT32 ? xDim * yDim : 0), maxFaceVelocity(0.0f), seconds(0.0), substeps(0),
+		  worstDivergence(0.0), worstError(0.0), worstRmsError(0.0), worstRelativeError(0.0) {}
+};
+
+/*
+	largest: double; running maximum
+	value: double; next value, a NaN is kept
+
+	Return type: double
+*/
+double keepLargest(double largest, double value) {
+	return value > largest || isnan(value) ? value : largest;
+}
+
+int main(int argc, char* argv[]){
+	SolverConfig config;
+	if (!parseArguments(config, argc, argv)) {
+		printUsage(argv[0]);
+		return 1;
+	}
+	config.storagePrecision = "float32";
+	config.checkpointInterval = 0;
+	config.resume = false;
+	if (!validateConfig(config)) {
+		return 1;
+	}
+
+	int numFrames = config.numFrames;
+	int xDim = config.xDim;
+	int yDim = config.yDim;
+	int initValue = 1;
+	string pressureSolver = config.pressureSolver;
+	const int tileSize = config.tileSize == -1 ? cacheTileSize() : config.tileSize;
+	ThreadPool threadPool(config.numThreads);
+	StepKernels stepKernels = selectStepKernels(xDim, yDim);
+	AdvectKernel advectKernel = bestAdvectKernel();
+	PCGSolver pcgSolver(xDim, yDim);
+	MultigridSolver multigridSolver(xDim, yDim);
+
+	vector<unique_ptr<Run> > runs;
+	runs.push_back(unique_ptr<Run>(new Run(xDim, yDim, STORAGE_FLOAT32, initValue)));
+	runs.push_back(unique_ptr<Run>(new Run(xDim, yDim, STORAGE_FLOAT16, initValue)));
+	runs.push_back(unique_ptr<Run>(new Run(xDim, yDim, STORAGE_BFLOAT16, initValue)));
+	Run &reference = *runs[0];
+	if (!fillGrid(reference.grid.horizVelocity, config.initialHorizFile)
+		|| !fillGrid(reference.grid.vertVelocity, config.initialVertFile)
+		|| !fillGrid(reference.grid.pressure, config.initialPressureFile)) {
+		return 1;
+	}
+	for (unique_ptr<Run> &run : runs) {
+		if (run->precision != STORAGE_FLOAT32) {
+			run->packed.load(reference.grid.horizVelocity, reference.grid.vertVelocity, reference.grid.pressure);
+			run->packed.store(run->grid.horizVelocity, run->grid.vertVelocity);
+		}
+		run->maxFaceVelocity = maxVelocity(run->grid.horizVelocity, run->grid.vertVelocity, xDim, yDim);
+	}
+
+	ofstream report(REPORT_FILE);
+	report << "frame,storage,max_divergence,max_error,rms_error,relative_error" << endl;
+
+	// The substep of solver.cpp, on the dense grids or the packed ones
+	auto substep = [&](Run &run, float deltaT) {
+		auto start = chrono::steady_clock::now();
+		FieldGrid &horiz = run.grid.horizVelocity;
+		FieldGrid &vert = run.grid.vertVelocity;
+		FieldGrid &pressure = run.grid.pressure;
+		bool packed = run.precision != STORAGE_FLOAT32;
+		const vector<float> &solveRhs = packed ? run.packed.rhs() : run.rhs;
+
+		if (packed) {
+			run.packed.addGravityBuildRHS(deltaT);
+		}
+		else if (tileSize > 0) {
+			addGravityBuildRHSTiled(horiz, vert, xDim, yDim, deltaT, run.rhs, tileSize);
+		}
+		else {
+			stepKernels.addGravity(vert, xDim, yDim, deltaT);
+			stepKernels.buildRHS(horiz, vert, xDim, yDim, run.rhs);
+		}
+		if (pressureSolver == "gs") {
+			if (packed) {
+				run.packed.project(deltaT);
+			}
+			else {
+				stepKernels.project(pressure, deltaT, xDim, yDim, run.rhs);
+			}
+		}
+		else {
+			if (packed) {
+				run.packed.unpackPressure(pressure);
+			}
+			if (pressureSolver == "rbsor") {
+				projectRedBlack(pressure, deltaT, xDim, yDim, solveRhs, config.sorOmega, config.redBlackSweeps, threadPool);
+			}
+			else if (pressureSolver == "pcg") {
+				pcgSolver.solve(pressure, deltaT, solveRhs, config.pressureTolerance, config.maxPressureIterations);
+			}
+			else {
+				multigridSolver.solve(pressure, deltaT, solveRhs, config.pressureTolerance, config.maxPressureIterations);
+			}
+			if (packed) {
+				run.packed.packPressure(pressure);
+			}
+		}
+		if (packed) {
+			run.maxFaceVelocity = run.packed.applyPressure(deltaT);
+		}
+		else if (tileSize > 0) {
+			run.maxFaceVelocity = applyPressureTiled(pressure, horiz, vert, deltaT, xDim, yDim, tileSize, 0);
+		}
+		else {
+			run.maxFaceVelocity = stepKernels.applyPressure(pressure, horiz, vert, deltaT, xDim, yDim);
+		}
+		run.seconds += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+		// Measured outside the timed stages
+		run.worstDivergence = keepLargest(run.worstDivergence, packed ? run.packed.maxDivergence() : maxDivergence(horiz, vert, xDim, yDim));
+
+		start = chrono::steady_clock::now();
+		if (packed) {
+			run.packed.advect(deltaT, run.maxFaceVelocity, advectKernel, threadPool);
+		}
+		else {
+			advectSimd(horiz, vert, run.updatedHoriz, run.updatedVert, xDim, yDim, deltaT, advectKernel, threadPool);
+			horiz.swap(run.updatedHoriz);
+			vert.swap(run.updatedVert);
+		}
+		run.seconds += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+		run.substeps++;
+	};
+
+	const float TIME_PER_FRAME = config.timePerFrame;
+	for (int i = 0; i < numFrames; ++i) {
+		// Each run takes its own cfl substeps; they meet again at every frame boundary.
+		for (unique_ptr<Run> &run : runs) {
+			float frameTimeLeft = TIME_PER_FRAME;
+			while (frameTimeLeft > 0) {
+				float deltaT = cflTimestep(config.deltaT, config.cfl, run->maxFaceVelocity, frameTimeLeft);
+				substep(*run, deltaT);
+				frameTimeLeft -= deltaT;
+			}
+		}
+
+		const FieldGrid &referenceHoriz = reference.grid.horizVelocity;
+		const FieldGrid &referenceVert = reference.grid.vertVelocity;
+		double fastest = maxVelocity(referenceHoriz, referenceVert, xDim, yDim);
+		for (size_t index = 1; index < runs.size(); ++index) {
+			Run &run = *runs[index];
+			run.packed.store(run.grid.horizVelocity, run.grid.vertVelocity);
+			double largestError = 0.0, sumSquares = 0.0;
+			for (int x = 0; x <= xDim; ++x) {
+				for (int y = 0; y < yDim; ++y) {
+					double error = fabs((double)run.grid.horizVelocity(x, y) - referenceHoriz(x, y));
+					largestError = keepLargest(largestError, error);
+					sumSquares += error * error;
+				}
+			}
+			for (int x = 0; x < xDim; ++x) {
+				for (int y = 0; y <= yDim; ++y) {
+					double error = fabs((double)run.grid.vertVelocity(x, y) - referenceVert(x, y));
+					largestError = keepLargest(largestError, error);
+					sumSquares += error * error;
+				}
+			}
+			double rmsError = sqrt(sumSquares / ((double)(xDim + 1) * yDim + (double)xDim * (yDim + 1)));
+			double relativeError = fastest > 0 ? largestError / fastest : largestError;
+			run.worstError = keepLargest(run.worstError, largestError);
+			run.worstRmsError = keepLargest(run.worstRmsError, rmsError);
+			run.worstRelativeError = keepLargest(run.worstRelativeError, relativeError);
+			report << i << "," << storagePrecisionName(run.precision) << "," << run.worstDivergence << ","
+				<< largestError << "," << rmsError << "," << relativeError << endl;
+		}
+	}
+
+	double cells = (double)xDim * yDim;
+	cout << numFrames << " frames of " << xDim << "x" << yDim << ", " << pressureSolver << " solver; per frame values in " << REPORT_FILE << endl;
+	for (unique_ptr<Run> &run : runs) {
+		double bytesPerCell = run->precision == STORAGE_FLOAT32 ? 5.0 * sizeof(float) : run->packed.bytes() / cells;
+		cout << storagePrecisionName(run->precision) << ": max divergence " << run->worstDivergence;
+		if (run->precision != STORAGE_FLOAT32) {
+			cout << ", velocity error max " << run->worstError << " (" << run->worstRelativeError
+				<< " of the fastest face), rms " << run->worstRmsError;
+		}
+		cout << "; " << run->seconds * 1e9 / (cells * (run->substeps > 0 ? run->substeps : 1)) << " ns per cell-step, "
+			<< bytesPerCell << " bytes per cell" << endl;
+	}
+	return 0;
+}
@@ -0,0 +1,225 @@
+#include "pressure_solver.h"
+#include "trace.h"
+#include <cmath>
+
+
+namespace {
+
+// Amount of the dropped fill-in added back to the diagonal, and the fraction of the
+// diagonal below which a pivot is considered unsafe. Values from Bridson, Fluid Simulation for Computer Graphics.
+const double MIC_TUNING = 0.97;
+const double MIC_SAFETY = 0.25;
+
+double dot(const vector<double> &a, const vector<double> &b) {
+	double sum = 0.0;
+	for (size_t i = 0; i < a.size(); ++i) {
+		sum += a[i] * b[i];
+	}
+	return sum;
+}
+
+double maxAbs(const vector<double> &a) {
+	double largest = 0.0;
+	for (size_t i = 0; i < a.size(); ++i) {
+		largest = fmax(largest, fabs(a[i]));
+	}
+	return largest;
+}
+
+}
+
+
+/*
+	width: int; number of cells in x direction
+	height: int; number of cells in y direction
+*/
+PCGSolver::PCGSolver(int width, int height)
+	: width(width), height(height),
+	  precon(width * height), pressure(width * height), residual(width * height),
+	  aux(width * height), search(width * height), scratch(width * height) {
+	buildPreconditioner();
+}
+
+void PCGSolver::buildPreconditioner() {
+	/*
+	Computes the MIC(0) factor of L. Every cell is fluid, so the off diagonals are -1
+	wherever a neighbour exists and the diagonal is the neighbour count.
+	*/
+	for (int y = 0; y < height; y++) {
+		for (int x = 0; x < width; x++) {
+			int index = x + y*width;
+			double diagonal = (x > 0) + (y > 0) + (x < width - 1) + (y < height - 1);
+			double e = diagonal;
+
+			// Fill-in dropped by the incomplete factorisation is only added to the
+			// diagonal when the neighbour it couples through exists.
+			if (x > 0) {
+				double left = precon[index - 1];
+				e -= left * left;
+				if (y < height - 1) {
+					e -= MIC_TUNING * left * left;
+				}
+			}
+			if (y > 0) {
+				double below = precon[index - width];
+				e -= below * below;
+				if (x < width - 1) {
+					e -= MIC_TUNING * below * below;
+				}
+			}
+
+			if (e < MIC_SAFETY * diagonal) {
+				e = diagonal;
+			}
+			precon[index] = 1.0 / sqrt(e);
+		}
+	}
+}
+
+void PCGSolver::applyLaplacian(const vector<double> &in, vector<double> &out) const {
+	/*
+	out = L * in
+	*/
+	for (int y = 0; y < height; y++) {
+		for (int x = 0; x < width; x++) {
+			int index = x + y*width;
+			double diagonal = 0.0, offDiagonal = 0.0;
+
+			if (x > 0) {
+				diagonal    += 1.0;
+				offDiagonal -= in[index - 1];
+			}
+			if (y > 0) {
+				diagonal    += 1.0;
+				offDiagonal -= in[index - width];
+			}
+			if (x < width - 1) {
+				diagonal    += 1.0;
+				offDiagonal -= in[index + 1];
+			}
+			if (y < height - 1) {
+				diagonal    += 1.0;
+				offDiagonal -= in[index + width];
+			}
+			out[index] = diagonal * in[index] + offDiagonal;
+		}
+	}
+}
+
+void PCGSolver::applyPreconditioner(const vector<double> &in, vector<double> &out) {
+	/*
+	out = (F F^T)^-1 * in, with F the MIC(0) factor. Forward substitution into scratch,
+	then back substitution into out.
+	*/
+	for (int y = 0; y < height; y++) {
+		for (int x = 0; x < width; x++) {
+			int index = x + y*width;
+			double t = in[index];
+			if (x > 0) {
+				t += precon[index - 1] * scratch[index - 1];
+			}
+			if (y > 0) {
+				t += precon[index - width] * scratch[index - width];
+			}
+			scratch[index] = t * precon[index];
+		}
+	}
+
+	for (int y = height - 1; y >= 0; y--) {
+		for (int x = width - 1; x >= 0; x--) {
+			int index = x + y*width;
+			double t = scratch[index];
+			if (x < width - 1) {
+				t += precon[index] * out[index + 1];
+			}
+			if (y < height - 1) {
+				t += precon[index] * out[index + width];
+			}
+			out[index] = t * precon[index];
+		}
+	}
+}
+
+/*
+	pressureGrid: FieldGrid; holds pressure values, used as the initial guess
+	deltaT: double; time step the system is scaled by
+	rhs: vector of floats; negative divergence from buildRHS(), indexed x + y*width
+	tolerance: double; stop once max|residual| <= tolerance * max|rhs|
+	maxIterations: int; stop after this many iterations even if not converged
+
+	Altered by reference: pressureGrid
+	Return type: SolveStats
+*/
+SolveStats PCGSolver::solve(FieldGrid &pressureGrid, double deltaT, const vector<float> &rhs, double tolerance, int maxIterations) {
+	/*
+	Solves L * pressure = rhs / deltaT, warm started from pressureGrid.
+	A closed box leaves L with constant pressure as its null space, so the mean of rhs is
+	removed first; otherwise the system has no solution and the residual cannot converge.
+	*/
+	TRACE_SCOPE("pcgSolve");
+	SolveStats stats = {0, 0.0};
+	int numCells = width * height;
+
+	double mean = 0.0;
+	for (int index = 0; index < numCells; ++index) {
+		mean += rhs[index];
+	}
+	mean /= numCells;
+
+	for (int y = 0; y < height; y++) {
+		for (int x = 0; x < width; x++) {
+			pressure[x + y*width] = pressureGrid(y, x);
+		}
+	}
+
+	applyLaplacian(pressure, aux);
+	for (int index = 0; index < numCells; ++index) {
+		residual[index] = (rhs[index] - mean) / deltaT - aux[index];
+	}
+
+	double target = 0.0;
+	for (int index = 0; index < numCells; ++index) {
+		target = fmax(target, fabs(rhs[index] - mean));
+	}
+	target *= tolerance / deltaT;
+
+	double residualNorm = maxAbs(residual);
+	if (residualNorm > target) {
+		applyPreconditioner(residual, aux);
+		search = aux;
+		double sigma = dot(aux, residual);
+
+		while (stats.iterations < maxIterations) {
+			stats.iterations++;
+
+			applyLaplacian(search, aux);
+			double alpha = sigma / dot(aux, search);
+			for (int index = 0; index < numCells; ++index) {
+				pressure[index] += alpha * search[index];
+				residual[index] -= alpha * aux[index];
+			}
+
+			residualNorm = maxAbs(residual);
+			if (residualNorm <= target) {
+				break;
+			}
+
+			applyPreconditioner(residual, aux);
+			double sigmaNew = dot(aux, residual);
+			double beta = sigmaNew / sigma;
+			for (int index = 0; index < numCells; ++index) {
+				search[index] = aux[index] + beta * search[index];
+			}
+			sigma = sigmaNew;
+		}
+	}
+
+	for (int y = 0; y < height; y++) {
+		for (int x = 0; x < width; x++) {
+			pressureGrid(y, x) = pressure[x + y*width];
+		}
+	}
+
+	stats.residual = residualNorm * deltaT;
+	return stats;
+}
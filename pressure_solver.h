@@ -0,0 +1,62 @@
+#ifndef __PRESSURESOLVER__
+#define __PRESSURESOLVER__
+
+
+#include "mac_grid.h"
+#include <vector>
+using namespace std;
+
+
+/*
+	iterations: int; number of iterations the solver ran
+	residual: double; max norm of rhs - A*pressure when the solver stopped
+*/
+struct SolveStats {
+	int iterations;
+	double residual;
+};
+
+
+/*
+	Conjugate gradient solver for the pressure Poisson system built by buildRHS(),
+	preconditioned with modified incomplete Cholesky, MIC(0).
+	The system is the one project() relaxes: deltaT * L * pressure = rhs, where L is the
+	5 point Laplacian with Neumann walls. L is factored once per grid size and reused
+	for every deltaT; search vectors are owned by the solver so a solve does not allocate.
+*/
+class PCGSolver {
+public:
+	/*
+		width: int; number of cells in x direction
+		height: int; number of cells in y direction
+	*/
+	PCGSolver(int width, int height);
+
+	/*
+		pressureGrid: FieldGrid; holds pressure values, used as the initial guess
+		deltaT: double; time step the system is scaled by
+		rhs: vector of floats; negative divergence from buildRHS(), indexed x + y*width
+		tolerance: double; stop once max|residual| <= tolerance * max|rhs|
+		maxIterations: int; stop after this many iterations even if not converged
+
+		Altered by reference: pressureGrid
+		Return type: SolveStats
+	*/
+	SolveStats solve(FieldGrid &pressureGrid, double deltaT, const vector<float> &rhs, double tolerance, int maxIterations);
+
+private:
+	void buildPreconditioner();
+	void applyLaplacian(const vector<double> &in, vector<double> &out) const;
+	void applyPreconditioner(const vector<double> &in, vector<double> &out);
+
+	int width;
+	int height;
+	vector<double> precon;
+	vector<double> pressure;
+	vector<double> residual;
+	vector<double> aux;
+	vector<double> search;
+	vector<double> scratch;
+};
+
+#endif
@@ -0,0 +1,574 @@
+#include "mac_grid.h"
+#include "grid_fns.h"
+#include "pressure_solver.h"
+#include "multigrid.h"
+#include "advect.h"
+#include "advect_simd.h"
+#include "advect_maccormack.h"
+#include "thread_pool.h"
+#include "step_kernels.h"
+#include "config.h"
+#include <climits>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+	Golden-output check of the optimized solver against the reference serial implementation:
+		./regression_check [--case all|files|random|vortex|jet] [--ulps n] [--rel r] [--abs a]
+			[--divergence d] [--deterministic] [--thread-counts 1,2,...] [--config file] [--key value]...
+
+	The reference run is the plain code every optimization was derived from: addGravity(),
+	buildRHS(), project() and applyPressure() of grid_fns.h, advect() of advect.h (or the
+	scalar kernels of MacCormackAdvector) and the configured pressure solve, all on one thread.
+	The optimized run is the dense substep of solver.cpp with the configured threads, tileSize,
+	step kernels of selectStepKernels() and the widest advect kernel (or --kernel).
+	Both start from the same canned initial condition and take their own cfl substeps; after
+	every frame their face velocities and pressure are compared value by value. A value
+	matches when it is within --ulps units in the last place (default 4), within --rel of the
+	larger magnitude (default 1e-5) or within --abs (default 1e-6). The largest divergence
+	after applyPressure() of any substep of the frame, as the max and RMS over the cells, may
+	not exceed the reference's by more than a factor of 1 + --divergence (default 0.1) plus
+	--abs. The first frame that fails is reported with its first and its worst cell, and the
+	case stops there.
+
+	--deterministic instead runs the optimized mode at each of --thread-counts (default 1, 2, 3
+	and the hardware concurrency) and requires every field to be bit-identical to the run on
+	one thread. The threaded stages split the grid into whole rows or tiles whose results do
+	not depend on where the chunks start (see Executor in thread_pool.h), so this must hold
+	for every thread count; a failure is a bug, not rounding.
+
+	Cases, sized by xDim and yDim:
+		files   the initialHoriz, initialVert and initialPressure files
+		random  uniform noise in [-1, 1) on every face, zero pressure
+		vortex  a Gaussian vortex in the middle of the grid, zero pressure
+		jet     a band of fast horizontal flow through a still fluid, zero pressure
+	The sparseTile, storage, scalars, format, output and checkpoint options are ignored.
+	Exits with 1 if any case fails.
+*/
+
+namespace {
+
+const char* CASES[] = {"files", "random", "vortex", "jet"};
+
+/*
+	ulps: int; largest distance in units in the last place that still matches
+	rel: double; largest difference relative to the larger magnitude that still matches
+	abs: double; largest difference that always matches
+	divergence: double; relative excess of the divergence norms allowed over the reference's
+	exact: bool; every value must be bit-identical, the tolerances are ignored
+*/
+struct Tolerance {
+	int ulps;
+	double rel;
+	double abs;
+	double divergence;
+	bool exact;
+};
+
+/*
+	How a run steps.
+	reference: bool; the serial reference implementation, the remaining fields are ignored
+	numThreads: int; threads of the optimized run
+	kernel: AdvectKernel; advect kernel of the optimized run
+*/
+struct Mode {
+	bool reference;
+	int numThreads;
+	AdvectKernel kernel;
+};
+
+/*
+	One simulation: its grids, scratch and the divergence norms of the current frame.
+*/
+struct Run {
+	Mode mode;
+	MacGrid grid;
+	FieldGrid updatedHoriz;
+	FieldGrid updatedVert;
+	vector<float> rhs;
+	MacCormackAdvector advector;
+	PCGSolver pcgSolver;
+	MultigridSolver multigridSolver;
+	unique_ptr<Executor> executor;
+	float maxFaceVelocity;
+	int substeps;
+	// Largest over the substeps of the frame, after applyPressure()
+	double maxDivergence;
+	double rmsDivergence;
+
+	Run(const Mode &mode, int xDim, int yDim, AdvectScheme scheme)
+		: mode(mode), grid(xDim, yDim, 0), updatedHoriz(xDim+1, yDim, 0), updatedVert(xDim, yDim+1, 0), rhs(xDim * yDim),
+		  advector(xDim, yDim, scheme), pcgSolver(xDim, yDim), multigridSolver(xDim, yDim),
+		  executor(mode.reference ? (Executor*)new SerialExecutor() : (Executor*)new ThreadPool(mode.numThreads)),
+		  maxFaceVelocity(0.0f), substeps(0), maxDivergence(0.0), rmsDivergence(0.0) {}
+};
+
+/*
+	First or worst value of a frame that does not match.
+*/
+struct Mismatch {
+	const char* field;
+	int x;
+	int y;
+	float expected;
+	float actual;
+	long long ulps;
+	double rel;
+};
+
+/*
+	value: float
+
+	Return type: long long; value's position on a line where adjacent floats are 1 apart and
+	-0 and +0 coincide
+*/
+long long orderedBits(float value) {
+	int32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	return bits < 0 ? -(long long)(bits & 0x7fffffff) : bits;
+}
+
+/*
+	expected, actual: float; the reference and the compared value
+	tolerance: Tolerance
+	mismatch: Mismatch; receives the distances
+
+	Altered by reference: mismatch.ulps and mismatch.rel
+	Return type: bool; true if actual matches expected within tolerance
+*/
+bool valuesMatch(float expected, float actual, const Tolerance &tolerance, Mismatch &mismatch) {
+	bool identical = memcmp(&expected, &actual, sizeof(float)) == 0;
+	double difference = fabs((double)actual - expected);
+	double larger = fmax(fabs((double)expected), fabs((double)actual));
+	mismatch.ulps = llabs(orderedBits(actual) - orderedBits(expected));
+	mismatch.rel = larger > 0 ? difference / larger : 0.0;
+	if (identical) {
+		return true;
+	}
+	if (tolerance.exact || isnan(expected) || isnan(actual)) {
+		return false;
+	}
+	return mismatch.ulps <= tolerance.ulps || difference <= tolerance.rel * larger || difference <= tolerance.abs;
+}
+
+/*
+	name: const char*; field name for the report
+	expected, actual: FieldGrid; the field of both runs, the same shape
+	tolerance: Tolerance
+	failures: long long; counts the values that do not match
+	first, worst: Mismatch; the first value in row order and the one most ulps off
+	largestUlps, largestRel: running maxima over every value compared
+
+	Altered by reference: failures, first, worst, largestUlps, largestRel
+	Return type: void
+*/
+void compareField(const char* name, const FieldGrid &expected, const FieldGrid &actual, const Tolerance &tolerance,
+	long long &failures, Mismatch &first, Mismatch &worst, long long &largestUlps, double &largestRel) {
+	for (int x = 0; x < expected.rows(); ++x) {
+		for (int y = 0; y < expected.cols(); ++y) {
+			Mismatch mismatch = {name, x, y, expected(x, y), actual(x, y), 0, 0.0};
+			bool match = valuesMatch(mismatch.expected, mismatch.actual, tolerance, mismatch);
+			largestUlps = max(largestUlps, mismatch.ulps);
+			largestRel = isnan(mismatch.rel) ? largestRel : fmax(largestRel, mismatch.rel);
+			if (match) {
+				continue;
+			}
+			if (failures == 0) {
+				first = mismatch;
+			}
+			if (failures == 0 || mismatch.ulps > worst.ulps) {
+				worst = mismatch;
+			}
+			failures++;
+		}
+	}
+}
+
+/*
+	mismatch: Mismatch
+
+	Return type: string; the field, cell and both values
+*/
+string describe(const Mismatch &mismatch) {
+	stringstream text;
+	text.precision(9);
+	text << mismatch.field << "(" << mismatch.x << ", " << mismatch.y << "): expected " << mismatch.expected
+		<< ", got " << mismatch.actual << ", " << mismatch.ulps << " ulps, relative " << mismatch.rel;
+	return text.str();
+}
+
+/*
+	grid: MacGrid; receives the initial condition
+	name: string; one of CASES
+	config: SolverConfig; xDim, yDim and the initial condition files
+
+	Altered by reference: grid
+	Return type: bool; false if the files case cannot read its files
+*/
+bool fillCase(MacGrid &grid, const string &name, const SolverConfig &config) {
+	int xDim = config.xDim;
+	int yDim = config.yDim;
+	if (name == "files") {
+		return fillGrid(grid.horizVelocity, config.initialHorizFile)
+			&& fillGrid(grid.vertVelocity, config.initialVertFile)
+			&& fillGrid(grid.pressure, config.initialPressureFile);
+	}
+	grid.pressure.fill(0.0f);
+	if (name == "random") {
+		unsigned seed = 1;
+		for (FieldGrid* field : {&grid.horizVelocity, &grid.vertVelocity}) {
+			for (int x = 0; x < field->rows(); ++x) {
+				for (int y = 0; y < field->cols(); ++y) {
+					seed = seed * 1664525u + 1013904223u;
+					(*field)(x, y) = (seed >> 8) / 8388608.0f - 1.0f;
+				}
+			}
+		}
+		return true;
+	}
+	// Face velocities in cells per unit time, from the cell size of the smaller axis
+	float scale = min(xDim, yDim);
+	float centerX = xDim / 2.0f;
+	float centerY = yDim / 2.0f;
+	float radius = scale / 6.0f;
+	for (int x = 0; x <= xDim; ++x) {
+		for (int y = 0; y < yDim; ++y) {
+			float dy = y + 0.5f - centerY;
+			float dx = x - centerX;
+			grid.horizVelocity(x, y) = name == "vortex"
+				? -dy / radius * exp(-(dx * dx + dy * dy) / (radius * radius)) * scale / 4
+				: (fabs(dy) < radius / 2 ? scale / 4 : 0.0f);
+		}
+	}
+	for (int x = 0; x < xDim; ++x) {
+		for (int y = 0; y <= yDim; ++y) {
+			float dy = y - centerY;
+			float dx = x + 0.5f - centerX;
+			grid.vertVelocity(x, y) = name == "vortex"
+				? dx / radius * exp(-(dx * dx + dy * dy) / (radius * radius)) * scale / 4
+				: 0.0f;
+		}
+	}
+	return true;
+}
+
+/*
+	run: Run; advanced by one substep
+	config: SolverConfig; pressure solver and its options, tileSize
+	stepKernels: StepKernels; kernels of the optimized mode
+	deltaT: float; substep length
+
+	Altered by reference: run
+	Return type: void
+*/
+void substep(Run &run, const SolverConfig &config, const StepKernels &stepKernels, float deltaT) {
+	int xDim = config.xDim;
+	int yDim = config.yDim;
+	FieldGrid &horiz = run.grid.horizVelocity;
+	FieldGrid &vert = run.grid.vertVelocity;
+	FieldGrid &pressure = run.grid.pressure;
+	bool reference = run.mode.reference;
+	const int tileSize = reference ? 0 : config.tileSize == -1 ? cacheTileSize() : config.tileSize;
+
+	if (reference) {
+		addGravity(vert, xDim, yDim, deltaT);
+		buildRHS(horiz, vert, xDim, yDim, run.rhs);
+	}
+	else if (tileSize > 0) {
+		addGravityBuildRHSTiled(horiz, vert, xDim, yDim, deltaT, run.rhs, tileSize);
+	}
+	else {
+		stepKernels.addGravity(vert, xDim, yDim, deltaT);
+		stepKernels.buildRHS(horiz, vert, xDim, yDim, run.rhs);
+	}
+
+	if (config.pressureSolver == "gs") {
+		if (reference) {
+			project(pressure, deltaT, xDim, yDim, run.rhs);
+		}
+		else {
+			stepKernels.project(pressure, deltaT, xDim, yDim, run.rhs);
+		}
+	}
+	else if (config.pressureSolver == "rbsor") {
+		projectRedBlack(pressure, deltaT, xDim, yDim, run.rhs, config.sorOmega, config.redBlackSweeps, *run.executor);
+	}
+	else if (config.pressureSolver == "pcg") {
+		run.pcgSolver.solve(pressure, deltaT, run.rhs, config.pressureTolerance, config.maxPressureIterations);
+	}
+	else {
+		run.multigridSolver.solve(pressure, deltaT, run.rhs, config.pressureTolerance, config.maxPressureIterations);
+	}
+
+	if (reference) {
+		run.maxFaceVelocity = applyPressure(pressure, horiz, vert, deltaT, xDim, yDim);
+	}
+	else if (tileSize > 0) {
+		run.maxFaceVelocity = applyPressureTiled(pressure, horiz, vert, deltaT, xDim, yDim, tileSize, 0);
+	}
+	else {
+		run.maxFaceVelocity = stepKernels.applyPressure(pressure, horiz, vert, deltaT, xDim, yDim);
+	}
+
+	// Measured on the reference code for every run, so only the fields can differ
+	double sumSquares = 0.0;
+	for (int y = 0; y < yDim; ++y) {
+		for (int x = 0; x < xDim; ++x) {
+			double divergence = horiz(x + 1, y) - horiz(x, y) + vert(x, y + 1) - vert(x, y);
+			sumSquares += divergence * divergence;
+		}
+	}
+	run.maxDivergence = fmax(run.maxDivergence, maxDivergence(horiz, vert, xDim, yDim));
+	run.rmsDivergence = fmax(run.rmsDivergence, sqrt(sumSquares / ((double)xDim * yDim)));
+
+	if (reference && config.advectScheme == "semilagrangian") {
+		advect(horiz, vert, run.updatedHoriz, run.updatedVert, xDim, yDim, deltaT, *run.executor);
+	}
+	else {
+		run.advector.advect(horiz, vert, run.updatedHoriz, run.updatedVert, deltaT, reference ? ADVECT_SCALAR : run.mode.kernel, *run.executor);
+	}
+	horiz.swap(run.updatedHoriz);
+	vert.swap(run.updatedVert);
+	run.substeps++;
+}
+
+/*
+	name: string; case to run
+	config: SolverConfig
+	modes: vector of Mode; the first is what the others are compared with
+	tolerance: Tolerance
+
+	Prints the outcome of every comparison.
+	Return type: bool; false if any mode diverged or the case could not be set up
+*/
+bool runCase(const string &name, const SolverConfig &config, const vector<Mode> &modes, const Tolerance &tolerance) {
+	int xDim = config.xDim;
+	int yDim = config.yDim;
+	AdvectScheme scheme = ADVECT_SEMI_LAGRANGIAN;
+	parseAdvectScheme(config.advectScheme, scheme);
+	StepKernels stepKernels = selectStepKernels(xDim, yDim);
+
+	vector<unique_ptr<Run> > runs;
+	for (const Mode &mode : modes) {
+		runs.push_back(unique_ptr<Run>(new Run(mode, xDim, yDim, scheme)));
+		if (!fillCase(runs.back()->grid, name, config)) {
+			return false;
+		}
+		runs.back()->maxFaceVelocity = maxVelocity(runs.back()->grid.horizVelocity, runs.back()->grid.vertVelocity, xDim, yDim);
+	}
+
+	auto modeName = [](const Mode &mode) {
+		return mode.reference ? string("reference") : to_string(mode.numThreads) + " threads, " + advectKernelName(mode.kernel);
+	};
+	Run &expected = *runs[0];
+	// Statistics of every compared run over the frames so far
+	vector<long long> largestUlps(runs.size(), 0);
+	vector<double> largestRel(runs.size(), 0.0);
+	vector<bool> diverged(runs.size(), false);
+	bool passed = true;
+	for (int frame = 0; frame < config.numFrames; ++frame) {
+		for (size_t index = 0; index < runs.size(); ++index) {
+			if (diverged[index]) {
+				continue;
+			}
+			Run &run = *runs[index];
+			run.maxDivergence = 0.0;
+			run.rmsDivergence = 0.0;
+			run.substeps = 0;
+			float frameTimeLeft = config.timePerFrame;
+			while (frameTimeLeft > 0) {
+				float deltaT = cflTimestep(config.deltaT, config.cfl, run.maxFaceVelocity, frameTimeLeft);
+				substep(run, config, stepKernels, deltaT);
+				frameTimeLeft -= deltaT;
+			}
+		}
+
+		for (size_t index = 1; index < runs.size(); ++index) {
+			if (diverged[index]) {
+				continue;
+			}
+			Run &actual = *runs[index];
+			long long failures = 0;
+			Mismatch first, worst;
+			compareField("horizVelocity", expected.grid.horizVelocity, actual.grid.horizVelocity, tolerance, failures, first, worst, largestUlps[index], largestRel[index]);
+			compareField("vertVelocity", expected.grid.vertVelocity, actual.grid.vertVelocity, tolerance, failures, first, worst, largestUlps[index], largestRel[index]);
+			compareField("pressure", expected.grid.pressure, actual.grid.pressure, tolerance, failures, first, worst, largestUlps[index], largestRel[index]);
+
+			double allowance = tolerance.exact ? 1.0 : 1.0 + tolerance.divergence;
+			double slack = tolerance.exact ? 0.0 : tolerance.abs;
+			bool divergenceFails = !(actual.maxDivergence <= expected.maxDivergence * allowance + slack)
+				|| !(actual.rmsDivergence <= expected.rmsDivergence * allowance + slack);
+			if (failures == 0 && !divergenceFails) {
+				continue;
+			}
+
+			diverged[index] = true;
+			passed = false;
+			cout << name << ": " << modeName(actual.mode) << " diverges from " << modeName(expected.mode) << " at frame " << frame;
+			if (actual.substeps != expected.substeps) {
+				cout << " (" << actual.substeps << " substeps against " << expected.substeps << ")";
+			}
+			cout << endl;
+			if (failures > 0) {
+				cout << "\t" << failures << " values out of tolerance" << endl
+					<< "\tfirst: " << describe(first) << endl
+					<< "\tworst: " << describe(worst) << endl;
+			}
+			if (divergenceFails) {
+				cout << "\tdivergence after applyPressure: max " << actual.maxDivergence << " against " << expected.maxDivergence
+					<< ", rms " << actual.rmsDivergence << " against " << expected.rmsDivergence << endl;
+			}
+		}
+	}
+
+	for (size_t index = 1; index < runs.size(); ++index) {
+		if (!diverged[index]) {
+			cout << name << ": " << modeName(runs[index]->mode) << " matches " << modeName(expected.mode) << " for " << config.numFrames
+				<< " frames; largest difference " << largestUlps[index] << " ulps, relative " << largestRel[index] << endl;
+		}
+	}
+	return passed;
+}
+
+/*
+	name: string; scalar, sse41 or avx2
+	kernel: AdvectKernel; receives the kernel named
+
+	Altered by reference: kernel
+	Return type: bool; false if name is none of them or the CPU cannot run it
+*/
+bool parseKernel(const string &name, AdvectKernel &kernel) {
+	const AdvectKernel kernels[] = {ADVECT_SCALAR, ADVECT_SSE41, ADVECT_AVX2};
+	for (AdvectKernel candidate : kernels) {
+		if (name == advectKernelName(candidate) && candidate <= bestAdvectKernel()) {
+			kernel = candidate;
+			return true;
+		}
+	}
+	return false;
+}
+
+}
+
+int main(int argc, char* argv[]){
+	/*
+	The options of this tool are taken out before the rest go to parseArguments().
+	*/
+	Tolerance tolerance = {4, 1e-5, 1e-6, 0.1, false};
+	bool deterministic = false;
+	string caseName = "all";
+	AdvectKernel kernel = bestAdvectKernel();
+	vector<int> threadCounts;
+	vector<char*> solverArguments(1, argv[0]);
+	bool valid = true;
+	for (int index = 1; index < argc; ++index) {
+		string option = argv[index];
+		bool hasValue = index + 1 < argc;
+		if (option == "--deterministic") {
+			deterministic = true;
+		}
+		else if (option == "--case" && hasValue) {
+			caseName = argv[++index];
+		}
+		else if (option == "--ulps" && hasValue) {
+			tolerance.ulps = atoi(argv[++index]);
+		}
+		else if (option == "--rel" && hasValue) {
+			tolerance.rel = atof(argv[++index]);
+		}
+		else if (option == "--abs" && hasValue) {
+			tolerance.abs = atof(argv[++index]);
+		}
+		else if (option == "--divergence" && hasValue) {
+			tolerance.divergence = atof(argv[++index]);
+		}
+		else if (option == "--kernel" && hasValue) {
+			if (!parseKernel(argv[++index], kernel)) {
+				cerr << "--kernel must be scalar, sse41 or avx2, and supported by this CPU" << endl;
+				valid = false;
+			}
+		}
+		else if (option == "--thread-counts" && hasValue) {
+			stringstream list(argv[++index]);
+			string count;
+			while (getline(list, count, ',')) {
+				threadCounts.push_back(atoi(count.c_str()));
+			}
+		}
+		else {
+			solverArguments.push_back(argv[index]);
+		}
+	}
+
+	SolverConfig config;
+	if (!valid || !parseArguments(config, (int)solverArguments.size(), solverArguments.data())) {
+		cerr << "usage: " << argv[0] << " [--case all|files|random|vortex|jet] [--ulps n] [--rel r] [--abs a] [--divergence d]" << endl
+			<< "       [--kernel scalar|sse41|avx2] [--deterministic] [--thread-counts 1,2,...] and the solver options:" << endl;
+		printUsage(argv[0]);
+		return 1;
+	}
+	config.sparseTile = 0;
+	config.storagePrecision = "float32";
+	config.scalarFiles = "";
+	config.checkpointInterval = 0;
+	config.resume = false;
+	if (!validateConfig(config)) {
+		return 1;
+	}
+
+	vector<Mode> modes;
+	if (deterministic) {
+		tolerance.exact = true;
+		if (threadCounts.empty()) {
+			threadCounts = {1, 2, 3, (int)thread::hardware_concurrency()};
+		}
+		threadCounts.insert(threadCounts.begin(), 1);
+		for (size_t index = 0; index < threadCounts.size(); ++index) {
+			if (threadCounts[index] < 1) {
+				cerr << "--thread-counts must be positive" << endl;
+				return 1;
+			}
+			if (index == 0 || threadCounts[index] != 1) {
+				modes.push_back({false, threadCounts[index], kernel});
+			}
+		}
+	}
+	else {
+		modes.push_back({true, 1, ADVECT_SCALAR});
+		modes.push_back({false, config.numThreads, kernel});
+	}
+
+	vector<string> cases;
+	for (const char* name : CASES) {
+		if (caseName == "all" || caseName == name) {
+			cases.push_back(name);
+		}
+	}
+	if (cases.empty()) {
+		cerr << "--case must be all, files, random, vortex or jet, not " << caseName << endl;
+		return 1;
+	}
+
+	cout << config.xDim << "x" << config.yDim << ", " << config.numFrames << " frames, " << config.pressureSolver << " solver, "
+		<< config.advectScheme << " advection, tileSize " << config.tileSize;
+	if (deterministic) {
+		cout << "; bit-identical across thread counts" << endl;
+	}
+	else {
+		cout << "; tolerance " << tolerance.ulps << " ulps, relative " << tolerance.rel << ", absolute " << tolerance.abs
+			<< ", divergence " << tolerance.divergence << endl;
+	}
+	bool passed = true;
+	for (const string &name : cases) {
+		passed = runCase(name, config, modes, tolerance) && passed;
+	}
+	return passed ? 0 : 1;
+}
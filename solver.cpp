@@ -1,59 +1,367 @@
+#include "mac_grid.h"
 #include "grid_fns.h"
 #include "utils.h"
+#include "pressure_solver.h"
+#include "multigrid.h"
 #include "advect.h"
+#include "advect_simd.h"
+#include "advect_maccormack.h"
+#include "thread_pool.h"
+#include "frame_io.h"
+#include "async_frame_writer.h"
+#include "frame_codec.h"
+#include "trace.h"
+#include "config.h"
+#include "step_kernels.h"
+#include "checkpoint.h"
+#include "sparse_grid.h"
+#include "packed_grid.h"
+#include <cmath>
 #include <string>
 #include <stdlib.h>
+#include <unistd.h>
 #include <iostream>
 
 int main(int argc, char* argv[]){
 /* Below is basic skeleton of a fluid solver. Each function will be implemented,
 and combine to give us a simulator.*/
 
-	string fileName = "outputVelocities.txt";
-	int numFrames = 500;
-	int xDim = 32;
-	int yDim = 32;
-	float deltaT = 1 / 30.0;
-	float t;
+	// Grid size, timing, solver and I/O come from --config files and --key value options, see config.h.
+	SolverConfig config;
+	if (!parseArguments(config, argc, argv)) {
+		printUsage(argv[0]);
+		return 1;
+	}
+	// A resumed run takes its grids, output position and result-affecting options from the checkpoint.
+	CheckpointState restored;
+	if (config.resume && !readCheckpoint(config.checkpointFile, config, restored)) {
+		return 1;
+	}
+	if (!validateConfig(config)) {
+		return 1;
+	}
+
+	int numFrames = config.numFrames;
+	int xDim = config.xDim;
+	int yDim = config.yDim;
+	float deltaT = config.deltaT;
+	// With a cfl set, substeps shrink below config.deltaT so no face velocity carries anything more than cfl cells.
+	const double cflNumber = config.cfl;
+	float frameTimeLeft;
 
 	int initValue = 1;
 
+	// Pressure solve: "gs" runs the single Gauss-Seidel sweep of project(),
+	// "pcg" solves to pressureTolerance with the MIC(0) preconditioned conjugate gradient,
+	// "mg" solves to pressureTolerance with multigrid V-cycles,
+	// "rbsor" runs redBlackSweeps parallel red-black SOR sweeps relaxed by sorOmega.
+	string pressureSolver = config.pressureSolver;
+	const double pressureTolerance = config.pressureTolerance;
+	const int maxPressureIterations = config.maxPressureIterations;
+	const double sorOmega = config.sorOmega;
+	const int redBlackSweeps = config.redBlackSweeps;
+
+	// Frames go to the binary frame format of frame_io.h, raw or compressed to within
+	// outputErrorBound by frame_codec.h, or are exported as text.
+	string outputFormat = config.outputFormat;
+	const float outputErrorBound = config.outputErrorBound;
+	const int keyframeInterval = config.keyframeInterval;
+	string fileName = config.outputFile;
+	if (fileName.empty()) {
+		fileName = outputFormat == "text" ? "outputVelocities.txt" : "outputVelocities.bin";
+	}
+	// Snapshot buffers between the solver and the writer thread; the solver blocks when all are full.
+	const int outputQueueSize = config.outputQueueSize;
+
+	// Advection and the red-black sweeps run on a pool sized to the machine unless told otherwise.
+	ThreadPool threadPool(config.numThreads);
+	// Gravity, divergence, the Gauss-Seidel sweep and the pressure update, specialised for common grid sizes.
+	StepKernels stepKernels = selectStepKernels(xDim, yDim);
+	// Or, with a tileSize, the fused kernels over cache sized blocks; identical results either way.
+	const int tileSize = config.tileSize == -1 ? cacheTileSize() : config.tileSize;
+	AdvectKernel advectKernel = bestAdvectKernel();
+	// Velocity advection: first order semi-Lagrangian, or maccormack or bfecc for the second order schemes.
+	AdvectScheme advectScheme = ADVECT_SEMI_LAGRANGIAN;
+	parseAdvectScheme(config.advectScheme, advectScheme);
+	// Or, with a sparseTile, the whole step runs on tiles allocated only where the flow moves;
+	// the dense grids below then only stage the initial state and the frames.
+	const bool sparse = config.sparseTile > 0;
+	const float sparseThreshold = config.sparseThreshold;
+	SparseGrid sparseGrid(xDim, yDim, config.sparseTile);
+	// Or, with float16 or bfloat16 storage, the velocities and the pressure are kept packed
+	// between the stages; the dense grids then stage the initial state and the frames, and
+	// the pressure for the solves other than gs.
+	StoragePrecision storagePrecision = STORAGE_FLOAT32;
+	parseStoragePrecision(config.storagePrecision, storagePrecision);
+	const bool packed = storagePrecision != STORAGE_FLOAT32;
+	PackedMacGrid packedGrid(xDim, yDim, storagePrecision, initValue);
+	// Passive scalars named by the scalars option, written after u and v of every cell.
+	vector<string> scalarFiles = scalarFileNames(config);
+	const int numScalars = scalarFiles.size();
+
 	// Make sure no existing data already in save destination, save number of frames we produce.
-	clearOutputFile(fileName, numFrames, xDim, yDim);
+	// A resumed run instead cuts the output back to the frames the checkpoint had seen written.
+	FrameWriter frameWriter;
+	uint32_t outputCodec = outputFormat == "compressed" ? FRAME_CODEC_QUANT_RICE : FRAME_CODEC_RAW;
+	if (config.resume) {
+		bool truncated = outputFormat == "text"
+			? truncate(fileName.c_str(), restored.outputSize) == 0
+			: frameWriter.resume(fileName, xDim, yDim, outputCodec, restored.frameOffsets, restored.frameSizes, restored.outputSize);
+		if (!truncated) {
+			cerr << "could not resume " << fileName << " from frame " << restored.nextFrame << endl;
+			return 1;
+		}
+	}
+	else if (outputFormat == "text" && !clearOutputFile(fileName, numFrames, xDim, yDim, 2 + numScalars)) {
+		cerr << "could not open " << fileName << endl;
+		return 1;
+	}
+	else if (outputFormat != "text" && !frameWriter.open(fileName, xDim, yDim, outputCodec, 2 + numScalars)) {
+		cerr << "could not open " << fileName << endl;
+		return 1;
+	}
 
 	// 1. Initialize grids with fluid
-	vector< vector<float> > pressureGrid(xDim, vector<float>(yDim, initValue));
-	vector< vector<float> > horizVelocityGrid(xDim+1, vector<float>(yDim, initValue));
-	vector< vector<float> > vertVelocityGrid(xDim, vector<float>(yDim+1, initValue));
-
-	fillGrid(horizVelocityGrid, "initialHorizVelocities.txt");
-	fillGrid(vertVelocityGrid, "initialVertVelocities.txt");
-	fillGrid(pressureGrid, "initialPressure.txt");
-
-	// Used for updating fields ins advect function
-	vector< vector<float> > updatedHorizGrid(xDim+1, vector<float>(yDim, initValue));
-	vector< vector<float> > updatedVertGrid(xDim, vector<float>(yDim+1, initValue));
-	vector<float> *rhs = 0;
-
-	const float TIME_PER_FRAME = 1 / 15.0;
-	for (int i = 0; i < numFrames; ++i) {
-		t = 0;
-		saveVelocityField(horizVelocityGrid, vertVelocityGrid, xDim, yDim, fileName);
-		deltaT = 1 / 30.0;
-		while (t < TIME_PER_FRAME) {
-			addGravity(vertVelocityGrid, xDim, yDim, deltaT);
-			rhs = buildRHS(horizVelocityGrid, vertVelocityGrid, xDim, yDim);
-			project(pressureGrid, deltaT, xDim, yDim, *rhs);
-			applyPressure(pressureGrid, horizVelocityGrid, vertVelocityGrid, deltaT, xDim, yDim);
-			advect(horizVelocityGrid, vertVelocityGrid, updatedHorizGrid, updatedVertGrid, xDim, yDim, deltaT);
-			delete rhs;
-
-			horizVelocityGrid = updatedHorizGrid;
-			vertVelocityGrid = updatedVertGrid;
-
-			t = t + deltaT;
-		}
-	// 	save frame i
-	}
-	saveVelocityField(horizVelocityGrid, vertVelocityGrid, xDim, yDim, fileName);
+	MacGrid grid(xDim, yDim, initValue);
+	FieldGrid &pressureGrid = grid.pressure;
+	FieldGrid &horizVelocityGrid = grid.horizVelocity;
+	FieldGrid &vertVelocityGrid = grid.vertVelocity;
+
+	if (config.resume) {
+		horizVelocityGrid.swap(restored.horizVelocity);
+		vertVelocityGrid.swap(restored.vertVelocity);
+		pressureGrid.swap(restored.pressure);
+	}
+	else if (!fillGrid(horizVelocityGrid, config.initialHorizFile)
+		|| !fillGrid(vertVelocityGrid, config.initialVertFile)
+		|| !fillGrid(pressureGrid, config.initialPressureFile)) {
+		return 1;
+	}
+
+	// Passive scalars, xDim x yDim at the cell centres, one grid per field, carried by the advection
+	// with the velocity's own backtrace.
+	vector<FieldGrid> scalarGrids(numScalars, FieldGrid(xDim, yDim, 0));
+	vector<FieldGrid> updatedScalarGrids(numScalars, FieldGrid(xDim, yDim, 0));
+	for (int field = 0; field < numScalars; ++field) {
+		if (!fillGrid(scalarGrids[field], scalarFiles[field])) {
+			return 1;
+		}
+	}
+
+	if (sparse) {
+		sparseGrid.load(horizVelocityGrid, vertVelocityGrid, pressureGrid, sparseThreshold);
+	}
+	if (packed) {
+		packedGrid.load(horizVelocityGrid, vertVelocityGrid, pressureGrid);
+	}
+
+	// Back buffers written by the advect function, swapped with the live grids afterwards
+	const bool dense = !sparse && !packed;
+	FieldGrid updatedHorizGrid(dense ? xDim+1 : 0, yDim, initValue);
+	FieldGrid updatedVertGrid(dense ? xDim : 0, yDim+1, initValue);
+	// Scratch of the second order schemes
+	MacCormackAdvector advector(xDim, yDim, dense ? advectScheme : ADVECT_SEMI_LAGRANGIAN);
+	// Divergence handed to the pressure solve, reused by every substep
+	vector<float> rhs(dense ? xDim * yDim : 0);
+	const vector<float> &solveRhs = packed ? packedGrid.rhs() : rhs;
+	PCGSolver pcgSolver(xDim, yDim);
+	MultigridSolver multigridSolver(xDim, yDim);
+	SolveStats stats = {0, 0.0};
+	float tiledDivergence = 0.0f;
+	int substep;
+
+	// Frames are serialized on a writer thread from snapshots of the face velocities.
+	FrameEncoder frameEncoder(xDim * yDim * (2 + numScalars), outputErrorBound, keyframeInterval);
+	if (config.resume && outputFormat == "compressed" && !frameEncoder.restore(restored.encoderFrames, restored.encoderState)) {
+		cerr << config.checkpointFile << " does not match the compressed output" << endl;
+		return 1;
+	}
+	vector<float> centerVelocities(xDim * yDim * (2 + numScalars));
+	vector<unsigned char> encodedFrame;
+	// Only touched on the writer thread until finish() joins it.
+	bool outputFailed = false;
+	AsyncFrameWriter asyncWriter(xDim, yDim, outputQueueSize, [&](const FieldGrid &horiz, const FieldGrid &vert, const FieldGrid* scalars) {
+		TRACE_SCOPE("writeFrame");
+		bool written;
+		if (outputFormat == "text") {
+			written = saveVelocityField(horiz, vert, xDim, yDim, fileName, scalars, numScalars);
+		}
+		else if (outputFormat == "compressed") {
+			centerVelocityFrame(horiz, vert, xDim, yDim, centerVelocities.data(), scalars, numScalars);
+			frameEncoder.encode(centerVelocities.data(), encodedFrame);
+			written = frameWriter.writeFrameBytes(encodedFrame.data(), encodedFrame.size());
+		}
+		else {
+			written = frameWriter.writeFrame(horiz, vert, scalars);
+		}
+		outputFailed = outputFailed || !written;
+	}, numScalars);
+
+	// Every checkpointInterval frames the state is captured and written after the frames queued before it,
+	// on the writer thread, so the solver only waits for the grid copy.
+	Checkpointer checkpointer(config);
+	const int checkpointInterval = config.checkpointInterval;
+	const int startFrame = config.resume ? restored.nextFrame : 0;
+
+	const float TIME_PER_FRAME = config.timePerFrame;
+	// Advection only interpolates between face velocities, so the maximum applyPressure reduces
+	// in a substep bounds the velocities the next substep starts from. Only the initial grids need a sweep.
+	float maxFaceVelocity = config.resume ? restored.maxFaceVelocity : maxVelocity(horizVelocityGrid, vertVelocityGrid, xDim, yDim);
+	for (int i = startFrame; i < numFrames; ++i) {
+		frameTimeLeft = TIME_PER_FRAME;
+		if (checkpointInterval > 0 && i > startFrame && i % checkpointInterval == 0) {
+			TRACE_SCOPE("captureCheckpoint");
+			CheckpointState &checkpoint = checkpointer.capture(horizVelocityGrid, vertVelocityGrid, pressureGrid, i, maxFaceVelocity);
+			asyncWriter.submitTask([&] {
+				TRACE_SCOPE("writeCheckpoint");
+				if (outputFormat == "text") {
+					syncFile(fileName, checkpoint.outputSize);
+				}
+				else {
+					checkpoint.outputSize = frameWriter.flush();
+					checkpoint.frameOffsets = frameWriter.frameOffsets();
+					checkpoint.frameSizes = frameWriter.frameSizes();
+					checkpoint.encoderFrames = frameEncoder.framesEncoded();
+					checkpoint.encoderState = frameEncoder.lastQuantized();
+				}
+				checkpointer.write(config.checkpointFile);
+			});
+		}
+		{
+			TRACE_SCOPE("submitFrame");
+			if (sparse) {
+				sparseGrid.store(horizVelocityGrid, vertVelocityGrid);
+			}
+			if (packed) {
+				packedGrid.store(horizVelocityGrid, vertVelocityGrid);
+			}
+			asyncWriter.submit(horizVelocityGrid, vertVelocityGrid, scalarGrids.data());
+		}
+		substep = 0;
+		while (frameTimeLeft > 0) {
+			TRACE_SCOPE("substep");
+			deltaT = cflTimestep(config.deltaT, cflNumber, maxFaceVelocity, frameTimeLeft);
+			if (sparse) {
+				sparseGrid.addGravityBuildRHS(deltaT);
+				if (pressureSolver == "gs") {
+					sparseGrid.project(deltaT);
+				}
+				else {
+					sparseGrid.projectRedBlack(deltaT, sorOmega, redBlackSweeps, threadPool);
+				}
+				maxFaceVelocity = sparseGrid.applyPressure(deltaT);
+				TRACE_SUBSTEP(i, substep, NAN, sparseGrid.maxDivergence(), maxFaceVelocity * deltaT);
+				sparseGrid.advect(deltaT, maxFaceVelocity, advectKernel, threadPool);
+				sparseGrid.updateActiveTiles(sparseThreshold, maxFaceVelocity * deltaT);
+
+				frameTimeLeft -= deltaT;
+				substep++;
+				continue;
+			}
+			if (packed) {
+				packedGrid.addGravityBuildRHS(deltaT);
+			}
+			else if (tileSize > 0) {
+				addGravityBuildRHSTiled(horizVelocityGrid, vertVelocityGrid, xDim, yDim, deltaT, rhs, tileSize);
+			}
+			else {
+				stepKernels.addGravity(vertVelocityGrid, xDim, yDim, deltaT);
+				stepKernels.buildRHS(horizVelocityGrid, vertVelocityGrid, xDim, yDim, rhs);
+			}
+			if (pressureSolver == "gs") {
+				if (packed) {
+					packedGrid.project(deltaT);
+				}
+				else {
+					stepKernels.project(pressureGrid, deltaT, xDim, yDim, rhs);
+				}
+			}
+			else {
+				// The other solves work on the float pressure grid, unpacked for them with packed storage.
+				if (packed) {
+					packedGrid.unpackPressure(pressureGrid);
+				}
+				if (pressureSolver == "rbsor") {
+					projectRedBlack(pressureGrid, deltaT, xDim, yDim, solveRhs, sorOmega, redBlackSweeps, threadPool);
+				}
+				else {
+					if (pressureSolver == "pcg") {
+						stats = pcgSolver.solve(pressureGrid, deltaT, solveRhs, pressureTolerance, maxPressureIterations);
+					}
+					else {
+						stats = multigridSolver.solve(pressureGrid, deltaT, solveRhs, pressureTolerance, maxPressureIterations);
+					}
+					cout << "frame " << i << " substep " << substep << ": " << stats.iterations
+						<< " iterations, residual " << stats.residual << endl;
+				}
+				if (packed) {
+					packedGrid.packPressure(pressureGrid);
+				}
+			}
+			if (packed) {
+				maxFaceVelocity = packedGrid.applyPressure(deltaT);
+			}
+			else if (tileSize > 0) {
+				maxFaceVelocity = applyPressureTiled(pressureGrid, horizVelocityGrid, vertVelocityGrid, deltaT, xDim, yDim, tileSize,
+					traceEnabled ? &tiledDivergence : 0);
+			}
+			else {
+				maxFaceVelocity = stepKernels.applyPressure(pressureGrid, horizVelocityGrid, vertVelocityGrid, deltaT, xDim, yDim);
+			}
+			// Only evaluated when built with FLUID_TRACE; gs and rbsor report no residual.
+			TRACE_SUBSTEP(i, substep, pressureSolver == "pcg" || pressureSolver == "mg" ? stats.residual : NAN,
+				packed ? packedGrid.maxDivergence() : tileSize > 0 ? tiledDivergence : maxDivergence(horizVelocityGrid, vertVelocityGrid, xDim, yDim),
+				maxFaceVelocity * deltaT);
+			if (packed) {
+				packedGrid.advect(deltaT, maxFaceVelocity, advectKernel, threadPool);
+			}
+			else {
+				ScalarBatch scalars = {scalarGrids.data(), updatedScalarGrids.data(), numScalars};
+				advector.advect(horizVelocityGrid, vertVelocityGrid, updatedHorizGrid, updatedVertGrid, deltaT, scalars, advectKernel, threadPool);
+
+				horizVelocityGrid.swap(updatedHorizGrid);
+				vertVelocityGrid.swap(updatedVertGrid);
+				scalarGrids.swap(updatedScalarGrids);
+			}
+
+			// The last substep of a frame is exactly frameTimeLeft, so this lands on 0.
+			frameTimeLeft -= deltaT;
+			substep++;
+		}
+		TRACE_FRAME(i);
+	}
+	if (sparse) {
+		sparseGrid.store(horizVelocityGrid, vertVelocityGrid);
+	}
+	if (packed) {
+		packedGrid.store(horizVelocityGrid, vertVelocityGrid);
+	}
+	asyncWriter.submit(horizVelocityGrid, vertVelocityGrid, scalarGrids.data());
+	asyncWriter.finish();
+	if (!frameWriter.close() || outputFailed) {
+		cerr << "could not write " << fileName << endl;
+		return 1;
+	}
+	TRACE_WRITE("trace.json", "traceSummary.csv");
+
+	FrameWriterStats outputStats = asyncWriter.stats();
+	cout << "output: " << outputStats.framesWritten << " frames, queue high-water mark "
+		<< outputStats.highWaterMark << "/" << outputQueueSize << ", solver blocked "
+		<< outputStats.blockedSeconds << "s" << endl;
+	if (checkpointInterval > 0) {
+		cout << "checkpoints: " << checkpointer.checkpointsWritten() << " written to " << config.checkpointFile << endl;
+	}
+	if (sparse) {
+		SparseGridStats sparseStats = sparseGrid.stats();
+		cout << "sparse tiles: " << sparseStats.meanTiles << " of " << sparseStats.totalTiles << " active on average, peak "
+			<< sparseStats.peakTiles << ", " << sparseStats.bytes / 1e6 << " MB allocated at the end" << endl;
+	}
+	if (packed) {
+		cout << "storage: " << storagePrecisionName(storagePrecision) << ", " << packedGrid.bytes() / 1e6 << " MB of packed fields" << endl;
+	}
+	if (outputFormat == "compressed") {
+		CodecStats codecStats = frameEncoder.stats();
+		cout << "compression ratio " << (double)codecStats.rawBytes / codecStats.encodedBytes
+			<< ", encode " << codecStats.rawBytes / 1e6 / codecStats.encodeSeconds << " MB/s" << endl;
+	}
 }
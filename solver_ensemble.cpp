@@ -0,0 +1,67 @@
+#include "config.h"
+#include "ensemble.h"
+#include "thread_pool.h"
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+
+/*
+	Runs many small simulations in one process, one per core at a time:
+		./solver_ensemble manifest [--config file] [--key value]...
+	The options after the manifest are the defaults every case starts from, and threads sets
+	how many cases run at once; see loadManifest() in ensemble.h for the manifest format.
+	Grids of 32^2 to 128^2 cells are too small to spread over threads, so rather than
+	parallelising within a case the cases are dealt out over a WorkStealingPool, which keeps
+	every thread busy however unevenly the cases' sizes and frame counts divide.
+*/
+int main(int argc, char* argv[]){
+	SolverConfig defaults;
+	if (argc < 2 || !parseArguments(defaults, argc - 1, argv + 1)) {
+		cerr << "usage: " << argv[0] << " manifest [--config file] [--key value]..." << endl;
+		printUsage(argv[0]);
+		return 1;
+	}
+	string manifestFile = argv[1];
+	int numThreads = defaults.numThreads > 0 ? defaults.numThreads : 1;
+
+	vector<SolverConfig> cases;
+	if (!loadManifest(manifestFile, defaults, cases)) {
+		return 1;
+	}
+
+	vector<CaseResult> results(cases.size());
+	vector<char> succeeded(cases.size(), 0);
+	WorkStealingPool pool(numThreads);
+	auto start = chrono::steady_clock::now();
+	pool.parallelFor(0, (int)cases.size(), [&](int caseBegin, int caseEnd) {
+		for (int index = caseBegin; index < caseEnd; ++index) {
+			succeeded[index] = runCase(cases[index], results[index]);
+		}
+	});
+	double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+	int failed = 0;
+	double cellSteps = 0.0;
+	double caseSeconds = 0.0;
+	double slowestCase = 0.0;
+	for (size_t index = 0; index < cases.size(); ++index) {
+		if (!succeeded[index]) {
+			cerr << "case " << index << " (" << cases[index].outputFile << ") failed" << endl;
+			failed++;
+			continue;
+		}
+		cellSteps += results[index].cellSteps;
+		caseSeconds += results[index].seconds;
+		if (results[index].seconds > slowestCase) {
+			slowestCase = results[index].seconds;
+		}
+	}
+	int completed = (int)cases.size() - failed;
+	cout << "ensemble: " << completed << " of " << cases.size() << " cases on " << numThreads << " threads in "
+		<< seconds << "s, " << completed / seconds << " cases/s, " << cellSteps / seconds << " cell-steps/s" << endl;
+	cout << "cases: " << (completed > 0 ? caseSeconds / completed : 0.0) << "s mean, " << slowestCase
+		<< "s slowest, threads busy " << 100.0 * caseSeconds / (seconds * numThreads) << "%, "
+		<< pool.steals() << " cases stolen" << endl;
+	return failed == 0 ? 0 : 1;
+}
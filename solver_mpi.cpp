@@ -0,0 +1,195 @@
+#include "mac_grid.h"
+#include "grid_fns.h"
+#include "utils.h"
+#include "advect_simd.h"
+#include "thread_pool.h"
+#include "frame_io.h"
+#include "async_frame_writer.h"
+#include "frame_codec.h"
+#include "config.h"
+#include "distributed.h"
+#include <mpi.h>
+#include <memory>
+#include <string>
+#include <iostream>
+
+/*
+	The solver of solver.cpp with every substep spread over MPI ranks by SlabSolver.
+	Takes the same options and writes the same output, bit for bit, from rank 0; run as e.g.
+		mpirun -np 4 ./solver_mpi --solver gs --format binary
+	Only the gs and rbsor pressure solves are distributed, and checkpoints are not written.
+*/
+int main(int argc, char* argv[]){
+	MPI_Init(&argc, &argv);
+	int rank, numRanks;
+	MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+	MPI_Comm_size(MPI_COMM_WORLD, &numRanks);
+
+	// Every rank parses the same arguments; only rank 0 reports problems.
+	SolverConfig config;
+	bool valid;
+	if (rank == 0) {
+		valid = parseArguments(config, argc, argv);
+		if (!valid) {
+			printUsage(argv[0]);
+		}
+		valid = valid && validateConfig(config);
+		if (valid && config.pressureSolver != "gs" && config.pressureSolver != "rbsor") {
+			cerr << "solver_mpi supports the gs and rbsor solvers, not " << config.pressureSolver << endl;
+			valid = false;
+		}
+		if (valid && config.advectScheme != "semilagrangian") {
+			cerr << "solver_mpi supports semilagrangian advection only, not " << config.advectScheme << endl;
+			valid = false;
+		}
+		if (valid && !scalarFileNames(config).empty()) {
+			cerr << "solver_mpi does not carry passive scalars" << endl;
+			valid = false;
+		}
+		if (valid && config.storagePrecision != "float32") {
+			cerr << "solver_mpi stores float32 fields only, not " << config.storagePrecision << endl;
+			valid = false;
+		}
+		if (valid && (config.checkpointInterval > 0 || config.resume)) {
+			cerr << "solver_mpi does not write or resume checkpoints" << endl;
+			valid = false;
+		}
+		if (valid && numRanks > config.xDim) {
+			cerr << "solver_mpi needs at least one column of cells per rank, " << numRanks << " ranks for xDim " << config.xDim << endl;
+			valid = false;
+		}
+	}
+	else {
+		streambuf* errors = cerr.rdbuf(0);
+		valid = parseArguments(config, argc, argv) && validateConfig(config);
+		cerr.rdbuf(errors);
+	}
+	int status = valid;
+	MPI_Allreduce(MPI_IN_PLACE, &status, 1, MPI_INT, MPI_MIN, MPI_COMM_WORLD);
+	if (!status) {
+		MPI_Finalize();
+		return 1;
+	}
+
+	int numFrames = config.numFrames;
+	int xDim = config.xDim;
+	int yDim = config.yDim;
+	float deltaT = config.deltaT;
+	const double cflNumber = config.cfl;
+	float frameTimeLeft;
+
+	int initValue = 1;
+
+	string pressureSolver = config.pressureSolver;
+	const double sorOmega = config.sorOmega;
+	const int redBlackSweeps = config.redBlackSweeps;
+
+	string outputFormat = config.outputFormat;
+	const float outputErrorBound = config.outputErrorBound;
+	const int keyframeInterval = config.keyframeInterval;
+	string fileName = config.outputFile;
+	if (fileName.empty()) {
+		fileName = outputFormat == "text" ? "outputVelocities.txt" : "outputVelocities.bin";
+	}
+	const int outputQueueSize = config.outputQueueSize;
+
+	// Each rank runs its slab's rows on its own pool; size it to the cores left per rank.
+	ThreadPool threadPool(config.numThreads);
+	AdvectKernel advectKernel = bestAdvectKernel();
+	if (rank == 0 && config.tileSize != 0) {
+		cout << "tileSize is ignored by solver_mpi" << endl;
+	}
+
+	// Rank 0 holds the whole grid: it reads the initial state, hands out the slabs and
+	// collects every frame back for the writer thread.
+	MacGrid grid(rank == 0 ? xDim : 0, rank == 0 ? yDim : 0, initValue);
+	FrameWriter frameWriter;
+	FrameEncoder frameEncoder(xDim * yDim * 2, outputErrorBound, keyframeInterval);
+	vector<float> centerVelocities;
+	vector<unsigned char> encodedFrame;
+	unique_ptr<AsyncFrameWriter> asyncWriter;
+	if (rank == 0) {
+		uint32_t outputCodec = outputFormat == "compressed" ? FRAME_CODEC_QUANT_RICE : FRAME_CODEC_RAW;
+		status = outputFormat == "text"
+			? clearOutputFile(fileName, numFrames, xDim, yDim)
+			: frameWriter.open(fileName, xDim, yDim, outputCodec);
+		if (!status) {
+			cerr << "could not open " << fileName << endl;
+		}
+		status = status && fillGrid(grid.horizVelocity, config.initialHorizFile)
+			&& fillGrid(grid.vertVelocity, config.initialVertFile)
+			&& fillGrid(grid.pressure, config.initialPressureFile);
+	}
+	MPI_Bcast(&status, 1, MPI_INT, 0, MPI_COMM_WORLD);
+	if (!status) {
+		MPI_Finalize();
+		return 1;
+	}
+
+	// Only touched on rank 0's writer thread until finish() joins it.
+	bool outputFailed = false;
+	if (rank == 0) {
+		centerVelocities.resize(xDim * yDim * 2);
+		asyncWriter.reset(new AsyncFrameWriter(xDim, yDim, outputQueueSize, [&](const FieldGrid &horiz, const FieldGrid &vert, const FieldGrid*) {
+			bool written;
+			if (outputFormat == "text") {
+				written = saveVelocityField(horiz, vert, xDim, yDim, fileName);
+			}
+			else if (outputFormat == "compressed") {
+				centerVelocityFrame(horiz, vert, xDim, yDim, centerVelocities.data());
+				frameEncoder.encode(centerVelocities.data(), encodedFrame);
+				written = frameWriter.writeFrameBytes(encodedFrame.data(), encodedFrame.size());
+			}
+			else {
+				written = frameWriter.writeFrame(horiz, vert);
+			}
+			outputFailed = outputFailed || !written;
+		}));
+	}
+
+	SlabSolver slab(xDim, yDim, MPI_COMM_WORLD);
+	slab.scatter(&grid.horizVelocity, &grid.vertVelocity, &grid.pressure);
+
+	const float TIME_PER_FRAME = config.timePerFrame;
+	float maxFaceVelocity = rank == 0 ? maxVelocity(grid.horizVelocity, grid.vertVelocity, xDim, yDim) : 0.0f;
+	MPI_Bcast(&maxFaceVelocity, 1, MPI_FLOAT, 0, MPI_COMM_WORLD);
+	for (int i = 0; i < numFrames; ++i) {
+		frameTimeLeft = TIME_PER_FRAME;
+		slab.gather(&grid.horizVelocity, &grid.vertVelocity);
+		if (rank == 0) {
+			asyncWriter->submit(grid.horizVelocity, grid.vertVelocity);
+		}
+		while (frameTimeLeft > 0) {
+			// Every rank holds the same maxFaceVelocity, so they all take the same substeps.
+			deltaT = cflTimestep(config.deltaT, cflNumber, maxFaceVelocity, frameTimeLeft);
+			slab.addGravityBuildRHS(deltaT);
+			if (pressureSolver == "gs") {
+				slab.project(deltaT);
+			}
+			else {
+				slab.projectRedBlack(deltaT, sorOmega, redBlackSweeps, threadPool);
+			}
+			maxFaceVelocity = slab.applyPressure(deltaT);
+			slab.advect(deltaT, maxFaceVelocity, advectKernel, threadPool);
+
+			frameTimeLeft -= deltaT;
+		}
+	}
+	slab.gather(&grid.horizVelocity, &grid.vertVelocity);
+
+	if (rank == 0) {
+		asyncWriter->submit(grid.horizVelocity, grid.vertVelocity);
+		asyncWriter->finish();
+		if (!frameWriter.close() || outputFailed) {
+			// The other ranks are done with rank 0; only its exit status reports the failure.
+			cerr << "could not write " << fileName << endl;
+			status = 0;
+		}
+
+		FrameWriterStats outputStats = asyncWriter->stats();
+		cout << "output: " << outputStats.framesWritten << " frames from " << numRanks << " ranks, velocity halo "
+			<< slab.haloRows() << " rows, solver blocked " << outputStats.blockedSeconds << "s" << endl;
+	}
+	MPI_Finalize();
+	return status ? 0 : 1;
+}
@@ -0,0 +1,621 @@
+#include "sparse_grid.h"
+#include "advect.h"
+#include "step_kernels.h"
+#include "trace.h"
+#include <algorithm>
+#include <cmath>
+
+
+/*
+	xDim: int; number of cells in x direction
+	yDim: int; number of cells in y direction
+	tileSize: int; tile edge in cells, a power of two; 0 for an unused grid that allocates nothing
+*/
+SparseGrid::SparseGrid(int xDim, int yDim, int tileSize)
+	: xDim(xDim), yDim(yDim), tileSize(tileSize), shift(0), mask(0), tileCells(0), tilesX(0), tilesY(0),
+	  peakTiles(0), tileSubsteps(0.0), substeps(0) {
+	for (int which = 0; which < NUM_FIELDS; ++which) {
+		offsets[which] = 0;
+	}
+	if (tileSize <= 0) {
+		return;
+	}
+	while ((1 << shift) < tileSize) {
+		shift++;
+	}
+	mask = tileSize - 1;
+	tileCells = tileSize * tileSize;
+	for (int which = 0; which < NUM_FIELDS; ++which) {
+		offsets[which] = which * tileCells;
+	}
+	tilesX = (xDim + mask) >> shift;
+	tilesY = (yDim + mask) >> shift;
+	tiles.resize(tilesX * tilesY);
+	tileData.assign(tilesX * tilesY, 0);
+	rowStart.assign(tilesY + 1, 0);
+	rightWall.assign(yDim, 0.0f);
+	topWall.assign(xDim, 0.0f);
+	hot.assign(tilesX * tilesY, 0);
+	wanted.assign(tilesX * tilesY, 0);
+	fresh.assign(tilesX * tilesY, 0);
+	prefix.assign(max(tilesX, tilesY) + 1, 0);
+}
+
+/*
+	horizVelocityGrid, vertVelocityGrid, pressureGrid: FieldGrid; the dense grids to start from
+	threshold: float; faces faster than this keep their tile and its neighbours active; negative keeps every tile
+
+	Return type: void
+*/
+void SparseGrid::load(const FieldGrid &horizVelocityGrid, const FieldGrid &vertVelocityGrid, const FieldGrid &pressureGrid, float threshold) {
+	for (int tileX = 0; tileX < tilesX; ++tileX) {
+		for (int tileY = 0; tileY < tilesY; ++tileY) {
+			float fastest = 0.0f;
+			for (int x = tileX << shift; x < min((tileX + 1) << shift, xDim); ++x) {
+				for (int y = tileY << shift; y < min((tileY + 1) << shift, yDim); ++y) {
+					fastest = fmax(fastest, fmax(fabs(horizVelocityGrid(x, y)), fabs(vertVelocityGrid(x, y))));
+				}
+			}
+			hot[tileIndex(tileX, tileY)] = threshold < 0 || fastest > threshold;
+		}
+	}
+	retile(1);
+
+	for (size_t k = 0; k < activeList.size(); ++k) {
+		int tileX = activeList[k] / tilesY;
+		int tileY = activeList[k] % tilesY;
+		float* horiz = field(tileX, tileY, HORIZ);
+		float* vert = field(tileX, tileY, VERT);
+		float* pressure = field(tileX, tileY, PRESSURE);
+		for (int x = tileX << shift; x < min((tileX + 1) << shift, xDim); ++x) {
+			for (int y = tileY << shift; y < min((tileY + 1) << shift, yDim); ++y) {
+				int local = ((x & mask) << shift) + (y & mask);
+				horiz[local] = horizVelocityGrid(x, y);
+				vert[local] = vertVelocityGrid(x, y);
+				pressure[local] = pressureGrid(y, x);
+			}
+		}
+	}
+	for (int y = 0; y < yDim; ++y) {
+		rightWall[y] = horizVelocityGrid(xDim, y);
+	}
+	for (int x = 0; x < xDim; ++x) {
+		topWall[x] = vertVelocityGrid(x, yDim);
+	}
+}
+
+/*
+	horizVelocityGrid, vertVelocityGrid: FieldGrid; receive every face, 0 in inactive tiles
+
+	Altered by reference: horizVelocityGrid, vertVelocityGrid
+	Return type: void
+*/
+void SparseGrid::store(FieldGrid &horizVelocityGrid, FieldGrid &vertVelocityGrid) const {
+	TRACE_SCOPE("sparseStore");
+	for (int tileX = 0; tileX < tilesX; ++tileX) {
+		for (int tileY = 0; tileY < tilesY; ++tileY) {
+			const float* horiz = field(tileX, tileY, HORIZ);
+			const float* vert = field(tileX, tileY, VERT);
+			for (int x = tileX << shift; x < min((tileX + 1) << shift, xDim); ++x) {
+				for (int y = tileY << shift; y < min((tileY + 1) << shift, yDim); ++y) {
+					int local = ((x & mask) << shift) + (y & mask);
+					horizVelocityGrid(x, y) = horiz ? horiz[local] : 0.0f;
+					vertVelocityGrid(x, y) = vert ? vert[local] : 0.0f;
+				}
+			}
+		}
+	}
+	for (int y = 0; y < yDim; ++y) {
+		horizVelocityGrid(xDim, y) = rightWall[y];
+	}
+	for (int x = 0; x < xDim; ++x) {
+		vertVelocityGrid(x, yDim) = topWall[x];
+	}
+}
+
+/*
+	deltaT: float; length of the substep
+
+	Return type: void
+*/
+void SparseGrid::addGravityBuildRHS(float deltaT) {
+	TRACE_SCOPE("sparseGravityBuildRHS");
+	for (size_t k = 0; k < activeList.size(); ++k) {
+		int tileX = activeList[k] / tilesY;
+		int tileY = activeList[k] % tilesY;
+		float* vert = field(tileX, tileY, VERT);
+		int width = min(tileSize, xDim - (tileX << shift));
+		int height = min(tileSize, yDim - (tileY << shift));
+		for (int localX = 0; localX < width; ++localX) {
+			for (int localY = 0; localY < height; ++localY) {
+				vert[(localX << shift) + localY] -= deltaT * 9.81;
+			}
+		}
+	}
+
+	/*
+	Every face the rhs reads is final once gravity is in; the right and top faces of a tile
+	are the next tile's left and bottom faces, or a wall.
+	*/
+	for (size_t k = 0; k < activeList.size(); ++k) {
+		int tileX = activeList[k] / tilesY;
+		int tileY = activeList[k] % tilesY;
+		const float* horiz = field(tileX, tileY, HORIZ);
+		const float* vert = field(tileX, tileY, VERT);
+		const float* rightHoriz = field(tileX + 1, tileY, HORIZ);
+		const float* upVert = field(tileX, tileY + 1, VERT);
+		float* rhs = field(tileX, tileY, RHS);
+		for (int x = tileX << shift; x < min((tileX + 1) << shift, xDim); ++x) {
+			for (int y = tileY << shift; y < min((tileY + 1) << shift, yDim); ++y) {
+				int localX = x & mask;
+				int localY = y & mask;
+				int local = (localX << shift) + localY;
+				float right = x + 1 == xDim ? rightWall[y] : localX < mask ? horiz[local + tileSize] : rightHoriz ? rightHoriz[localY] : 0.0f;
+				float up = y + 1 == yDim ? topWall[x] : localY < mask ? vert[local + 1] : upVert ? upVert[localX << shift] : 0.0f;
+				rhs[local] = wallCellRHS(x, y, xDim, yDim, horiz[local], right, vert[local], up);
+			}
+		}
+	}
+}
+
+/*
+	deltaT: double; time step the system is scaled by
+
+	Return type: void
+*/
+void SparseGrid::project(double deltaT) {
+	/*
+	A sweep reads the new pressure of the cells left of and below a cell, so the active cells
+	are visited as project() visits them: each row of y in turn, across the active tiles of that
+	row in x. A neighbour in an inactive tile is a wall.
+	*/
+	TRACE_SCOPE("sparseProject");
+	for (int y = 0; y < yDim; y++) {
+		int tileY = y >> shift;
+		int localY = y & mask;
+		for (int k = rowStart[tileY]; k < rowStart[tileY + 1]; ++k) {
+			int tileX = activeList[k] / tilesY;
+			float* pressure = field(tileX, tileY, PRESSURE);
+			const float* rhs = field(tileX, tileY, RHS);
+			const float* leftPressure = field(tileX - 1, tileY, PRESSURE);
+			const float* rightPressure = field(tileX + 1, tileY, PRESSURE);
+			const float* downPressure = field(tileX, tileY - 1, PRESSURE);
+			const float* upPressure = field(tileX, tileY + 1, PRESSURE);
+			for (int x = tileX << shift; x < min((tileX + 1) << shift, xDim); x++) {
+				int localX = x & mask;
+				int local = (localX << shift) + localY;
+				double diagonal = 0.0, offDiagonal = 0.0;
+
+				if (x > 0 && (localX > 0 || leftPressure)) {
+					diagonal    += deltaT;
+					offDiagonal -= deltaT * (localX > 0 ? pressure[local - tileSize] : leftPressure[(mask << shift) + localY]);
+				}
+				if (y > 0 && (localY > 0 || downPressure)) {
+					diagonal    += deltaT;
+					offDiagonal -= deltaT * (localY > 0 ? pressure[local - 1] : downPressure[(localX << shift) + mask]);
+				}
+				if (x < xDim - 1 && (localX < mask || rightPressure)) {
+					diagonal    += deltaT;
+					offDiagonal -= deltaT * (localX < mask ? pressure[local + tileSize] : rightPressure[localY]);
+				}
+				if (y < yDim - 1 && (localY < mask || upPressure)) {
+					diagonal    += deltaT;
+					offDiagonal -= deltaT * (localY < mask ? pressure[local + 1] : upPressure[localX << shift]);
+				}
+
+				pressure[local] = (rhs[local] - offDiagonal) / diagonal;
+			}
+		}
+	}
+}
+
+/*
+	deltaT: double; time step the system is scaled by
+	omega: double; relaxation factor
+	sweeps: int; number of red-black sweeps to run
+	executor: Executor; runs the active tiles of each colour
+
+	Return type: void
+*/
+void SparseGrid::projectRedBlack(double deltaT, double omega, int sweeps, Executor &executor) {
+	TRACE_SCOPE("sparseProjectRedBlack");
+	for (int sweep = 0; sweep < sweeps; ++sweep) {
+		for (int color = 0; color < 2; ++color) {
+			executor.parallelFor(0, activeList.size(), [&](int tileBegin, int tileEnd) {
+				for (int k = tileBegin; k < tileEnd; ++k) {
+					int tileX = activeList[k] / tilesY;
+					int tileY = activeList[k] % tilesY;
+					float* pressure = field(tileX, tileY, PRESSURE);
+					const float* rhs = field(tileX, tileY, RHS);
+					const float* leftPressure = field(tileX - 1, tileY, PRESSURE);
+					const float* rightPressure = field(tileX + 1, tileY, PRESSURE);
+					const float* downPressure = field(tileX, tileY - 1, PRESSURE);
+					const float* upPressure = field(tileX, tileY + 1, PRESSURE);
+					int firstY = tileY << shift;
+					for (int x = tileX << shift; x < min((tileX + 1) << shift, xDim); x++) {
+						int localX = x & mask;
+						// This colour's cells have x + y + color even, as projectRedBlack() starts each row at (y + color) % 2.
+						for (int y = firstY + ((x + firstY + color) & 1); y < min(firstY + tileSize, yDim); y += 2) {
+							int localY = y & mask;
+							int local = (localX << shift) + localY;
+							double diagonal = 0.0, offDiagonal = 0.0;
+
+							if (x > 0 && (localX > 0 || leftPressure)) {
+								diagonal    += deltaT;
+								offDiagonal -= deltaT * (localX > 0 ? pressure[local - tileSize] : leftPressure[(mask << shift) + localY]);
+							}
+							if (y > 0 && (localY > 0 || downPressure)) {
+								diagonal    += deltaT;
+								offDiagonal -= deltaT * (localY > 0 ? pressure[local - 1] : downPressure[(localX << shift) + mask]);
+							}
+							if (x < xDim - 1 && (localX < mask || rightPressure)) {
+								diagonal    += deltaT;
+								offDiagonal -= deltaT * (localX < mask ? pressure[local + tileSize] : rightPressure[localY]);
+							}
+							if (y < yDim - 1 && (localY < mask || upPressure)) {
+								diagonal    += deltaT;
+								offDiagonal -= deltaT * (localY < mask ? pressure[local + 1] : upPressure[localX << shift]);
+							}
+
+							double newPressure = (rhs[local] - offDiagonal) / diagonal;
+							pressure[local] = (1 - omega) * pressure[local] + omega * newPressure;
+						}
+					}
+				}
+			});
+		}
+	}
+}
+
+/*
+	deltaT: double; time step the system is scaled by
+
+	Return type: float
+*/
+float SparseGrid::applyPressure(double deltaT) {
+	/*
+	A face takes the update of the cell on either side of it, the left or lower one first, so
+	cells are visited in the order of applyPressure(). Faces in inactive tiles, like the walls,
+	are not updated; they are zero.
+	*/
+	TRACE_SCOPE("sparseApplyPressure");
+	float largest = 0.0f;
+	for (int y = 0; y < yDim; y++) {
+		int tileY = y >> shift;
+		int localY = y & mask;
+		for (int k = rowStart[tileY]; k < rowStart[tileY + 1]; ++k) {
+			int tileX = activeList[k] / tilesY;
+			const float* pressure = field(tileX, tileY, PRESSURE);
+			float* horiz = field(tileX, tileY, HORIZ);
+			float* vert = field(tileX, tileY, VERT);
+			float* rightHoriz = field(tileX + 1, tileY, HORIZ);
+			float* upVert = field(tileX, tileY + 1, VERT);
+			bool leftActive = active(tileX - 1, tileY);
+			bool downActive = active(tileX, tileY - 1);
+			for (int x = tileX << shift; x < min((tileX + 1) << shift, xDim); x++) {
+				int localX = x & mask;
+				int local = (localX << shift) + localY;
+				float cellPressure = pressure[local];
+				horiz[local] -= deltaT * cellPressure;
+				if (x + 1 < xDim && localX < mask) {
+					horiz[local + tileSize] += deltaT * cellPressure;
+				}
+				else if (x + 1 < xDim && rightHoriz) {
+					rightHoriz[localY] += deltaT * cellPressure;
+				}
+				vert[local] -= deltaT * cellPressure;
+				if (y + 1 < yDim && localY < mask) {
+					vert[local + 1] += deltaT * cellPressure;
+				}
+				else if (y + 1 < yDim && upVert) {
+					upVert[localX << shift] += deltaT * cellPressure;
+				}
+
+				float horizFace = x > 0 && (localX > 0 || leftActive) ? horiz[local] : 0.0f;
+				float vertFace = y > 0 && (localY > 0 || downActive) ? vert[local] : 0.0f;
+				largest = fmax(largest, fmax(fabs(horizFace), fabs(vertFace)));
+			}
+		}
+	}
+
+	// Bound the liquid to edges of screen and of the active tiles
+	for (size_t k = 0; k < activeList.size(); ++k) {
+		int tileX = activeList[k] / tilesY;
+		int tileY = activeList[k] % tilesY;
+		if (!active(tileX - 1, tileY)) {
+			float* horiz = field(tileX, tileY, HORIZ);
+			fill(horiz, horiz + min(tileSize, yDim - (tileY << shift)), 0.0f);
+		}
+		if (!active(tileX, tileY - 1)) {
+			float* vert = field(tileX, tileY, VERT);
+			for (int localX = 0; localX < min(tileSize, xDim - (tileX << shift)); ++localX) {
+				vert[localX << shift] = 0.0f;
+			}
+		}
+	}
+	fill(rightWall.begin(), rightWall.end(), 0.0f);
+	fill(topWall.begin(), topWall.end(), 0.0f);
+	return largest;
+}
+
+/*
+	deltaT: float; time step over which we advect the velocity
+	maxFaceVelocity: float; applyPressure() of this substep, bounds how far a backtrace reaches
+	kernel: AdvectKernel; instruction set to use
+	executor: Executor; runs the active tiles
+
+	Return type: void
+*/
+void SparseGrid::advect(float deltaT, float maxFaceVelocity, AdvectKernel kernel, Executor &executor) {
+	/*
+	Each tile runs the vector kernels of advect_simd.h on windows gathered around it. A backtrace
+	moves at most maxFaceVelocity*deltaT cells and interpolates one face further, so an apron of
+	that plus 2 holds everything the tile reads. Flows that would need an apron wider than a
+	tile, or the scalar kernel, read faces straight from the tiles through traceBack() of
+	advect.h; i-.5 and j-.5 truncate towards zero in correctHVGet() and correctVVGet(), so
+	cell 0 reads face 1. Wall faces are not advected, so they need no carrying over.
+	The active tiles are split into one contiguous chunk per thread of the executor, and
+	each chunk gathers into its own set of windows, kept from one substep to the next.
+	*/
+	TRACE_SCOPE("sparseAdvect");
+	double reach = (double)maxFaceVelocity * deltaT;
+	bool windowed = kernel != ADVECT_SCALAR && reach < tileSize;
+	int apron = windowed ? (int)ceil(reach) + 2 : 0;
+	int span = tileSize + 2*apron + 1;
+	int numChunks = executor.numThreads();
+	if (windowed && (int)windows.size() < WINDOWS_PER_CHUNK * numChunks) {
+		// Sized for the widest apron, reach just under tileSize
+		int largestSpan = tileSize + 2*(tileSize + 2) + 1;
+		windows.reserve(WINDOWS_PER_CHUNK * numChunks);
+		while ((int)windows.size() < WINDOWS_PER_CHUNK * numChunks) {
+			windows.push_back(FieldGrid(largestSpan, largestSpan, 0.0f));
+			windows.push_back(FieldGrid(largestSpan, largestSpan, 0.0f));
+			windows.push_back(FieldGrid(tileSize, tileSize, 0.0f));
+			windows.push_back(FieldGrid(tileSize, tileSize, 0.0f));
+		}
+	}
+	int numTiles = activeList.size();
+	executor.parallelFor(0, numChunks, [&](int chunkBegin, int chunkEnd) {
+		for (int chunk = chunkBegin; chunk < chunkEnd; ++chunk) {
+			FieldGrid* window = windowed ? &windows[WINDOWS_PER_CHUNK * chunk] : 0;
+			for (int k = (int)((long long)numTiles * chunk / numChunks); k < (int)((long long)numTiles * (chunk + 1) / numChunks); ++k) {
+				int tileX = activeList[k] / tilesY;
+				int tileY = activeList[k] % tilesY;
+				int firstX = tileX << shift;
+				int firstY = tileY << shift;
+				int lastX = min(firstX + tileSize, xDim);
+				int lastY = min(firstY + tileSize, yDim);
+				float* updatedHoriz = tileData[activeList[k]] + offsets[UPDATED_HORIZ];
+				float* updatedVert = tileData[activeList[k]] + offsets[UPDATED_VERT];
+				if (windowed) {
+					FieldGrid &horiz = window[0];
+					FieldGrid &vert = window[1];
+					FieldGrid &updatedHorizWindow = window[2];
+					FieldGrid &updatedVertWindow = window[3];
+					horiz.moveWindow(firstX - apron, firstY - apron);
+					vert.moveWindow(firstX - apron, firstY - apron);
+					updatedHorizWindow.moveWindow(firstX, firstY);
+					updatedVertWindow.moveWindow(firstX, firstY);
+					gatherWindow(horiz, HORIZ, span);
+					gatherWindow(vert, VERT, span);
+					advectSimdBlock(horiz, vert, updatedHorizWindow, updatedVertWindow, xDim, yDim, deltaT, firstX, lastX, firstY, lastY, kernel);
+					for (int i = firstX; i < lastX; ++i) {
+						copy(updatedHorizWindow.row(i) + firstY, updatedHorizWindow.row(i) + lastY, updatedHoriz + ((i & mask) << shift));
+						copy(updatedVertWindow.row(i) + firstY, updatedVertWindow.row(i) + lastY, updatedVert + ((i & mask) << shift));
+					}
+					continue;
+				}
+				for (int i = firstX; i < lastX; ++i) {
+					for (int j = firstY; j < lastY; ++j) {
+						Vec2 centerVelocity = {(horizAt(i > 0 ? i : 1, j) + horizAt(i + 1, j)) / 2, (vertAt(i, j > 0 ? j : 1) + vertAt(i, j + 1)) / 2};
+						Backtrace trace = traceBack(centerVelocity, xDim, yDim, deltaT, i, j);
+
+						int local = ((i & mask) << shift) + (j & mask);
+						updatedHoriz[local] = (1-trace.alpha) * horizAt(trace.left, trace.cellY) + trace.alpha * horizAt(trace.right, trace.cellY);
+						updatedVert[local] = (1-trace.alpha) * vertAt(trace.cellX, trace.cellY) + trace.alpha * vertAt(trace.cellX, trace.top);
+					}
+				}
+			}
+		}
+	});
+	swap(offsets[HORIZ], offsets[UPDATED_HORIZ]);
+	swap(offsets[VERT], offsets[UPDATED_VERT]);
+}
+
+/*
+	window: FieldGrid; a window onto the horizontal or vertical faces
+	which: Field; HORIZ or VERT
+	extent: int; rows and columns to fill from the start of the window, at most its size
+
+	Copies the faces of the first extent rows and columns of the window from the tiles, a run
+	of y within one tile at a time; faces in inactive tiles are 0, and cells of the window
+	outside the grid or past extent are left alone.
+	Return type: void
+*/
+void SparseGrid::gatherWindow(FieldGrid &window, Field which, int extent) const {
+	bool horizontal = which == HORIZ;
+	int rowEnd = min(window.firstRow() + extent, horizontal ? xDim + 1 : xDim);
+	int colBegin = max(window.firstCol(), 0);
+	int colEnd = min(window.firstCol() + extent, horizontal ? yDim : yDim + 1);
+	for (int x = max(window.firstRow(), 0); x < rowEnd; ++x) {
+		float* out = window.row(x);
+		if (x == xDim) {
+			copy(rightWall.begin() + colBegin, rightWall.begin() + colEnd, out + colBegin);
+			continue;
+		}
+		for (int y = colBegin; y < min(colEnd, yDim); ) {
+			int runEnd = min(min(colEnd, yDim), ((y >> shift) + 1) << shift);
+			const float* tile = tileData[tileIndex(x >> shift, y >> shift)];
+			if (tile) {
+				const float* run = tile + offsets[which] + ((x & mask) << shift) + (y & mask);
+				copy(run, run + (runEnd - y), out + y);
+			}
+			else {
+				fill(out + y, out + runEnd, 0.0f);
+			}
+			y = runEnd;
+		}
+		if (colEnd > yDim) {
+			out[yDim] = topWall[x];
+		}
+	}
+}
+
+/*
+	threshold: float; faces faster than this keep their tile active; negative keeps every tile
+	reach: float; cells the fastest face may carry fluid in the next substep
+
+	Return type: int
+*/
+int SparseGrid::updateActiveTiles(float threshold, float reach) {
+	TRACE_SCOPE("sparseUpdateActiveTiles");
+	fill(hot.begin(), hot.end(), 0);
+	for (size_t k = 0; k < activeList.size(); ++k) {
+		int tileX = activeList[k] / tilesY;
+		int tileY = activeList[k] % tilesY;
+		const float* horiz = field(tileX, tileY, HORIZ);
+		const float* vert = field(tileX, tileY, VERT);
+		float fastest = 0.0f;
+		for (int localX = 0; localX < min(tileSize, xDim - (tileX << shift)); ++localX) {
+			for (int localY = 0; localY < min(tileSize, yDim - (tileY << shift)); ++localY) {
+				int local = (localX << shift) + localY;
+				fastest = fmax(fastest, fmax(fabs(horiz[local]), fabs(vert[local])));
+			}
+		}
+		hot[activeList[k]] = threshold < 0 || fastest > threshold;
+	}
+
+	// A NaN or huge reach keeps everything near a hot tile, which is every tile.
+	int widest = max(tilesX, tilesY);
+	retile(reach < (float)tileSize * widest ? 1 + (int)(reach / tileSize) : widest);
+
+	substeps++;
+	tileSubsteps += activeList.size();
+	return activeList.size();
+}
+
+/*
+	reachTiles: int; tiles either side of a hot tile to keep active, at least 1
+
+	Activates the tiles within reachTiles of a hot tile and frees all others.
+	Return type: void
+*/
+void SparseGrid::retile(int reachTiles) {
+	// Spread hot along x into fresh, then along y into wanted, with running counts.
+	for (int tileY = 0; tileY < tilesY; ++tileY) {
+		for (int tileX = 0; tileX < tilesX; ++tileX) {
+			prefix[tileX + 1] = prefix[tileX] + hot[tileIndex(tileX, tileY)];
+		}
+		for (int tileX = 0; tileX < tilesX; ++tileX) {
+			fresh[tileIndex(tileX, tileY)] = prefix[min(tileX + reachTiles + 1, tilesX)] > prefix[max(tileX - reachTiles, 0)];
+		}
+	}
+	for (int tileX = 0; tileX < tilesX; ++tileX) {
+		for (int tileY = 0; tileY < tilesY; ++tileY) {
+			prefix[tileY + 1] = prefix[tileY] + fresh[tileIndex(tileX, tileY)];
+		}
+		for (int tileY = 0; tileY < tilesY; ++tileY) {
+			wanted[tileIndex(tileX, tileY)] = prefix[min(tileY + reachTiles + 1, tilesY)] > prefix[max(tileY - reachTiles, 0)];
+		}
+	}
+
+	for (int tile = 0; tile < tilesX * tilesY; ++tile) {
+		fresh[tile] = wanted[tile] && tiles[tile].empty();
+		if (fresh[tile]) {
+			tiles[tile].assign(NUM_FIELDS * tileCells, 0.0f);
+			tileData[tile] = tiles[tile].data();
+		}
+	}
+
+	/*
+	Fluid at rest under gravity holds a pressure that grows with depth, so a new tile takes its
+	pressures from the adjacent edge of a tile that was already active, a side neighbour first
+	as those share its rows of y. The faces between them are about to stop being walls.
+	*/
+	for (int tileX = 0; tileX < tilesX; ++tileX) {
+		for (int tileY = 0; tileY < tilesY; ++tileY) {
+			if (!fresh[tileIndex(tileX, tileY)]) {
+				continue;
+			}
+			float* pressure = field(tileX, tileY, PRESSURE);
+			const float* left = tileX > 0 && !fresh[tileIndex(tileX - 1, tileY)] ? field(tileX - 1, tileY, PRESSURE) : 0;
+			const float* right = tileX < tilesX - 1 && !fresh[tileIndex(tileX + 1, tileY)] ? field(tileX + 1, tileY, PRESSURE) : 0;
+			const float* down = tileY > 0 && !fresh[tileIndex(tileX, tileY - 1)] ? field(tileX, tileY - 1, PRESSURE) : 0;
+			const float* up = tileY < tilesY - 1 && !fresh[tileIndex(tileX, tileY + 1)] ? field(tileX, tileY + 1, PRESSURE) : 0;
+			for (int localX = 0; localX < tileSize; ++localX) {
+				for (int localY = 0; localY < tileSize; ++localY) {
+					float seed = 0.0f;
+					if (left) {
+						seed = left[(mask << shift) + localY];
+					}
+					else if (right) {
+						seed = right[localY];
+					}
+					else if (down) {
+						seed = down[(localX << shift) + mask];
+					}
+					else if (up) {
+						seed = up[localX << shift];
+					}
+					pressure[(localX << shift) + localY] = seed;
+				}
+			}
+		}
+	}
+
+	for (int tile = 0; tile < tilesX * tilesY; ++tile) {
+		if (!wanted[tile] && !tiles[tile].empty()) {
+			vector<float>().swap(tiles[tile]);
+			tileData[tile] = 0;
+		}
+	}
+	rebuildActiveList();
+	peakTiles = max(peakTiles, (int)activeList.size());
+}
+
+/*
+	Return type: void
+*/
+void SparseGrid::rebuildActiveList() {
+	activeList.clear();
+	for (int tileY = 0; tileY < tilesY; ++tileY) {
+		rowStart[tileY] = activeList.size();
+		for (int tileX = 0; tileX < tilesX; ++tileX) {
+			if (tileData[tileIndex(tileX, tileY)]) {
+				activeList.push_back(tileIndex(tileX, tileY));
+			}
+		}
+	}
+	rowStart[tilesY] = activeList.size();
+}
+
+/*
+	Return type: float
+*/
+float SparseGrid::maxDivergence() const {
+	float largest = 0.0;
+	for (size_t k = 0; k < activeList.size(); ++k) {
+		int tileX = activeList[k] / tilesY;
+		int tileY = activeList[k] % tilesY;
+		for (int x = tileX << shift; x < min((tileX + 1) << shift, xDim); x++) {
+			for (int y = tileY << shift; y < min((tileY + 1) << shift, yDim); y++) {
+				float divergence = horizAt(x + 1, y) - horizAt(x, y) + vertAt(x, y + 1) - vertAt(x, y);
+				largest = fmax(largest, fabs(divergence));
+			}
+		}
+	}
+	return largest;
+}
+
+/*
+	Return type: SparseGridStats
+*/
+SparseGridStats SparseGrid::stats() const {
+	SparseGridStats result;
+	result.activeTiles = activeList.size();
+	result.totalTiles = tilesX * tilesY;
+	result.peakTiles = peakTiles;
+	result.meanTiles = substeps > 0 ? tileSubsteps / substeps : activeList.size();
+	result.bytes = activeList.size() * NUM_FIELDS * (size_t)tileCells * sizeof(float);
+	return result;
+}
@@ -0,0 +1,222 @@
+#ifndef __SPARSEGRID__
+#define __SPARSEGRID__
+
+
+#include "mac_grid.h"
+#include "advect_simd.h"
+#include "thread_pool.h"
+#include <cstddef>
+#include <vector>
+using namespace std;
+
+
+/*
+	activeTiles: int; tiles allocated now
+	totalTiles: int; tiles covering the whole grid
+	peakTiles: int; most tiles ever allocated at once
+	meanTiles: double; tiles allocated per substep, averaged over every substep so far
+	bytes: size_t; tile storage allocated now
+*/
+struct SparseGridStats {
+	int activeTiles;
+	int totalTiles;
+	int peakTiles;
+	double meanTiles;
+	size_t bytes;
+};
+
+
+/*
+	The MAC grid stored as square tiles of tileSize x tileSize cells, allocated only where the flow moves.
+
+	A tile holds the left and bottom faces of its cells, their pressures and the step's scratch
+	(rhs and the advected faces); the right and top wall faces are kept in two dense rows.
+	Every stage visits the active tiles only, so time and memory follow the moving region
+	rather than the whole grid.
+
+	A tile that is not allocated is quiescent: its faces are 0 and it takes no part in the
+	step, so the faces between it and active tiles act as walls. After every substep
+	updateActiveTiles() keeps allocated the tiles within reach of a tile with a face faster than
+	the threshold and frees the rest, so moving fluid always has active tiles ahead of it.
+	A tile starts with zero velocity and the pressures of an active neighbour's adjacent edge.
+
+	With every tile active the stages match gs, rbsor, applyPressure() and advect() of the
+	dense grid bit for bit: cells are visited in the same order where that matters.
+*/
+class SparseGrid {
+public:
+	/*
+		xDim: int; number of cells in x direction
+		yDim: int; number of cells in y direction
+		tileSize: int; tile edge in cells, a power of two; 0 for an unused grid that allocates nothing
+	*/
+	SparseGrid(int xDim, int yDim, int tileSize);
+
+	/*
+		horizVelocityGrid, vertVelocityGrid, pressureGrid: FieldGrid; the dense grids to start from
+		threshold: float; faces faster than this keep their tile and its neighbours active; negative keeps every tile
+
+		Faces and pressures of tiles left inactive are dropped.
+		Return type: void
+	*/
+	void load(const FieldGrid &horizVelocityGrid, const FieldGrid &vertVelocityGrid, const FieldGrid &pressureGrid, float threshold);
+
+	/*
+		horizVelocityGrid, vertVelocityGrid: FieldGrid; receive every face, 0 in inactive tiles
+
+		Altered by reference: horizVelocityGrid, vertVelocityGrid
+		Return type: void
+	*/
+	void store(FieldGrid &horizVelocityGrid, FieldGrid &vertVelocityGrid) const;
+
+	/*
+		deltaT: float; length of the substep
+
+		addGravity() then buildRHS() over the active tiles.
+		Return type: void
+	*/
+	void addGravityBuildRHS(float deltaT);
+
+	/*
+		deltaT: double; time step the system is scaled by
+
+		One Gauss-Seidel sweep, as project(), over the active cells.
+		Return type: void
+	*/
+	void project(double deltaT);
+
+	/*
+		deltaT: double; time step the system is scaled by
+		omega: double; relaxation factor
+		sweeps: int; number of red-black sweeps to run
+		executor: Executor; runs the active tiles of each colour
+
+		As projectRedBlack() over the active cells.
+		Return type: void
+	*/
+	void projectRedBlack(double deltaT, double omega, int sweeps, Executor &executor);
+
+	/*
+		deltaT: double; time step the system is scaled by
+
+		As applyPressure(); faces between active and inactive tiles are zeroed with the walls.
+		Return type: float; largest |velocity| on any face afterwards
+	*/
+	float applyPressure(double deltaT);
+
+	/*
+		deltaT: float; time step over which we advect the velocity
+		maxFaceVelocity: float; applyPressure() of this substep, bounds how far a backtrace reaches
+		kernel: AdvectKernel; instruction set to use
+		executor: Executor; runs the active tiles
+
+		As advectSimd(), backtraces into inactive tiles reading zero velocity.
+		Return type: void
+	*/
+	void advect(float deltaT, float maxFaceVelocity, AdvectKernel kernel, Executor &executor);
+
+	/*
+		threshold: float; faces faster than this keep their tile active; negative keeps every tile
+		reach: float; cells the fastest face may carry fluid in the next substep
+
+		Keeps active every tile within reach, plus one tile, of a tile with a face faster than threshold and frees the others.
+		Return type: int; tiles active afterwards
+	*/
+	int updateActiveTiles(float threshold, float reach);
+
+	/*
+		Return type: float; largest |divergence| of any active cell, as maxDivergence()
+	*/
+	float maxDivergence() const;
+
+	/*
+		Return type: SparseGridStats
+	*/
+	SparseGridStats stats() const;
+
+private:
+	// Fields of a tile, each tileSize*tileSize floats, element (x,y) at (x%tileSize)*tileSize + y%tileSize
+	enum Field { HORIZ, VERT, PRESSURE, RHS, UPDATED_HORIZ, UPDATED_VERT, NUM_FIELDS };
+	// advect() windows of a chunk of tiles: horizontal and vertical faces, then their updated tiles
+	static const int WINDOWS_PER_CHUNK = 4;
+
+	inline int tileIndex(int tileX, int tileY) const { return tileX * tilesY + tileY; }
+	inline bool active(int tileX, int tileY) const {
+		return tileX >= 0 && tileX < tilesX && tileY >= 0 && tileY < tilesY && tileData[tileIndex(tileX, tileY)];
+	}
+	// Field of tile (tileX, tileY), 0 if it is inactive or off the grid
+	inline float* field(int tileX, int tileY, Field which) {
+		return active(tileX, tileY) ? tileData[tileIndex(tileX, tileY)] + offsets[which] : 0;
+	}
+	inline const float* field(int tileX, int tileY, Field which) const {
+		return active(tileX, tileY) ? tileData[tileIndex(tileX, tileY)] + offsets[which] : 0;
+	}
+
+	/*
+		x: int; 0 to xDim
+		y: int; 0 to yDim-1
+
+		Return type: float; horizontal face (x,y), 0 in an inactive tile
+	*/
+	inline float horizAt(int x, int y) const {
+		if (x == xDim) {
+			return rightWall[y];
+		}
+		const float* tile = tileData[tileIndex(x >> shift, y >> shift)];
+		return tile ? tile[offsets[HORIZ] + ((x & mask) << shift) + (y & mask)] : 0.0f;
+	}
+
+	/*
+		x: int; 0 to xDim-1
+		y: int; 0 to yDim
+
+		Return type: float; vertical face (x,y), 0 in an inactive tile
+	*/
+	inline float vertAt(int x, int y) const {
+		if (y == yDim) {
+			return topWall[x];
+		}
+		const float* tile = tileData[tileIndex(x >> shift, y >> shift)];
+		return tile ? tile[offsets[VERT] + ((x & mask) << shift) + (y & mask)] : 0.0f;
+	}
+
+	void gatherWindow(FieldGrid &window, Field which, int extent) const;
+	void retile(int reachTiles);
+	void rebuildActiveList();
+
+	int xDim;
+	int yDim;
+	int tileSize;
+	int shift;
+	int mask;
+	int tileCells;
+	int tilesX;
+	int tilesY;
+	// Start of each field within a tile; advect() swaps the current and updated faces by swapping these
+	int offsets[NUM_FIELDS];
+
+	// Per tile, empty while inactive, otherwise NUM_FIELDS fields
+	vector<vector<float> > tiles;
+	// tiles[tile].data(), or 0 while inactive
+	vector<float*> tileData;
+	// Active tiles in the order the dense kernels reach them: tile rows of y, then x
+	vector<int> activeList;
+	// Active tiles of tile row tileY are activeList[rowStart[tileY]] to activeList[rowStart[tileY+1]-1]
+	vector<int> rowStart;
+	// Faces on the right wall, x = xDim, and the top wall, y = yDim
+	vector<float> rightWall;
+	vector<float> topWall;
+	// Scratch of retile(), one flag per tile and the running counts of a row or column of tiles
+	vector<unsigned char> hot;
+	vector<unsigned char> wanted;
+	vector<unsigned char> fresh;
+	vector<int> prefix;
+	// WINDOWS_PER_CHUNK windows per thread advect() has run on, allocated the first time
+	vector<FieldGrid> windows;
+
+	int peakTiles;
+	double tileSubsteps;
+	int substeps;
+};
+
+#endif
@@ -0,0 +1,185 @@
+#include "step_kernels.h"
+#include <algorithm>
+#include <unistd.h>
+
+
+namespace {
+
+template<int FIXED_X, int FIXED_Y>
+StepKernels instantiate(const char* name) {
+	StepKernels kernels = {name, &addGravityKernel<FIXED_X, FIXED_Y>, &buildRHSKernel<FIXED_X, FIXED_Y>,
+		&projectKernel<FIXED_X, FIXED_Y>, &applyPressureKernel<FIXED_X, FIXED_Y>};
+	return kernels;
+}
+
+}
+
+
+/*
+	xDim: int; number of cells in x direction
+	yDim: int; number of cells in y direction
+
+	Return type: StepKernels
+*/
+StepKernels selectStepKernels(int xDim, int yDim) {
+	if (xDim == yDim) {
+		switch (xDim) {
+			case 32: return instantiate<32, 32>("32x32");
+			case 64: return instantiate<64, 64>("64x64");
+			case 128: return instantiate<128, 128>("128x128");
+			case 256: return instantiate<256, 256>("256x256");
+			case 512: return instantiate<512, 512>("512x512");
+			case 1024: return instantiate<1024, 1024>("1024x1024");
+		}
+	}
+	return instantiate<0, 0>("generic");
+}
+
+/*
+	horizVelocityGrid: FieldGrid; holds horizontal velocity components at 1/2 indices
+	vertVelocityGrid: FieldGrid; holds vertical velocity components at 1/2 indices
+	xDim: int; number of cells in x direction
+	yDim: int; number of cells in y direction
+	deltaT: float; length of the substep
+	rhs: vector of floats; receives the negated divergence, indexed x + y*xDim
+	tileSize: int; block edge in cells, at least 1
+
+	Altered by reference: vertVelocityGrid, rhs
+	Return type: void
+*/
+void addGravityBuildRHSTiled(const FieldGrid &horizVelocityGrid, FieldGrid &vertVelocityGrid, int xDim, int yDim, float deltaT,
+	vector<float> &rhs, int tileSize) {
+	/*
+	The rhs of the top cell of a block reads the bottom face of the block above, which must
+	already have had gravity added, so blocks go down each column of blocks instead of up.
+	The edge cells are redone with the wall faces read as 0 once every block is done.
+	*/
+	TRACE_SCOPE("addGravityBuildRHS");
+	const int horizStride = horizVelocityGrid.rowStride();
+	const int vertStride = vertVelocityGrid.rowStride();
+	const float* horiz = horizVelocityGrid.row(0);
+	float* vert = vertVelocityGrid.row(0);
+
+	if (rhs.size() != (size_t)(xDim * yDim)) {
+		rhs.resize(xDim * yDim);
+	}
+	float* out = rhs.data();
+	for (int x0 = 0; x0 < xDim; x0 += tileSize) {
+		int x1 = min(x0 + tileSize, xDim);
+		for (int y0 = (yDim - 1) / tileSize * tileSize; y0 >= 0; y0 -= tileSize) {
+			int y1 = min(y0 + tileSize, yDim);
+			for (int x = x0; x < x1; ++x) {
+				for (int y = y0; y < y1; ++y) {
+					vert[x*vertStride + y] -= deltaT * 9.81;
+				}
+			}
+			for (int x = x0; x < x1; ++x) {
+				for (int y = y0; y < y1; ++y) {
+					float term1 = horiz[(x + 1)*horizStride + y] - horiz[x*horizStride + y];
+					float term2 = vert[x*vertStride + y + 1] - vert[x*vertStride + y];
+					out[x + y*xDim] = -1*(term1 + term2);
+				}
+			}
+		}
+	}
+	wallCellsRHS(horiz, horizStride, vert, vertStride, xDim, yDim, out);
+}
+
+/*
+	pressureGrid: FieldGrid; holds pressure values at integer indices
+	horizVelocityGrid: FieldGrid; holds horizontal velocity components at 1/2 indices
+	vertVelocityGrid: FieldGrid; holds vertical velocity components at 1/2 indices
+	deltaT: double; length of the substep
+	xDim: int; number of cells in x direction
+	yDim: int; number of cells in y direction
+	tileSize: int; block edge in cells, at least 1
+	largestDivergence: float*; receives maxDivergence() of the updated grids, or 0 to skip it
+
+	Altered by reference: horizVelocityGrid, vertVelocityGrid
+	Return type: float
+*/
+float applyPressureTiled(const FieldGrid &pressureGrid, FieldGrid &horizVelocityGrid, FieldGrid &vertVelocityGrid, double deltaT,
+	int xDim, int yDim, int tileSize, float* largestDivergence) {
+	/*
+	Every face takes the update of the cell below or left of it before the one above or right,
+	as in applyPressure(), since blocks and the cells in them both go in increasing x then y.
+	A cell's divergence, when asked for, is final once the cells right of and above it are done. After each
+	block that holds for the block shifted one cell left and down, so that is where it is taken,
+	with the wall faces read as the zero they are set to at the end.
+	*/
+	TRACE_SCOPE("applyPressure");
+	const int pressureStride = pressureGrid.rowStride();
+	const int horizStride = horizVelocityGrid.rowStride();
+	const int vertStride = vertVelocityGrid.rowStride();
+	const float* pressure = pressureGrid.row(0);
+	float* horiz = horizVelocityGrid.row(0);
+	float* vert = vertVelocityGrid.row(0);
+	float largest = 0.0f;
+	float largestDiv = 0.0f;
+
+	for (int x0 = 0; x0 < xDim; x0 += tileSize) {
+		int x1 = min(x0 + tileSize, xDim);
+		for (int y0 = 0; y0 < yDim; y0 += tileSize) {
+			int y1 = min(y0 + tileSize, yDim);
+			for (int x = x0; x < x1; ++x) {
+				for (int y = y0; y < y1; ++y) {
+					float cellPressure = pressure[y*pressureStride + x];
+					horiz[x*horizStride + y] -= deltaT * cellPressure;
+					horiz[(x + 1)*horizStride + y] += deltaT * cellPressure;
+					vert[x*vertStride + y] -= deltaT * cellPressure;
+					vert[x*vertStride + y + 1] += deltaT * cellPressure;
+
+					float horizFace = x > 0 ? horiz[x*horizStride + y] : 0.0f;
+					float vertFace = y > 0 ? vert[x*vertStride + y] : 0.0f;
+					largest = fmax(largest, fmax(fabs(horizFace), fabs(vertFace)));
+				}
+			}
+
+			if (!largestDivergence) {
+				continue;
+			}
+			int divergenceX1 = x1 == xDim ? xDim : x1 - 1;
+			int divergenceY1 = y1 == yDim ? yDim : y1 - 1;
+			for (int x = max(x0 - 1, 0); x < divergenceX1; ++x) {
+				for (int y = max(y0 - 1, 0); y < divergenceY1; ++y) {
+					float left = x > 0 ? horiz[x*horizStride + y] : 0.0f;
+					float right = x + 1 < xDim ? horiz[(x + 1)*horizStride + y] : 0.0f;
+					float bottom = y > 0 ? vert[x*vertStride + y] : 0.0f;
+					float top = y + 1 < yDim ? vert[x*vertStride + y + 1] : 0.0f;
+					float divergence = right - left + top - bottom;
+					largestDiv = fmax(largestDiv, fabs(divergence));
+				}
+			}
+		}
+	}
+
+	// Bound the liquid to edges of screen
+	for (int y = 0; y < yDim; y++) {
+		horiz[y] = 0.0;
+		horiz[xDim*horizStride + y] = 0.0;
+	}
+	for (int x = 0; x < xDim; x++) {
+		vert[x*vertStride] = 0.0;
+		vert[x*vertStride + yDim] = 0.0;
+	}
+	if (largestDivergence) {
+		*largestDivergence = largestDiv;
+	}
+	return largest;
+}
+
+/*
+	Return type: int
+*/
+int cacheTileSize() {
+	long cacheBytes = sysconf(_SC_LEVEL2_CACHE_SIZE);
+	if (cacheBytes <= 0) {
+		cacheBytes = 256 * 1024;
+	}
+	// A block holds about three floats per cell: the pressure or rhs and the two velocity grids.
+	int tileSize = 16;
+	while (3 * 4 * (long)(2 * tileSize) * (2 * tileSize) <= cacheBytes / 4) {
+		tileSize *= 2;
+	}
+	return tileSize;
+}
@@ -0,0 +1,270 @@
+#ifndef __STEPKERNELS__
+#define __STEPKERNELS__
+
+
+#include "mac_grid.h"
+#include "trace.h"
+#include <cmath>
+#include <vector>
+using namespace std;
+
+
+/*
+	The per-substep grid kernels written once as templates over the grid size.
+
+	FIXED_X and FIXED_Y of 0 give the generic kernels, sized by the xDim and yDim arguments;
+	addGravity(), buildRHS(), project() and applyPressure() in grid_fns are these instantiations.
+	Any other value is a compile-time size: the runtime dimensions are ignored, loop bounds
+	and row strides are constants, so the compiler can unroll and vectorize the loops.
+	Every instantiation does the same arithmetic in the same order, so results are identical.
+	selectStepKernels() picks an instantiation once at startup.
+*/
+
+template<int FIXED_X, int FIXED_Y>
+void addGravityKernel(FieldGrid &vertVelocityGrid, int xDim, int yDim, float deltaT) {
+	TRACE_SCOPE("addGravity");
+	const int width = FIXED_X ? FIXED_X : xDim;
+	const int height = FIXED_Y ? FIXED_Y : yDim;
+	const int vertStride = FIXED_Y ? FieldGrid::strideFor(FIXED_Y + 1) : vertVelocityGrid.rowStride();
+	float* vert = vertVelocityGrid.row(0);
+
+	for (int x = 0; x < width; ++x) {
+		for (int y = 0; y < height; ++y) {
+			vert[x*vertStride + y] -= deltaT * 9.81;
+		}
+	}
+}
+
+/*
+	x, y: int; cell on the edge of the grid
+	xDim, yDim: int; size of the grid
+	left, right, below, above: float; the cell's faces as stored
+
+	applyPressure() zeroes the wall faces after the solve, so the system is only the one it
+	leaves divergence-free if the rhs reads them as 0 as well, whatever gravity and advection
+	left in them. Every buildRHS() variant overwrites its edge cells with this.
+	Return type: float; the cell's rhs with its wall faces read as 0
+*/
+inline float wallCellRHS(int x, int y, int xDim, int yDim, float left, float right, float below, float above) {
+	if (x == 0) {
+		left = 0.0f;
+	}
+	if (x == xDim - 1) {
+		right = 0.0f;
+	}
+	if (y == 0) {
+		below = 0.0f;
+	}
+	if (y == yDim - 1) {
+		above = 0.0f;
+	}
+	float term1 = right - left;
+	float term2 = above - below;
+	return -1*(term1 + term2);
+}
+
+/*
+	horiz, vert: float*; face (0, 0) of the velocity grids
+	horizStride, vertStride: int; floats from one row of the grid to the next
+	xDim, yDim: int; size of the grid
+	rhs: float*; rhs indexed x + y*xDim, already filled for every cell
+
+	Overwrites the edge cells with wallCellRHS(), so the loop that fills the rest can stay branch-free.
+	Return type: void
+*/
+inline void wallCellsRHS(const float* horiz, int horizStride, const float* vert, int vertStride, int xDim, int yDim, float* rhs) {
+	auto edgeCell = [&](int x, int y) {
+		rhs[x + y*xDim] = wallCellRHS(x, y, xDim, yDim, horiz[x*horizStride + y], horiz[(x + 1)*horizStride + y],
+			vert[x*vertStride + y], vert[x*vertStride + y + 1]);
+	};
+	for (int y = 0; y < yDim; y++) {
+		edgeCell(0, y);
+		edgeCell(xDim - 1, y);
+	}
+	for (int x = 0; x < xDim; x++) {
+		edgeCell(x, 0);
+		edgeCell(x, yDim - 1);
+	}
+}
+
+// Based off of repo here: https://github.com/tunabrain/incremental-fluids.git
+template<int FIXED_X, int FIXED_Y>
+void buildRHSKernel(const FieldGrid &horizVelocityGrid, const FieldGrid &vertVelocityGrid, int xDim, int yDim, vector<float> &rhs) {
+	TRACE_SCOPE("buildRHS");
+	const int width = FIXED_X ? FIXED_X : xDim;
+	const int height = FIXED_Y ? FIXED_Y : yDim;
+	const int horizStride = FIXED_Y ? FieldGrid::strideFor(FIXED_Y) : horizVelocityGrid.rowStride();
+	const int vertStride = FIXED_Y ? FieldGrid::strideFor(FIXED_Y + 1) : vertVelocityGrid.rowStride();
+	const float* horiz = horizVelocityGrid.row(0);
+	const float* vert = vertVelocityGrid.row(0);
+
+	if (rhs.size() != (size_t)(width * height)) {
+		rhs.resize(width * height);
+	}
+	float* out = rhs.data();
+	for (int y = 0; y < height; y++) {
+		for (int x = 0; x < width; x++) {
+			float term1 = horiz[(x + 1)*horizStride + y] - horiz[x*horizStride + y];
+			float term2 = vert[x*vertStride + y + 1] - vert[x*vertStride + y];
+			out[x + y*width] = -1*(term1 + term2);
+		}
+	}
+
+	wallCellsRHS(horiz, horizStride, vert, vertStride, width, height, out);
+}
+
+// Based off of repo here: https://github.com/tunabrain/incremental-fluids.git
+template<int FIXED_X, int FIXED_Y>
+void projectKernel(FieldGrid &pressureGrid, double deltaT, int xDim, int yDim, const vector<float> &rhs) {
+	TRACE_SCOPE("project");
+	const int width = FIXED_X ? FIXED_X : xDim;
+	const int height = FIXED_Y ? FIXED_Y : yDim;
+	const int pressureStride = FIXED_X ? FieldGrid::strideFor(FIXED_X) : pressureGrid.rowStride();
+	float* pressure = pressureGrid.row(0);
+
+	for (int y = 0; y < height; y++) {
+		for (int x = 0; x < width; x++) {
+			int index = y*pressureStride + x;
+			double diagonal = 0.0, offDiagonal = 0.0;
+
+			if (x > 0) {
+				diagonal    += deltaT;
+				offDiagonal -= deltaT * pressure[index - 1];
+			}
+			if (y > 0) {
+				diagonal    += deltaT;
+				offDiagonal -= deltaT * pressure[index - pressureStride];
+			}
+			if (x < width - 1) {
+				diagonal    += deltaT;
+				offDiagonal -= deltaT * pressure[index + 1];
+			}
+			if (y < height - 1) {
+				diagonal    += deltaT;
+				offDiagonal -= deltaT * pressure[index + pressureStride];
+			}
+
+			pressure[index] = (rhs[x + y*width] - offDiagonal) / diagonal;
+		}
+	}
+}
+
+// Based off of repo here: https://github.com/tunabrain/incremental-fluids.git
+// Returns the largest |velocity| on any face afterwards, reduced in the same pass.
+template<int FIXED_X, int FIXED_Y>
+float applyPressureKernel(const FieldGrid &pressureGrid, FieldGrid &horizVelocityGrid, FieldGrid &vertVelocityGrid, double deltaT, int xDim, int yDim) {
+	TRACE_SCOPE("applyPressure");
+	const int width = FIXED_X ? FIXED_X : xDim;
+	const int height = FIXED_Y ? FIXED_Y : yDim;
+	const int pressureStride = FIXED_X ? FieldGrid::strideFor(FIXED_X) : pressureGrid.rowStride();
+	const int horizStride = FIXED_Y ? FieldGrid::strideFor(FIXED_Y) : horizVelocityGrid.rowStride();
+	const int vertStride = FIXED_Y ? FieldGrid::strideFor(FIXED_Y + 1) : vertVelocityGrid.rowStride();
+	const float* pressure = pressureGrid.row(0);
+	float* horiz = horizVelocityGrid.row(0);
+	float* vert = vertVelocityGrid.row(0);
+	float largest = 0.0f;
+
+	for (int y = 0; y < height; y++) {
+		for (int x = 0; x < width; x++) {
+			float cellPressure = pressure[y*pressureStride + x];
+			horiz[x*horizStride + y] -= deltaT * cellPressure;
+			horiz[(x + 1)*horizStride + y] += deltaT * cellPressure;
+			vert[x*vertStride + y] -= deltaT * cellPressure;
+			vert[x*vertStride + y + 1] += deltaT * cellPressure;
+
+			// The left and bottom faces of this cell are final now. Wall faces are zeroed below, so skip them.
+			float horizFace = x > 0 ? horiz[x*horizStride + y] : 0.0f;
+			float vertFace = y > 0 ? vert[x*vertStride + y] : 0.0f;
+			largest = fmax(largest, fmax(fabs(horizFace), fabs(vertFace)));
+		}
+	}
+
+	// Bound the liquid to edges of screen
+	for (int y = 0; y < height; y++) {
+		horiz[y] = 0.0;
+		horiz[width*horizStride + y] = 0.0;
+	}
+	for (int x = 0; x < width; x++) {
+		vert[x*vertStride] = 0.0;
+		vert[x*vertStride + height] = 0.0;
+	}
+	return largest;
+}
+
+
+/*
+	One instantiation of the step kernels, all for the same grid size.
+	name: const char*; "generic" or the fixed size, e.g. "64x64"
+*/
+struct StepKernels {
+	const char* name;
+	void (*addGravity)(FieldGrid &vertVelocityGrid, int xDim, int yDim, float deltaT);
+	void (*buildRHS)(const FieldGrid &horizVelocityGrid, const FieldGrid &vertVelocityGrid, int xDim, int yDim, vector<float> &rhs);
+	void (*project)(FieldGrid &pressureGrid, double deltaT, int width, int height, const vector<float> &rhs);
+	float (*applyPressure)(const FieldGrid &pressureGrid, FieldGrid &horizVelocityGrid, FieldGrid &vertVelocityGrid, double deltaT, int xDim, int yDim);
+};
+
+
+/*
+	Tiled execution of the same kernels, for grids too large for the cache.
+
+	The untiled kernels walk the velocity grids column by column (x outer) but the pressure
+	and the rhs row by row (y outer), so on a large grid one side of every pass misses the
+	cache. The tiled kernels cut the grid into tileSize by tileSize blocks, x outer and y
+	inner both across and within blocks, so each block of pressure, rhs and both velocity
+	grids is loaded once and used from the cache for both layouts. Stages that can share a
+	pass do: gravity with the rhs, and the pressure update with the max velocity and
+	max divergence reductions. Updates happen in the same order as the untiled kernels,
+	so results are identical bit for bit.
+*/
+
+/*
+	horizVelocityGrid: FieldGrid; holds horizontal velocity components at 1/2 indices
+	vertVelocityGrid: FieldGrid; holds vertical velocity components at 1/2 indices
+	xDim: int; number of cells in x direction
+	yDim: int; number of cells in y direction
+	deltaT: float; length of the substep
+	rhs: vector of floats; receives the negated divergence, indexed x + y*xDim
+	tileSize: int; block edge in cells, at least 1
+
+	addGravity() then buildRHS() in one pass.
+	Altered by reference: vertVelocityGrid, rhs
+	Return type: void
+*/
+void addGravityBuildRHSTiled(const FieldGrid &horizVelocityGrid, FieldGrid &vertVelocityGrid, int xDim, int yDim, float deltaT,
+	vector<float> &rhs, int tileSize);
+
+/*
+	pressureGrid: FieldGrid; holds pressure values at integer indices
+	horizVelocityGrid: FieldGrid; holds horizontal velocity components at 1/2 indices
+	vertVelocityGrid: FieldGrid; holds vertical velocity components at 1/2 indices
+	deltaT: double; length of the substep
+	xDim: int; number of cells in x direction
+	yDim: int; number of cells in y direction
+	tileSize: int; block edge in cells, at least 1
+	largestDivergence: float*; receives maxDivergence() of the updated grids, or 0 to skip it
+
+	applyPressure() with maxDivergence() in the same pass.
+	Altered by reference: horizVelocityGrid, vertVelocityGrid
+	Return type: float; largest |velocity| on any face afterwards, as applyPressure() returns
+*/
+float applyPressureTiled(const FieldGrid &pressureGrid, FieldGrid &horizVelocityGrid, FieldGrid &vertVelocityGrid, double deltaT,
+	int xDim, int yDim, int tileSize, float* largestDivergence);
+
+/*
+	Return type: int; largest power of two tile edge whose pressure, rhs and velocity blocks
+		fit in a quarter of the L2 cache, 256KB assumed if the size is unknown
+*/
+int cacheTileSize();
+
+
+/*
+	xDim: int; number of cells in x direction
+	yDim: int; number of cells in y direction
+
+	Return type: StepKernels; the fixed size instantiation for xDim by yDim if there is one
+		(square grids of 32 to 1024 cells a side, powers of two), else the generic kernels
+*/
+StepKernels selectStepKernels(int xDim, int yDim);
+
+#endif
@@ -0,0 +1,249 @@
+#include "thread_pool.h"
+
+
+/*
+	begin: int; first index of the range
+	end: int; one past the last index of the range
+	body: callable taking (chunkBegin, chunkEnd)
+
+	Return type: void
+*/
+void SerialExecutor::parallelFor(int begin, int end, RangeFunction body) {
+	if (begin < end) {
+		body(begin, end);
+	}
+}
+
+
+/*
+	numThreads: int; threads to run on, including the caller; values below 1 mean 1
+*/
+ThreadPool::ThreadPool(int numThreads)
+	: task(0), taskBegin(0), taskEnd(0), generation(0), pending(0), stopping(false) {
+	for (int worker = 1; worker < numThreads; ++worker) {
+		workers.push_back(thread(&ThreadPool::workerLoop, this, worker));
+	}
+}
+
+ThreadPool::~ThreadPool() {
+	{
+		unique_lock<mutex> guard(lock);
+		stopping = true;
+	}
+	wake.notify_all();
+	for (size_t worker = 0; worker < workers.size(); ++worker) {
+		workers[worker].join();
+	}
+}
+
+/*
+	chunk: int; which of the numThreads() contiguous chunks of the current range to run
+
+	Return type: void
+*/
+void ThreadPool::runChunk(int chunk) {
+	long long length = taskEnd - taskBegin;
+	int chunkBegin = taskBegin + (int)(length * chunk / numThreads());
+	int chunkEnd = taskBegin + (int)(length * (chunk + 1) / numThreads());
+	if (chunkBegin < chunkEnd) {
+		(*task)(chunkBegin, chunkEnd);
+	}
+}
+
+/*
+	worker: int; chunk index this thread runs for every task
+
+	Return type: void
+*/
+void ThreadPool::workerLoop(int worker) {
+	/*
+	Sleeps until a new task generation is published, runs its chunk, reports back.
+	*/
+	int seenGeneration = 0;
+	while (true) {
+		{
+			unique_lock<mutex> guard(lock);
+			wake.wait(guard, [&] { return stopping || generation != seenGeneration; });
+			if (stopping) {
+				return;
+			}
+			seenGeneration = generation;
+		}
+
+		runChunk(worker);
+
+		{
+			unique_lock<mutex> guard(lock);
+			pending--;
+			if (pending == 0) {
+				finished.notify_one();
+			}
+		}
+	}
+}
+
+/*
+	begin: int; first index of the range
+	end: int; one past the last index of the range
+	body: callable taking (chunkBegin, chunkEnd)
+
+	Return type: void
+*/
+void ThreadPool::parallelFor(int begin, int end, RangeFunction body) {
+	if (begin >= end) {
+		return;
+	}
+	if (workers.empty()) {
+		body(begin, end);
+		return;
+	}
+
+	{
+		unique_lock<mutex> guard(lock);
+		task = &body;
+		taskBegin = begin;
+		taskEnd = end;
+		pending = (int)workers.size();
+		generation++;
+	}
+	wake.notify_all();
+
+	runChunk(0);
+
+	unique_lock<mutex> guard(lock);
+	finished.wait(guard, [&] { return pending == 0; });
+	task = 0;
+}
+
+
+/*
+	numThreads: int; threads to run on, including the caller; values below 1 mean 1
+*/
+WorkStealingPool::WorkStealingPool(int numThreads)
+	: task(0), generation(0), pending(0), stopping(false), stolen(0) {
+	for (int block = 0; block < numThreads || block == 0; ++block) {
+		blocks.push_back(unique_ptr<Block>(new Block()));
+		blocks.back()->front = 0;
+		blocks.back()->back = 0;
+	}
+	for (int worker = 1; worker < numThreads; ++worker) {
+		workers.push_back(thread(&WorkStealingPool::workerLoop, this, worker));
+	}
+}
+
+WorkStealingPool::~WorkStealingPool() {
+	{
+		unique_lock<mutex> guard(lock);
+		stopping = true;
+	}
+	wake.notify_all();
+	for (size_t worker = 0; worker < workers.size(); ++worker) {
+		workers[worker].join();
+	}
+}
+
+/*
+	self: int; thread asking for work
+	index: int; receives the index to run
+
+	Altered by reference: index
+	Return type: bool; false once every block is empty
+*/
+bool WorkStealingPool::take(int self, int &index) {
+	/*
+	The owner and a thief only contend for the last index of a block. No block is refilled
+	while a range runs, so one pass over the others finding nothing means the range is done.
+	*/
+	{
+		Block &own = *blocks[self];
+		unique_lock<mutex> guard(own.lock);
+		if (own.front < own.back) {
+			index = own.front++;
+			return true;
+		}
+	}
+	for (int offset = 1; offset < numThreads(); ++offset) {
+		Block &victim = *blocks[(self + offset) % numThreads()];
+		unique_lock<mutex> guard(victim.lock);
+		if (victim.front < victim.back) {
+			index = --victim.back;
+			stolen++;
+			return true;
+		}
+	}
+	return false;
+}
+
+/*
+	self: int; thread running
+
+	Return type: void
+*/
+void WorkStealingPool::runBlocks(int self) {
+	int index;
+	while (take(self, index)) {
+		(*task)(index, index + 1);
+	}
+}
+
+/*
+	worker: int; block this thread starts on for every task
+
+	Return type: void
+*/
+void WorkStealingPool::workerLoop(int worker) {
+	int seenGeneration = 0;
+	while (true) {
+		{
+			unique_lock<mutex> guard(lock);
+			wake.wait(guard, [&] { return stopping || generation != seenGeneration; });
+			if (stopping) {
+				return;
+			}
+			seenGeneration = generation;
+		}
+
+		runBlocks(worker);
+
+		{
+			unique_lock<mutex> guard(lock);
+			pending--;
+			if (pending == 0) {
+				finished.notify_one();
+			}
+		}
+	}
+}
+
+/*
+	begin: int; first index of the range
+	end: int; one past the last index of the range
+	body: callable taking (chunkBegin, chunkEnd); called with one index at a time
+
+	Return type: void
+*/
+void WorkStealingPool::parallelFor(int begin, int end, RangeFunction body) {
+	if (begin >= end) {
+		return;
+	}
+
+	{
+		unique_lock<mutex> guard(lock);
+		long long length = end - begin;
+		for (int block = 0; block < numThreads(); ++block) {
+			unique_lock<mutex> blockGuard(blocks[block]->lock);
+			blocks[block]->front = begin + (int)(length * block / numThreads());
+			blocks[block]->back = begin + (int)(length * (block + 1) / numThreads());
+		}
+		task = &body;
+		pending = (int)workers.size();
+		generation++;
+	}
+	wake.notify_all();
+
+	runBlocks(0);
+
+	unique_lock<mutex> guard(lock);
+	finished.wait(guard, [&] { return pending == 0; });
+	task = 0;
+}
@@ -0,0 +1,159 @@
+#ifndef __THREADPOOL__
+#define __THREADPOOL__
+
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+using namespace std;
+
+
+/*
+	Non-owning reference to a callable taking (chunkBegin, chunkEnd). Unlike std::function
+	it never copies the callable, so handing a lambda to parallelFor does not allocate.
+	Only valid while the callable it was made from is alive; a lambda passed straight to
+	parallelFor lives until parallelFor returns.
+*/
+class RangeFunction {
+public:
+	template<class Body>
+	RangeFunction(const Body &body) : object(&body), invoke(&call<Body>) {}
+
+	void operator()(int chunkBegin, int chunkEnd) const {
+		invoke(object, chunkBegin, chunkEnd);
+	}
+
+private:
+	template<class Body>
+	static void call(const void* object, int chunkBegin, int chunkEnd) {
+		(*(const Body*)object)(chunkBegin, chunkEnd);
+	}
+
+	const void* object;
+	void (*invoke)(const void*, int, int);
+};
+
+
+/*
+	Runs a loop body over a range of rows. Kernels take an Executor so the caller decides
+	whether they run serially or on a pool of threads.
+	A body must compute every index the same way whichever chunk it lands in, with no
+	floating point reduction across a chunk, so the results of the solver do not depend on
+	the thread count; regression_check --deterministic checks that they are bit-identical.
+*/
+class Executor {
+public:
+	virtual ~Executor() {}
+
+	/*
+		Return type: int; number of chunks parallelFor splits a range into at most
+	*/
+	virtual int numThreads() const = 0;
+
+	/*
+		begin: int; first index of the range
+		end: int; one past the last index of the range
+		body: callable taking (chunkBegin, chunkEnd); called on disjoint chunks covering [begin, end)
+
+		Returns once every chunk is done.
+		Return type: void
+	*/
+	virtual void parallelFor(int begin, int end, RangeFunction body) = 0;
+};
+
+
+/*
+	Runs the whole range on the calling thread.
+*/
+class SerialExecutor : public Executor {
+public:
+	int numThreads() const { return 1; }
+	void parallelFor(int begin, int end, RangeFunction body);
+};
+
+
+/*
+	Fixed set of worker threads started once and reused for every parallelFor.
+	The range is split into numThreads contiguous chunks; the calling thread runs the
+	first chunk itself, so a pool of n threads starts n-1 workers.
+*/
+class ThreadPool : public Executor {
+public:
+	/*
+		numThreads: int; threads to run on, including the caller; values below 1 mean 1
+	*/
+	explicit ThreadPool(int numThreads);
+	~ThreadPool();
+
+	int numThreads() const { return (int)workers.size() + 1; }
+	void parallelFor(int begin, int end, RangeFunction body);
+
+private:
+	void workerLoop(int worker);
+	void runChunk(int chunk);
+
+	vector<thread> workers;
+	mutex lock;
+	condition_variable wake;
+	condition_variable finished;
+	const RangeFunction* task;
+	int taskBegin;
+	int taskEnd;
+	int generation;
+	int pending;
+	bool stopping;
+};
+
+
+/*
+	Pool for ranges of independent, uneven tasks, such as whole simulations. parallelFor
+	deals the range out in contiguous blocks, one per thread, and calls the body on one
+	index at a time. Each thread takes indices from the front of its own block; once that
+	is empty it steals from the back of another thread's block, so threads that drew short
+	tasks take over the work of those still busy instead of idling.
+	The calling thread works as thread 0, so a pool of n threads starts n-1 workers.
+*/
+class WorkStealingPool : public Executor {
+public:
+	/*
+		numThreads: int; threads to run on, including the caller; values below 1 mean 1
+	*/
+	explicit WorkStealingPool(int numThreads);
+	~WorkStealingPool();
+
+	int numThreads() const { return (int)workers.size() + 1; }
+	void parallelFor(int begin, int end, RangeFunction body);
+
+	/*
+		Return type: long long; indices run by a thread other than the one they were dealt to, over every parallelFor so far
+	*/
+	long long steals() const { return stolen; }
+
+private:
+	// Indices [front, back) of one thread's block still to run
+	struct Block {
+		mutex lock;
+		int front;
+		int back;
+	};
+
+	void workerLoop(int worker);
+	void runBlocks(int self);
+	bool take(int self, int &index);
+
+	vector<thread> workers;
+	vector<unique_ptr<Block> > blocks;
+	mutex lock;
+	condition_variable wake;
+	condition_variable finished;
+	const RangeFunction* task;
+	int generation;
+	int pending;
+	bool stopping;
+	atomic<long long> stolen;
+};
+
+#endif
@@ -0,0 +1,253 @@
+#include "trace.h"
+
+#ifdef FLUID_TRACE
+
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+
+namespace {
+
+struct Event {
+	const char* name;
+	double start;
+	double end;
+};
+
+// Events of one thread, appended without locking. summarized counts the events
+// already folded into a frame summary.
+struct ThreadBuffer {
+	int id;
+	vector<Event> events;
+	size_t summarized;
+};
+
+struct Substep {
+	int frame;
+	int substep;
+	double time;
+	double residual;
+	double maxDivergence;
+	double cfl;
+};
+
+struct StageTotal {
+	const char* name;
+	double microseconds;
+};
+
+struct FrameSummary {
+	int frame;
+	int substeps;
+	double start;
+	double end;
+	double maxResidual;
+	double maxDivergence;
+	double maxCfl;
+	vector<StageTotal> stages;
+};
+
+const chrono::steady_clock::time_point epoch = chrono::steady_clock::now();
+
+// Guards buffers; each buffer itself is only written by its own thread.
+mutex traceLock;
+vector<unique_ptr<ThreadBuffer>> buffers;
+
+// Only touched by the thread driving the frames.
+vector<Substep> substeps;
+vector<FrameSummary> frames;
+size_t frameFirstSubstep = 0;
+double frameEnd = 0.0;
+
+ThreadBuffer &threadBuffer() {
+	thread_local ThreadBuffer* buffer = 0;
+	if (!buffer) {
+		unique_lock<mutex> guard(traceLock);
+		buffers.push_back(unique_ptr<ThreadBuffer>(new ThreadBuffer));
+		buffer = buffers.back().get();
+		buffer->id = (int)buffers.size();
+		buffer->summarized = 0;
+		buffer->events.reserve(1 << 16);
+	}
+	return *buffer;
+}
+
+/*
+	outputFile: ofstream; stream to write to
+	first: bool by reference; true until a field has been written
+	name: const char*; JSON key
+	value: double; written only if finite, JSON has no NaN or infinity
+
+	Altered by reference: first
+	Return type: void
+*/
+void writeNumberField(ofstream &outputFile, bool &first, const char* name, double value) {
+	if (!isfinite(value)) {
+		return;
+	}
+	outputFile << (first ? "" : ", ") << "\"" << name << "\": " << value;
+	first = false;
+}
+
+/*
+	Return type: string; value as text, empty if not finite
+*/
+string csvNumber(double value) {
+	return isfinite(value) ? to_string(value) : "";
+}
+
+}
+
+
+/*
+	Return type: double; microseconds since the program started
+*/
+double traceNow() {
+	return chrono::duration<double, micro>(chrono::steady_clock::now() - epoch).count();
+}
+
+/*
+	name: const char*; event name, must outlive the trace
+	start: double; traceNow() when the event began
+	end: double; traceNow() when it ended
+
+	Return type: void
+*/
+void traceEvent(const char* name, double start, double end) {
+	threadBuffer().events.push_back({name, start, end});
+}
+
+/*
+	frame: int; frame the substep belongs to
+	substep: int; substep within the frame
+	residual: double; pressure residual reported by the solve, NAN if none
+	maxDivergence: double; largest |divergence| of a cell after applyPressure
+	cfl: double; largest face velocity times deltaT, in cells
+
+	Return type: void
+*/
+void traceSubstep(int frame, int substep, double residual, double maxDivergence, double cfl) {
+	substeps.push_back({frame, substep, traceNow(), residual, maxDivergence, cfl});
+}
+
+/*
+	frame: int; frame that just finished
+
+	Return type: void
+*/
+void traceFrame(int frame) {
+	/*
+	Folds the calling thread's events and the substeps since the previous frame into one summary.
+	*/
+	ThreadBuffer &buffer = threadBuffer();
+	FrameSummary summary;
+	summary.frame = frame;
+	summary.substeps = (int)(substeps.size() - frameFirstSubstep);
+	summary.start = frameEnd;
+	summary.end = traceNow();
+	summary.maxResidual = NAN;
+	summary.maxDivergence = NAN;
+	summary.maxCfl = NAN;
+
+	for (size_t index = frameFirstSubstep; index < substeps.size(); ++index) {
+		summary.maxResidual = fmax(summary.maxResidual, substeps[index].residual);
+		summary.maxDivergence = fmax(summary.maxDivergence, substeps[index].maxDivergence);
+		summary.maxCfl = fmax(summary.maxCfl, substeps[index].cfl);
+	}
+	for (size_t index = buffer.summarized; index < buffer.events.size(); ++index) {
+		const Event &event = buffer.events[index];
+		size_t stage = 0;
+		while (stage < summary.stages.size() && summary.stages[stage].name != event.name) {
+			stage++;
+		}
+		if (stage == summary.stages.size()) {
+			summary.stages.push_back({event.name, 0.0});
+		}
+		summary.stages[stage].microseconds += event.end - event.start;
+	}
+
+	frames.push_back(summary);
+	buffer.summarized = buffer.events.size();
+	frameFirstSubstep = substeps.size();
+	frameEnd = summary.end;
+}
+
+/*
+	traceFileName: string; Chrome trace-event JSON to write
+	summaryFileName: string; per-frame CSV to write
+
+	Every other thread must be idle, their buffers are read without locking.
+	Return type: bool; false if either file could not be written
+*/
+bool writeTrace(string traceFileName, string summaryFileName) {
+	ofstream traceFile(traceFileName, ios::out | ios::trunc);
+	traceFile.setf(ios::fixed);
+	traceFile.precision(3);
+	traceFile << "{\"traceEvents\": [" << endl;
+	bool firstEvent = true;
+	{
+		unique_lock<mutex> guard(traceLock);
+		for (size_t index = 0; index < buffers.size(); ++index) {
+			const ThreadBuffer &buffer = *buffers[index];
+			for (const Event &event : buffer.events) {
+				traceFile << (firstEvent ? "" : ",\n") << "{\"name\": \"" << event.name << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": "
+					<< buffer.id << ", \"ts\": " << event.start << ", \"dur\": " << event.end - event.start << "}";
+				firstEvent = false;
+			}
+		}
+	}
+	traceFile.unsetf(ios::fixed);
+	traceFile.precision(9);
+	for (const Substep &substep : substeps) {
+		traceFile << (firstEvent ? "" : ",\n") << "{\"name\": \"telemetry\", \"ph\": \"C\", \"pid\": 1, \"ts\": " << substep.time << ", \"args\": {";
+		bool firstField = true;
+		writeNumberField(traceFile, firstField, "residual", substep.residual);
+		writeNumberField(traceFile, firstField, "max_divergence", substep.maxDivergence);
+		writeNumberField(traceFile, firstField, "cfl", substep.cfl);
+		traceFile << "}}";
+		firstEvent = false;
+	}
+	traceFile << endl << "]}" << endl;
+
+	// Stage columns are every name any frame recorded, in the order they first appeared.
+	vector<const char*> stageNames;
+	for (const FrameSummary &summary : frames) {
+		for (const StageTotal &stage : summary.stages) {
+			size_t name = 0;
+			while (name < stageNames.size() && stageNames[name] != stage.name) {
+				name++;
+			}
+			if (name == stageNames.size()) {
+				stageNames.push_back(stage.name);
+			}
+		}
+	}
+
+	ofstream summaryFile(summaryFileName, ios::out | ios::trunc);
+	summaryFile << "frame,substeps,frame_ms,max_residual,max_divergence,max_cfl";
+	for (const char* name : stageNames) {
+		summaryFile << "," << name << "_ms";
+	}
+	summaryFile << endl;
+	for (const FrameSummary &summary : frames) {
+		summaryFile << summary.frame << "," << summary.substeps << "," << (summary.end - summary.start) / 1000.0 << ","
+			<< csvNumber(summary.maxResidual) << "," << csvNumber(summary.maxDivergence) << "," << csvNumber(summary.maxCfl);
+		for (const char* name : stageNames) {
+			double microseconds = 0.0;
+			for (const StageTotal &stage : summary.stages) {
+				if (stage.name == name) {
+					microseconds = stage.microseconds;
+				}
+			}
+			summaryFile << "," << microseconds / 1000.0;
+		}
+		summaryFile << endl;
+	}
+	return (bool)traceFile && (bool)summaryFile;
+}
+
+#endif
@@ -0,0 +1,101 @@
+#ifndef __TRACE__
+#define __TRACE__
+
+
+#include <string>
+using namespace std;
+
+
+/*
+	Hot path instrumentation, only built when FLUID_TRACE is defined (scons trace=1).
+	Without it every TRACE_ macro expands to nothing, arguments included, so neither the
+	timers nor the telemetry they would compute cost anything.
+
+	TRACE_SCOPE(name)
+		Times the rest of the enclosing block as one event named name, a string literal.
+		Safe on any thread; each thread records into its own buffer.
+	TRACE_SUBSTEP(frame, substep, residual, maxDivergence, cfl)
+		Records the telemetry of one substep. residual is NAN for solvers that do not report one.
+	TRACE_FRAME(frame)
+		Closes frame: the per-frame summary gets its substep count, the largest telemetry
+		values and the time the calling thread spent in each TRACE_SCOPE name since the last frame.
+	TRACE_WRITE(traceFileName, summaryFileName)
+		Writes every event and substep as Chrome trace-event JSON (chrome://tracing, Perfetto)
+		and the per-frame summary as CSV.
+	traceEnabled
+		true when built with FLUID_TRACE, for telemetry a kernel can produce as a by-product
+		but should skip otherwise.
+*/
+#ifdef FLUID_TRACE
+
+const bool traceEnabled = true;
+
+/*
+	Return type: double; microseconds since the program started
+*/
+double traceNow();
+
+/*
+	name: const char*; event name, must outlive the trace
+	start: double; traceNow() when the event began
+	end: double; traceNow() when it ended
+
+	Return type: void
+*/
+void traceEvent(const char* name, double start, double end);
+
+/*
+	frame: int; frame the substep belongs to
+	substep: int; substep within the frame
+	residual: double; pressure residual reported by the solve, NAN if none
+	maxDivergence: double; largest |divergence| of a cell after applyPressure
+	cfl: double; largest face velocity times deltaT, in cells
+
+	Return type: void
+*/
+void traceSubstep(int frame, int substep, double residual, double maxDivergence, double cfl);
+
+/*
+	frame: int; frame that just finished
+
+	Return type: void
+*/
+void traceFrame(int frame);
+
+/*
+	traceFileName: string; Chrome trace-event JSON to write
+	summaryFileName: string; per-frame CSV to write
+
+	Return type: bool; false if either file could not be written
+*/
+bool writeTrace(string traceFileName, string summaryFileName);
+
+class TraceScope {
+public:
+	explicit TraceScope(const char* name) : name(name), start(traceNow()) {}
+	~TraceScope() { traceEvent(name, start, traceNow()); }
+
+private:
+	const char* name;
+	double start;
+};
+
+#define TRACE_JOIN_NAME(a, b) a##b
+#define TRACE_SCOPE_NAME(line) TRACE_JOIN_NAME(traceScope, line)
+#define TRACE_SCOPE(name) TraceScope TRACE_SCOPE_NAME(__LINE__)(name)
+#define TRACE_SUBSTEP(frame, substep, residual, maxDivergence, cfl) traceSubstep(frame, substep, residual, maxDivergence, cfl)
+#define TRACE_FRAME(frame) traceFrame(frame)
+#define TRACE_WRITE(traceFileName, summaryFileName) writeTrace(traceFileName, summaryFileName)
+
+#else
+
+const bool traceEnabled = false;
+
+#define TRACE_SCOPE(name)
+#define TRACE_SUBSTEP(frame, substep, residual, maxDivergence, cfl)
+#define TRACE_FRAME(frame)
+#define TRACE_WRITE(traceFileName, summaryFileName)
+
+#endif
+
+#endif
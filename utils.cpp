@@ -10,17 +10,24 @@
 	numFrames: int; number of matrices -1 we'll have
 	xDims: int; number of rows
 	yDims: int; number of cols
-	Return type: void
+	components: int; values per cell, 2 plus the number of passive scalars
+	Return type: bool; false if the file could not be written
 */
-void clearOutputFile(string fileName, int numFrames, int xDim, int yDim) {
+bool clearOutputFile(string fileName, int numFrames, int xDim, int yDim, int components) {
 	/*
 	Opens and clears the given fileName for later use.
-	Saves number of frames for use in Unity.
+	Saves number of frames for use in Unity. With scalars the values per cell follow as a
+	fourth number, as the binary header records them; a velocity-only header keeps three.
 	*/
 	ofstream outputFile;
 	outputFile.open(fileName, ios::out | ios::trunc);
-	outputFile << numFrames << " " << xDim << " " << yDim << endl;
+	outputFile << numFrames << " " << xDim << " " << yDim;
+	if (components != 2) {
+		outputFile << " " << components;
+	}
+	outputFile << endl;
 	outputFile.close();
+	return !outputFile.fail();
 }
 
 /*
@@ -41,36 +48,71 @@ string outputVector(vector<float> &vec) {
 }
 
 /*
-	horizVelocityGrid: 2D vector of floats; holds vertical horizontal components at 1/2 indices
-	vertVelocityGrid: 2D vector of floats; holds vertical velocity components at 1/2 indices
+	horizVelocityGrid: FieldGrid; holds vertical horizontal components at 1/2 indices
+	vertVelocityGrid: FieldGrid; holds vertical velocity components at 1/2 indices
 	xDim: int; number of cells in x direction
 	yDim: int; number of cells in y direction
 	fileName: string; the file to output to
+	scalarGrids: FieldGrid*; numScalars cell-centred fields
+	numScalars: int; number of scalar fields
 
-	Return type: void
+	Return type: bool; false if the file could not be written
 */
-void saveVelocityField(vector< vector<float> > &horizVelocityGrid, vector< vector<float> > &vertVelocityGrid, int xDim, int yDim, string fileName) {
+bool saveVelocityField(const FieldGrid &horizVelocityGrid, const FieldGrid &vertVelocityGrid, int xDim, int yDim, string fileName,
+	const FieldGrid* scalarGrids, int numScalars) {
 	/*
-	Saves center velocities of given horizontal and vertical velocity fields to fileName.
+	Saves center velocities of given horizontal and vertical velocity fields to fileName,
+	each followed by the cell's scalars.
 	*/
-	vector<float>* centerVelocity;
+	Vec2 centerVelocity;
 	ofstream outputFile;
 	outputFile.open(fileName, ios::app);
 	outputFile << "Start Matrix" << endl;
-	for (size_t i = 0; i < xDim; ++i) {
-		for (size_t j = 0; j < yDim-1; ++j) {
+	for (int i = 0; i < xDim; ++i) {
+		for (int j = 0; j < yDim; ++j) {
 			centerVelocity = centerVel(horizVelocityGrid, vertVelocityGrid, i, j);
-			outputFile << outputVector(*centerVelocity);
-			outputFile << ";";
-			delete centerVelocity;
+			outputFile << centerVelocity.x << " " << centerVelocity.y;
+			for (int field = 0; field < numScalars; ++field) {
+				outputFile << " " << scalarGrids[field](i, j);
+			}
+			outputFile << (j < yDim-1 ? ";" : "\n");
+		}
+	}
+	outputFile << "End Matrix" << endl;
+	outputFile.close();
+	return !outputFile.fail();
+}
+
+/*
+	frame: float*; xDim*yDim cells of components values, as filled by centerVelocityFrame()
+	xDim: int; number of cells in x direction
+	yDim: int; number of cells in y direction
+	components: int; values per cell, u and v followed by the scalars
+	fileName: string; the file to output to
+
+	Return type: bool; false if the file could not be written
+*/
+bool saveCenterVelocities(const float* frame, int xDim, int yDim, int components, string fileName) {
+	/*
+	The text of saveVelocityField() for a frame that is already averaged to the cell centers,
+	such as FluidSolver::centerVelocities().
+	*/
+	ofstream outputFile;
+	outputFile.open(fileName, ios::app);
+	outputFile << "Start Matrix" << endl;
+	for (int i = 0; i < xDim; ++i) {
+		for (int j = 0; j < yDim; ++j) {
+			const float* cell = frame + ((size_t)i * yDim + j) * components;
+			outputFile << cell[0] << " " << cell[1];
+			for (int value = 2; value < components; ++value) {
+				outputFile << " " << cell[value];
+			}
+			outputFile << (j < yDim-1 ? ";" : "\n");
 		}
-		centerVelocity = centerVel(horizVelocityGrid, vertVelocityGrid, i, yDim-1);
-		outputFile << outputVector(*centerVelocity);
-		delete centerVelocity;
-		outputFile << endl;
 	}
 	outputFile << "End Matrix" << endl;
 	outputFile.close();
+	return !outputFile.fail();
 }
 
 
@@ -2,6 +2,7 @@
 #define __UTILS__
 
 
+#include "mac_grid.h"
 #include <string>
 #include <vector>
 using namespace std;
@@ -11,9 +12,10 @@ using namespace std;
 	numFrames: int; number of matrices -1 we'll have
 	xDims: int; number of rows
 	yDims: int; number of cols
-	Return type: void
+	components: int; values per cell, 2 plus the number of passive scalars
+	Return type: bool; false if the file could not be written
 */
-void clearOutputFile(string fileName, int numFrames, int xDim, int yDim);
+bool clearOutputFile(string fileName, int numFrames, int xDim, int yDim, int components = 2);
 
 
 /*
@@ -25,15 +27,30 @@ string outputVector(vector<float> &vec);
 
 
 /*
-	horizVelocityGrid: 2D vector of floats; holds vertical horizontal components at 1/2 indices
-	vertVelocityGrid: 2D vector of floats; holds vertical velocity components at 1/2 indices
+	horizVelocityGrid: FieldGrid; holds vertical horizontal components at 1/2 indices
+	vertVelocityGrid: FieldGrid; holds vertical velocity components at 1/2 indices
 	xDim: int; number of cells in x direction
 	yDim: int; number of cells in y direction
 	fileName: string; the file to output to
+	scalarGrids: FieldGrid*; numScalars cell-centred fields written after each cell's velocity
+	numScalars: int; number of scalar fields
 
-	Return type: void
+	Return type: bool; false if the file could not be written
 */
-void saveVelocityField(vector< vector<float> > &horizVelocityGrid, vector< vector<float> > &vertVelocityGrid, int xDim, int yDim, string fileName);
+bool saveVelocityField(const FieldGrid &horizVelocityGrid, const FieldGrid &vertVelocityGrid, int xDim, int yDim, string fileName,
+	const FieldGrid* scalarGrids = 0, int numScalars = 0);
+
+
+/*
+	frame: float*; xDim*yDim cells of components values, as filled by centerVelocityFrame()
+	xDim: int; number of cells in x direction
+	yDim: int; number of cells in y direction
+	components: int; values per cell, u and v followed by the scalars
+	fileName: string; the file to output to
+
+	Return type: bool; false if the file could not be written
+*/
+bool saveCenterVelocities(const float* frame, int xDim, int yDim, int components, string fileName);
 
 
 /*